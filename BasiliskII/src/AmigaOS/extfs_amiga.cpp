@@ -295,23 +295,27 @@ void close_rfork(const char *path, int fd)
 
 
 /*
- *  Read "length" bytes from file to "buffer",
+ *  Read "length" bytes at "offset" from file to "buffer",
  *  returns number of bytes read (or -1 on error)
  */
 
-ssize_t extfs_read(int fd, void *buffer, size_t length)
+ssize_t extfs_read(int fd, void *buffer, size_t length, off_t offset)
 {
+	if (lseek(fd, offset, SEEK_SET) < 0)
+		return -1;
 	return read(fd, buffer, length);
 }
 
 
 /*
- *  Write "length" bytes from "buffer" to file,
+ *  Write "length" bytes from "buffer" to file at "offset",
  *  returns number of bytes written (or -1 on error)
  */
 
-ssize_t extfs_write(int fd, void *buffer, size_t length)
+ssize_t extfs_write(int fd, void *buffer, size_t length, off_t offset)
 {
+	if (lseek(fd, offset, SEEK_SET) < 0)
+		return -1;
 	return write(fd, buffer, length);
 }
 
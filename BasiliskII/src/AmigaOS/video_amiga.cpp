@@ -495,6 +495,15 @@ void VideoInterrupt(void)
 }
 
 
+/*
+ *  Record dirty area from NQD (the whole frame buffer is refreshed anyway)
+ */
+
+void video_set_dirty_area(int x, int y, int w, int h)
+{
+}
+
+
 /*
  *  Process for window refresh and message handling
  */
@@ -354,7 +354,7 @@ void close_rfork(const char *path, int fd)
 
 
 /*
- *  Read "length" bytes from file to "buffer",
+ *  Read "length" bytes at "offset" from file to "buffer",
  *  returns number of bytes read (or -1 on error)
  */
 
@@ -365,8 +365,11 @@ static inline ssize_t sread(int fd, void *buf, size_t count)
 	return res;
 }
 
-ssize_t extfs_read(int fd, void *buffer, size_t length)
+ssize_t extfs_read(int fd, void *buffer, size_t length, off_t offset)
 {
+	if (lseek(fd, offset, SEEK_SET) < 0)
+		return -1;
+
 	// Buffer in kernel space?
 	if ((uint32)buffer < 0x80000000) {
 
@@ -395,7 +398,7 @@ ssize_t extfs_read(int fd, void *buffer, size_t length)
 
 
 /*
- *  Write "length" bytes from "buffer" to file,
+ *  Write "length" bytes from "buffer" to file at "offset",
  *  returns number of bytes written (or -1 on error)
  */
 
@@ -406,8 +409,11 @@ static inline ssize_t swrite(int fd, void *buf, size_t count)
 	return res;
 }
 
-ssize_t extfs_write(int fd, void *buffer, size_t length)
+ssize_t extfs_write(int fd, void *buffer, size_t length, off_t offset)
 {
+	if (lseek(fd, offset, SEEK_SET) < 0)
+		return -1;
+
 	// Buffer in kernel space?
 	if ((uint32)buffer < 0x80000000) {
 
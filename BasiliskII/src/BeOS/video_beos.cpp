@@ -445,6 +445,15 @@ void VideoInterrupt(void)
 }
 
 
+/*
+ *  Record dirty area from NQD
+ */
+
+void video_set_dirty_area(int x, int y, int w, int h)
+{
+}
+
+
 /*
  *  Filter function for receiving mouse and keyboard events
  */
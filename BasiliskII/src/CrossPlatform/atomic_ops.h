@@ -0,0 +1,147 @@
+/*
+ *  atomic_ops.h - Atomic operations for GCC/Clang and MSVC
+ *
+ *  Basilisk II (C) 1997-2008 Christian Bauer
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef ATOMIC_OPS_H
+#define ATOMIC_OPS_H
+
+/*
+ *  Operations on naturally aligned 1, 4 and 8 byte integers. Loads have
+ *  acquire semantics, stores release semantics, read-modify-write
+ *  operations are full barriers.
+ */
+
+#if defined(_MSC_VER)
+
+#include <intrin.h>
+
+template <typename T> static inline T B2_atomic_load(const T *p)
+{
+	if (sizeof(T) == 8) {
+		__int64 v = _InterlockedCompareExchange64((volatile __int64 *)p, 0, 0);
+		return (T)v;
+	}
+	T v = *(const volatile T *)p;	// Acquire on x86 and x64
+	_ReadWriteBarrier();
+	return v;
+}
+
+template <typename T> static inline void B2_atomic_store(T *p, T v)
+{
+	if (sizeof(T) == 8) {
+		__int64 old = *(volatile __int64 *)p;
+		while (_InterlockedCompareExchange64((volatile __int64 *)p, (__int64)v, old) != old)
+			old = *(volatile __int64 *)p;
+		return;
+	}
+	_ReadWriteBarrier();
+	*(volatile T *)p = v;			// Release on x86 and x64
+}
+
+template <typename T> static inline T B2_atomic_exchange(T *p, T v)
+{
+	if (sizeof(T) == 1)
+		return (T)_InterlockedExchange8((volatile char *)p, (char)v);
+#ifdef _WIN64
+	if (sizeof(T) == 8)
+		return (T)_InterlockedExchange64((volatile __int64 *)p, (__int64)v);
+#endif
+	return (T)_InterlockedExchange((volatile long *)p, (long)v);
+}
+
+template <typename T> static inline T B2_atomic_fetch_add(T *p, T v)
+{
+#ifdef _WIN64
+	if (sizeof(T) == 8)
+		return (T)_InterlockedExchangeAdd64((volatile __int64 *)p, (__int64)v);
+#endif
+	return (T)_InterlockedExchangeAdd((volatile long *)p, (long)v);
+}
+
+template <typename T> static inline T B2_atomic_fetch_or(T *p, T v)
+{
+#ifdef _WIN64
+	if (sizeof(T) == 8)
+		return (T)_InterlockedOr64((volatile __int64 *)p, (__int64)v);
+#endif
+	return (T)_InterlockedOr((volatile long *)p, (long)v);
+}
+
+template <typename T> static inline T B2_atomic_fetch_and(T *p, T v)
+{
+#ifdef _WIN64
+	if (sizeof(T) == 8)
+		return (T)_InterlockedAnd64((volatile __int64 *)p, (__int64)v);
+#endif
+	return (T)_InterlockedAnd((volatile long *)p, (long)v);
+}
+
+// Number of trailing zero bits, x must not be 0
+static inline int B2_ctz(uintptr x)
+{
+	unsigned long bit;
+#ifdef _WIN64
+	_BitScanForward64(&bit, x);
+#else
+	_BitScanForward(&bit, x);
+#endif
+	return bit;
+}
+
+#else
+
+template <typename T> static inline T B2_atomic_load(const T *p)
+{
+	return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+
+template <typename T> static inline void B2_atomic_store(T *p, T v)
+{
+	__atomic_store_n(p, v, __ATOMIC_RELEASE);
+}
+
+template <typename T> static inline T B2_atomic_exchange(T *p, T v)
+{
+	return __atomic_exchange_n(p, v, __ATOMIC_ACQ_REL);
+}
+
+template <typename T> static inline T B2_atomic_fetch_add(T *p, T v)
+{
+	return __atomic_fetch_add(p, v, __ATOMIC_ACQ_REL);
+}
+
+template <typename T> static inline T B2_atomic_fetch_or(T *p, T v)
+{
+	return __atomic_fetch_or(p, v, __ATOMIC_ACQ_REL);
+}
+
+template <typename T> static inline T B2_atomic_fetch_and(T *p, T v)
+{
+	return __atomic_fetch_and(p, v, __ATOMIC_ACQ_REL);
+}
+
+// Number of trailing zero bits, x must not be 0
+static inline int B2_ctz(uintptr x)
+{
+	return sizeof(uintptr) == sizeof(unsigned long) ? __builtin_ctzl(x) : __builtin_ctzll(x);
+}
+
+#endif
+
+#endif
@@ -0,0 +1,257 @@
+/*
+ *  audio_convert.h - Audio sample format and rate conversion
+ *
+ *  Basilisk II (C) 1997-2008 Christian Bauer
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef AUDIO_CONVERT_H
+#define AUDIO_CONVERT_H
+
+#include <math.h>
+#include <vector>
+
+/*
+ *  The Mac delivers unsigned 8-bit or big-endian signed 16-bit samples,
+ *  mono or stereo, at the rate the Sound Manager picked. audio_converter
+ *  turns them into float, mixes the channels, resamples them with a
+ *  windowed-sinc polyphase filter and stores them in the host's native
+ *  16-bit or float format. This lets the host device run at its own rate.
+ *
+ *  The filter passes up to 90% of the lower of the two Nyquist frequencies
+ *  and attenuates by 80 dB from that frequency on, so its length grows
+ *  with the downsampling ratio (about 100 taps when upsampling, 220 for
+ *  48 kHz -> 22.05 kHz).
+ */
+
+// Wide vector types, the compiler lowers them to SSE2 or NEON registers
+#if defined(__GNUC__)
+#define HAVE_AUDIO_VECTORS 1
+typedef uint16 audio_vec_u16 __attribute__((vector_size(16)));
+#endif
+
+// Swap bytes of 16-bit samples, dest may equal src
+static inline void audio_swap_16(uint8 *dest, const uint8 *src, uint32 bytes)
+{
+	uint32 i = 0;
+#ifdef HAVE_AUDIO_VECTORS
+	for (; i + 16 <= bytes; i += 16) {
+		audio_vec_u16 v;
+		memcpy(&v, src + i, sizeof(v));
+		v = (v << 8) | (v >> 8);
+		memcpy(dest + i, &v, sizeof(v));
+	}
+#endif
+	for (; i + 2 <= bytes; i += 2) {
+		uint8 t = src[i];
+		dest[i] = src[i + 1];
+		dest[i + 1] = t;
+	}
+}
+
+class audio_converter {
+public:
+	enum {
+		OUT_S16,	// Host-endian signed 16-bit
+		OUT_F32		// Host-endian float
+	};
+
+	audio_converter() : in_rate(0), out_rate(0), taps(0) {}
+
+	// Set input and output formats, drops buffered input
+	void init(uint32 in_rate_, int in_bits_, int in_channels_, uint32 out_rate_, int out_format_, int out_channels_)
+	{
+		in_rate = in_rate_;
+		in_bits = in_bits_;
+		in_channels = in_channels_;
+		out_rate = out_rate_;
+		out_format = out_format_;
+		out_channels = out_channels_;
+		step = ((uint64)in_rate << 32) / out_rate;
+		build_filter();
+		reset();
+	}
+
+	// Drop buffered input
+	void reset(void)
+	{
+		hist.assign((taps / 2 - 1) * out_channels, 0.0f);
+		pos = (uint64)(taps / 2 - 1) << 32;
+	}
+
+	// Bytes per output frame
+	int out_frame_size(void) const
+	{
+		return out_channels * (out_format == OUT_F32 ? 4 : 2);
+	}
+
+	// Number of input frames needed for the given number of output frames
+	uint32 in_frames(uint32 out_frames) const
+	{
+		return (uint32)(((uint64)out_frames * in_rate + out_rate - 1) / out_rate);
+	}
+
+	// Convert Mac samples, output is appended to out, returns number of output frames
+	uint32 convert(const uint8 *src, uint32 frames, std::vector<uint8> &out)
+	{
+		// Decode and mix channels into the history buffer
+		size_t base = hist.size();
+		hist.resize(base + frames * out_channels);
+		float *h = &hist[base];
+		for (uint32 i = 0; i < frames; i++) {
+			float l, r;
+			if (in_bits == 8) {
+				l = (src[0] - 128) * (1.0f / 128.0f);
+				r = in_channels == 2 ? (src[1] - 128) * (1.0f / 128.0f) : l;
+			} else {
+				l = (int16)((src[0] << 8) | src[1]) * (1.0f / 32768.0f);
+				r = in_channels == 2 ? (int16)((src[2] << 8) | src[3]) * (1.0f / 32768.0f) : l;
+			}
+			src += in_channels * (in_bits >> 3);
+			if (out_channels == 2) {
+				h[0] = l;
+				h[1] = r;
+				h += 2;
+			} else
+				*h++ = (l + r) * 0.5f;
+		}
+
+		// Same rate, no filtering needed
+		const int fs = out_frame_size();
+		size_t out_base = out.size();
+		if (in_rate == out_rate) {
+			out.resize(out_base + frames * fs);
+			for (uint32 i = 0; i < frames; i++)
+				store(&out[out_base + i * fs], &hist[base + i * out_channels]);
+			hist.resize(base);
+			return frames;
+		}
+
+		// Resample
+		const uint32 avail = hist.size() / out_channels;
+		uint32 max_out = (uint32)((((uint64)avail << 32) - pos) / step) + 1;
+		out.resize(out_base + max_out * fs);
+		uint32 produced = 0;
+		while ((uint32)(pos >> 32) + taps / 2 < avail && produced < max_out) {
+			float sample[2];
+			filter(sample);
+			store(&out[out_base + produced * fs], sample);
+			produced++;
+			pos += step;
+		}
+		out.resize(out_base + produced * fs);
+
+		// Keep what the filter still needs
+		uint32 keep_from = (uint32)(pos >> 32) - (taps / 2 - 1);
+		hist.erase(hist.begin(), hist.begin() + keep_from * out_channels);
+		pos -= (uint64)keep_from << 32;
+		return produced;
+	}
+
+private:
+	static const int PHASES = 256;		// Number of fractional positions
+	static const int MAX_TAPS = 512;	// Longest filter, for ratios beyond 1:5
+	static const int PASSBAND = 90;		// Flat up to this percentage of the lower Nyquist frequency
+	static const int STOPBAND_DB = 80;	// Attenuation from the lower Nyquist frequency on
+
+	// Modified Bessel function of the first kind, order 0
+	static double bessel_i0(double x)
+	{
+		double sum = 1, term = 1;
+		for (int k = 1; term > sum * 1e-12; k++) {
+			term *= (x / (2 * k)) * (x / (2 * k));
+			sum += term;
+		}
+		return sum;
+	}
+
+	// Kaiser-windowed sinc filter bank, one row of taps coefficients per phase
+	void build_filter(void)
+	{
+		// Filter length for the transition band from PASSBAND to 1 (Kaiser's formula)
+		const double nyquist = in_rate <= out_rate ? 1.0 : (double)out_rate / in_rate;
+		const double transition = M_PI * nyquist * (100 - PASSBAND) / 100;
+		taps = ((int)ceil((STOPBAND_DB - 7.95) / (2.285 * transition)) + 2) & ~1;
+		if (taps > MAX_TAPS)
+			taps = MAX_TAPS;
+		const double beta = 0.1102 * (STOPBAND_DB - 8.7);
+		const double cutoff = nyquist * (100 + PASSBAND) / 200;
+
+		coeffs.resize((PHASES + 1) * taps);
+		for (int p = 0; p <= PHASES; p++) {
+			double sum = 0;
+			for (int k = 0; k < taps; k++) {
+				double t = (k - (taps / 2 - 1)) - (double)p / PHASES;
+				double x = M_PI * cutoff * t;
+				double sinc = fabs(x) < 1e-9 ? 1.0 : sin(x) / x;
+				double r = t / (taps / 2);
+				double w = fabs(r) < 1.0 ? bessel_i0(beta * sqrt(1.0 - r * r)) : 0.0;
+				coeffs[p * taps + k] = sinc * w;
+				sum += sinc * w;
+			}
+			for (int k = 0; k < taps; k++)
+				coeffs[p * taps + k] /= sum;
+		}
+	}
+
+	// Evaluate filter at the current position
+	void filter(float *sample) const
+	{
+		const uint32 i = (uint32)(pos >> 32) - (taps / 2 - 1);
+		const uint32 frac = (uint32)pos;
+		const uint32 p = frac >> 24;					// 8 bits of phase
+		const float mu = (frac & 0xffffff) * (1.0f / 16777216.0f);
+		const float *c0 = &coeffs[p * taps];
+		const float *c1 = c0 + taps;
+		const float *h = &hist[i * out_channels];
+		float acc[2] = { 0, 0 };
+		for (int k = 0; k < taps; k++) {
+			float c = c0[k] + (c1[k] - c0[k]) * mu;
+			for (int ch = 0; ch < out_channels; ch++)
+				acc[ch] += h[k * out_channels + ch] * c;
+		}
+		sample[0] = acc[0];
+		sample[1] = acc[1];
+	}
+
+	void store(uint8 *dest, const float *sample) const
+	{
+		for (int ch = 0; ch < out_channels; ch++) {
+			float v = sample[ch];
+			if (out_format == OUT_F32)
+				memcpy(dest + ch * 4, &v, 4);
+			else {
+				if (v > 32767.0f / 32768.0f)
+					v = 32767.0f / 32768.0f;
+				else if (v < -1.0f)
+					v = -1.0f;
+				int16 s = (int16)lrintf(v * 32768.0f);
+				memcpy(dest + ch * 2, &s, 2);
+			}
+		}
+	}
+
+	uint32 in_rate, out_rate;
+	int in_bits, in_channels;
+	int out_format, out_channels;
+	int taps;					// Filter length in input frames
+	uint64 step;				// Input frames per output frame, 32.32 fixed point
+	uint64 pos;					// Position in hist, 32.32 fixed point
+	std::vector<float> hist;	// Decoded input frames, interleaved
+	std::vector<float> coeffs;	// Filter bank
+};
+
+#endif
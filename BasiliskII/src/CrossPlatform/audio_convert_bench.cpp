@@ -0,0 +1,215 @@
+/*
+ *  audio_convert_bench.cpp - Quality and speed of the audio converter
+ *
+ *  Basilisk II (C) 1997-2008 Christian Bauer
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/*
+ *  Feeds sine waves in the Mac's 16-bit big-endian format through
+ *  audio_converter, the way the SDL audio driver does, and reports:
+ *  - the SNR against the ideal sine at the output rate,
+ *  - the gain of the sinc filter across the passband and, when
+ *    downsampling, above the output Nyquist frequency,
+ *  - conversion speed for S16 and F32 output.
+ *
+ *  Built with AUDIO_CONVERT_TEST ("make check"), it checks the SNR and
+ *  the filter response against the limits below instead.
+ */
+
+#include "sysdeps.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "audio_convert.h"
+
+static const uint32 BLOCK_FRAMES = 4096;	// Mac frames per AudioInterrupt()
+
+// Make Mac stereo samples of a sine with the given frequency and amplitude
+static void make_sine(std::vector<uint8> &mac, uint32 frames, double freq, uint32 rate, double amp)
+{
+	mac.resize(frames * 4);
+	for (uint32 i = 0; i < frames; i++) {
+		int16 s = (int16)lrint(amp * 32767.0 * sin(2 * M_PI * freq * i / rate));
+		mac[i * 4 + 0] = mac[i * 4 + 2] = (uint16)s >> 8;
+		mac[i * 4 + 1] = mac[i * 4 + 3] = s & 0xff;
+	}
+}
+
+// Convert Mac samples block by block, returns left channel as float
+static void convert(audio_converter &conv, const std::vector<uint8> &mac, std::vector<float> &left)
+{
+	std::vector<uint8> out;
+	const uint32 frames = mac.size() / 4;
+	for (uint32 i = 0; i < frames; i += BLOCK_FRAMES) {
+		uint32 n = frames - i < BLOCK_FRAMES ? frames - i : BLOCK_FRAMES;
+		conv.convert(&mac[i * 4], n, out);
+	}
+	const uint32 out_frames = out.size() / 8;
+	left.resize(out_frames);
+	for (uint32 i = 0; i < out_frames; i++)
+		memcpy(&left[i], &out[i * 8], 4);
+}
+
+// Skip the filter's run-in and run-out
+static const uint32 EDGE = 64;
+
+// SNR in dB of a converted sine
+static double sine_snr(uint32 in_rate, uint32 out_rate, double freq)
+{
+	audio_converter conv;
+	conv.init(in_rate, 16, 2, out_rate, audio_converter::OUT_F32, 2);
+	std::vector<uint8> mac;
+	std::vector<float> left;
+	make_sine(mac, in_rate, freq, in_rate, 0.5);
+	convert(conv, mac, left);
+
+	double sig = 0, noise = 0;
+	for (uint32 i = EDGE; i + EDGE < left.size(); i++) {
+		double ideal = 0.5 * 32767.0 / 32768.0 * sin(2 * M_PI * freq * i / out_rate);
+		sig += ideal * ideal;
+		noise += (left[i] - ideal) * (left[i] - ideal);
+	}
+	return 10 * log10(sig / noise);
+}
+
+// Gain in dB for a sine of the given frequency
+static double sine_gain(uint32 in_rate, uint32 out_rate, double freq)
+{
+	audio_converter conv;
+	conv.init(in_rate, 16, 2, out_rate, audio_converter::OUT_F32, 2);
+	std::vector<uint8> mac;
+	std::vector<float> left;
+	make_sine(mac, in_rate, freq, in_rate, 0.5);
+	convert(conv, mac, left);
+
+	double sum = 0;
+	uint32 n = 0;
+	for (uint32 i = EDGE; i + EDGE < left.size(); i++, n++)
+		sum += left[i] * left[i];
+	return 20 * log10(sqrt(2 * sum / n) / (0.5 * 32767.0 / 32768.0));
+}
+
+static double usec(const struct timeval &start, const struct timeval &end)
+{
+	return (end.tv_sec - start.tv_sec) * 1e6 + (end.tv_usec - start.tv_usec);
+}
+
+// Output frames per second
+static double speed(uint32 in_rate, uint32 out_rate, int out_format)
+{
+	audio_converter conv;
+	conv.init(in_rate, 16, 2, out_rate, out_format, 2);
+	std::vector<uint8> mac;
+	make_sine(mac, BLOCK_FRAMES, 440, in_rate, 0.5);
+	std::vector<uint8> out;
+	out.reserve(BLOCK_FRAMES * 8 * (out_rate / in_rate + 2));
+
+	const uint32 seconds = 20;		// of audio
+	uint64 produced = 0;
+	struct timeval start, end;
+	gettimeofday(&start, NULL);
+	for (uint32 i = 0; i < seconds * in_rate / BLOCK_FRAMES; i++) {
+		out.clear();
+		produced += conv.convert(&mac[0], BLOCK_FRAMES, out);
+	}
+	gettimeofday(&end, NULL);
+	return produced / (usec(start, end) / 1e6);
+}
+
+static const uint32 rates[][2] = {
+	{ 11025, 44100 }, { 22050, 44100 }, { 22050, 48000 }, { 44100, 48000 }, { 48000, 22050 }
+};
+static const int n_rates = sizeof(rates) / sizeof(rates[0]);
+
+// Frequencies relative to the lower Nyquist frequency
+static const double rel[] = { 0.1, 0.5, 0.8, 0.9, 0.95, 1.05, 1.1, 1.3, 1.6 };
+static const int n_rel = sizeof(rel) / sizeof(rel[0]);
+
+#ifdef AUDIO_CONVERT_TEST
+const double MIN_SNR_DB = 80;			// 1 kHz sine
+const double MAX_PASSBAND_DB = 0.5;		// Deviation up to 0.9
+const double MAX_STOPBAND_DB = -70;		// Gain from 1.05 on
+
+int main(void)
+{
+	int failures = 0;
+	for (int r = 0; r < n_rates; r++) {
+		const uint32 in_rate = rates[r][0], out_rate = rates[r][1];
+		const double snr = sine_snr(in_rate, out_rate, 1000);
+		if (snr < MIN_SNR_DB) {
+			printf("%u -> %u Hz: SNR %.1f dB\n", in_rate, out_rate, snr);
+			failures++;
+		}
+		const double nyquist = (in_rate < out_rate ? in_rate : out_rate) / 2.0;
+		for (int f = 0; f < n_rel; f++) {
+			const double freq = rel[f] * nyquist;
+			if (freq >= in_rate / 2.0 || (rel[f] > 0.9 && rel[f] < 1.0))
+				continue;
+			const double gain = sine_gain(in_rate, out_rate, freq);
+			if (rel[f] < 1.0 ? fabs(gain) > MAX_PASSBAND_DB : gain > MAX_STOPBAND_DB) {
+				printf("%u -> %u Hz: gain %.1f dB at %.2f of Nyquist\n", in_rate, out_rate, gain, rel[f]);
+				failures++;
+			}
+		}
+	}
+	if (failures) {
+		printf("audio_convert_test: %d checks failed\n", failures);
+		return 1;
+	}
+	printf("audio_convert_test: OK\n");
+	return 0;
+}
+#else
+int main(void)
+{
+	printf("SNR, 1 kHz sine, F32 output\n");
+	for (int r = 0; r < n_rates; r++)
+		printf("  %5u -> %5u Hz: %5.1f dB\n", rates[r][0], rates[r][1], sine_snr(rates[r][0], rates[r][1], 1000));
+
+	printf("Sinc response (gain in dB at fraction of min(in, out) / 2)\n");
+	printf("                ");
+	for (int f = 0; f < n_rel; f++)
+		printf(" %6.2f", rel[f]);
+	printf("\n");
+	for (int r = 0; r < n_rates; r++) {
+		const uint32 in_rate = rates[r][0], out_rate = rates[r][1];
+		const double nyquist = (in_rate < out_rate ? in_rate : out_rate) / 2.0;
+		printf("  %5u -> %5u:", in_rate, out_rate);
+		for (int f = 0; f < n_rel; f++) {
+			const double freq = rel[f] * nyquist;
+			if (freq >= in_rate / 2.0)
+				printf("      -");
+			else
+				printf(" %6.1f", sine_gain(in_rate, out_rate, freq));
+		}
+		printf("\n");
+	}
+
+	printf("Speed, stereo, output frames per second\n");
+	for (int r = 0; r < n_rates; r++) {
+		const uint32 in_rate = rates[r][0], out_rate = rates[r][1];
+		const double s16 = speed(in_rate, out_rate, audio_converter::OUT_S16);
+		const double f32 = speed(in_rate, out_rate, audio_converter::OUT_F32);
+		printf("  %5u -> %5u Hz: S16 %6.2f M/s (%4.0fx realtime), F32 %6.2f M/s (%4.0fx realtime)\n",
+		       in_rate, out_rate, s16 / 1e6, s16 / out_rate, f32 / 1e6, f32 / out_rate);
+	}
+	return 0;
+}
+#endif
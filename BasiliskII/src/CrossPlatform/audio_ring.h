@@ -0,0 +1,191 @@
+/*
+ *  audio_ring.h - Audio buffering between the emulated Mac and the host
+ *
+ *  Basilisk II (C) 1997-2008 Christian Bauer
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef AUDIO_RING_H
+#define AUDIO_RING_H
+
+#include "audio_convert.h"
+#include "atomic_ops.h"
+
+/*
+ *  The Mac fills the ring from AudioInterrupt() ahead of the host, up to
+ *  a latency target. The host audio thread only consumes and never waits
+ *  for the emulated CPU: a late Mac produces an underrun (silence), which
+ *  raises the target by one block, and a long run without underruns
+ *  slowly lowers it back to the configured latency.
+ *
+ *  There is a single producer (the emulation thread) and a single
+ *  consumer (the host audio thread), so head and tail are plain atomics.
+ */
+
+class audio_ring {
+public:
+	audio_ring() : buf(NULL), size(0), head(0), tail(0), irq_pending(false) {}
+	~audio_ring() { delete[] buf; }
+
+	// Allocate ring for the given block size, target latency in blocks, no stream may be running
+	void init(uint32 block_bytes, uint32 latency_blocks)
+	{
+		if (latency_blocks < 1)
+			latency_blocks = 1;
+		if (latency_blocks > MAX_BLOCKS / 2)
+			latency_blocks = MAX_BLOCKS / 2;
+		delete[] buf;
+		block = block_bytes;
+		size = 1;
+		while (size < block_bytes * MAX_BLOCKS)	// power of two, so that the counters may wrap
+			size <<= 1;
+		buf = new uint8[size];
+		head = tail = 0;
+		min_target = target = latency_blocks * block_bytes;
+		good_blocks = 0;
+		primed = false;
+		underruns = overruns = 0;
+		irq_pending = false;
+	}
+
+	// Number of bytes waiting to be played
+	uint32 fill(void) const
+	{
+		return B2_atomic_load(&head) - B2_atomic_load(&tail);
+	}
+
+	// Check whether the Mac should deliver more data (host side)
+	bool wants_data(void) const
+	{
+		return fill() < B2_atomic_load(&target);
+	}
+
+	// Append data (Mac side), returns number of bytes stored, 16-bit samples are converted to host order if requested
+	uint32 write(const uint8 *src, uint32 len, bool swap16 = false)
+	{
+		uint32 h = B2_atomic_load(&head);
+		uint32 room = size - (h - B2_atomic_load(&tail));
+		if (len > room) {
+			B2_atomic_fetch_add(&overruns, (uint32)1);
+			len = room & ~1;
+		}
+		for (uint32 done = 0; done < len; ) {
+			uint32 ofs = (h + done) % size;
+			uint32 n = size - ofs;
+			if (n > len - done)
+				n = len - done;
+#ifndef WORDS_BIGENDIAN
+			if (swap16)
+				audio_swap_16(buf + ofs, src + done, n);
+			else
+#endif
+				memcpy(buf + ofs, src + done, n);
+			done += n;
+		}
+		B2_atomic_store(&head, h + len);
+		return len;
+	}
+
+	// Remove data (host side), returns number of bytes delivered, the rest of dest is left alone
+	uint32 read(uint8 *dest, uint32 len)
+	{
+		uint32 t = B2_atomic_load(&tail);
+		uint32 avail = B2_atomic_load(&head) - t;
+
+		// Wait for the latency target to be reached before (re)starting playback
+		if (!primed) {
+			if (avail < target && avail < size - block)
+				return 0;
+			primed = true;
+		}
+
+		uint32 actual = len < avail ? len : avail;
+		for (uint32 done = 0; done < actual; ) {
+			uint32 ofs = (t + done) % size;
+			uint32 n = size - ofs;
+			if (n > actual - done)
+				n = actual - done;
+			memcpy(dest + done, buf + ofs, n);
+			done += n;
+		}
+		B2_atomic_store(&tail, t + actual);
+
+		// Adapt latency target
+		if (actual < len) {
+			B2_atomic_fetch_add(&underruns, (uint32)1);
+			good_blocks = 0;
+			primed = false;
+			if (target + block <= size / 2)
+				B2_atomic_store(&target, target + block);
+		} else if (++good_blocks >= SHRINK_AFTER) {
+			good_blocks = 0;
+			if (target > min_target)
+				B2_atomic_store(&target, target - block);
+		}
+		return actual;
+	}
+
+	// Drop everything waiting to be played (host side)
+	void flush(void)
+	{
+		B2_atomic_store(&tail, B2_atomic_load(&head));
+		good_blocks = 0;
+		primed = false;
+	}
+
+	// Mark audio interrupt as requested, returns false if one is already pending
+	bool request_irq(void)
+	{
+		return !B2_atomic_exchange(&irq_pending, true);
+	}
+
+	// Audio interrupt was handled (Mac side)
+	void irq_done(void)
+	{
+		B2_atomic_store(&irq_pending, false);
+	}
+
+	uint32 underrun_count(void) const { return B2_atomic_load(&underruns); }
+	uint32 overrun_count(void) const { return B2_atomic_load(&overruns); }
+	uint32 target_bytes(void) const { return B2_atomic_load(&target); }
+
+private:
+	static const uint32 MAX_BLOCKS = 16;	// Ring size in blocks
+	static const uint32 SHRINK_AFTER = 256;	// Blocks without underrun before lowering the target
+
+	uint8 *buf;
+	uint32 size;			// Ring size in bytes
+	uint32 block;			// Block size in bytes
+	uint32 head, tail;		// Free-running byte counters
+	uint32 target;			// Current latency target in bytes
+	uint32 min_target;		// Configured latency target in bytes
+	uint32 good_blocks;		// Blocks played since the last underrun
+	bool primed;			// Flag: latency target was reached, playing
+	uint32 underruns, overruns;
+	bool irq_pending;		// Flag: audio interrupt requested but not yet handled
+};
+
+// Get latency target in blocks from the "audiolatency" prefs item (in ms, 0 = two blocks)
+static inline uint32 audio_latency_blocks(uint32 frames_per_block, uint32 sample_rate)
+{
+	int32 ms = PrefsFindInt32("audiolatency");
+	if (ms <= 0 || frames_per_block == 0)
+		return 2;
+	uint32 frames = (uint64)ms * sample_rate / 1000;
+	return (frames + frames_per_block - 1) / frames_per_block;
+}
+
+#endif
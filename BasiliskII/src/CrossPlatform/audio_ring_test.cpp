@@ -0,0 +1,229 @@
+/*
+ *  audio_ring_test.cpp - Audio ring against a null sink
+ *
+ *  Basilisk II (C) 1997-2008 Christian Bauer
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/*
+ *  Plays a counting byte pattern through audio_ring into a sink that
+ *  throws the data away. The first part steps producer and sink in lock
+ *  step, so that the underrun and overrun counters and the latency target
+ *  have exact expected values. The second part runs the Mac side and the
+ *  sink in two threads, the way AudioInterrupt() and the host callback
+ *  do, with the producer stalling now and then.
+ */
+
+#include "sysdeps.h"
+#include "prefs.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "audio_ring.h"
+
+static int32 latency_pref;
+int32 PrefsFindInt32(const char *name) { return latency_pref; }
+
+static const uint32 BLOCK = 512;		// Bytes per audio block
+static const uint32 SHRINK_AFTER = 256;	// Must match audio_ring
+static int failures;
+
+#define CHECK(cond) do { \
+	if (!(cond)) { \
+		printf("%s:%d: %s failed\n", __FILE__, __LINE__, #cond); \
+		failures++; \
+	} \
+} while (0)
+
+// Counting pattern, 251 is prime so it does not line up with the ring size
+static uint8 pattern_byte(uint32 pos)
+{
+	return pos % 251;
+}
+
+// Mac side: deliver one block of the pattern
+static uint32 produce_pos;
+static void produce(audio_ring &ring)
+{
+	uint8 block[BLOCK];
+	for (uint32 i = 0; i < BLOCK; i++)
+		block[i] = pattern_byte(produce_pos + i);
+	produce_pos += ring.write(block, BLOCK);
+}
+
+// Null sink: fetch one block, check it and throw it away, returns false on bad data
+static uint32 consume_pos;
+static bool consume(audio_ring &ring)
+{
+	uint8 block[BLOCK];
+	uint32 actual = ring.read(block, BLOCK);
+	for (uint32 i = 0; i < actual; i++) {
+		if (block[i] != pattern_byte(consume_pos + i)) {
+			printf("bad data at byte %u\n", consume_pos + i);
+			return false;
+		}
+	}
+	consume_pos += actual;
+	return true;
+}
+
+// One period of the lock step simulation, the Mac skips its interrupt if stalled
+static bool period(audio_ring &ring, bool stalled)
+{
+	if (!stalled) {
+		while (ring.wants_data())
+			produce(ring);
+	}
+	return consume(ring);
+}
+
+static void test_lock_step(void)
+{
+	audio_ring ring;
+	ring.init(BLOCK, 2);
+	produce_pos = consume_pos = 0;
+
+	// Prompt Mac: no underruns, target stays put
+	for (int i = 0; i < 1000; i++)
+		CHECK(period(ring, false));
+	CHECK(ring.underrun_count() == 0);
+	CHECK(ring.overrun_count() == 0);
+	CHECK(ring.target_bytes() == 2 * BLOCK);
+	CHECK(consume_pos > 999 * BLOCK);
+
+	// A stall as long as the latency target drains the ring and costs one underrun and one more block of latency
+	for (int stall = 1; stall <= 3; stall++) {
+		for (uint32 i = 0; i < ring.target_bytes() / BLOCK; i++)
+			CHECK(period(ring, true));
+		for (int i = 0; i < 10; i++)
+			CHECK(period(ring, false));
+		CHECK(ring.underrun_count() == (uint32)stall);
+		CHECK(ring.target_bytes() == (2 + stall) * BLOCK);
+	}
+
+	// The target shrinks by one block per SHRINK_AFTER good blocks, but not below the configured latency
+	for (uint32 i = 0; i < 4 * SHRINK_AFTER; i++)
+		CHECK(period(ring, false));
+	CHECK(ring.target_bytes() == 2 * BLOCK);
+	CHECK(ring.underrun_count() == 3);
+	CHECK(ring.overrun_count() == 0);
+
+	// A Mac writing more than fits is cut off and counted
+	ring.flush();
+	consume_pos = produce_pos;
+	uint32 stored = 0;
+	for (int i = 0; i < 64; i++) {
+		uint32 before = produce_pos;
+		produce(ring);
+		stored += produce_pos - before;
+	}
+	CHECK(ring.overrun_count() > 0);
+	CHECK(ring.fill() == stored);
+	while (ring.fill())
+		CHECK(consume(ring));
+	CHECK(consume_pos == produce_pos);
+}
+
+static void test_swap(void)
+{
+	audio_ring ring;
+	ring.init(BLOCK, 2);
+	uint8 in[BLOCK], out[BLOCK];
+	for (uint32 i = 0; i < BLOCK; i++)
+		in[i] = i;
+	ring.write(in, BLOCK, true);
+	ring.write(in, BLOCK, true);
+	CHECK(ring.read(out, BLOCK) == BLOCK);
+	for (uint32 i = 0; i < BLOCK; i++) {
+#ifdef WORDS_BIGENDIAN
+		CHECK(out[i] == in[i]);
+#else
+		CHECK(out[i] == in[i ^ 1]);
+#endif
+	}
+}
+
+static void test_latency_pref(void)
+{
+	latency_pref = 0;
+	CHECK(audio_latency_blocks(1024, 44100) == 2);
+	latency_pref = 50;		// 2205 frames
+	CHECK(audio_latency_blocks(1024, 44100) == 3);
+	CHECK(audio_latency_blocks(2205, 44100) == 1);
+	latency_pref = 0;
+}
+
+// Threaded run, the sink plays one block every 200 usec
+static audio_ring thread_ring;
+static volatile bool sink_done;
+static bool sink_ok = true;
+
+static void *sink_func(void *arg)
+{
+	for (int i = 0; i < 5000; i++) {
+		if (!consume(thread_ring))
+			sink_ok = false;
+		usleep(200);
+	}
+	sink_done = true;
+	return NULL;
+}
+
+static void test_threads(void)
+{
+	thread_ring.init(BLOCK, 2);
+	produce_pos = consume_pos = 0;
+	sink_done = false;
+	pthread_t sink;
+	pthread_create(&sink, NULL, sink_func, NULL);
+
+	// Poll like the Mac interrupt would, stalling for 5 ms every 500 polls
+	uint32 max_target = 0;
+	for (int polls = 0; !sink_done; polls++) {
+		while (thread_ring.wants_data())
+			produce(thread_ring);
+		if (thread_ring.target_bytes() > max_target)
+			max_target = thread_ring.target_bytes();
+		usleep(polls % 500 == 499 ? 5000 : 100);
+	}
+	pthread_join(sink, NULL);
+
+	printf("threads: %u bytes played, %u underruns, %u overruns, target up to %u blocks\n",
+	       consume_pos, thread_ring.underrun_count(), thread_ring.overrun_count(), max_target / BLOCK);
+	CHECK(sink_ok);
+	CHECK(thread_ring.overrun_count() == 0);
+	CHECK(thread_ring.underrun_count() > 0);
+	CHECK(max_target > 2 * BLOCK);
+	CHECK(produce_pos - consume_pos == thread_ring.fill());
+}
+
+int main(void)
+{
+	test_lock_step();
+	test_swap();
+	test_latency_pref();
+	test_threads();
+	if (failures) {
+		printf("audio_ring_test: %d failures\n", failures);
+		return 1;
+	}
+	printf("audio_ring_test: OK\n");
+	return 0;
+}
@@ -19,6 +19,7 @@
  */
 
 #include "sysdeps.h"
+#include "prefs.h"
 #include "video.h"
 #include "video_blit.h"
 
@@ -29,6 +30,10 @@
 #include <stdio.h>
 #include <stdlib.h>
 
+#ifdef HAVE_PTHREADS
+#include <pthread.h>
+#endif
+
 // Format of the target visual
 static VisualFormat visualFormat;
 
@@ -627,3 +632,310 @@ bool Screen_blitter_init(VisualFormat const & visual_format, bool native_byte_or
 	// --> In that case, we return FALSE
 	return (Screen_blit != Blit_Copy_Raw);
 }
+
+
+/* -------------------------------------------------------------------------- */
+/* --- Multi-threaded blitting of scanlines                               --- */
+/* -------------------------------------------------------------------------- */
+
+// Don't bother waking up other threads for less than that many source bytes
+const uint32 BLIT_THREADS_MIN_BYTES = 64 * 1024;
+
+// Work to do on a set of scanlines
+struct Screen_blit_job {
+	uint8 *			dest;				// First destination scanline
+	uint32			dest_row_bytes;		// Bytes per destination scanline
+	const uint8 *	source;				// First source scanline
+	uint32			source_row_bytes;	// Bytes per source scanline
+	uint32			length;				// Number of source bytes to blit per scanline
+	uint32			n_rows;				// Number of scanlines
+	uint8 *			copy;				// Copy of the source scanlines to update (optional)
+};
+
+// Blit the SLICE-th of N_SLICES bands of scanlines of JOB
+static void Screen_blit_slice(Screen_blit_job const & job, int slice, int n_slices)
+{
+	const uint32 first_row = (job.n_rows * slice) / n_slices;
+	const uint32 last_row = (job.n_rows * (slice + 1)) / n_slices;
+	uint8 *dest = job.dest + first_row * job.dest_row_bytes;
+	for (uint32 j = first_row; j < last_row; j++) {
+		const uint32 i = j * job.source_row_bytes;
+		if (job.copy)
+			memcpy(job.copy + i, job.source + i, job.length);
+		Screen_blit(dest, job.source + i, job.length);
+		dest += job.dest_row_bytes;
+	}
+}
+
+#ifdef HAVE_PTHREADS
+const int BLIT_THREADS_MAX = 8;				// scaling stops way before with memory bandwidth
+static int blit_threads_count = 0;			// Number of threads blitting a job, including the caller, 0 if not started
+static pthread_t blit_threads[BLIT_THREADS_MAX];
+static pthread_mutex_t blit_threads_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t blit_threads_start = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t blit_threads_done = PTHREAD_COND_INITIALIZER;
+static Screen_blit_job blit_threads_job;	// Job being processed
+static uint32 blit_threads_generation = 0;	// Incremented for each new job
+static uint32 blit_threads_init_generation;	// Generation when the helper threads were started
+static int blit_threads_pending = 0;		// Number of helper threads still working on the job
+static bool blit_threads_quit = false;		// Flag: helper threads shall exit
+
+static void *Screen_blit_thread(void *arg)
+{
+	const int slice = (int)(intptr)arg;
+
+	uint32 generation = blit_threads_init_generation;
+
+	pthread_mutex_lock(&blit_threads_lock);
+	for (;;) {
+		while (blit_threads_generation == generation && !blit_threads_quit)
+			pthread_cond_wait(&blit_threads_start, &blit_threads_lock);
+		if (blit_threads_quit)
+			break;
+		generation = blit_threads_generation;
+		const Screen_blit_job job = blit_threads_job;
+		pthread_mutex_unlock(&blit_threads_lock);
+
+		Screen_blit_slice(job, slice, blit_threads_count);
+
+		pthread_mutex_lock(&blit_threads_lock);
+		if (--blit_threads_pending == 0)
+			pthread_cond_signal(&blit_threads_done);
+	}
+	pthread_mutex_unlock(&blit_threads_lock);
+	return NULL;
+}
+
+// Start the helper threads, on the first update large enough to need
+// them. The "blitthreads" pref sets the total number of threads blitting
+// scanlines, 0 means one per online CPU
+static void Screen_blitter_threads_init(void)
+{
+	blit_threads_count = 1;
+	blit_threads_quit = false;
+	blit_threads_init_generation = blit_threads_generation;
+
+	int n_threads = PrefsFindInt32("blitthreads");
+#ifdef _SC_NPROCESSORS_ONLN
+	if (n_threads <= 0)
+		n_threads = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+	if (n_threads > BLIT_THREADS_MAX)
+		n_threads = BLIT_THREADS_MAX;
+
+	for (int i = 1; i < n_threads; i++) {
+		if (pthread_create(&blit_threads[i], NULL, Screen_blit_thread, (void *)(intptr)i) != 0)
+			break;
+		blit_threads_count++;
+	}
+}
+#endif
+
+// Stop the helper threads, if they were started
+void Screen_blitter_exit(void)
+{
+#ifdef HAVE_PTHREADS
+	if (blit_threads_count == 0)
+		return;
+	pthread_mutex_lock(&blit_threads_lock);
+	blit_threads_quit = true;
+	pthread_cond_broadcast(&blit_threads_start);
+	pthread_mutex_unlock(&blit_threads_lock);
+	for (int i = 1; i < blit_threads_count; i++)
+		pthread_join(blit_threads[i], NULL);
+	blit_threads_count = 0;
+#endif
+}
+
+// Blit N_ROWS scanlines of LENGTH source bytes, and update the copy of
+// the source buffer if COPY is set. Large updates are split into bands
+// of scanlines converted in parallel
+void Screen_blit_rows(uint8 * dest, uint32 dest_row_bytes, const uint8 * source, uint32 source_row_bytes, uint32 length, uint32 n_rows, uint8 * copy)
+{
+	Screen_blit_job job;
+	job.dest = dest;
+	job.dest_row_bytes = dest_row_bytes;
+	job.source = source;
+	job.source_row_bytes = source_row_bytes;
+	job.length = length;
+	job.n_rows = n_rows;
+	job.copy = copy;
+
+#ifdef HAVE_PTHREADS
+	if (blit_threads_count == 0 && length * n_rows >= BLIT_THREADS_MIN_BYTES)
+		Screen_blitter_threads_init();
+	const int n_threads = blit_threads_count;
+	if (n_threads > 1 && n_rows >= (uint32)n_threads && length * n_rows >= BLIT_THREADS_MIN_BYTES) {
+		pthread_mutex_lock(&blit_threads_lock);
+		blit_threads_job = job;
+		blit_threads_pending = n_threads - 1;
+		blit_threads_generation++;
+		pthread_cond_broadcast(&blit_threads_start);
+		pthread_mutex_unlock(&blit_threads_lock);
+
+		Screen_blit_slice(job, 0, n_threads);
+
+		pthread_mutex_lock(&blit_threads_lock);
+		while (blit_threads_pending > 0)
+			pthread_cond_wait(&blit_threads_done, &blit_threads_lock);
+		pthread_mutex_unlock(&blit_threads_lock);
+		return;
+	}
+#endif
+
+	Screen_blit_slice(job, 0, 1);
+}
+
+
+#ifdef VIDEO_BLIT_BENCHMARK
+/* Convert 8-bit frames to 32 bits with 1 to 8 threads, and check that all
+   thread counts produce the same output.
+
+   blit_threads_bench [frames]
+     Converts a whole 1920x1080 frame FRAMES times (default 200).
+
+   blit_threads_bench dump...
+     Replays the screen updates recorded in PPM frame dumps of the headless
+     video backend ("dumpframes" with "dumpinterval 1"): the scanlines from
+     the first to the last one that changed between two dumps are converted,
+     like update_display_static() does. Only the sizes and positions of the
+     updates come from the dumps, the pixels are random.  */
+#include <ctype.h>
+#include <sys/time.h>
+
+static int32 bench_threads;
+
+int32 PrefsFindInt32(const char *name)
+{
+	return bench_threads;
+}
+
+struct bench_update {
+	uint32 y, n_rows;
+};
+
+// Read a PPM dump into FRAME, false if it's not one of the expected size
+static bool read_dump(const char *name, uint32 &width, uint32 &height, vector<uint8> &frame)
+{
+	FILE *f = fopen(name, "rb");
+	if (f == NULL) {
+		perror(name);
+		return false;
+	}
+	unsigned w, h, max;
+	bool ok = fscanf(f, "P6 %u %u %u", &w, &h, &max) == 3 && fgetc(f) != EOF && max == 255
+	       && (width == 0 || (w == width && h == height));
+	if (ok) {
+		width = w;
+		height = h;
+		frame.resize(w * h * 3);
+		ok = fread(&frame[0], 1, frame.size(), f) == frame.size();
+	}
+	fclose(f);
+	if (!ok)
+		fprintf(stderr, "%s: not a PPM dump of %ux%u pixels\n", name, width, height);
+	return ok;
+}
+
+// Find the updates between successive dumps, the first dump is a full update
+static bool read_updates(int n, char **names, uint32 &width, uint32 &height, vector<bench_update> &updates)
+{
+	vector<uint8> prev, frame;
+	width = height = 0;
+	for (int i = 0; i < n; i++) {
+		if (!read_dump(names[i], width, height, frame))
+			return false;
+		const uint32 row_bytes = width * 3;
+		uint32 y1 = 0, y2 = height - 1;
+		if (i > 0) {
+			while (y1 <= y2 && memcmp(&frame[y1 * row_bytes], &prev[y1 * row_bytes], row_bytes) == 0)
+				y1++;
+			if (y1 > y2) {
+				prev.swap(frame);
+				continue;
+			}
+			while (y2 > y1 && memcmp(&frame[y2 * row_bytes], &prev[y2 * row_bytes], row_bytes) == 0)
+				y2--;
+		}
+		bench_update u = { y1, y2 - y1 + 1 };
+		updates.push_back(u);
+		prev.swap(frame);
+	}
+	return true;
+}
+
+int main(int argc, char **argv)
+{
+	uint32 width = 1920, height = 1080;
+	vector<bench_update> updates;
+	int repeat = 1;
+	if (argc > 1 && !isdigit(argv[1][0])) {
+		if (!read_updates(argc - 1, argv + 1, width, height, updates))
+			return 1;
+		uint64 rows = 0;
+		uint32 threaded = 0;
+		for (size_t i = 0; i < updates.size(); i++) {
+			rows += updates[i].n_rows;
+			if (updates[i].n_rows * width >= BLIT_THREADS_MIN_BYTES)
+				threaded++;
+		}
+		printf("%d dumps of %ux%u: %u updates, %.1f scanlines on average, %u (%.0f%%) large enough for helper threads\n",
+			argc - 1, width, height, (uint32)updates.size(), updates.empty() ? 0.0 : (double)rows / updates.size(),
+			threaded, updates.empty() ? 0.0 : threaded * 100.0 / updates.size());
+		if (rows == 0)
+			return 0;
+
+		// Replay the sequence often enough to convert 200 frames worth of scanlines
+		repeat = (200 * height + rows - 1) / rows;
+	} else {
+		const int frames = argc > 1 ? atoi(argv[1]) : 200;
+		bench_update u = { 0, height };
+		updates.assign(frames, u);
+	}
+
+	VisualFormat format;
+	memset(&format, 0, sizeof(format));
+	format.depth = 32;
+	format.Rmask = 0xff0000;
+	format.Gmask = 0x00ff00;
+	format.Bmask = 0x0000ff;
+	Screen_blitter_init(format, true, 8);
+	for (int i = 0; i < 256; i++)
+		ExpandMap[i] = i * 0x010203;
+
+	uint8 *source = (uint8 *)malloc(width * height);
+	uint8 *dest = (uint8 *)malloc(width * height * 4);
+	uint8 *reference = (uint8 *)malloc(width * height * 4);
+	for (uint32 i = 0; i < width * height; i++)
+		source[i] = rand();
+
+#ifdef _SC_NPROCESSORS_ONLN
+	printf("%ld online CPUs\n", sysconf(_SC_NPROCESSORS_ONLN));
+#endif
+	const uint32 n_updates = updates.size() * repeat;
+	double base_usec = 0;
+	for (bench_threads = 1; bench_threads <= BLIT_THREADS_MAX; bench_threads *= 2) {
+		memset(dest, 0, width * height * 4);
+		struct timeval start, end;
+		gettimeofday(&start, NULL);
+		for (int r = 0; r < repeat; r++) {
+			for (size_t i = 0; i < updates.size(); i++) {
+				const bench_update &u = updates[i];
+				Screen_blit_rows(dest + u.y * width * 4, width * 4, source + u.y * width, width, width, u.n_rows);
+			}
+		}
+		gettimeofday(&end, NULL);
+		const double usec = ((end.tv_sec - start.tv_sec) * 1e6 + (end.tv_usec - start.tv_usec)) / n_updates;
+		if (bench_threads == 1) {
+			memcpy(reference, dest, width * height * 4);
+			base_usec = usec;
+		} else if (memcmp(reference, dest, width * height * 4) != 0) {
+			printf("%d threads: output differs\n", bench_threads);
+			return 1;
+		}
+		printf("%d threads: %7.1f usec/update, speedup %.2f\n", bench_threads, usec, base_usec / usec);
+		Screen_blitter_exit();
+	}
+	return 0;
+}
+#endif
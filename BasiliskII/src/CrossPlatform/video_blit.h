@@ -34,6 +34,8 @@ struct VisualFormat {
 // Prototypes
 extern void (*Screen_blit)(uint8 * dest, const uint8 * source, uint32 length);
 extern bool Screen_blitter_init(VisualFormat const & visual_format, bool native_byte_order, int mac_depth);
+extern void Screen_blit_rows(uint8 * dest, uint32 dest_row_bytes, const uint8 * source, uint32 source_row_bytes, uint32 length, uint32 n_rows, uint8 * copy = NULL);
+extern void Screen_blitter_exit(void);
 extern uint32 ExpandMap[256];
 
 // Glue for SheepShaver and BasiliskII
@@ -26,6 +26,7 @@
 
 #include "sigsegv.h"
 #include "vm_alloc.h"
+#include "atomic_ops.h"
 #ifdef _WIN32
 #include "util_windows.h"
 #endif
@@ -36,6 +37,11 @@ extern void update_sdl_video(SDL_Surface *screen, Sint32 x, Sint32 y, Sint32 w,
 extern void update_sdl_video(SDL_Surface *screen, int numrects, SDL_Rect *rects);
 #endif
 
+// Import headless-backend-specific functions
+#ifdef USE_HEADLESS_VIDEO
+static void update_headless_video(int y, int h);
+#endif
+
 // Glue for SDL and X11 support
 #ifdef TEST_VOSF_PERFORMANCE
 #define MONITOR_INIT			/* nothing */
@@ -50,6 +56,16 @@ extern void update_sdl_video(SDL_Surface *screen, int numrects, SDL_Rect *rects)
 #define VIDEO_DRV_WIDTH			drv->s->w
 #define VIDEO_DRV_HEIGHT		drv->s->h
 #define VIDEO_DRV_ROW_BYTES		drv->s->pitch
+#elif defined(USE_HEADLESS_VIDEO)
+#define MONITOR_INIT			Headless_monitor_desc &monitor
+#define VIDEO_DRV_WIN_INIT		driver_headless *drv
+#define VIDEO_DRV_DGA_INIT		driver_headless *drv
+#define VIDEO_DRV_LOCK_PIXELS	/* nothing */
+#define VIDEO_DRV_UNLOCK_PIXELS	/* nothing */
+#define VIDEO_DRV_DEPTH			drv->depth
+#define VIDEO_DRV_WIDTH			drv->mode.x
+#define VIDEO_DRV_HEIGHT		drv->mode.y
+#define VIDEO_DRV_ROW_BYTES		drv->bytes_per_row
 #else
 #ifdef SHEEPSHAVER
 #define MONITOR_INIT			/* nothing */
@@ -98,42 +114,53 @@ struct ScreenInfo {
     
 	bool dirty;					// Flag: set if the frame buffer was touched
 	bool very_dirty;			// Flag: set if the frame buffer was completely modified (e.g. colormap changes)
-    char * dirtyPages;			// Table of flags set if page was altered
+	bool writeWatch;			// Flag: set if the host tracks writes for us (no SIGSEGV, no mprotect)
+    uintptr * dirtyPages;		// Bitmap of pages that were altered
+    uintptr * refreshPages;		// Bitmap of pages being refreshed, private to the update routines
+    uint32 pageWords;			// Number of words in the page bitmaps
+    void ** watchPages;			// Table of page addresses returned by vm_get_write_watch()
     ScreenPageInfo * pageInfo;	// Table of mappings page -> Mac scanlines
 };
 
 static ScreenInfo mainBuffer;
 
-#define PFLAG_SET_VALUE			0x00
-#define PFLAG_CLEAR_VALUE		0x01
-#define PFLAG_SET_VALUE_4		0x00000000
-#define PFLAG_CLEAR_VALUE_4		0x01010101
-#define PFLAG_SET(page)			mainBuffer.dirtyPages[page] = PFLAG_SET_VALUE
-#define PFLAG_CLEAR(page)		mainBuffer.dirtyPages[page] = PFLAG_CLEAR_VALUE
-#define PFLAG_ISSET(page)		(mainBuffer.dirtyPages[page] == PFLAG_SET_VALUE)
-#define PFLAG_ISCLEAR(page)		(mainBuffer.dirtyPages[page] != PFLAG_SET_VALUE)
-
-#ifdef UNALIGNED_PROFITABLE
-# define PFLAG_ISSET_4(page)	(*((uint32 *)(mainBuffer.dirtyPages + (page))) == PFLAG_SET_VALUE_4)
-# define PFLAG_ISCLEAR_4(page)	(*((uint32 *)(mainBuffer.dirtyPages + (page))) == PFLAG_CLEAR_VALUE_4)
-#else
-# define PFLAG_ISSET_4(page) \
-		PFLAG_ISSET(page  ) && PFLAG_ISSET(page+1) \
-	&&	PFLAG_ISSET(page+2) && PFLAG_ISSET(page+3)
-# define PFLAG_ISCLEAR_4(page) \
-		PFLAG_ISCLEAR(page  ) && PFLAG_ISCLEAR(page+1) \
-	&&	PFLAG_ISCLEAR(page+2) && PFLAG_ISCLEAR(page+3)
-#endif
+// The page bitmaps are made of host words, bits are atomically set from
+// the SIGSEGV handler and fetched-and-cleared by the update routines
+#define PFLAG_WORD_BITS			(sizeof(uintptr) * 8)
+#define PFLAG_WORD(page)		((page) / PFLAG_WORD_BITS)
+#define PFLAG_MASK(page)		((uintptr)1 << ((page) % PFLAG_WORD_BITS))
+
+#define PFLAG_SET(page) \
+	B2_atomic_fetch_or(&mainBuffer.dirtyPages[PFLAG_WORD(page)], PFLAG_MASK(page))
+#define PFLAG_CLEAR(page) \
+	B2_atomic_fetch_and(&mainBuffer.dirtyPages[PFLAG_WORD(page)], ~PFLAG_MASK(page))
+#define PFLAG_ISSET(page) \
+	((B2_atomic_load(&mainBuffer.dirtyPages[PFLAG_WORD(page)]) & PFLAG_MASK(page)) != 0)
+#define PFLAG_ISCLEAR(page)		(!PFLAG_ISSET(page))
+
+// Set the selected page range [ first_page, last_page [ into the SET or CLEAR state
+static void vosf_set_page_range(unsigned first_page, unsigned last_page, bool set)
+{
+	while (first_page < last_page) {
+		const unsigned bit = first_page % PFLAG_WORD_BITS;
+		unsigned n = PFLAG_WORD_BITS - bit;
+		if (n > last_page - first_page)
+			n = last_page - first_page;
+		const uintptr mask = (n == PFLAG_WORD_BITS ? ~(uintptr)0 : ((uintptr)1 << n) - 1) << bit;
+		uintptr *word = &mainBuffer.dirtyPages[PFLAG_WORD(first_page)];
+		if (set)
+			B2_atomic_fetch_or(word, mask);
+		else
+			B2_atomic_fetch_and(word, ~mask);
+		first_page += n;
+	}
+}
 
-// Set the selected page range [ first_page, last_page [ into the SET state
 #define PFLAG_SET_RANGE(first_page, last_page) \
-	memset(mainBuffer.dirtyPages + (first_page), PFLAG_SET_VALUE, \
-		(last_page) - (first_page))
+	vosf_set_page_range(first_page, last_page, true)
 
-// Set the selected page range [ first_page, last_page [ into the CLEAR state
 #define PFLAG_CLEAR_RANGE(first_page, last_page) \
-	memset(mainBuffer.dirtyPages + (first_page), PFLAG_CLEAR_VALUE, \
-		(last_page) - (first_page))
+	vosf_set_page_range(first_page, last_page, false)
 
 #define PFLAG_SET_ALL do { \
 	PFLAG_SET_RANGE(0, mainBuffer.pageCount); \
@@ -150,48 +177,54 @@ static ScreenInfo mainBuffer;
 	mainBuffer.very_dirty = true; \
 } while (0)
 
-// Set the following macro definition to 1 if your system
-// provides a really fast strchr() implementation
-//#define HAVE_FAST_STRCHR 0
+// Move the pages altered so far into refreshPages[] and clear them in
+// dirtyPages[]. Pages touched afterwards will be caught by the next update
+static void vosf_grab_dirty_pages(void)
+{
+	for (uint32 i = 0; i < mainBuffer.pageWords; i++) {
+		uintptr bits = 0;
+		if (B2_atomic_load(&mainBuffer.dirtyPages[i]) != 0)
+			bits = B2_atomic_exchange(&mainBuffer.dirtyPages[i], (uintptr)0);
+		mainBuffer.refreshPages[i] = bits;
+	}
+}
+
+// Find the next page set (resp. clear) in refreshPages[], or pageCount
+static inline unsigned find_next_page(unsigned page, uintptr invert)
+{
+	if (page >= mainBuffer.pageCount)
+		return mainBuffer.pageCount;
+	uint32 w = PFLAG_WORD(page);
+	uintptr bits = (mainBuffer.refreshPages[w] ^ invert) & (~(uintptr)0 << (page % PFLAG_WORD_BITS));
+	while (bits == 0) {
+		if (++w >= mainBuffer.pageWords)
+			return mainBuffer.pageCount;
+		bits = mainBuffer.refreshPages[w] ^ invert;
+	}
+	page = w * PFLAG_WORD_BITS + B2_ctz(bits);
+	return page < mainBuffer.pageCount ? page : mainBuffer.pageCount;
+}
 
 static inline unsigned find_next_page_set(unsigned page)
 {
-#if HAVE_FAST_STRCHR
-	char *match = strchr(mainBuffer.dirtyPages + page, PFLAG_SET_VALUE);
-	return match ? match - mainBuffer.dirtyPages : mainBuffer.pageCount;
-#else
-	while (PFLAG_ISCLEAR_4(page))
-		page += 4;
-	while (PFLAG_ISCLEAR(page))
-		page++;
-	return page;
-#endif
+	return find_next_page(page, 0);
 }
 
 static inline unsigned find_next_page_clear(unsigned page)
 {
-#if HAVE_FAST_STRCHR
-	char *match = strchr(mainBuffer.dirtyPages + page, PFLAG_CLEAR_VALUE);
-	return match ? match - mainBuffer.dirtyPages : mainBuffer.pageCount;
-#else
-	while (PFLAG_ISSET_4(page))
-		page += 4;
-	while (PFLAG_ISSET(page))
-		page++;
-	return page;
-#endif
+	return find_next_page(page, ~(uintptr)0);
 }
 
 #if defined(HAVE_PTHREADS)
-static pthread_mutex_t vosf_lock = PTHREAD_MUTEX_INITIALIZER;	// Mutex to protect frame buffer (dirtyPages in fact)
+static pthread_mutex_t vosf_lock = PTHREAD_MUTEX_INITIALIZER;	// Mutex to serialize frame buffer updates (not taken on faults)
 #define LOCK_VOSF pthread_mutex_lock(&vosf_lock);
 #define UNLOCK_VOSF pthread_mutex_unlock(&vosf_lock);
 #elif defined(_WIN32)
-static mutex_t vosf_lock;										// Mutex to protect frame buffer (dirtyPages in fact)
+static mutex_t vosf_lock;										// Mutex to serialize frame buffer updates (not taken on faults)
 #define LOCK_VOSF vosf_lock.lock();
 #define UNLOCK_VOSF vosf_lock.unlock();
 #elif defined(HAVE_SPINLOCKS)
-static spinlock_t vosf_lock = SPIN_LOCK_UNLOCKED;				// Mutex to protect frame buffer (dirtyPages in fact)
+static spinlock_t vosf_lock = SPIN_LOCK_UNLOCKED;				// Mutex to serialize frame buffer updates (not taken on faults)
 #define LOCK_VOSF spin_lock(&vosf_lock)
 #define UNLOCK_VOSF spin_unlock(&vosf_lock)
 #else
@@ -199,6 +232,38 @@ static spinlock_t vosf_lock = SPIN_LOCK_UNLOCKED;				// Mutex to protect frame b
 #define UNLOCK_VOSF
 #endif
 
+// Check whether the frame buffer may need to be refreshed. With
+// write-tracking, dirty pages are only known once they are fetched
+static inline bool video_vosf_dirty(void)
+{
+	return mainBuffer.dirty || mainBuffer.writeWatch;
+}
+
+// Import the pages modified since the last fetch into dirtyPages[]
+// and re-arm write-tracking for them
+static void vosf_fetch_write_watch(void)
+{
+	unsigned int n_pages = mainBuffer.pageCount;
+	if (vm_get_write_watch((void *)mainBuffer.memStart, mainBuffer.memLength,
+						   mainBuffer.watchPages, &n_pages, VM_WRITE_WATCH_RESET) < 0) {
+		// Don't lose updates, redraw everything
+		PFLAG_SET_ALL;
+		return;
+	}
+	for (unsigned int i = 0; i < n_pages; i++)
+		PFLAG_SET(((uintptr)mainBuffer.watchPages[i] - mainBuffer.memStart) >> mainBuffer.pageBits);
+	if (n_pages > 0)
+		mainBuffer.dirty = true;
+}
+
+// Start tracking writes again for the whole frame buffer
+static int vosf_protect_all(void)
+{
+	if (mainBuffer.writeWatch)
+		return vm_reset_write_watch((char *)mainBuffer.memStart, mainBuffer.memLength);
+	return vm_protect((char *)mainBuffer.memStart, mainBuffer.memLength, VM_PAGE_READ);
+}
+
 static int log_base_2(uint32 x)
 {
 	uint32 mask = 0x80000000;
@@ -252,9 +317,11 @@ static bool video_vosf_profitable(uint32 *duration_p = NULL, uint32 *n_page_faul
 		}
 		duration += uint32(GetTicks_usec() - start);
 
+		if (mainBuffer.writeWatch)
+			vosf_fetch_write_watch();
 		PFLAG_CLEAR_ALL;
 		mainBuffer.dirty = false;
-		if (vm_protect((char *)mainBuffer.memStart, mainBuffer.memLength, VM_PAGE_READ) != 0)
+		if (vosf_protect_all() != 0)
 			return false;
 	}
 
@@ -263,8 +330,9 @@ static bool video_vosf_profitable(uint32 *duration_p = NULL, uint32 *n_page_faul
 	if (n_page_faults_p)
 	  *n_page_faults_p = n_page_faults;
 
-	D(bug("Triggered %d page faults in %ld usec (%.1f usec per fault)\n", n_page_faults, duration, double(duration) / double(n_page_faults)));
-	return ((duration / n_tries) < (VOSF_PROFITABLE_THRESHOLD * (frame_skip ? frame_skip : 1)));
+	D(bug("Triggered %d page faults in %ld usec (%.1f usec per fault, %s)\n", n_page_faults, duration, double(duration) / double(n_page_faults),
+		  mainBuffer.writeWatch ? "write-tracking" : "SIGSEGV"));
+	return ((duration / n_tries) < uint32(VOSF_PROFITABLE_THRESHOLD * (frame_skip ? frame_skip : 1)));
 }
 
 
@@ -289,16 +357,16 @@ static bool video_vosf_init(MONITOR_INIT)
 	mainBuffer.pageBits = log_base_2(mainBuffer.pageSize);
 	mainBuffer.pageCount =  (mainBuffer.memLength + page_mask)/mainBuffer.pageSize;
 	
-	// The "2" more bytes requested are a safety net to insure the
-	// loops in the update routines will terminate.
-	// See "How can we deal with array overrun conditions ?" hereunder for further details.
-	mainBuffer.dirtyPages = (char *) malloc(mainBuffer.pageCount + 2);
+	// Allocate the page bitmaps, bits beyond pageCount are always clear
+	mainBuffer.pageWords = (mainBuffer.pageCount + PFLAG_WORD_BITS - 1) / PFLAG_WORD_BITS;
+	mainBuffer.dirtyPages = (uintptr *) calloc(mainBuffer.pageWords, sizeof(uintptr));
 	if (mainBuffer.dirtyPages == NULL)
 		return false;
+	mainBuffer.refreshPages = (uintptr *) calloc(mainBuffer.pageWords, sizeof(uintptr));
+	if (mainBuffer.refreshPages == NULL)
+		return false;
 		
 	PFLAG_CLEAR_ALL;
-	PFLAG_CLEAR(mainBuffer.pageCount);
-	PFLAG_SET(mainBuffer.pageCount+1);
 	
 	// Allocate and fill in pageInfo with start and end (inclusive) row in number of bytes
 	mainBuffer.pageInfo = (ScreenPageInfo *) malloc(mainBuffer.pageCount * sizeof(ScreenPageInfo));
@@ -323,8 +391,18 @@ static bool video_vosf_init(MONITOR_INIT)
 			a = mainBuffer.memLength;
 	}
 	
+	// Let the host track writes if the frame buffer was allocated with
+	// VM_MAP_WRITE_WATCH, this avoids one SIGSEGV + mprotect() per page
+	mainBuffer.writeWatch = false;
+	mainBuffer.watchPages = (void **) malloc(mainBuffer.pageCount * sizeof(void *));
+	if (mainBuffer.watchPages == NULL)
+		return false;
+	if (vm_reset_write_watch((char *)mainBuffer.memStart, mainBuffer.memLength) == 0)
+		mainBuffer.writeWatch = true;
+	D(bug("VOSF uses %s to track frame buffer writes\n", mainBuffer.writeWatch ? "write-tracking" : "SIGSEGV"));
+
 	// We can now write-protect the frame buffer
-	if (vm_protect((char *)mainBuffer.memStart, mainBuffer.memLength, VM_PAGE_READ) != 0)
+	if (vosf_protect_all() != 0)
 		return false;
 	
 	// The frame buffer is sane, i.e. there is no write to it yet
@@ -347,6 +425,15 @@ static void video_vosf_exit(void)
 		free(mainBuffer.dirtyPages);
 		mainBuffer.dirtyPages = NULL;
 	}
+	if (mainBuffer.refreshPages) {
+		free(mainBuffer.refreshPages);
+		mainBuffer.refreshPages = NULL;
+	}
+	if (mainBuffer.watchPages) {
+		free(mainBuffer.watchPages);
+		mainBuffer.watchPages = NULL;
+	}
+	mainBuffer.writeWatch = false;
 }
 
 
@@ -361,8 +448,9 @@ static void vosf_do_set_dirty_area(uintptr first, uintptr last)
 	uint8 *addr = (uint8 *)(first & ~(mainBuffer.pageSize - 1));
 	for (int i = first_page; i <= last_page; i++) {
 		if (PFLAG_ISCLEAR(i)) {
+			if (!mainBuffer.writeWatch)
+				vm_protect(addr, mainBuffer.pageSize, VM_PAGE_READ | VM_PAGE_WRITE);
 			PFLAG_SET(i);
-			vm_protect(addr, mainBuffer.pageSize, VM_PAGE_READ | VM_PAGE_WRITE);
 		}
 		addr += mainBuffer.pageSize;
 	}
@@ -428,16 +516,17 @@ bool Screen_fault_handler(sigsegv_info_t *sip)
 	/* Someone attempted to write to the frame buffer. Make it writeable
 	 * now so that the data could actually be written to. It will be made
 	 * read-only back in one of the screen update_*() functions.
+	 *
+	 * No lock is taken here: the page is made writeable *before* it is
+	 * marked, so an update routine grabbing the dirty pages in between
+	 * either sees the bit and protects the page again (then the write
+	 * faults once more), or misses it and the next update will catch it.
 	 */
 	if (((uintptr)addr - mainBuffer.memStart) < mainBuffer.memLength) {
 		const int page  = ((uintptr)addr - mainBuffer.memStart) >> mainBuffer.pageBits;
-		LOCK_VOSF;
-		if (PFLAG_ISCLEAR(page)) {
-			PFLAG_SET(page);
-			vm_protect((char *)(addr & ~(mainBuffer.pageSize - 1)), mainBuffer.pageSize, VM_PAGE_READ | VM_PAGE_WRITE);
-		}
-		mainBuffer.dirty = true;
-		UNLOCK_VOSF;
+		vm_protect((char *)(addr & ~(mainBuffer.pageSize - 1)), mainBuffer.pageSize, VM_PAGE_READ | VM_PAGE_WRITE);
+		PFLAG_SET(page);
+		B2_atomic_store(&mainBuffer.dirty, true);
 		return true;
 	}
 	
@@ -450,37 +539,14 @@ bool Screen_fault_handler(sigsegv_info_t *sip)
  *	Update display for Windowed mode and VOSF
  */
 
-/*	How can we deal with array overrun conditions ?
-	
-	The state of the framebuffer pages that have been touched are maintained
-	in the dirtyPages[] table. That table is (pageCount + 2) bytes long.
-
-Terminology
-	
-	"Last Page" denotes the pageCount-nth page, i.e. dirtyPages[pageCount - 1].
-	"CLEAR Page Guard" refers to the page following the Last Page but is always
-	in the CLEAR state. "SET Page Guard" refers to the page following the CLEAR
-	Page Guard but is always in the SET state.
-
-Rough process
-	
-	The update routines must determine which pages have to be blitted to the
-	screen. This job consists in finding the first_page that was touched.
-	i.e. find the next page that is SET. Then, finding how many pages were
-	touched starting from first_page. i.e. find the next page that is CLEAR.
-
-There are two cases to check:
+/*	How are dirty pages collected ?
 
-	- Last Page is CLEAR: find_next_page_set() will reach the SET Page Guard
-	but it is beyond the valid pageCount value. Therefore, we exit from the
-	update routine.
-	
-	- Last Page is SET: first_page equals (pageCount - 1) and
-	find_next_page_clear() will reach the CLEAR Page Guard. We blit the last
-	page to the screen. On the next iteration, page equals pageCount and
-	find_next_page_set() will reach the SET Page Guard. We still safely exit
-	from the update routine because the SET Page Guard position is greater
-	than pageCount.
+	Pages are marked in the dirtyPages[] bitmap by the SIGSEGV handler or
+	by vosf_do_set_dirty_area(). The update routines first clear the dirty
+	flag, then atomically move dirtyPages[] into refreshPages[], which they
+	own, and scan it a word at a time for runs of set pages. A page written
+	to after the move is left marked for the next update, so clearing the
+	dirty flag beforehand never loses an update.
 */
 
 #ifndef TEST_VOSF_PERFORMANCE
@@ -488,6 +554,11 @@ static void update_display_window_vosf(VIDEO_DRV_WIN_INIT)
 {
 	VIDEO_MODE_INIT;
 
+	if (mainBuffer.writeWatch)
+		vosf_fetch_write_watch();
+	mainBuffer.dirty = false;
+	vosf_grab_dirty_pages();
+
 	unsigned page = 0;
 	for (;;) {
 		const unsigned first_page = find_next_page_set(page);
@@ -495,12 +566,13 @@ static void update_display_window_vosf(VIDEO_DRV_WIN_INIT)
 			break;
 
 		page = find_next_page_clear(first_page);
-		PFLAG_CLEAR_RANGE(first_page, page);
 
 		// Make the dirty pages read-only again
-		const int32 offset  = first_page << mainBuffer.pageBits;
-		const uint32 length = (page - first_page) << mainBuffer.pageBits;
-		vm_protect((char *)mainBuffer.memStart + offset, length, VM_PAGE_READ);
+		if (!mainBuffer.writeWatch) {
+			const int32 offset  = first_page << mainBuffer.pageBits;
+			const uint32 length = (page - first_page) << mainBuffer.pageBits;
+			vm_protect((char *)mainBuffer.memStart + offset, length, VM_PAGE_READ);
+		}
 		
 		// There is at least one line to update
 		const int y1 = mainBuffer.pageInfo[first_page].top;
@@ -511,16 +583,15 @@ static void update_display_window_vosf(VIDEO_DRV_WIN_INIT)
 		VIDEO_DRV_LOCK_PIXELS;
 		const int src_bytes_per_row = VIDEO_MODE_ROW_BYTES;
 		const int dst_bytes_per_row = VIDEO_DRV_ROW_BYTES;
-		int i1 = y1 * src_bytes_per_row, i2 = y1 * dst_bytes_per_row, j;
-		for (j = y1; j <= y2; j++) {
-			Screen_blit(the_host_buffer + i2, the_buffer + i1, src_bytes_per_row);
-			i1 += src_bytes_per_row;
-			i2 += dst_bytes_per_row;
-		}
+		Screen_blit_rows(the_host_buffer + y1 * dst_bytes_per_row, dst_bytes_per_row,
+						 the_buffer + y1 * src_bytes_per_row, src_bytes_per_row,
+						 src_bytes_per_row, height);
 		VIDEO_DRV_UNLOCK_PIXELS;
 
 #ifdef USE_SDL_VIDEO
 		update_sdl_video(drv->s, 0, y1, VIDEO_MODE_X, height);
+#elif defined(USE_HEADLESS_VIDEO)
+		update_headless_video(y1, height);
 #else
 		if (VIDEO_DRV_HAVE_SHM)
 			XShmPutImage(x_display, VIDEO_DRV_WINDOW, VIDEO_DRV_GC, VIDEO_DRV_IMAGE, 0, y1, 0, y1, VIDEO_MODE_X, height, 0);
@@ -528,7 +599,6 @@ static void update_display_window_vosf(VIDEO_DRV_WIN_INIT)
 			XPutImage(x_display, VIDEO_DRV_WINDOW, VIDEO_DRV_GC, VIDEO_DRV_IMAGE, 0, y1, 0, y1, VIDEO_MODE_X, height);
 #endif
 	}
-	mainBuffer.dirty = false;
 }
 #endif
 
@@ -551,10 +621,13 @@ static void update_display_dga_vosf(VIDEO_DRV_DGA_INIT)
 	assert(dst_bytes_per_row <= scr_bytes_per_row);
 	const int scr_bytes_left = scr_bytes_per_row - dst_bytes_per_row;
 
+	if (mainBuffer.writeWatch)
+		vosf_fetch_write_watch();
+
 	// Full screen update requested?
 	if (mainBuffer.very_dirty) {
 		PFLAG_CLEAR_ALL;
-		vm_protect((char *)mainBuffer.memStart, mainBuffer.memLength, VM_PAGE_READ);
+		vosf_protect_all();
 		memcpy(the_buffer_copy, the_buffer, VIDEO_MODE_ROW_BYTES * VIDEO_MODE_Y);
 		VIDEO_DRV_LOCK_PIXELS;
 		int i1 = 0, i2 = 0;
@@ -565,6 +638,8 @@ static void update_display_dga_vosf(VIDEO_DRV_DGA_INIT)
 		}
 #ifdef USE_SDL_VIDEO
 		update_sdl_video(drv->s, 0, 0, VIDEO_MODE_X, VIDEO_MODE_Y);
+#elif defined(USE_HEADLESS_VIDEO)
+		update_headless_video(0, VIDEO_MODE_Y);
 #endif
 		VIDEO_DRV_UNLOCK_PIXELS;
 		return;
@@ -573,12 +648,17 @@ static void update_display_dga_vosf(VIDEO_DRV_DGA_INIT)
 	// Setup partial blitter (use 64-pixel wide chunks)
 	const uint32 n_pixels = 64;
 	const uint32 n_chunks = VIDEO_MODE_X / n_pixels;
+#ifdef USE_SDL_VIDEO
 	const uint32 n_pixels_left = VIDEO_MODE_X - (n_chunks * n_pixels);
+#endif
 	const uint32 src_chunk_size = src_bytes_per_row / n_chunks;
 	const uint32 dst_chunk_size = dst_bytes_per_row / n_chunks;
 	const uint32 src_chunk_size_left = src_bytes_per_row - (n_chunks * src_chunk_size);
 	const uint32 dst_chunk_size_left = dst_bytes_per_row - (n_chunks * dst_chunk_size);
 
+	mainBuffer.dirty = false;
+	vosf_grab_dirty_pages();
+
 	unsigned page = 0;
 	uint32 last_scanline = uint32(-1);
 	for (;;) {
@@ -587,12 +667,13 @@ static void update_display_dga_vosf(VIDEO_DRV_DGA_INIT)
 			break;
 
 		page = find_next_page_clear(first_page);
-		PFLAG_CLEAR_RANGE(first_page, page);
 
 		// Make the dirty pages read-only again
-		const int32 offset  = first_page << mainBuffer.pageBits;
-		const uint32 length = (page - first_page) << mainBuffer.pageBits;
-		vm_protect((char *)mainBuffer.memStart + offset, length, VM_PAGE_READ);
+		if (!mainBuffer.writeWatch) {
+			const int32 offset  = first_page << mainBuffer.pageBits;
+			const uint32 length = (page - first_page) << mainBuffer.pageBits;
+			vm_protect((char *)mainBuffer.memStart + offset, length, VM_PAGE_READ);
+		}
 
 		// Optimized for scanlines, don't process overlapping lines again
 		uint32 y1 = mainBuffer.pageInfo[first_page].top;
@@ -671,10 +752,11 @@ static void update_display_dga_vosf(VIDEO_DRV_DGA_INIT)
 		}
 #ifdef USE_SDL_VIDEO
 		update_sdl_video(drv->s, bbi, bb);
+#elif defined(USE_HEADLESS_VIDEO)
+		update_headless_video(y1, y2 - y1 + 1);
 #endif
 		VIDEO_DRV_UNLOCK_PIXELS;
 	}
-	mainBuffer.dirty = false;
 }
 #endif
 #endif
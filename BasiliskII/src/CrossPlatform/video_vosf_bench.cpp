@@ -0,0 +1,157 @@
+/*
+ *  video_vosf_bench.cpp - Cost of the VOSF dirty page scan
+ *
+ *  Basilisk II (C) 1997-2008 Christian Bauer
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/*
+ *  Marks a share of the frame buffer pages dirty, then collects them the
+ *  way the VOSF update routines do: grab the dirty bitmap and walk it for
+ *  runs of dirty pages. The same pages are also collected with the former
+ *  one-byte-per-page table, which serves as the reference for the runs
+ *  found in the bitmap.
+ */
+
+#include "sysdeps.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "video.h"
+#include "video_blit.h"
+
+#define TEST_VOSF_PERFORMANCE 1
+
+// Glue for video_vosf.h
+static uint8 *the_buffer;
+static uint32 the_buffer_size;
+static int32 frame_skip;
+static struct {
+	video_mode mode;
+	const video_mode &get_current_mode() const { return mode; }
+} monitor;
+uint64 GetTicks_usec(void) { return 0; }
+
+#define DEBUG 0
+#include "debug.h"
+#include "video_vosf.h"
+
+// The byte-per-page table used before the bitmap. It ends with four set
+// guard pages, so that the search for a set page always stops, then four
+// clear ones for the search for a clear page
+static char *byte_pages;
+
+static unsigned byte_find_next_set(unsigned page)
+{
+	while (*(uint32 *)(byte_pages + page) == 0x01010101)
+		page += 4;
+	while (byte_pages[page] != 0)
+		page++;
+	return page;
+}
+
+static unsigned byte_find_next_clear(unsigned page)
+{
+	while (*(uint32 *)(byte_pages + page) == 0)
+		page += 4;
+	while (byte_pages[page] == 0)
+		page++;
+	return page;
+}
+
+static double usec(const struct timeval &start, const struct timeval &end)
+{
+	return (end.tv_sec - start.tv_sec) * 1e6 + (end.tv_usec - start.tv_usec);
+}
+
+int main(int argc, char **argv)
+{
+	const uint32 n_pages = argc > 1 ? atoi(argv[1]) : 2048;
+	const int rounds = 2000;
+
+	mainBuffer.pageCount = n_pages;
+	mainBuffer.pageWords = (n_pages + PFLAG_WORD_BITS - 1) / PFLAG_WORD_BITS;
+	mainBuffer.dirtyPages = (uintptr *)calloc(mainBuffer.pageWords, sizeof(uintptr));
+	mainBuffer.refreshPages = (uintptr *)calloc(mainBuffer.pageWords, sizeof(uintptr));
+	byte_pages = (char *)malloc(n_pages + 8);
+	unsigned *runs = (unsigned *)malloc((n_pages + 2) * sizeof(unsigned));
+	bool *dirty = (bool *)malloc(n_pages);
+
+	static const int percents[] = { 0, 1, 10, 50, 90, 100 };
+	printf("%u pages, %d rounds\n", n_pages, rounds);
+	for (unsigned p = 0; p < sizeof(percents) / sizeof(percents[0]); p++) {
+		srand(1);
+		for (uint32 i = 0; i < n_pages; i++)
+			dirty[i] = (unsigned)rand() % 100 < (unsigned)percents[p];
+
+		double bitmap_usec = 0, byte_usec = 0;
+		unsigned n_runs = 0;
+		for (int r = 0; r < rounds; r++) {
+			for (uint32 i = 0; i < n_pages; i++) {
+				if (dirty[i])
+					PFLAG_SET(i);
+			}
+			struct timeval start, end;
+			gettimeofday(&start, NULL);
+			vosf_grab_dirty_pages();
+			unsigned n = 0;
+			for (unsigned page = 0; page < n_pages; ) {
+				const unsigned first_page = find_next_page_set(page);
+				if (first_page >= n_pages)
+					break;
+				page = find_next_page_clear(first_page);
+				runs[n++] = first_page;
+				runs[n++] = page;
+			}
+			gettimeofday(&end, NULL);
+			bitmap_usec += usec(start, end);
+
+			for (uint32 i = 0; i < n_pages; i++)
+				byte_pages[i] = dirty[i] ? 0 : 1;
+			memset(byte_pages + n_pages, 0, 4);
+			memset(byte_pages + n_pages + 4, 1, 4);
+			gettimeofday(&start, NULL);
+			unsigned m = 0;
+			for (unsigned page = 0; page < n_pages; ) {
+				const unsigned first_page = byte_find_next_set(page);
+				if (first_page >= n_pages)
+					break;
+				page = byte_find_next_clear(first_page);
+				if (page > n_pages)
+					page = n_pages;
+				memset(byte_pages + first_page, 1, page - first_page);
+				if (m + 1 >= n || runs[m] != first_page || runs[m + 1] != page) {
+					printf("%d%% dirty: runs differ at %u\n", percents[p], first_page);
+					return 1;
+				}
+				m += 2;
+			}
+			gettimeofday(&end, NULL);
+			byte_usec += usec(start, end);
+			if (m != n) {
+				printf("%d%% dirty: %u runs expected, %u found\n", percents[p], m / 2, n / 2);
+				return 1;
+			}
+			n_runs = n / 2;
+		}
+		printf("%3d%% dirty: %5u runs, bitmap %6.2f usec, byte table %6.2f usec per refresh\n",
+		       percents[p], n_runs, bitmap_usec / rounds, byte_usec / rounds);
+	}
+	return 0;
+}
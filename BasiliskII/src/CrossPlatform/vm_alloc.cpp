@@ -43,6 +43,86 @@
 #include <sys/utsname.h>
 #endif
 
+/* On Linux, write-tracking is implemented with userfaultfd() in
+   asynchronous write-protect mode: the kernel resolves the write
+   faults by itself (no SIGSEGV is delivered) and PAGEMAP_SCAN reports
+   then re-protects the pages that were written to.  */
+#if defined(HAVE_VM_WRITE_WATCH) && defined(HAVE_MMAP_VM) && defined(__linux__)
+#define HAVE_LINUX_WRITE_WATCH 1
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/userfaultfd.h>
+
+/* Definitions from Linux 6.7 that may be missing in older headers.  */
+#ifndef UFFD_FEATURE_WP_UNPOPULATED
+#define UFFD_FEATURE_WP_UNPOPULATED		(1<<13)
+#endif
+#ifndef UFFD_FEATURE_WP_ASYNC
+#define UFFD_FEATURE_WP_ASYNC			(1<<15)
+#endif
+#ifndef UFFD_USER_MODE_ONLY
+#define UFFD_USER_MODE_ONLY				1
+#endif
+#ifndef PAGEMAP_SCAN
+struct page_region {
+	__u64 start;
+	__u64 end;
+	__u64 categories;
+};
+
+struct pm_scan_arg {
+	__u64 size;
+	__u64 flags;
+	__u64 start;
+	__u64 end;
+	__u64 walk_end;
+	__u64 vec;
+	__u64 vec_len;
+	__u64 max_pages;
+	__u64 category_inverted;
+	__u64 category_mask;
+	__u64 category_anyof_mask;
+	__u64 return_mask;
+};
+
+#define PM_SCAN_WP_MATCHING				(1 << 0)
+#define PM_SCAN_CHECK_WPASYNC			(1 << 1)
+#define PAGE_IS_WRITTEN					(1 << 1)
+#define PAGEMAP_SCAN					_IOWR('f', 16, struct pm_scan_arg)
+#endif
+
+static int uffd_fd = -1;				// userfaultfd() descriptor, shared by all write-watched areas
+static int pagemap_fd = -1;				// /proc/self/pagemap, target of PAGEMAP_SCAN requests
+#endif
+
+/* On Linux, large areas can be backed by huge pages to save TLB misses:
+   either pages from the hugetlbfs pool, which the administrator has to
+   reserve, or transparent huge pages that the kernel assembles itself.
+   hugetlbfs mappings are made of whole huge pages, so their actual size
+   is remembered for vm_protect() and vm_release().  */
+#if defined(HAVE_MMAP_VM) && defined(__linux__)
+#define HAVE_LINUX_HUGE_PAGES 1
+#include <sched.h>
+#include <sys/syscall.h>
+
+#ifndef MAP_HUGETLB
+#define MAP_HUGETLB						0x40000
+#endif
+#ifndef MADV_HUGEPAGE
+#define MADV_HUGEPAGE					14
+#endif
+#ifndef MPOL_BIND
+#define MPOL_BIND						2
+#endif
+
+struct hugetlb_area {
+	char *addr;
+	size_t size;
+};
+static hugetlb_area hugetlb_areas[8];	// hugetlbfs mappings, size 0 if unused
+static size_t huge_page_size = 0;		// Size of hugetlbfs pages
+#endif
+
 #ifdef HAVE_MACH_VM
 #ifndef HAVE_MACH_TASK_SELF
 #ifdef HAVE_TASK_SELF
@@ -179,6 +259,72 @@ static int vm_error(kern_return_t ret_code)
 }
 #endif
 
+/* Huge page helpers.  */
+
+#ifdef HAVE_LINUX_HUGE_PAGES
+static size_t get_huge_page_size(void)
+{
+	if (huge_page_size == 0) {
+		huge_page_size = 2 * 1024 * 1024;
+		FILE *f = fopen("/proc/meminfo", "r");
+		if (f) {
+			char line[128];
+			unsigned long kb;
+			while (fgets(line, sizeof(line), f)) {
+				if (sscanf(line, "Hugepagesize: %lu kB", &kb) == 1) {
+					huge_page_size = kb * 1024;
+					break;
+				}
+			}
+			fclose(f);
+		}
+	}
+	return huge_page_size;
+}
+
+static hugetlb_area *find_hugetlb_area(void * addr)
+{
+	for (unsigned int i = 0; i < sizeof(hugetlb_areas) / sizeof(hugetlb_areas[0]); i++) {
+		hugetlb_area *area = &hugetlb_areas[i];
+		if (area->size && (char *)addr >= area->addr && (char *)addr < area->addr + area->size)
+			return area;
+	}
+	return NULL;
+}
+
+/* Map SIZE bytes from the hugetlbfs pool at ADDR, returns MAP_FAILED if
+   the pool has not got enough pages.  */
+static void * map_hugetlb(void * addr, size_t size, int flags)
+{
+	const size_t page_size = get_huge_page_size();
+	if ((flags & MAP_FIXED) && ((vm_uintptr_t)addr & (page_size - 1)))
+		return MAP_FAILED;
+
+	hugetlb_area *area = NULL;
+	for (unsigned int i = 0; i < sizeof(hugetlb_areas) / sizeof(hugetlb_areas[0]) && area == NULL; i++) {
+		if (hugetlb_areas[i].size == 0)
+			area = &hugetlb_areas[i];
+	}
+	if (area == NULL)
+		return MAP_FAILED;
+
+	size = (size + page_size - 1) & ~(page_size - 1);
+	void * ret = mmap((caddr_t)addr, size, VM_PAGE_DEFAULT, flags | MAP_HUGETLB, -1, 0);
+	if (ret != MAP_FAILED) {
+		area->addr = (char *)ret;
+		area->size = size;
+	}
+	return ret;
+}
+
+/* Ask for transparent huge pages, unless the area already has huge pages.  */
+static void advise_huge_pages(void * addr, size_t size, int options)
+{
+	if ((options & (VM_MAP_HUGEPAGES | VM_MAP_HUGETLB)) && find_hugetlb_area(addr) == NULL)
+		madvise(addr, size, MADV_HUGEPAGE);
+}
+#endif
+
 /* Initialize the VM system. Returns 0 if successful, -1 for errors.  */
 
 int vm_init(void)
@@ -220,8 +366,60 @@ void vm_exit(void)
 	}
 #endif
 #endif
+
+#ifdef HAVE_LINUX_WRITE_WATCH
+	if (pagemap_fd != -1) {
+		close(pagemap_fd);
+		pagemap_fd = -1;
+	}
+	if (uffd_fd != -1) {
+		close(uffd_fd);
+		uffd_fd = -1;
+	}
+#endif
 }
 
+/* Register the region [ ADDR, ADDR + SIZE [ for write-tracking. The
+   userfaultfd is opened on first use so that kernels without support
+   for asynchronous write-protection only fail VM_MAP_WRITE_WATCH
+   requests. Returns 0 if successful, -1 for errors.  */
+
+#ifdef HAVE_LINUX_WRITE_WATCH
+static int vm_init_write_watch(void * addr, size_t size)
+{
+	if (uffd_fd < 0) {
+		int fd = syscall(__NR_userfaultfd, O_CLOEXEC | O_NONBLOCK | UFFD_USER_MODE_ONLY);
+		if (fd < 0)
+			return -1;
+
+		struct uffdio_api api;
+		memset(&api, 0, sizeof(api));
+		api.api = UFFD_API;
+		api.features = UFFD_FEATURE_WP_ASYNC | UFFD_FEATURE_WP_UNPOPULATED;
+		if (ioctl(fd, UFFDIO_API, &api) < 0) {
+			close(fd);
+			return -1;
+		}
+
+		if ((pagemap_fd = open("/proc/self/pagemap", O_RDONLY | O_CLOEXEC)) < 0) {
+			close(fd);
+			return -1;
+		}
+		uffd_fd = fd;
+	}
+
+	struct uffdio_register reg;
+	memset(&reg, 0, sizeof(reg));
+	reg.range.start = (vm_uintptr_t)addr;
+	reg.range.len = size;
+	reg.mode = UFFDIO_REGISTER_MODE_WP;
+	if (ioctl(uffd_fd, UFFDIO_REGISTER, &reg) < 0)
+		return -1;
+
+	return vm_reset_write_watch(addr, size);
+}
+#endif
+
 /* Allocate zero-filled memory of SIZE bytes. The mapping is private
    and default protection bits are read / write. The return value
    is the actual mapping address chosen or VM_MAP_FAILED for errors.  */
@@ -252,7 +450,14 @@ void * vm_acquire(size_t size, int options)
 	int fd = zero_fd;
 	int the_map_flags = translate_map_flags(options) | map_flags;
 
-	if ((addr = mmap((caddr_t)next_address, size, VM_PAGE_DEFAULT, the_map_flags, fd, 0)) == (void *)MAP_FAILED)
+	addr = (void *)MAP_FAILED;
+#ifdef HAVE_LINUX_HUGE_PAGES
+	if (options & VM_MAP_WRITE_WATCH)
+		options &= ~(VM_MAP_HUGEPAGES | VM_MAP_HUGETLB);
+	if (options & VM_MAP_HUGETLB)
+		addr = map_hugetlb(next_address, size, the_map_flags);
+#endif
+	if (addr == (void *)MAP_FAILED && (addr = mmap((caddr_t)next_address, size, VM_PAGE_DEFAULT, the_map_flags, fd, 0)) == (void *)MAP_FAILED)
 		return VM_MAP_FAILED;
 	
 	// Sanity checks for 64-bit platforms
@@ -260,6 +465,17 @@ void * vm_acquire(size_t size, int options)
 		return VM_MAP_FAILED;
 
 	next_address = (char *)addr + size;
+
+#ifdef HAVE_LINUX_HUGE_PAGES
+	advise_huge_pages(addr, size, options);
+#endif
+
+#ifdef HAVE_LINUX_WRITE_WATCH
+	if ((options & VM_MAP_WRITE_WATCH) && vm_init_write_watch(addr, size) < 0) {
+		munmap((caddr_t)addr, size);
+		return VM_MAP_FAILED;
+	}
+#endif
 #elif defined(HAVE_WIN32_VM)
 	int alloc_type = MEM_RESERVE | MEM_COMMIT;
 	if (options & VM_MAP_WRITE_WATCH)
@@ -310,8 +526,26 @@ int vm_acquire_fixed(void * addr, size_t size, int options)
 	int fd = zero_fd;
 	int the_map_flags = translate_map_flags(options) | map_flags | MAP_FIXED;
 
-	if (mmap((caddr_t)addr, size, VM_PAGE_DEFAULT, the_map_flags, fd, 0) == (void *)MAP_FAILED)
+	void * ret = (void *)MAP_FAILED;
+#ifdef HAVE_LINUX_HUGE_PAGES
+	if (options & VM_MAP_WRITE_WATCH)
+		options &= ~(VM_MAP_HUGEPAGES | VM_MAP_HUGETLB);
+	if (options & VM_MAP_HUGETLB)
+		ret = map_hugetlb(addr, size, the_map_flags);
+#endif
+	if (ret == (void *)MAP_FAILED && mmap((caddr_t)addr, size, VM_PAGE_DEFAULT, the_map_flags, fd, 0) == (void *)MAP_FAILED)
+		return -1;
+
+#ifdef HAVE_LINUX_HUGE_PAGES
+	advise_huge_pages(addr, size, options);
+#endif
+
+#ifdef HAVE_LINUX_WRITE_WATCH
+	if ((options & VM_MAP_WRITE_WATCH) && vm_init_write_watch(addr, size) < 0) {
+		munmap((caddr_t)addr, size);
 		return -1;
+	}
+#endif
 #elif defined(HAVE_WIN32_VM)
 	// Windows cannot allocate Low Memory
 	if (addr == NULL)
@@ -354,6 +588,13 @@ int vm_release(void * addr, size_t size)
 		return -1;
 #else
 #ifdef HAVE_MMAP_VM
+#ifdef HAVE_LINUX_HUGE_PAGES
+	hugetlb_area *area = find_hugetlb_area(addr);
+	if (area && area->addr == (char *)addr) {
+		size = area->size;
+		area->size = 0;
+	}
+#endif
 	if (munmap((caddr_t)addr, size) != 0)
 		return -1;
 #else
@@ -379,6 +620,22 @@ int vm_protect(void * addr, size_t size, int prot)
 	return ret_code == KERN_SUCCESS ? 0 : -1;
 #else
 #ifdef HAVE_MMAP_VM
+#ifdef HAVE_LINUX_HUGE_PAGES
+	// hugetlbfs pages can only be protected as a whole, so refuse ranges
+	// that would change the protection of bytes outside of them; the end
+	// of the area may be given unrounded, as the rest is padding
+	hugetlb_area *area = find_hugetlb_area(addr);
+	if (area) {
+		const vm_uintptr_t page_mask = get_huge_page_size() - 1;
+		vm_uintptr_t end = (vm_uintptr_t)addr + size;
+		if (((vm_uintptr_t)addr & page_mask)
+		 || ((end & page_mask) && ((end + page_mask) & ~page_mask) != (vm_uintptr_t)area->addr + area->size)) {
+			errno = EINVAL;
+			return -1;
+		}
+		size = ((end + page_mask) & ~page_mask) - (vm_uintptr_t)addr;
+	}
+#endif
 	int ret_code = mprotect((caddr_t)addr, size, prot);
 	return ret_code == 0 ? 0 : -1;
 #else
@@ -417,6 +674,50 @@ int vm_get_write_watch(void * addr, size_t size,
 	*n_pages = count;
 	return 0;
 #endif
+#ifdef HAVE_LINUX_WRITE_WATCH
+	if (pagemap_fd < 0)
+		return -1;
+
+	const vm_uintptr_t page_size = vm_get_page_size();
+	const unsigned int max_pages = *n_pages;
+	unsigned int count = 0;
+
+	// Written pages are reported as ranges, expand them into PAGES[]
+	struct page_region regions[64];
+	vm_uintptr_t start = (vm_uintptr_t)addr;
+	const vm_uintptr_t end = start + size;
+	while (start < end && count < max_pages) {
+		struct pm_scan_arg arg;
+		memset(&arg, 0, sizeof(arg));
+		arg.size = sizeof(arg);
+		arg.flags = PM_SCAN_CHECK_WPASYNC;
+		if (options & VM_WRITE_WATCH_RESET)
+			arg.flags |= PM_SCAN_WP_MATCHING;
+		arg.start = start;
+		arg.end = end;
+		arg.vec = (vm_uintptr_t)regions;
+		arg.vec_len = sizeof(regions) / sizeof(regions[0]);
+		arg.max_pages = max_pages - count;
+		arg.category_mask = PAGE_IS_WRITTEN;
+		arg.return_mask = PAGE_IS_WRITTEN;
+
+		int n_regions = ioctl(pagemap_fd, PAGEMAP_SCAN, &arg);
+		if (n_regions < 0)
+			return -1;
+
+		for (int i = 0; i < n_regions; i++) {
+			for (vm_uintptr_t page = regions[i].start; page < regions[i].end && count < max_pages; page += page_size)
+				pages[count++] = (void *)page;
+		}
+
+		if (arg.walk_end <= start)
+			break;
+		start = arg.walk_end;
+	}
+
+	*n_pages = count;
+	return 0;
+#endif
 #endif
 	// Unsupported
 	return -1;
@@ -432,6 +733,18 @@ int vm_reset_write_watch(void * addr, size_t size)
 	int ret_code = ResetWriteWatch(addr, size);
 	return ret_code == 0 ? 0 : -1;
 #endif
+#ifdef HAVE_LINUX_WRITE_WATCH
+	if (uffd_fd < 0)
+		return -1;
+
+	struct uffdio_writeprotect wp;
+	memset(&wp, 0, sizeof(wp));
+	wp.range.start = (vm_uintptr_t)addr;
+	wp.range.len = size;
+	wp.mode = UFFDIO_WRITEPROTECT_MODE_WP;
+	int ret_code = ioctl(uffd_fd, UFFDIO_WRITEPROTECT, &wp);
+	return ret_code == 0 ? 0 : -1;
+#endif
 #endif
 	// Unsupported
 	return -1;
@@ -454,6 +767,62 @@ int vm_get_page_size(void)
 #endif
 }
 
+/* Translate a huge page setting to VM_MAP_* options.  */
+
+int vm_huge_page_options(const char * mode)
+{
+	if (mode && strcmp(mode, "hugetlb") == 0)
+		return VM_MAP_HUGETLB;
+	if (mode && strcmp(mode, "thp") == 0)
+		return VM_MAP_HUGEPAGES;
+	return 0;
+}
+
+/* Bind memory and CPUs to a NUMA node, like "numactl --membind=NODE
+   --cpunodebind=NODE" does.  */
+
+int vm_bind_numa_node(int node)
+{
+#if defined(HAVE_LINUX_HUGE_PAGES) && defined(__NR_set_mempolicy)
+	const int max_nodes = 1024;
+	if (node < 0 || node >= max_nodes) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	// Run on the CPUs of the node, its "cpulist" looks like "0-3,8-11"
+	char path[64];
+	sprintf(path, "/sys/devices/system/node/node%d/cpulist", node);
+	FILE *f = fopen(path, "r");
+	if (f == NULL)
+		return -1;
+	cpu_set_t cpus;
+	CPU_ZERO(&cpus);
+	int first, last;
+	while (fscanf(f, "%d", &first) == 1) {
+		last = first;
+		if (fscanf(f, "-%d", &last) < 0)
+			break;
+		for (int cpu = first; cpu <= last && cpu < CPU_SETSIZE; cpu++)
+			CPU_SET(cpu, &cpus);
+		if (fgetc(f) != ',')
+			break;
+	}
+	fclose(f);
+	if (CPU_COUNT(&cpus) == 0 || sched_setaffinity(0, sizeof(cpus), &cpus) < 0)
+		return -1;
+
+	// Allocate memory from the node only
+	unsigned long nodes[max_nodes / (8 * sizeof(unsigned long))];
+	memset(nodes, 0, sizeof(nodes));
+	nodes[node / (8 * sizeof(unsigned long))] = 1UL << (node % (8 * sizeof(unsigned long)));
+	return syscall(__NR_set_mempolicy, MPOL_BIND, nodes, max_nodes + 1) == 0 ? 0 : -1;
+#else
+	// Unsupported
+	return -1;
+#endif
+}
+
 #ifdef CONFIGURE_TEST_VM_WRITE_WATCH
 int main(void)
 {
@@ -583,3 +952,242 @@ int main(void)
 #endif
 }
 #endif
+
+#ifdef VM_HUGE_PAGES_BENCHMARK
+/* Random access over RAM-sized areas with normal pages, transparent huge
+   pages and hugetlbfs pages. Accesses form one random cycle through the
+   area, so each load depends on the previous one like pointer chasing
+   in the emulated Mac does.  */
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+#ifdef __linux__
+#include <sys/ioctl.h>
+#include <linux/perf_event.h>
+#endif
+
+static volatile unsigned int sink;
+
+static int open_dtlb_counter(void)
+{
+#if defined(__linux__) && defined(__NR_perf_event_open)
+	struct perf_event_attr attr;
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = PERF_TYPE_HW_CACHE;
+	attr.config = PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	return syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+#else
+	return -1;
+#endif
+}
+
+// Size of the area backed by huge pages, according to /proc/self/smaps
+static unsigned long huge_kb(void * addr)
+{
+	unsigned long kb = 0;
+	FILE *f = fopen("/proc/self/smaps", "r");
+	if (f == NULL)
+		return 0;
+	char line[256];
+	bool in_area = false;
+	while (fgets(line, sizeof(line), f)) {
+		unsigned long start, end, n;
+		if (sscanf(line, "%lx-%lx ", &start, &end) == 2)
+			in_area = (vm_uintptr_t)addr >= start && (vm_uintptr_t)addr < end;
+		else if (in_area && (sscanf(line, "AnonHugePages: %lu kB", &n) == 1 || sscanf(line, "Private_Hugetlb: %lu kB", &n) == 1))
+			kb += n;
+	}
+	fclose(f);
+	return kb;
+}
+
+int main(int argc, char **argv)
+{
+	const size_t size = (argc > 1 ? atoi(argv[1]) : 256) << 20;
+	const size_t steps = 20000000;
+	vm_init();
+
+	static const struct {
+		const char *name;
+		int options;
+	} modes[] = {
+		{"4K pages", VM_MAP_DEFAULT},
+		{"thp", VM_MAP_DEFAULT | VM_MAP_HUGEPAGES},
+		{"hugetlb", VM_MAP_DEFAULT | VM_MAP_HUGETLB},
+	};
+	for (unsigned int m = 0; m < sizeof(modes) / sizeof(modes[0]); m++) {
+		unsigned int *area = (unsigned int *)vm_acquire(size, modes[m].options);
+		if (area == VM_MAP_FAILED) {
+			printf("%-9s cannot allocate %lu MB\n", modes[m].name, (unsigned long)(size >> 20));
+			continue;
+		}
+
+		// Link one word per 64-byte line into a random cycle
+		const unsigned int lines = size / 64;
+		unsigned int *order = (unsigned int *)malloc(lines * sizeof(unsigned int));
+		for (unsigned int i = 0; i < lines; i++)
+			order[i] = i;
+		srand(1);
+		for (unsigned int i = lines - 1; i > 0; i--) {
+			unsigned int j = ((unsigned int)rand() * (RAND_MAX + 1U) + rand()) % (i + 1);
+			unsigned int t = order[i]; order[i] = order[j]; order[j] = t;
+		}
+		for (unsigned int i = 0; i < lines; i++)
+			area[order[i] * 16] = order[(i + 1) % lines] * 16;
+		free(order);
+
+		int counter = open_dtlb_counter();
+		unsigned long long misses = 0;
+		struct timeval start, end;
+		gettimeofday(&start, NULL);
+		if (counter >= 0)
+			ioctl(counter, PERF_EVENT_IOC_RESET, 0), ioctl(counter, PERF_EVENT_IOC_ENABLE, 0);
+		unsigned int i = 0;
+		for (size_t s = 0; s < steps; s++)
+			i = area[i];
+		if (counter >= 0) {
+			ioctl(counter, PERF_EVENT_IOC_DISABLE, 0);
+			if (read(counter, &misses, sizeof(misses)) != sizeof(misses))
+				misses = 0;
+			close(counter);
+		}
+		gettimeofday(&end, NULL);
+		double ns = ((end.tv_sec - start.tv_sec) * 1e6 + (end.tv_usec - start.tv_usec)) * 1000.0 / steps;
+		sink = i;
+		unsigned long huge_mb = huge_kb(area) >> 10;
+		bool from_pool = find_hugetlb_area(area) != NULL;
+
+		// Partial protection can't work on hugetlbfs pages (and splits
+		// transparent huge pages, so check it after measuring)
+		bool partial_protect = vm_protect((char *)area + 4096, 4096, VM_PAGE_READ) == 0;
+
+		printf("%-9s %4lu MB huge: %5.1f ns/access", modes[m].name, huge_mb, ns);
+		if (counter >= 0)
+			printf(", %.3f dTLB misses/access", (double)misses / steps);
+		else
+			printf(", dTLB counter unavailable");
+		printf(", 4K vm_protect %s%s\n", partial_protect ? "works" : "refused",
+		       (modes[m].options & VM_MAP_HUGETLB) && !from_pool ? " (pool too small, fell back to thp)" : "");
+		vm_release(area, size);
+	}
+	return 0;
+}
+#endif
+
+#ifdef VM_WRITE_WATCH_BENCHMARK
+/* Frame buffer write tracking as VOSF does it: write to a share of the
+   pages, then find the dirty pages and re-arm tracking for the next
+   frame. Compares the SIGSEGV scheme (read-only pages, one fault and one
+   mprotect() per dirtied page) with vm_get_write_watch().  */
+#include <stdio.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <sys/time.h>
+
+static char *bench_area;
+static size_t bench_size;
+static unsigned char *bench_dirty;
+static unsigned long bench_faults;
+
+static void bench_fault_handler(int sig, siginfo_t *sip, void *)
+{
+	const vm_uintptr_t page_size = vm_get_page_size();
+	char *page = (char *)((vm_uintptr_t)sip->si_addr & -page_size);
+	if (page < bench_area || page >= bench_area + bench_size)
+		abort();
+	bench_dirty[(page - bench_area) / page_size] = 1;
+	bench_faults++;
+	vm_protect(page, page_size, VM_PAGE_READ | VM_PAGE_WRITE);
+}
+
+static double bench_usec(const struct timeval &start, const struct timeval &end)
+{
+	return (end.tv_sec - start.tv_sec) * 1e6 + (end.tv_usec - start.tv_usec);
+}
+
+int main(int argc, char **argv)
+{
+	bench_size = (size_t)(argc > 1 ? atoi(argv[1]) : 8) << 20;
+	const int frames = 200;
+	vm_init();
+
+	const vm_uintptr_t page_size = vm_get_page_size();
+	const unsigned int n_pages = bench_size / page_size;
+	bench_dirty = (unsigned char *)calloc(n_pages, 1);
+	void **pages = (void **)malloc(n_pages * sizeof(void *));
+	unsigned int *order = (unsigned int *)malloc(n_pages * sizeof(unsigned int));
+
+	struct sigaction sa;
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_sigaction = bench_fault_handler;
+	sa.sa_flags = SA_SIGINFO;
+	sigaction(SIGSEGV, &sa, NULL);
+
+	static const int percents[] = { 1, 10, 50, 100 };
+	printf("%u pages of %lu bytes, %d frames\n", n_pages, (unsigned long)page_size, frames);
+	for (int watch = 0; watch < 2; watch++) {
+		const int options = VM_MAP_DEFAULT | (watch ? VM_MAP_WRITE_WATCH : 0);
+		if ((bench_area = (char *)vm_acquire(bench_size, options)) == VM_MAP_FAILED) {
+			printf("%-11s unavailable\n", watch ? "write watch" : "SIGSEGV");
+			continue;
+		}
+		memset(bench_area, 0, bench_size);
+		if (watch)
+			vm_reset_write_watch(bench_area, bench_size);
+		else
+			vm_protect(bench_area, bench_size, VM_PAGE_READ);
+
+		for (unsigned int p = 0; p < sizeof(percents) / sizeof(percents[0]); p++) {
+			const unsigned int n_written = n_pages * percents[p] / 100;
+			unsigned long found = 0;
+			bench_faults = 0;
+			srand(1);
+			double write_usec = 0, scan_usec = 0;
+			for (int f = 0; f < frames; f++) {
+				for (unsigned int i = 0; i < n_pages; i++)
+					order[i] = i;
+				for (unsigned int i = 0; i < n_written; i++) {
+					unsigned int j = i + rand() % (n_pages - i);
+					unsigned int t = order[i]; order[i] = order[j]; order[j] = t;
+				}
+
+				struct timeval start, mid, end;
+				gettimeofday(&start, NULL);
+				for (unsigned int i = 0; i < n_written; i++)
+					bench_area[order[i] * page_size + (f & 63)] = f;
+				gettimeofday(&mid, NULL);
+				if (watch) {
+					unsigned int n = n_pages;
+					if (vm_get_write_watch(bench_area, bench_size, pages, &n, VM_WRITE_WATCH_RESET) < 0)
+						return 1;
+					found += n;
+				} else {
+					for (unsigned int i = 0; i < n_pages; i++) {
+						if (bench_dirty[i]) {
+							bench_dirty[i] = 0;
+							found++;
+						}
+					}
+					vm_protect(bench_area, bench_size, VM_PAGE_READ);
+				}
+				gettimeofday(&end, NULL);
+				write_usec += bench_usec(start, mid);
+				scan_usec += bench_usec(mid, end);
+			}
+			if (found != (unsigned long)n_written * frames) {
+				printf("%s: found %lu dirty pages, expected %lu\n", watch ? "write watch" : "SIGSEGV",
+				       found, (unsigned long)n_written * frames);
+				return 1;
+			}
+			printf("%-11s %3d%% dirty: %8.1f faults/frame, writes %8.1f usec/frame, scan+re-arm %7.1f usec/frame\n",
+			       watch ? "write watch" : "SIGSEGV", percents[p], (double)bench_faults / frames,
+			       write_usec / frames, scan_usec / frames);
+		}
+		vm_release(bench_area, bench_size);
+	}
+	return 0;
+}
+#endif
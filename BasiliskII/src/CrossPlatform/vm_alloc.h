@@ -58,6 +58,15 @@ extern "C" {
 #define VM_MAP_FIXED			0x04
 #define VM_MAP_32BIT			0x08
 #define VM_MAP_WRITE_WATCH		0x10
+#define VM_MAP_HUGEPAGES		0x20
+#define VM_MAP_HUGETLB			0x40
+
+/* VM_MAP_HUGEPAGES asks for transparent huge pages, VM_MAP_HUGETLB for
+   pages from the hugetlbfs pool and falls back to VM_MAP_HUGEPAGES if
+   the pool is too small. Both are hints, ignored where unsupported and
+   for VM_MAP_WRITE_WATCH areas. Page-granular vm_protect() and mmap()
+   still work on VM_MAP_HUGEPAGES areas; on VM_MAP_HUGETLB ones,
+   vm_protect() fails unless the range covers whole huge pages.  */
 
 /* Default mapping options.  */
 #define VM_MAP_DEFAULT			(VM_MAP_PRIVATE)
@@ -131,4 +140,15 @@ extern int vm_reset_write_watch(void * addr, size_t size);
 
 extern int vm_get_page_size(void);
 
+/* Bind the memory allocated from now on, and the CPUs that the calling
+   thread and threads created later run on, to NUMA node NODE. Returns
+   0 if successful, -1 for errors or if unsupported.  */
+
+extern int vm_bind_numa_node(int node);
+
+/* Translate a huge page setting ("thp", "hugetlb" or anything else for
+   normal pages) to VM_MAP_* options.  */
+
+extern int vm_huge_page_options(const char * mode);
+
 #endif /* VM_ALLOC_H */
@@ -52,6 +52,7 @@ using std::string;
 #include "main.h"
 #include "vm_alloc.h"
 #include "sigsegv.h"
+#include "startup.h"
 
 #if USE_JIT
 extern void flush_icache_range(uint8 *start, uint32 size); // from compemu_support.cpp
@@ -696,6 +697,9 @@ void ClearInterruptFlag(uint32 flag)
 
 void ErrorAlert(const char *text)
 {
+	if (StartupDeferAlert(text, true))
+		return;
+
 	NSString *title  = [NSString stringWithCString:
 						GetString(STR_ERROR_ALERT_TITLE) ];
 	NSString *error  = [NSString stringWithCString: text];
@@ -715,6 +719,9 @@ void ErrorAlert(const char *text)
 
 void WarningAlert(const char *text)
 {
+	if (StartupDeferAlert(text, false))
+		return;
+
 	NSString *title   = [NSString stringWithCString:
 							GetString(STR_WARNING_ALERT_TITLE) ];
 	NSString *warning = [NSString stringWithCString: text];
@@ -25,8 +25,9 @@
 #include "user_strings.h"
 #include "audio.h"
 #include "audio_defs.h"
+#include "audio_ring.h"
+#include "audio_convert.h"
 
-#include <SDL_mutex.h>
 #include <SDL_audio.h>
 #include <SDL_version.h>
 
@@ -46,7 +47,10 @@ static int audio_sample_size_index = 0;
 static int audio_channel_count_index = 0;
 
 // Global variables
-static SDL_sem *audio_irq_done_sem = NULL;			// Signal from interrupt to streaming thread: data block read
+static audio_ring audio_buffer;						// Data delivered by the Mac ahead of the streaming callback
+static audio_converter audio_conv;					// Mac format -> device format
+static std::vector<uint8> audio_conv_buf;			// Converted data of one block
+static SDL_AudioSpec audio_spec;					// Format of the opened device
 static uint8 silence_byte;							// Byte value to use to fill sound buffers with silence
 static uint8 *audio_mix_buf = NULL;
 static int audio_volume = SDL_MIX_MAXVOLUME;
@@ -68,6 +72,26 @@ static void set_audio_status_format(void)
 	AudioStatus.channels = audio_channel_counts[audio_channel_count_index];
 }
 
+// Set up conversion from the current Mac format to the device format
+static void init_audio_conversion(void)
+{
+	set_audio_status_format();
+	audio_conv.init(AudioStatus.sample_rate >> 16, AudioStatus.sample_size, AudioStatus.channels,
+		audio_spec.freq, audio_spec.format == AUDIO_S16SYS ? audio_converter::OUT_S16 : audio_converter::OUT_F32, audio_spec.channels);
+	audio_frames_per_block = audio_conv.in_frames(audio_spec.samples);
+	D(bug("audio: %d Hz/%d bit/%d ch -> %d Hz, %d frames per block\n", AudioStatus.sample_rate >> 16, AudioStatus.sample_size, AudioStatus.channels, audio_spec.freq, audio_frames_per_block));
+}
+
+// Check whether we can convert to the given device format
+static bool audio_format_supported(const SDL_AudioSpec &spec)
+{
+#ifdef AUDIO_F32SYS
+	if (spec.format == AUDIO_F32SYS)
+		return spec.channels == 1 || spec.channels == 2;
+#endif
+	return spec.format == AUDIO_S16SYS && (spec.channels == 1 || spec.channels == 2);
+}
+
 // Init SDL audio system
 static bool open_sdl_audio(void)
 {
@@ -87,21 +111,31 @@ static bool open_sdl_audio(void)
 		audio_channel_count_index = audio_channel_counts.size() - 1;
 	}
 
-	SDL_AudioSpec audio_spec;
-	memset(&audio_spec, 0, sizeof(audio_spec));
-	audio_spec.freq = audio_sample_rates[audio_sample_rate_index] >> 16;
-	audio_spec.format = (audio_sample_sizes[audio_sample_size_index] == 8) ? AUDIO_U8 : AUDIO_S16MSB;
-	audio_spec.channels = audio_channel_counts[audio_channel_count_index];
-	audio_spec.samples = 4096;
-	audio_spec.callback = stream_func;
-	audio_spec.userdata = NULL;
-
-	// Open the audio device, forcing the desired format
-	if (SDL_OpenAudio(&audio_spec, NULL) < 0) {
+	// The Mac format is converted in AudioInterrupt(), so let the device
+	// run at whatever rate and format it prefers as long as we can produce it
+	SDL_AudioSpec desired;
+	memset(&desired, 0, sizeof(desired));
+	desired.freq = 44100;
+	desired.format = AUDIO_S16SYS;
+	desired.channels = 2;
+	desired.samples = 4096;
+	desired.callback = stream_func;
+	desired.userdata = NULL;
+
+	// Open the audio device, forcing our format if the native one is unusable
+	if (SDL_OpenAudio(&desired, &audio_spec) < 0) {
 		fprintf(stderr, "WARNING: Cannot open audio: %s\n", SDL_GetError());
 		return false;
 	}
-	
+	if (!audio_format_supported(audio_spec)) {
+		SDL_CloseAudio();
+		audio_spec = desired;
+		if (SDL_OpenAudio(&audio_spec, NULL) < 0) {
+			fprintf(stderr, "WARNING: Cannot open audio: %s\n", SDL_GetError());
+			return false;
+		}
+	}
+
 #if SDL_VERSION_ATLEAST(2,0,0)
 	// HACK: workaround a bug in SDL pre-2.0.6 (reported via https://bugzilla.libsdl.org/show_bug.cgi?id=3710 )
 	// whereby SDL does not update audio_spec.size
@@ -121,13 +155,13 @@ static bool open_sdl_audio(void)
 	char driver_name[32];
 	SDL_AudioDriverName(driver_name, sizeof(driver_name) - 1);
 #endif
-	printf("Using SDL/%s audio output\n", driver_name ? driver_name : "");
+	printf("Using SDL/%s audio output (%d Hz, %d channels)\n", driver_name ? driver_name : "", audio_spec.freq, audio_spec.channels);
 	silence_byte = audio_spec.silence;
-	SDL_PauseAudio(0);
 
-	// Sound buffer size = 4096 frames
-	audio_frames_per_block = audio_spec.samples;
+	// Sound buffer size = one device buffer, the Mac block covers the same time
 	audio_mix_buf = (uint8*)malloc(audio_spec.size);
+	audio_buffer.init(audio_spec.size, audio_latency_blocks(audio_spec.samples, audio_spec.freq));
+	SDL_PauseAudio(0);
 	return true;
 }
 
@@ -140,7 +174,7 @@ static bool open_audio(void)
 	}
 
 	// Device opened, set AudioStatus
-	set_audio_status_format();
+	init_audio_conversion();
 
 	// Everything went fine
 	audio_open = true;
@@ -161,9 +195,6 @@ void AudioInit(void)
 	if (PrefsFindBool("nosound"))
 		return;
 
-	// Init semaphore
-	audio_irq_done_sem = SDL_CreateSemaphore(0);
-
 	// Open and initialize audio device
 	open_audio();
 }
@@ -186,10 +217,7 @@ void AudioExit(void)
 {
 	// Close audio device
 	close_audio();
-
-	// Delete semaphore
-	if (audio_irq_done_sem)
-		SDL_DestroySemaphore(audio_irq_done_sem);
+	D(bug("audio: %u underruns, %u overruns, latency target %u bytes\n", audio_buffer.underrun_count(), audio_buffer.overrun_count(), audio_buffer.target_bytes()));
 }
 
 
@@ -217,39 +245,26 @@ void audio_exit_stream()
 
 static void stream_func(void *arg, uint8 *stream, int stream_len)
 {
+	memset(stream, silence_byte, stream_len);
 	if (AudioStatus.num_sources) {
-		// Trigger audio interrupt to get new buffer
-		D(bug("stream: triggering irq\n"));
-		SetInterruptFlag(INTFLAG_AUDIO);
-		TriggerInterrupt();
-		D(bug("stream: waiting for ack\n"));
-		SDL_SemWait(audio_irq_done_sem);
-		D(bug("stream: ack received\n"));
-
-		// Get size of audio data
-		uint32 apple_stream_info = ReadMacInt32(audio_data + adatStreamInfo);
-		if (apple_stream_info && !audio_mute) {
-			int work_size = ReadMacInt32(apple_stream_info + scd_sampleCount) * (AudioStatus.sample_size >> 3) * AudioStatus.channels;
-			D(bug("stream: work_size %d\n", work_size));
-			if (work_size > stream_len)
-				work_size = stream_len;
-			if (work_size == 0)
-				goto silence;
-
-			// Send data to audio device
-			Mac2Host_memcpy(audio_mix_buf, ReadMacInt32(apple_stream_info + scd_buffer), work_size);
-			memset((uint8 *)stream, silence_byte, stream_len);
-			SDL_MixAudio(stream, audio_mix_buf, work_size, audio_volume);
 
-			D(bug("stream: data written\n"));
+		// Play what the Mac delivered so far, never wait for it
+		uint32 work_size = audio_buffer.read(audio_mix_buf, stream_len);
+		D(bug("stream: work_size %d\n", work_size));
+		if (work_size && !audio_mute)
+			SDL_MixAudio(stream, audio_mix_buf, work_size, audio_volume);
 
-		} else
-			goto silence;
+		// Trigger audio interrupt to get new data
+		if (audio_buffer.wants_data() && audio_buffer.request_irq()) {
+			D(bug("stream: triggering irq\n"));
+			SetInterruptFlag(INTFLAG_AUDIO);
+			TriggerInterrupt();
+		}
 
 	} else {
 
 		// Audio not active, play silence
-silence: memset(stream, silence_byte, stream_len);
+		audio_buffer.flush();
 	}
 #if defined(BINCUE)
 	MixAudio_bincue(stream, stream_len);
@@ -275,8 +290,26 @@ void AudioInterrupt(void)
 	} else
 		WriteMacInt32(audio_data + adatStreamInfo, 0);
 
-	// Signal stream function
-	SDL_SemPost(audio_irq_done_sem);
+	// Convert to device format and queue data for the stream function
+	uint32 work_size = 0;
+	uint32 apple_stream_info = ReadMacInt32(audio_data + adatStreamInfo);
+	if (apple_stream_info) {
+		uint32 sample_count = ReadMacInt32(apple_stream_info + scd_sampleCount);
+		if (sample_count) {
+			audio_conv_buf.clear();
+			audio_conv.convert(Mac2HostAddr(ReadMacInt32(apple_stream_info + scd_buffer)), sample_count, audio_conv_buf);
+			work_size = audio_conv_buf.size();
+			if (work_size)
+				audio_buffer.write(&audio_conv_buf[0], work_size);
+		}
+	}
+
+	// Keep filling ahead while the Mac delivers data
+	if (work_size && AudioStatus.num_sources && audio_buffer.wants_data()) {
+		SetInterruptFlag(INTFLAG_AUDIO);
+		TriggerInterrupt();
+	} else
+		audio_buffer.irq_done();
 	D(bug("AudioInterrupt done\n"));
 }
 
@@ -289,23 +322,26 @@ void AudioInterrupt(void)
 
 bool audio_set_sample_rate(int index)
 {
-	close_audio();
 	audio_sample_rate_index = index;
-	return open_audio();
+	if (audio_open)
+		init_audio_conversion();
+	return audio_open;
 }
 
 bool audio_set_sample_size(int index)
 {
-	close_audio();
 	audio_sample_size_index = index;
-	return open_audio();
+	if (audio_open)
+		init_audio_conversion();
+	return audio_open;
 }
 
 bool audio_set_channels(int index)
 {
-	close_audio();
 	audio_channel_count_index = index;
-	return open_audio();
+	if (audio_open)
+		init_audio_conversion();
+	return audio_open;
 }
 
 
@@ -202,13 +202,17 @@ static void *vm_acquire_framebuffer(uint32 size)
 	// always try to reallocate framebuffer at the same address
 	static void *fb = VM_MAP_FAILED;
 	if (fb != VM_MAP_FAILED) {
-		if (vm_acquire_fixed(fb, size) < 0) {
+		if (vm_acquire_fixed(fb, size, VM_MAP_DEFAULT | VM_MAP_WRITE_WATCH) < 0 &&
+			vm_acquire_fixed(fb, size) < 0) {
 #ifndef SHEEPSHAVER
 			printf("FATAL: Could not reallocate framebuffer at previous address\n");
 #endif
 			fb = VM_MAP_FAILED;
 		}
 	}
+	// prefer host write-tracking over SIGSEGV for VOSF, if available
+	if (fb == VM_MAP_FAILED)
+		fb = vm_acquire(size, VM_MAP_DEFAULT | VM_MAP_32BIT | VM_MAP_WRITE_WATCH);
 	if (fb == VM_MAP_FAILED)
 		fb = vm_acquire(size, VM_MAP_DEFAULT | VM_MAP_32BIT);
 	return fb;
@@ -971,6 +975,7 @@ bool VideoInit(bool classic)
 #ifdef ENABLE_VOSF
 	// Zero the mainBuffer structure
 	mainBuffer.dirtyPages = NULL;
+	mainBuffer.refreshPages = NULL;
 	mainBuffer.pageInfo = NULL;
 #endif
 
@@ -1208,6 +1213,9 @@ void VideoExit(void)
 	for (i = VideoMonitors.begin(); i != end; ++i)
 		dynamic_cast<SDL_monitor_desc *>(*i)->video_close();
 
+	// Stop the blitter threads
+	Screen_blitter_exit();
+
 	// Destroy locks
 	if (frame_buffer_lock)
 		SDL_DestroyMutex(frame_buffer_lock);
@@ -1939,12 +1947,9 @@ static void update_display_static(driver_base *drv)
 				// Blit to screen surface
 				int si = y1 * src_bytes_per_row + (x1 / pixels_per_byte);
 				int di = y1 * dst_bytes_per_row + x1;
-				for (uint32 j = y1; j <= y2; j++) {
-					memcpy(the_buffer_copy + si, the_buffer + si, wide / pixels_per_byte);
-					Screen_blit((uint8 *)drv->s->pixels + di, the_buffer + si, wide / pixels_per_byte);
-					si += src_bytes_per_row;
-					di += dst_bytes_per_row;
-				}
+				Screen_blit_rows((uint8 *)drv->s->pixels + di, dst_bytes_per_row,
+								 the_buffer + si, src_bytes_per_row,
+								 wide / pixels_per_byte, high, the_buffer_copy + si);
 
 				// Unlock surface, if required
 				if (SDL_MUSTLOCK(drv->s))
@@ -1995,12 +2000,11 @@ static void update_display_static(driver_base *drv)
 					SDL_LockSurface(drv->s);
 
 				// Blit to screen surface
-				for (uint32 j = y1; j <= y2; j++) {
-					uint32 i = j * bytes_per_row + x1 * bytes_per_pixel;
-					int dst_i = j * dst_bytes_per_row + x1 * bytes_per_pixel;
-					memcpy(the_buffer_copy + i, the_buffer + i, bytes_per_pixel * wide);
-					Screen_blit((uint8 *)drv->s->pixels + dst_i, the_buffer + i, bytes_per_pixel * wide);
-				}
+				uint32 i = y1 * bytes_per_row + x1 * bytes_per_pixel;
+				int dst_i = y1 * dst_bytes_per_row + x1 * bytes_per_pixel;
+				Screen_blit_rows((uint8 *)drv->s->pixels + dst_i, dst_bytes_per_row,
+								 the_buffer + i, bytes_per_row,
+								 bytes_per_pixel * wide, high, the_buffer_copy + i);
 
 				// Unlock surface, if required
 				if (SDL_MUSTLOCK(drv->s))
@@ -2134,7 +2138,7 @@ static void video_refresh_dga_vosf(void)
 	static uint32 tick_counter = 0;
 	if (++tick_counter >= frame_skip) {
 		tick_counter = 0;
-		if (mainBuffer.dirty) {
+		if (video_vosf_dirty()) {
 			LOCK_VOSF;
 			update_display_dga_vosf(drv);
 			UNLOCK_VOSF;
@@ -2152,7 +2156,7 @@ static void video_refresh_window_vosf(void)
 	static uint32 tick_counter = 0;
 	if (++tick_counter >= frame_skip) {
 		tick_counter = 0;
-		if (mainBuffer.dirty) {
+		if (video_vosf_dirty()) {
 			LOCK_VOSF;
 			update_display_window_vosf(drv);
 			UNLOCK_VOSF;
@@ -2271,7 +2275,6 @@ static int redraw_func(void *arg)
  *  Record dirty area from NQD
  */
 
-#ifdef SHEEPSHAVER
 void video_set_dirty_area(int x, int y, int w, int h)
 {
 #ifdef ENABLE_VOSF
@@ -2288,6 +2291,15 @@ void video_set_dirty_area(int x, int y, int w, int h)
 
 	// XXX handle dirty bounding boxes for non-VOSF modes
 }
-#endif
+
+
+/*
+ *  Align 60Hz tick to the host's vertical blank (not supported, the tick runs freely)
+ */
+
+uint64 VideoAlignTick(uint64 next)
+{
+	return next;
+}
 
 #endif	// ends: SDL version check
@@ -64,6 +64,7 @@
 #include "video_defs.h"
 #include "video_blit.h"
 #include "vm_alloc.h"
+#include "atomic_ops.h"
 
 #define DEBUG 0
 #include "debug.h"
@@ -113,6 +114,7 @@ static SDL_Thread *redraw_thread = NULL;			// Redraw thread
 static volatile bool thread_stop_req = false;
 static volatile bool thread_stop_ack = false;		// Acknowledge for thread_stop_req
 #endif
+static SDL_sem *frame_done_sem = NULL;				// Posted when the Mac completed a frame (VBL)
 
 #ifdef ENABLE_VOSF
 static bool use_vosf = false;						// Flag: VOSF enabled
@@ -147,6 +149,7 @@ static SDL_Palette *sdl_palette = NULL;				// Color palette to be used as CLUT a
 static bool sdl_palette_changed = false;			// Flag: Palette changed, redraw thread must set new colors
 static bool toggle_fullscreen = false;
 static bool did_add_event_watch = false;
+static bool use_vsync = false;						// Flag: renderer presents in sync with the host display
 
 static bool mouse_grabbed = false;
 
@@ -173,6 +176,8 @@ static void (*video_refresh)(void);
 // Prototypes
 static int redraw_func(void *arg);
 static int present_sdl_video();
+static void frame_presented(void);
+static void vsync_init(void);
 static int SDLCALL on_sdl_event_generated(void *userdata, SDL_Event * event);
 static bool is_fullscreen(SDL_Window *);
 
@@ -215,13 +220,17 @@ static void *vm_acquire_framebuffer(uint32 size)
 	// always try to reallocate framebuffer at the same address
 	static void *fb = VM_MAP_FAILED;
 	if (fb != VM_MAP_FAILED) {
-		if (vm_acquire_fixed(fb, size) < 0) {
+		if (vm_acquire_fixed(fb, size, VM_MAP_DEFAULT | VM_MAP_WRITE_WATCH) < 0 &&
+			vm_acquire_fixed(fb, size) < 0) {
 #ifndef SHEEPSHAVER
 			printf("FATAL: Could not reallocate framebuffer at previous address\n");
 #endif
 			fb = VM_MAP_FAILED;
 		}
 	}
+	// prefer host write-tracking over SIGSEGV for VOSF, if available
+	if (fb == VM_MAP_FAILED)
+		fb = vm_acquire(size, VM_MAP_DEFAULT | VM_MAP_32BIT | VM_MAP_WRITE_WATCH);
 	if (fb == VM_MAP_FAILED)
 		fb = vm_acquire(size, VM_MAP_DEFAULT | VM_MAP_32BIT);
 	return fb;
@@ -765,7 +774,8 @@ static SDL_Surface * init_sdl_video(int width, int height, int bpp, Uint32 flags
 #else
 		SDL_SetHint(SDL_HINT_RENDER_DRIVER, "");
 #endif
-		sdl_renderer = SDL_CreateRenderer(sdl_window, -1, 0);
+		vsync_init();
+		sdl_renderer = SDL_CreateRenderer(sdl_window, -1, use_vsync ? SDL_RENDERER_PRESENTVSYNC : 0);
 		if (!sdl_renderer) {
 			shutdown_sdl_video();
 			return NULL;
@@ -851,9 +861,142 @@ static SDL_Surface * init_sdl_video(int width, int height, int bpp, Uint32 flags
     return guest_surface;
 }
 
+/*
+ *  Frame pacing
+ *
+ *  The redraw thread refreshes guest_surface right after the Mac completed
+ *  a frame (VideoInterrupt()/VideoVBL()), and the result is presented at
+ *  the next VBL, only if something changed. With the "vsync" prefs item
+ *  the renderer waits for the host's vertical blank and the 60Hz tick is
+ *  pulled towards it (VideoAlignTick()) so that the wait stays short.
+ */
+
+const int VIDEO_REFRESH_HZ = 60;
+const int VIDEO_REFRESH_DELAY = 1000000 / VIDEO_REFRESH_HZ;
+const int VSYNC_LEAD = 1500;						// Time between 60Hz tick and vertical blank to aim at (usec)
+const int MAX_AUTO_FRAME_SKIP = 8;
+
+static uint64 vsync_time = 0;						// Time of last vertical blank (usec), 0 = unknown
+static uint32 vsync_period;							// Host refresh period (usec)
+
+static uint32 frame_skip_auto = 1;					// Current frame skip if the "frameskip" prefs item is 0
+static uint32 refresh_cost = 0;						// Average time of a display refresh (usec)
+static bool frame_refreshed = false;				// Flag: refresh function updated the display
+
+// Frame time statistics, in ms
+static const uint32 frame_hist_limit[] = { 17, 20, 34, 50, 67, 100, 250 };
+static const int FRAME_HIST_BUCKETS = sizeof(frame_hist_limit) / sizeof(frame_hist_limit[0]) + 1;
+static uint32 frame_hist[FRAME_HIST_BUCKETS];		// Number of presented frames per frame time
+static uint32 frames_presented = 0;					// Frames presented
+static uint32 frames_unchanged = 0;					// VBLs without changes
+static uint32 frames_skipped = 0;					// Refreshes skipped by frame skip
+static uint64 last_present = 0;
+
+// Check whether the display should be refreshed in this frame
+static bool frame_due(void)
+{
+	static uint32 tick_counter = 0;
+	uint32 skip = frame_skip ? frame_skip : frame_skip_auto;
+	if (++tick_counter >= skip) {
+		tick_counter = 0;
+		frame_refreshed = true;
+		return true;
+	}
+	frames_skipped++;
+	return false;
+}
+
+// Adapt frame skip to the time a refresh takes, keeping it below half a frame
+static void frame_refresh_done(uint32 usec)
+{
+	refresh_cost = (refresh_cost * 7 + usec) / 8;
+	uint32 skip = 1 + refresh_cost / (VIDEO_REFRESH_DELAY / 2);
+	if (skip > MAX_AUTO_FRAME_SKIP)
+		skip = MAX_AUTO_FRAME_SKIP;
+	if (skip != frame_skip_auto)
+		D(bug("frame skip %d, refresh takes %d usec\n", skip, refresh_cost));
+	frame_skip_auto = skip;
+}
+
+// Decide whether to present in sync with the host display, the Mac VBL can only follow a ~60Hz display
+static void vsync_init(void)
+{
+	use_vsync = false;
+	if (!PrefsFindBool("vsync"))
+		return;
+	SDL_DisplayMode mode;
+	if (SDL_GetCurrentDisplayMode(SDL_GetWindowDisplayIndex(sdl_window), &mode) != 0 || mode.refresh_rate < 57 || mode.refresh_rate > 63) {
+		printf("WARNING: Display does not refresh at 60 Hz, not using vsync\n");
+		return;
+	}
+	use_vsync = true;
+	vsync_period = 1000000 / mode.refresh_rate;
+	B2_atomic_store(&vsync_time, (uint64)0);
+}
+
+// Frame was presented, update statistics and vertical blank estimate
+static void frame_presented(void)
+{
+	uint64 now = GetTicks_usec();
+	if (last_present) {
+		uint32 ms = (now - last_present) / 1000;
+		int i = 0;
+		while (i < FRAME_HIST_BUCKETS - 1 && ms >= frame_hist_limit[i])
+			i++;
+		frame_hist[i]++;
+	}
+	last_present = now;
+	frames_presented++;
+
+	// With vsync, SDL_RenderPresent() returns at a vertical blank
+	if (use_vsync) {
+		uint64 last = B2_atomic_load(&vsync_time);
+		if (last && now - last < 8 * vsync_period) {
+			uint32 frames = (now - last + vsync_period / 2) / vsync_period;
+			if (frames) {
+				int32 error = int32(now - last - frames * vsync_period);
+				int32 period = vsync_period + error / (16 * int32(frames));
+				if (period > 15000 && period < 17500)
+					vsync_period = period;
+			}
+		}
+		B2_atomic_store(&vsync_time, now);
+	}
+}
+
+// Print frame statistics if requested by the "framestats" prefs item
+static void print_frame_stats(void)
+{
+	if (!PrefsFindBool("framestats"))
+		return;
+	printf("SDL2 video: %u frames presented, %u unchanged, %u refreshes skipped\n", frames_presented, frames_unchanged, frames_skipped);
+	for (int i = 0; i < FRAME_HIST_BUCKETS; i++) {
+		if (i < FRAME_HIST_BUCKETS - 1)
+			printf(" < %3u ms: %u\n", frame_hist_limit[i], frame_hist[i]);
+		else
+			printf(" >= %3u ms: %u\n", frame_hist_limit[i - 1], frame_hist[i]);
+	}
+}
+
+// Move the next 60Hz tick towards VSYNC_LEAD usec before a vertical blank (called from the tick thread)
+uint64 VideoAlignTick(uint64 next)
+{
+	uint64 last = B2_atomic_load(&vsync_time);
+	uint32 period = vsync_period;
+	if (!use_vsync || last == 0 || next < last || next - last > 1000000)
+		return next;
+	uint64 n = (next - last + VSYNC_LEAD + period / 2) / period;
+	int64 error = int64(last + n * period - VSYNC_LEAD - next);
+	return next + error / 8;
+}
+
 static int present_sdl_video()
 {
-	if (SDL_RectEmpty(&sdl_update_video_rect)) return 0;
+	// Nothing changed since the last frame, don't present the same image again
+	if (SDL_RectEmpty(&sdl_update_video_rect)) {
+		frames_unchanged++;
+		return 0;
+	}
 	
 	if (!sdl_renderer || !sdl_texture || !guest_surface) {
 		printf("WARNING: A video mode does not appear to have been set.\n");
@@ -919,6 +1062,7 @@ static int present_sdl_video()
 	
     // Update the display
 	SDL_RenderPresent(sdl_renderer);
+	frame_presented();
     
     // Indicate success to the caller!
     return 0;
@@ -1298,6 +1442,7 @@ bool VideoInit(bool classic)
 #ifdef ENABLE_VOSF
 	// Zero the mainBuffer structure
 	mainBuffer.dirtyPages = NULL;
+	mainBuffer.refreshPages = NULL;
 	mainBuffer.pageInfo = NULL;
 #endif
 
@@ -1308,6 +1453,8 @@ bool VideoInit(bool classic)
 		return false;
 	if ((frame_buffer_lock = SDL_CreateMutex()) == NULL)
 		return false;
+	if ((frame_done_sem = SDL_CreateSemaphore(0)) == NULL)
+		return false;
 
 	// Init keycode translation
 	keycode_init();
@@ -1537,6 +1684,9 @@ void VideoExit(void)
 	for (i = VideoMonitors.begin(); i != end; ++i)
 		dynamic_cast<SDL_monitor_desc *>(*i)->video_close();
 
+	// Stop the blitter threads
+	Screen_blitter_exit();
+
 	// Destroy locks
 	if (frame_buffer_lock)
 		SDL_DestroyMutex(frame_buffer_lock);
@@ -1544,6 +1694,12 @@ void VideoExit(void)
 		SDL_DestroyMutex(sdl_palette_lock);
 	if (sdl_events_lock)
 		SDL_DestroyMutex(sdl_events_lock);
+	if (frame_done_sem) {
+		SDL_DestroySemaphore(frame_done_sem);
+		frame_done_sem = NULL;
+	}
+
+	print_frame_stats();
 }
 
 
@@ -1647,6 +1803,10 @@ void VideoVBL(void)
 	
 	present_sdl_video();
 
+	// Let the redraw thread pick up the frame the Mac just completed
+	if (frame_done_sem && SDL_SemValue(frame_done_sem) == 0)
+		SDL_SemPost(frame_done_sem);
+
 	// Temporarily give up frame buffer lock (this is the point where
 	// we are suspended when the user presses Ctrl-Tab)
 	UNLOCK_FRAME_BUFFER;
@@ -1671,6 +1831,10 @@ void VideoInterrupt(void)
 
 	present_sdl_video();
 
+	// Let the redraw thread pick up the frame the Mac just completed
+	if (frame_done_sem && SDL_SemValue(frame_done_sem) == 0)
+		SDL_SemPost(frame_done_sem);
+
 	// Temporarily give up frame buffer lock (this is the point where
 	// we are suspended when the user presses Ctrl-Tab)
 	UNLOCK_FRAME_BUFFER;
@@ -2248,12 +2412,9 @@ static void update_display_static(driver_base *drv)
 				// Blit to screen surface
 				int si = y1 * src_bytes_per_row + (x1 / pixels_per_byte);
 				int di = y1 * dst_bytes_per_row + x1;
-				for (uint32 j = y1; j <= y2; j++) {
-					memcpy(the_buffer_copy + si, the_buffer + si, wide / pixels_per_byte);
-					Screen_blit((uint8 *)drv->s->pixels + di, the_buffer + si, wide / pixels_per_byte);
-					si += src_bytes_per_row;
-					di += dst_bytes_per_row;
-				}
+				Screen_blit_rows((uint8 *)drv->s->pixels + di, dst_bytes_per_row,
+								 the_buffer + si, src_bytes_per_row,
+								 wide / pixels_per_byte, high, the_buffer_copy + si);
 
 				// Unlock surface, if required
 				if (SDL_MUSTLOCK(drv->s))
@@ -2304,12 +2465,11 @@ static void update_display_static(driver_base *drv)
 					SDL_LockSurface(drv->s);
 
 				// Blit to screen surface
-				for (uint32 j = y1; j <= y2; j++) {
-					uint32 i = j * bytes_per_row + x1 * bytes_per_pixel;
-					int dst_i = j * dst_bytes_per_row + x1 * bytes_per_pixel;
-					memcpy(the_buffer_copy + i, the_buffer + i, bytes_per_pixel * wide);
-					Screen_blit((uint8 *)drv->s->pixels + dst_i, the_buffer + i, bytes_per_pixel * wide);
-				}
+				uint32 i = y1 * bytes_per_row + x1 * bytes_per_pixel;
+				int dst_i = y1 * dst_bytes_per_row + x1 * bytes_per_pixel;
+				Screen_blit_rows((uint8 *)drv->s->pixels + dst_i, dst_bytes_per_row,
+								 the_buffer + i, bytes_per_row,
+								 bytes_per_pixel * wide, high, the_buffer_copy + i);
 
 				// Unlock surface, if required
 				if (SDL_MUSTLOCK(drv->s))
@@ -2440,10 +2600,8 @@ static void video_refresh_dga_vosf(void)
 	possibly_quit_dga_mode();
 	
 	// Update display (VOSF variant)
-	static uint32 tick_counter = 0;
-	if (++tick_counter >= frame_skip) {
-		tick_counter = 0;
-		if (mainBuffer.dirty) {
+	if (frame_due()) {
+		if (video_vosf_dirty()) {
 			LOCK_VOSF;
 			update_display_dga_vosf(drv);
 			UNLOCK_VOSF;
@@ -2458,10 +2616,8 @@ static void video_refresh_window_vosf(void)
 	possibly_ungrab_mouse();
 	
 	// Update display (VOSF variant)
-	static uint32 tick_counter = 0;
-	if (++tick_counter >= frame_skip) {
-		tick_counter = 0;
-		if (mainBuffer.dirty) {
+	if (frame_due()) {
+		if (video_vosf_dirty()) {
 			LOCK_VOSF;
 			update_display_window_vosf(drv);
 			UNLOCK_VOSF;
@@ -2476,9 +2632,7 @@ static void video_refresh_window_static(void)
 	possibly_ungrab_mouse();
 
 	// Update display (static variant)
-	static uint32 tick_counter = 0;
-	if (++tick_counter >= frame_skip) {
-		tick_counter = 0;
+	if (frame_due()) {
 		const VIDEO_MODE &mode = drv->mode;
 		if ((int)VIDEO_MODE_DEPTH >= VIDEO_DEPTH_8BIT)
 			update_display_static_bbox(drv);
@@ -2519,7 +2673,11 @@ static inline void do_video_refresh(void)
 	handle_events();
 
 	// Update display
+	uint64 refresh_start = GetTicks_usec();
+	frame_refreshed = false;
 	video_refresh();
+	if (frame_refreshed)
+		frame_refresh_done(GetTicks_usec() - refresh_start);
 
 
 	// Set new palette if it was changed
@@ -2538,25 +2696,17 @@ void VideoRefresh(void)
 	do_video_refresh();
 }
 
-const int VIDEO_REFRESH_HZ = 60;
-const int VIDEO_REFRESH_DELAY = 1000000 / VIDEO_REFRESH_HZ;
-
 #ifndef USE_CPU_EMUL_SERVICES
 static int redraw_func(void *arg)
 {
 	uint64 start = GetTicks_usec();
 	int64 ticks = 0;
-	uint64 next = GetTicks_usec() + VIDEO_REFRESH_DELAY;
 
 	while (!redraw_thread_cancel) {
 
-		// Wait
-		next += VIDEO_REFRESH_DELAY;
-		int32 delay = int32(next - GetTicks_usec());
-		if (delay > 0)
-			Delay_usec(delay);
-		else if (delay < -VIDEO_REFRESH_DELAY)
-			next = GetTicks_usec();
+		// Wait for the Mac to complete a frame, refresh anyway if it
+		// doesn't (e.g. while MacsBug is running)
+		SDL_SemWaitTimeout(frame_done_sem, 2 * VIDEO_REFRESH_DELAY / 1000);
 		ticks++;
 
 		// Pause if requested (during video mode switches)
@@ -2580,7 +2730,6 @@ static int redraw_func(void *arg)
  *  Record dirty area from NQD
  */
 
-#ifdef SHEEPSHAVER
 void video_set_dirty_area(int x, int y, int w, int h)
 {
 #ifdef ENABLE_VOSF
@@ -2597,6 +2746,5 @@ void video_set_dirty_area(int x, int y, int w, int h)
 
 	// XXX handle dirty bounding boxes for non-VOSF modes
 }
-#endif
 
 #endif	// ends: SDL version check
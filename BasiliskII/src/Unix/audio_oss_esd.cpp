@@ -24,7 +24,6 @@
 #include <unistd.h>
 #include <errno.h>
 #include <pthread.h>
-#include <semaphore.h>
 
 #ifdef __linux__
 #include <linux/soundcard.h>
@@ -40,6 +39,7 @@
 #include "user_strings.h"
 #include "audio.h"
 #include "audio_defs.h"
+#include "audio_ring.h"
 
 #ifdef ENABLE_ESD
 #include <esd.h>
@@ -58,8 +58,7 @@ static int audio_channel_count_index = 0;
 static bool is_dsp_audio = false;					// Flag: is DSP audio
 static int audio_fd = -1;							// fd of dsp or ESD
 static int mixer_fd = -1;							// fd of mixer
-static sem_t audio_irq_done_sem;					// Signal from interrupt to streaming thread: data block read
-static bool sem_inited = false;						// Flag: audio_irq_done_sem initialized
+static audio_ring audio_buffer;						// Data delivered by the Mac ahead of the streaming thread
 static int sound_buffer_size;						// Size of sound buffer in bytes
 static bool little_endian = false;					// Flag: DSP accepts only little-endian 16-bit sound data
 static uint8 silence_byte;							// Byte value to use to fill sound buffers with silence
@@ -265,6 +264,7 @@ static bool open_audio(void)
 dev_opened:
 	sound_buffer_size = (audio_sample_sizes[audio_sample_size_index] >> 3) * audio_channel_counts[audio_channel_count_index] * audio_frames_per_block;
 	set_audio_status_format();
+	audio_buffer.init(sound_buffer_size, audio_latency_blocks(audio_frames_per_block, AudioStatus.sample_rate >> 16));
 
 	// Start streaming thread
 	Set_pthread_attr(&stream_thread_attr, 0);
@@ -289,11 +289,6 @@ void AudioInit(void)
 	if (PrefsFindBool("nosound"))
 		return;
 
-	// Init semaphore
-	if (sem_init(&audio_irq_done_sem, 0, 0) < 0)
-		return;
-	sem_inited = true;
-
 	// Try to open the mixer device
 	const char *mixer = PrefsFindString("mixer");
 	mixer_fd = open(mixer, O_RDWR);
@@ -311,7 +306,7 @@ void AudioInit(void)
 
 static void close_audio(void)
 {
-	// Stop stream and delete semaphore
+	// Stop stream
 	if (stream_thread_active) {
 		stream_thread_cancel = true;
 #ifdef HAVE_PTHREAD_CANCEL
@@ -339,12 +334,7 @@ void AudioExit(void)
 
 	// Close audio device
 	close_audio();
-
-	// Delete semaphore
-	if (sem_inited) {
-		sem_destroy(&audio_irq_done_sem);
-		sem_inited = false;
-	}
+	D(bug("audio: %u underruns, %u overruns, latency target %u bytes\n", audio_buffer.underrun_count(), audio_buffer.overrun_count(), audio_buffer.target_bytes()));
 
 	// Close mixer device
 	if (mixer_fd >= 0) {
@@ -380,57 +370,34 @@ void audio_exit_stream()
 
 static void *stream_func(void *arg)
 {
-	int16 *silent_buffer = new int16[sound_buffer_size / 2];
-	int16 *last_buffer = new int16[sound_buffer_size / 2];
-	memset(silent_buffer, silence_byte, sound_buffer_size);
+	uint8 *buffer = new uint8[sound_buffer_size];
 
 	while (!stream_thread_cancel) {
 		if (AudioStatus.num_sources) {
 
-			// Trigger audio interrupt to get new buffer
-			D(bug("stream: triggering irq\n"));
-			SetInterruptFlag(INTFLAG_AUDIO);
-			TriggerInterrupt();
-			D(bug("stream: waiting for ack\n"));
-			sem_wait(&audio_irq_done_sem);
-			D(bug("stream: ack received\n"));
-
-			// Get size of audio data
-			uint32 apple_stream_info = ReadMacInt32(audio_data + adatStreamInfo);
-			if (apple_stream_info) {
-				int work_size = ReadMacInt32(apple_stream_info + scd_sampleCount) * (AudioStatus.sample_size >> 3) * AudioStatus.channels;
-				D(bug("stream: work_size %d\n", work_size));
-				if (work_size > sound_buffer_size)
-					work_size = sound_buffer_size;
-				if (work_size == 0)
-					goto silence;
-
-				// Send data to DSP
-				if (work_size == sound_buffer_size && !little_endian)
-					write(audio_fd, Mac2HostAddr(ReadMacInt32(apple_stream_info + scd_buffer)), sound_buffer_size);
-				else {
-					// Last buffer or little-endian DSP
-					if (little_endian) {
-						int16 *p = (int16 *)Mac2HostAddr(ReadMacInt32(apple_stream_info + scd_buffer));
-						for (int i=0; i<work_size/2; i++)
-							last_buffer[i] = ntohs(p[i]);
-					} else
-						Mac2Host_memcpy(last_buffer, ReadMacInt32(apple_stream_info + scd_buffer), work_size);
-					memset((uint8 *)last_buffer + work_size, silence_byte, sound_buffer_size - work_size);
-					write(audio_fd, last_buffer, sound_buffer_size);
-				}
-				D(bug("stream: data written\n"));
-			} else
-				goto silence;
+			// Play what the Mac delivered so far, never wait for it
+			uint32 work_size = audio_buffer.read(buffer, sound_buffer_size);
+			D(bug("stream: work_size %d\n", work_size));
+			memset(buffer + work_size, silence_byte, sound_buffer_size - work_size);
+
+			// Trigger audio interrupt to get new data
+			if (audio_buffer.wants_data() && audio_buffer.request_irq()) {
+				D(bug("stream: triggering irq\n"));
+				SetInterruptFlag(INTFLAG_AUDIO);
+				TriggerInterrupt();
+			}
 
 		} else {
 
 			// Audio not active, play silence
-silence:	write(audio_fd, silent_buffer, sound_buffer_size);
+			audio_buffer.flush();
+			memset(buffer, silence_byte, sound_buffer_size);
 		}
+
+		// Send data to DSP, this blocks until the device has room
+		write(audio_fd, buffer, sound_buffer_size);
 	}
-	delete[] silent_buffer;
-	delete[] last_buffer;
+	delete[] buffer;
 	return NULL;
 }
 
@@ -453,8 +420,21 @@ void AudioInterrupt(void)
 	} else
 		WriteMacInt32(audio_data + adatStreamInfo, 0);
 
-	// Signal stream function
-	sem_post(&audio_irq_done_sem);
+	// Queue data for the streaming thread
+	uint32 work_size = 0;
+	uint32 apple_stream_info = ReadMacInt32(audio_data + adatStreamInfo);
+	if (apple_stream_info) {
+		work_size = ReadMacInt32(apple_stream_info + scd_sampleCount) * (AudioStatus.sample_size >> 3) * AudioStatus.channels;
+		if (work_size)
+			audio_buffer.write(Mac2HostAddr(ReadMacInt32(apple_stream_info + scd_buffer)), work_size, little_endian && AudioStatus.sample_size == 16);
+	}
+
+	// Keep filling ahead while the Mac delivers data
+	if (work_size && AudioStatus.num_sources && audio_buffer.wants_data()) {
+		SetInterruptFlag(INTFLAG_AUDIO);
+		TriggerInterrupt();
+	} else
+		audio_buffer.irq_done();
 	D(bug("AudioInterrupt done\n"));
 }
 
@@ -0,0 +1,106 @@
+#!/bin/sh
+# Run benchmark scripts (see bench_unix.cpp) in one or more Basilisk II
+# builds, keep the JSON results and print the mean time of each phase.
+#
+# Every run starts from the same disks: the disks of the prefs file get a
+# fresh "diskoverlay" directory, and with -x the ExtFS folder is copied
+# from a template, so scenarios that write files see the same state each
+# time. Build the binaries with --enable-headless-video to run them
+# without a display.
+#
+# Usage: bench.sh [-n runs] [-o resultdir] [-x extfsdir] prefs script|dir binary...
+#   -n   runs per binary and script (default 3)
+#   -o   directory for the JSON results (default ./bench-results)
+#   -x   ExtFS template folder
+# If a directory is given instead of a script, all *.bench files in it are run.
+
+RUNS=3
+OUT=./bench-results
+EXTFS=
+
+while getopts n:o:x: opt; do
+	case $opt in
+	n) RUNS=$OPTARG ;;
+	o) OUT=$OPTARG ;;
+	x) EXTFS=$OPTARG ;;
+	*) exit 2 ;;
+	esac
+done
+shift $((OPTIND - 1))
+
+if [ $# -lt 3 ]; then
+	echo "Usage: bench.sh [-n runs] [-o resultdir] [-x extfsdir] prefs script|dir binary..." >&2
+	exit 2
+fi
+PREFS=$1
+if [ -d "$2" ]; then
+	SCRIPTS=`ls "$2"/*.bench`
+else
+	SCRIPTS=$2
+fi
+shift 2
+
+mkdir -p "$OUT" || exit 1
+WORK=`mktemp -d /tmp/bench.XXXXXX` || exit 1
+trap 'rm -rf "$WORK"' EXIT INT TERM
+
+# "name<tab>wall_ms<tab>timed_out" for each phase of a result file
+phases() {
+	sed -n 's/^{"name": "\([^"]*\)", "wall_ms": \([0-9.]*\),.*"timed_out": \([a-z]*\)}.*/\1	\2	\3/p' "$1"
+}
+
+for script in $SCRIPTS; do
+	name=`basename "$script" .bench`
+	j=1
+	for bin in "$@"; do
+		i=1
+		while [ $i -le $RUNS ]; do
+			result=$OUT/$name-b$j-$i.json
+			rm -rf "$WORK/overlay" "$WORK/extfs" "$result"
+			mkdir "$WORK/overlay"
+			if [ -n "$EXTFS" ]; then
+				cp -a "$EXTFS" "$WORK/extfs"
+			fi
+			echo "$name: `basename $bin` (b$j) run $i"
+			if [ -n "$EXTFS" ]; then
+				"$bin" --config "$PREFS" --diskoverlay "$WORK/overlay" --extfs "$WORK/extfs" \
+					--benchscript "$script" --benchresult "$result" > "$OUT/$name-b$j-$i.log" 2>&1
+			else
+				"$bin" --config "$PREFS" --diskoverlay "$WORK/overlay" \
+					--benchscript "$script" --benchresult "$result" > "$OUT/$name-b$j-$i.log" 2>&1
+			fi
+			if [ ! -f "$result" ]; then
+				echo "no result, see $OUT/$name-b$j-$i.log" >&2
+			fi
+			i=$((i + 1))
+		done
+		j=$((j + 1))
+	done
+
+	# Mean wall time of each phase in ms, "*" if a run timed out
+	echo
+	echo "$name (mean ms over $RUNS runs)"
+	j=1
+	for bin in "$@"; do
+		for f in "$OUT"/$name-b$j-*.json; do
+			[ -f "$f" ] && phases "$f" | sed "s/^/b$j	/"
+		done
+		j=$((j + 1))
+	done | awk -F'	' -v nbin=$# '
+		!(($2) in seen) { seen[$2] = 1; order[n++] = $2 }
+		{ sum[$1, $2] += $3; cnt[$1, $2]++; if ($4 == "true") slow[$1, $2] = "*" }
+		END {
+			printf "%-20s", "phase"
+			for (b = 1; b <= nbin; b++) printf " %12s", "b" b
+			printf "\n"
+			for (i = 0; i < n; i++) {
+				printf "%-20s", order[i]
+				for (b = 1; b <= nbin; b++) {
+					k = "b" b SUBSEP order[i]
+					if (cnt[k]) printf " %11.1f%1s", sum[k] / cnt[k], slow[k]; else printf " %12s", "-"
+				}
+				printf "\n"
+			}
+		}'
+	echo
+done
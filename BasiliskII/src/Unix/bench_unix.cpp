@@ -0,0 +1,924 @@
+/*
+ *  bench_unix.cpp - Scripted guest benchmarks, Unix specific stuff
+ *
+ *  Basilisk II (C) 1997-2008 Christian Bauer
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/*
+ *  A benchmark script drives the Mac with mouse and keyboard input from
+ *  its own thread, the same way the video drivers feed host input to the
+ *  ADB code. It is split into named phases; for each phase the wall time,
+ *  the time the Mac spent idle, the 68k instructions executed (interpreter
+ *  only), the JIT compiler statistics and the disk and ExtFS I/O are
+ *  written to a JSON file when the emulator quits.
+ *
+ *  Script commands, one per line, "#" starts a comment line:
+ *    phase <name>                  end the current phase and start a new one
+ *    idle [<settle> [<timeout>]]   wait until the Mac has been idle for <settle>
+ *                                  seconds (default 2), give up after <timeout>
+ *                                  seconds (default 300)
+ *    sleep <seconds>
+ *    move <x> <y>                  move mouse to screen position
+ *    click [<x> <y>]
+ *    doubleclick [<x> <y>]
+ *    drag <x1> <y1> <x2> <y2>
+ *    key <keys>                    press a key with modifiers, e.g. "cmd-w", "return"
+ *    type <text>                   type text (US keyboard layout)
+ *    repeat <n> ... end            run the enclosed commands n times
+ *    quit                          quit the emulator
+ *
+ *  A phase that ends right after "idle" ends when the Mac became idle, so
+ *  the settle time isn't counted.
+ */
+
+#include "sysdeps.h"
+
+#if SUPPORTS_BENCH
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <pthread.h>
+#include <string>
+#include <vector>
+
+#include "cpu_emulation.h"
+#include "main.h"
+#include "prefs.h"
+#include "adb.h"
+#include "replay.h"
+#include "version.h"
+#include "bench.h"
+
+#define DEBUG 0
+#include "debug.h"
+
+#if USE_JIT
+extern int compiled_block_count, soft_flush_count, hard_flush_count, checksum_count;	// from compemu_support.cpp
+#endif
+
+
+// Script commands
+enum {
+	CMD_PHASE,
+	CMD_IDLE,
+	CMD_SLEEP,
+	CMD_MOVE,
+	CMD_CLICK,
+	CMD_DOUBLECLICK,
+	CMD_DRAG,
+	CMD_KEY,
+	CMD_TYPE,
+	CMD_REPEAT,
+	CMD_END,
+	CMD_QUIT
+};
+
+struct bench_cmd {
+	int op;
+	int line;				// Line number in script file
+	int nargs;
+	double arg[4];
+	std::string text;		// Phase name or text to type
+	std::vector<int> keys;	// CMD_KEY, modifiers followed by the key
+	size_t match;			// CMD_REPEAT: index of its CMD_END, and vice versa
+};
+
+// Counters at one point in time
+struct bench_sample {
+	uint64 time;			// usec
+	uint64 idle;			// usec spent in idle_wait()
+	uint64 instructions;
+	uint64 jit_blocks, jit_soft_flushes, jit_hard_flushes, jit_checksums;
+	uint64 io_calls[BENCH_NUM_IO];
+	uint64 io_bytes[BENCH_NUM_IO];
+};
+
+struct bench_phase {
+	std::string name;
+	bench_sample start, end;
+	bool timed_out;
+};
+
+const uint64 INPUT_DELAY = 50000;		// usec between injected input events, so the Mac sees each of them
+const uint64 IDLE_POLL = 100000;		// usec between idle checks
+const int IDLE_PERCENT = 90;			// The Mac is idle if it spends this much time in idle_wait()
+
+
+// Global variables
+bool BenchRunning = false;
+bool BenchCounting = false;
+uint64 BenchIOCalls[BENCH_NUM_IO];
+uint64 BenchIOBytes[BENCH_NUM_IO];
+
+static const char *script_path;
+static std::vector<bench_cmd> script;
+static std::vector<bench_phase> phases;
+static bool phase_open = false;				// Last entry of phases is still running
+static bool at_idle = false;				// Last command was a successful "idle"
+static bench_sample idle_sample;			// Counters when the Mac became idle
+
+static pthread_t script_thread;
+static pthread_attr_t script_thread_attr;
+static bool script_thread_active = false;
+static volatile bool script_cancel = false;	// Flag: stop script thread
+static volatile bool quit_requested = false;	// Flag: script wants the emulator to quit
+
+static volatile uint64 idle_total = 0;		// usec spent in idle_wait()
+static volatile uint64 idle_start = 0;		// Start of current idle_wait(), or 0
+
+
+/*
+ *  Key codes for US keyboard layout
+ */
+
+// Characters typed without shift, indexed by key code (\1 = no character)
+static const char key_chars[] = "asdfhgzxcv" "\1" "bqweryt123465=97-80]ou[ip" "\1" "lj'k;\\,/nm." "\1" " `";
+
+// Characters typed with shift, and the same keys without shift
+static const char shift_chars[] = "!@#$%^&*()_+{}|:\"<>?~";
+static const char unshift_chars[] = "1234567890-=[]\\;',./`";
+
+static const struct {
+	const char *name;
+	int code;
+} key_names[] = {
+	{"return", 0x24}, {"enter", 0x4c}, {"tab", 0x30}, {"space", 0x31}, {"delete", 0x33}, {"backspace", 0x33},
+	{"escape", 0x35}, {"esc", 0x35}, {"left", 0x3b}, {"right", 0x3c}, {"down", 0x3d}, {"up", 0x3e},
+	{"home", 0x73}, {"end", 0x77}, {"pageup", 0x74}, {"pagedown", 0x79},
+	{"f1", 0x7a}, {"f2", 0x78}, {"f3", 0x63}, {"f4", 0x76}, {"f5", 0x60}, {"f6", 0x61},
+	{"f7", 0x62}, {"f8", 0x64}, {"f9", 0x65}, {"f10", 0x6d}, {"f11", 0x67}, {"f12", 0x6f},
+	{"cmd", 0x37}, {"command", 0x37}, {"shift", 0x38}, {"option", 0x3a}, {"alt", 0x3a}, {"ctrl", 0x36}, {"control", 0x36},
+	{NULL, 0}
+};
+
+const int KEY_SHIFT = 0x38;
+
+// Find key code for character C, returns -1 if there is none
+static int char_to_key(char c, bool &shift)
+{
+	shift = false;
+	if (isupper(c)) {
+		shift = true;
+		c = tolower(c);
+	} else {
+		const char *s = c ? strchr(shift_chars, c) : NULL;
+		if (s) {
+			shift = true;
+			c = unshift_chars[s - shift_chars];
+		}
+	}
+	const char *k = c > 1 ? strchr(key_chars, c) : NULL;
+	return k ? k - key_chars : -1;
+}
+
+// Find key code for a key name or single character, returns -1 if there is none
+static int name_to_key(const std::string &name)
+{
+	for (int i = 0; key_names[i].name; i++)
+		if (strcasecmp(name.c_str(), key_names[i].name) == 0)
+			return key_names[i].code;
+	bool shift;
+	return name.size() == 1 ? char_to_key(tolower(name[0]), shift) : -1;
+}
+
+
+/*
+ *  Read script
+ */
+
+static bool parse_error(int line, const char *msg)
+{
+	printf("%s:%d: %s\n", script_path, line, msg);
+	return false;
+}
+
+static bool read_script(void)
+{
+	FILE *f = fopen(script_path, "r");
+	if (f == NULL)
+		return false;
+
+	static const struct {
+		const char *name;
+		int op;
+		int min_args, max_args;
+	} commands[] = {
+		{"phase", CMD_PHASE, 0, 0}, {"idle", CMD_IDLE, 0, 2}, {"sleep", CMD_SLEEP, 1, 1},
+		{"move", CMD_MOVE, 2, 2}, {"click", CMD_CLICK, 0, 2}, {"doubleclick", CMD_DOUBLECLICK, 0, 2},
+		{"drag", CMD_DRAG, 4, 4}, {"key", CMD_KEY, 0, 0}, {"type", CMD_TYPE, 0, 0},
+		{"repeat", CMD_REPEAT, 1, 1}, {"end", CMD_END, 0, 0}, {"quit", CMD_QUIT, 0, 0},
+		{NULL, 0, 0, 0}
+	};
+
+	std::vector<size_t> open_repeats;
+	char buf[1024];
+	bool ok = true;
+	for (int line = 1; ok && fgets(buf, sizeof(buf), f); line++) {
+
+		// Split into command and rest of line
+		char *p = buf;
+		while (isspace(*p))
+			p++;
+		char *e = p + strlen(p);
+		while (e > p && isspace(e[-1]))
+			*--e = 0;
+		if (*p == 0 || *p == '#')
+			continue;
+		char *rest = p;
+		while (*rest && !isspace(*rest))
+			rest++;
+		if (*rest)
+			*rest++ = 0;
+		while (isspace(*rest))
+			rest++;
+
+		int i;
+		for (i = 0; commands[i].name; i++)
+			if (strcmp(p, commands[i].name) == 0)
+				break;
+		if (commands[i].name == NULL) {
+			ok = parse_error(line, "unknown command");
+			break;
+		}
+
+		bench_cmd c;
+		c.op = commands[i].op;
+		c.line = line;
+		c.match = 0;
+		c.nargs = 0;
+		if (c.op == CMD_PHASE || c.op == CMD_TYPE) {
+			c.text = rest;
+			if (c.text.empty())
+				ok = parse_error(line, "text expected");
+		} else if (c.op == CMD_KEY) {
+
+			// Modifiers separated by "-", e.g. "cmd-shift-s"
+			std::string keys = rest;
+			size_t pos = 0;
+			while (ok && pos < keys.size()) {
+				size_t dash = keys.find('-', pos + 1);
+				if (dash == std::string::npos)
+					dash = keys.size();
+				int code = name_to_key(keys.substr(pos, dash - pos));
+				if (code < 0)
+					ok = parse_error(line, "unknown key");
+				c.keys.push_back(code);
+				pos = dash + 1;
+			}
+			if (ok && c.keys.empty())
+				ok = parse_error(line, "key expected");
+		} else {
+			char *q = rest;
+			while (*q && c.nargs < 4) {
+				char *end;
+				c.arg[c.nargs] = strtod(q, &end);
+				if (end == q || c.arg[c.nargs] < 0)
+					break;
+				c.nargs++;
+				q = end;
+				while (isspace(*q))
+					q++;
+			}
+			if (*q || c.nargs < commands[i].min_args || c.nargs > commands[i].max_args
+			 || ((c.op == CMD_CLICK || c.op == CMD_DOUBLECLICK) && c.nargs == 1))
+				ok = parse_error(line, "wrong arguments");
+		}
+
+		// Match repeat and end
+		if (c.op == CMD_REPEAT)
+			open_repeats.push_back(script.size());
+		else if (c.op == CMD_END) {
+			if (open_repeats.empty())
+				ok = parse_error(line, "end without repeat");
+			else {
+				c.match = open_repeats.back();
+				script[c.match].match = script.size();
+				open_repeats.pop_back();
+			}
+		}
+		script.push_back(c);
+	}
+	fclose(f);
+
+	if (ok && !open_repeats.empty())
+		ok = parse_error(script[open_repeats.back()].line, "repeat without end");
+	if (!ok)
+		script.clear();
+	return ok;
+}
+
+
+/*
+ *  Counters
+ */
+
+static void take_sample(bench_sample &s)
+{
+	s.time = GetTicks_usec();
+	uint64 start = idle_start;
+	s.idle = idle_total + (start && s.time > start ? s.time - start : 0);
+	s.instructions = ReplayInstructions;
+#if USE_JIT
+	s.jit_blocks = compiled_block_count;
+	s.jit_soft_flushes = soft_flush_count;
+	s.jit_hard_flushes = hard_flush_count;
+	s.jit_checksums = checksum_count;
+#else
+	s.jit_blocks = s.jit_soft_flushes = s.jit_hard_flushes = s.jit_checksums = 0;
+#endif
+	for (int i = 0; i < BENCH_NUM_IO; i++) {
+		s.io_calls[i] = BenchIOCalls[i];
+		s.io_bytes[i] = BenchIOBytes[i];
+	}
+}
+
+void BenchIdleBegin(void)
+{
+	if (BenchRunning)
+		idle_start = GetTicks_usec();
+}
+
+void BenchIdleEnd(void)
+{
+	if (BenchRunning && idle_start) {
+		idle_total += GetTicks_usec() - idle_start;
+		idle_start = 0;
+	}
+}
+
+
+/*
+ *  Phases
+ */
+
+static void end_phase(void)
+{
+	if (!phase_open)
+		return;
+	bench_phase &p = phases.back();
+	if (at_idle)
+		p.end = idle_sample;
+	else
+		take_sample(p.end);
+	phase_open = false;
+	printf("Benchmark phase %s: %.3f s%s\n", p.name.c_str(), (p.end.time - p.start.time) / 1000000.0, p.timed_out ? " (timed out)" : "");
+	fflush(stdout);
+}
+
+static void start_phase(const std::string &name)
+{
+	end_phase();
+	bench_phase p;
+	p.name = name;
+	p.timed_out = false;
+	take_sample(p.start);
+	phases.push_back(p);
+	phase_open = true;
+}
+
+
+/*
+ *  Script thread
+ */
+
+// Sleep, returns false if the script was cancelled
+static bool wait_usec(uint64 usec)
+{
+	while (usec && !script_cancel) {
+		uint64 d = usec < IDLE_POLL ? usec : IDLE_POLL;
+		Delay_usec(d);
+		usec -= d;
+	}
+	return !script_cancel;
+}
+
+// Wait until the Mac has been idle for SETTLE usec, returns false on timeout
+static bool wait_idle(uint64 settle, uint64 timeout)
+{
+	bench_sample last, now;
+	take_sample(last);
+	uint64 start = last.time;
+	bool idle = false;
+	while (wait_usec(IDLE_POLL)) {
+		take_sample(now);
+		if ((now.idle - last.idle) * 100 >= (now.time - last.time) * IDLE_PERCENT) {
+			if (!idle) {
+				idle_sample = last;
+				idle = true;
+			}
+			if (now.time - idle_sample.time >= settle)
+				return true;
+		} else
+			idle = false;
+		if (now.time - start >= timeout)
+			return false;
+		last = now;
+	}
+	return true;
+}
+
+static void mouse_click(int clicks)
+{
+	for (int i = 0; i < clicks; i++) {
+		ADBMouseDown(0);
+		wait_usec(INPUT_DELAY);
+		ADBMouseUp(0);
+		wait_usec(INPUT_DELAY);
+	}
+}
+
+static void mouse_drag(int x1, int y1, int x2, int y2)
+{
+	const int STEPS = 10;
+	ADBMouseMoved(x1, y1);
+	wait_usec(INPUT_DELAY);
+	ADBMouseDown(0);
+	for (int i = 1; i <= STEPS; i++) {
+		wait_usec(INPUT_DELAY);
+		ADBMouseMoved(x1 + (x2 - x1) * i / STEPS, y1 + (y2 - y1) * i / STEPS);
+	}
+	wait_usec(INPUT_DELAY);
+	ADBMouseUp(0);
+	wait_usec(INPUT_DELAY);
+}
+
+// Press the last key of KEYS while holding down the others
+static void press_keys(const std::vector<int> &keys)
+{
+	for (size_t i = 0; i < keys.size(); i++) {
+		ADBKeyDown(keys[i]);
+		wait_usec(INPUT_DELAY);
+	}
+	for (size_t i = keys.size(); i > 0; i--) {
+		ADBKeyUp(keys[i - 1]);
+		wait_usec(INPUT_DELAY);
+	}
+}
+
+static void type_text(const std::string &text)
+{
+	for (size_t i = 0; i < text.size() && !script_cancel; i++) {
+		bool shift;
+		int code = char_to_key(text[i], shift);
+		if (code < 0)
+			continue;
+		std::vector<int> keys;
+		if (shift)
+			keys.push_back(KEY_SHIFT);
+		keys.push_back(code);
+		press_keys(keys);
+	}
+}
+
+static void *script_func(void *arg)
+{
+	std::vector<int> repeats_left(script.size());
+	for (size_t pc = 0; pc < script.size() && !script_cancel; pc++) {
+		const bench_cmd &c = script[pc];
+		D(bug("bench command %d, line %d\n", c.op, c.line));
+		if (c.op != CMD_PHASE && c.op != CMD_REPEAT && c.op != CMD_END)
+			at_idle = false;
+
+		switch (c.op) {
+			case CMD_PHASE:
+				start_phase(c.text);
+				break;
+
+			case CMD_IDLE: {
+				double settle = c.nargs > 0 ? c.arg[0] : 2;
+				double timeout = c.nargs > 1 ? c.arg[1] : 300;
+				if (wait_idle(uint64(settle * 1000000), uint64(timeout * 1000000)))
+					at_idle = !script_cancel;
+				else {
+					printf("WARNING: Benchmark timed out waiting for the Mac to become idle\n");
+					if (phase_open)
+						phases.back().timed_out = true;
+				}
+				break;
+			}
+
+			case CMD_SLEEP:
+				wait_usec(uint64(c.arg[0] * 1000000));
+				break;
+
+			case CMD_MOVE:
+				ADBMouseMoved(int(c.arg[0]), int(c.arg[1]));
+				wait_usec(INPUT_DELAY);
+				break;
+
+			case CMD_CLICK:
+			case CMD_DOUBLECLICK:
+				if (c.nargs) {
+					ADBMouseMoved(int(c.arg[0]), int(c.arg[1]));
+					wait_usec(INPUT_DELAY);
+				}
+				mouse_click(c.op == CMD_DOUBLECLICK ? 2 : 1);
+				break;
+
+			case CMD_DRAG:
+				mouse_drag(int(c.arg[0]), int(c.arg[1]), int(c.arg[2]), int(c.arg[3]));
+				break;
+
+			case CMD_KEY:
+				press_keys(c.keys);
+				break;
+
+			case CMD_TYPE:
+				type_text(c.text);
+				break;
+
+			case CMD_REPEAT:
+				repeats_left[pc] = int(c.arg[0]);
+				if (repeats_left[pc] <= 0)
+					pc = c.match;
+				break;
+
+			case CMD_END:
+				if (--repeats_left[c.match] > 0)
+					pc = c.match;
+				break;
+
+			case CMD_QUIT:
+				quit_requested = true;
+				return NULL;
+		}
+	}
+	return NULL;
+}
+
+
+/*
+ *  Read script, called before InitAll()
+ */
+
+bool BenchInit(void)
+{
+	script_path = PrefsFindString("benchscript");
+	if (script_path == NULL || *script_path == 0)
+		return true;
+	if (!read_script())
+		return false;
+
+	// Idle detection needs the SynchIdleTime() patch
+	PrefsReplaceBool("idlewait", true);
+	return true;
+}
+
+
+/*
+ *  Start script thread, the first phase starts here
+ */
+
+void BenchStart(void)
+{
+	if (script.empty())
+		return;
+
+	BenchCounting = !UseJIT;
+	BenchRunning = true;
+	Set_pthread_attr(&script_thread_attr, 0);
+	script_thread_active = (pthread_create(&script_thread, &script_thread_attr, script_func, NULL) == 0);
+	if (!script_thread_active) {
+		printf("WARNING: Cannot start benchmark script thread\n");
+		BenchRunning = false;
+		return;
+	}
+	printf("Running benchmark script %s\n", script_path);
+	fflush(stdout);
+}
+
+
+/*
+ *  Called by the 1Hz interrupt in the emulation thread
+ */
+
+void BenchInterrupt(void)
+{
+	if (quit_requested) {
+		quit_requested = false;
+		QuitEmulator();
+	}
+}
+
+
+/*
+ *  Stop script and write results
+ */
+
+static void write_counters(FILE *f, const bench_sample &s, const bench_sample &e)
+{
+	static const char *const io_names[BENCH_NUM_IO] = {"disk_read", "disk_write", "extfs_read", "extfs_write", "extfs_meta_syscall"};
+
+	double secs = (e.time - s.time) / 1000000.0;
+	fprintf(f, "\"wall_ms\": %.1f, \"idle_ms\": %.1f", secs * 1000.0, (e.idle - s.idle) / 1000.0);
+	if (BenchCounting) {
+		uint64 insns = e.instructions - s.instructions;
+		fprintf(f, ", \"instructions\": %llu, \"mips\": %.2f", (unsigned long long)insns, secs > 0 ? insns / secs / 1000000.0 : 0.0);
+	} else
+		fprintf(f, ", \"instructions\": null, \"mips\": null");
+	fprintf(f, ", \"jit_blocks\": %llu, \"jit_soft_flushes\": %llu, \"jit_hard_flushes\": %llu, \"jit_checksums\": %llu",
+		(unsigned long long)(e.jit_blocks - s.jit_blocks), (unsigned long long)(e.jit_soft_flushes - s.jit_soft_flushes),
+		(unsigned long long)(e.jit_hard_flushes - s.jit_hard_flushes), (unsigned long long)(e.jit_checksums - s.jit_checksums));
+	for (int i = 0; i < BENCH_NUM_IO; i++) {
+		fprintf(f, ", \"%ss\": %llu", io_names[i], (unsigned long long)(e.io_calls[i] - s.io_calls[i]));
+		if (i != BENCH_EXTFS_META_SYSCALL)		// Counts calls, not bytes
+			fprintf(f, ", \"%s_bytes\": %llu", io_names[i], (unsigned long long)(e.io_bytes[i] - s.io_bytes[i]));
+	}
+}
+
+static void write_string(FILE *f, const std::string &s)
+{
+	fputc('"', f);
+	for (size_t i = 0; i < s.size(); i++) {
+		if (s[i] == '"' || s[i] == '\\')
+			fputc('\\', f);
+		if (uint8(s[i]) >= 0x20)
+			fputc(s[i], f);
+	}
+	fputc('"', f);
+}
+
+void BenchExit(void)
+{
+	if (!BenchRunning)
+		return;
+
+	if (script_thread_active) {
+		script_cancel = true;
+		pthread_join(script_thread, NULL);
+		script_thread_active = false;
+	}
+	end_phase();
+	BenchRunning = false;
+
+	// Write results, one line per phase
+	const char *result_path = PrefsFindString("benchresult");
+	FILE *f = stdout;
+	if (result_path && *result_path) {
+		f = fopen(result_path, "w");
+		if (f == NULL) {
+			printf("WARNING: Cannot write benchmark results to %s\n", result_path);
+			return;
+		}
+	}
+	fprintf(f, "{\n\"emulator\": ");
+	write_string(f, VERSION_STRING);
+	fprintf(f, ",\n\"script\": ");
+	write_string(f, script_path);
+	fprintf(f, ",\n\"jit\": %s,\n\"ram_size\": %u,\n\"phases\": [\n", UseJIT ? "true" : "false", RAMSize);
+	for (size_t i = 0; i < phases.size(); i++) {
+		fprintf(f, "{\"name\": ");
+		write_string(f, phases[i].name);
+		fprintf(f, ", ");
+		write_counters(f, phases[i].start, phases[i].end);
+		fprintf(f, ", \"timed_out\": %s}%s\n", phases[i].timed_out ? "true" : "false", i + 1 < phases.size() ? "," : "");
+	}
+	fprintf(f, "],\n\"total\": {");
+	if (!phases.empty())
+		write_counters(f, phases.front().start, phases.back().end);
+	fprintf(f, "}\n}\n");
+	if (f != stdout && (ferror(f) | fclose(f)))
+		printf("WARNING: Cannot write benchmark results to %s\n", result_path);
+}
+
+
+#ifdef BENCH_TEST
+/*
+ *  Parses good and bad scripts and checks the key mapping, then runs a
+ *  script against a fake clock that advances only when the script thread
+ *  waits. The ADB input it injects, the phase times and the JSON result
+ *  are compared against what the script asks for.
+ */
+
+#include <unistd.h>
+
+uint32 RAMSize = 0x800000;
+uint64 ReplayInstructions;
+#if USE_JIT
+bool UseJIT = false;
+int compiled_block_count, soft_flush_count, hard_flush_count, checksum_count;
+#endif
+
+static std::string script_pref, result_pref;
+static volatile uint64 fake_time = 1;		// usec
+static volatile bool mac_idle;				// Delay_usec() counts as idle time
+static volatile bool quit_called;
+
+const char *PrefsFindString(const char *name, int index) {return strcmp(name, "benchscript") == 0 ? script_pref.c_str() : result_pref.c_str();}
+void PrefsReplaceBool(const char *name, bool b) {}
+uint64 GetTicks_usec(void) {return fake_time;}
+void Set_pthread_attr(pthread_attr_t *attr, int priority) {pthread_attr_init(attr);}
+void QuitEmulator(void) {quit_called = true;}
+
+void Delay_usec(uint64 usec)
+{
+	if (mac_idle)
+		idle_total += usec;
+	fake_time += usec;
+}
+
+// ADB input injected by the script, as text
+static std::string adb_log;
+
+static void adb_event(const char *fmt, int a, int b = 0)
+{
+	char buf[64];
+	sprintf(buf, fmt, a, b);
+	adb_log += buf;
+}
+
+void ADBMouseMoved(int x, int y) {adb_event("m%d,%d ", x, y);}
+void ADBMouseDown(int button) {adb_event("D ", button);}
+void ADBMouseUp(int button) {adb_event("U ", button);}
+void ADBKeyDown(int code) {adb_event("k%02x ", code);}
+void ADBKeyUp(int code) {adb_event("K%02x ", code);}
+
+static int failures;
+
+#define CHECK(cond) do { \
+	if (!(cond)) { \
+		printf("%s:%d: %s failed\n", __FILE__, __LINE__, #cond); \
+		failures++; \
+	} \
+} while (0)
+
+// Write TEXT to the script file and parse it
+static bool parse(const char *text)
+{
+	FILE *f = fopen(script_pref.c_str(), "w");
+	fputs(text, f);
+	fclose(f);
+	script.clear();
+	return BenchInit();
+}
+
+static void test_keys(void)
+{
+	bool shift;
+	CHECK(char_to_key('a', shift) == 0x00 && !shift);
+	CHECK(char_to_key('A', shift) == 0x00 && shift);
+	CHECK(char_to_key('1', shift) == 0x12 && !shift);
+	CHECK(char_to_key('!', shift) == 0x12 && shift);
+	CHECK(char_to_key(' ', shift) == 0x31 && !shift);
+	CHECK(char_to_key('`', shift) == 0x32 && !shift);
+	CHECK(char_to_key('~', shift) == 0x32 && shift);
+	CHECK(char_to_key('\1', shift) == -1);
+	CHECK(char_to_key('\t', shift) == -1);
+	CHECK(name_to_key("return") == 0x24);
+	CHECK(name_to_key("CMD") == 0x37);
+	CHECK(name_to_key("W") == 0x0d);
+	CHECK(name_to_key("nokey") == -1);
+}
+
+static void test_parse(void)
+{
+	CHECK(parse("# comment\n\n  phase one two  \nrepeat 2\n repeat 0\n  click\n end\nend\nkey cmd-shift-s\nidle 1.5 10\nquit\n"));
+	CHECK(script.size() == 9);
+	if (script.size() == 9) {
+		CHECK(script[0].op == CMD_PHASE && script[0].text == "one two" && script[0].line == 3);
+		CHECK(script[1].op == CMD_REPEAT && script[1].match == 5 && script[5].match == 1);
+		CHECK(script[2].op == CMD_REPEAT && script[2].match == 4 && script[4].match == 2);
+		CHECK(script[3].op == CMD_CLICK && script[3].nargs == 0);
+		CHECK(script[6].keys.size() == 3 && script[6].keys[0] == 0x37 && script[6].keys[1] == 0x38 && script[6].keys[2] == 0x01);
+		CHECK(script[7].nargs == 2 && script[7].arg[0] == 1.5 && script[7].arg[1] == 10);
+	}
+
+	static const char *const bad[] = {
+		"jump\n", "phase\n", "type\n", "click 5\n", "move 1\n", "move -1 2\n", "sleep 1 2\n", "sleep x\n",
+		"drag 1 2 3\n", "idle 1 2 3\n", "key cmd-nokey\n", "key\n", "end\n", "repeat 2\nclick\n", "repeat 2\nend\nend\n",
+		NULL
+	};
+	for (int i = 0; bad[i]; i++) {
+		if (parse(bad[i])) {
+			printf("bad script \"%s\" accepted\n", bad[i]);
+			failures++;
+		}
+		CHECK(script.empty());
+	}
+}
+
+// Run a script with three phases and check the input and the results
+static void test_run(void)
+{
+	CHECK(parse(
+		"phase boot\n"
+		"idle 1 5\n"
+		"phase work\n"
+		"repeat 3\n"
+		"click 10 20\n"
+		"end\n"
+		"key cmd-shift-s\n"
+		"type Hi!\n"
+		"phase \"tail\"\n"
+		"sleep 2\n"
+		"quit\n"));
+
+	mac_idle = true;
+	BenchIOCalls[BENCH_DISK_READ] = 5;
+	BenchIOBytes[BENCH_DISK_READ] = 5 * 512;
+	BenchStart();
+	CHECK(BenchRunning);
+	for (int i = 0; i < 5000 && !quit_requested; i++)
+		usleep(1000);
+	CHECK(quit_requested);
+	BenchInterrupt();
+	CHECK(quit_called);
+	BenchExit();
+	CHECK(!BenchRunning);
+
+	CHECK(adb_log ==
+		"m10,20 D U m10,20 D U m10,20 D U "
+		"k37 k38 k01 K01 K38 K37 "
+		"k38 k04 K04 K38 k22 K22 k38 k12 K12 K38 ");
+	CHECK(phases.size() == 3);
+	if (phases.size() == 3) {
+		CHECK(phases[0].name == "boot" && phases[0].end.time == phases[0].start.time && !phases[0].timed_out);
+		CHECK(phases[1].end.time - phases[1].start.time == 3 * 3 * INPUT_DELAY + 6 * INPUT_DELAY + 10 * INPUT_DELAY);
+		CHECK(phases[2].end.time - phases[2].start.time == 2000000);
+	}
+
+	// The result is one line per phase, with the phase name quoted
+	FILE *f = fopen(result_pref.c_str(), "r");
+	CHECK(f != NULL);
+	std::string json;
+	if (f) {
+		char buf[1024];
+		while (fgets(buf, sizeof(buf), f))
+			json += buf;
+		fclose(f);
+	}
+	CHECK(json.find("\"jit\": false,\n\"ram_size\": 8388608,") != std::string::npos);
+	CHECK(json.find("{\"name\": \"boot\", \"wall_ms\": 0.0, \"idle_ms\": 0.0, \"instructions\": 0, \"mips\": 0.00,") != std::string::npos);
+	CHECK(json.find("{\"name\": \"work\", \"wall_ms\": 1250.0, \"idle_ms\": 1250.0,") != std::string::npos);
+	CHECK(json.find("{\"name\": \"\\\"tail\\\"\", \"wall_ms\": 2000.0,") != std::string::npos);
+	CHECK(json.find("\"disk_reads\": 0, \"disk_read_bytes\": 0,") != std::string::npos);
+	CHECK(json.find("\"extfs_meta_syscalls\": 0") != std::string::npos);
+	CHECK(json.find("extfs_meta_syscall_bytes") == std::string::npos);
+	CHECK(json.find("\"timed_out\": false}\n],\n\"total\": {\"wall_ms\": ") != std::string::npos);
+	CHECK(json.size() > 4 && json.compare(json.size() - 4, 4, "}\n}\n") == 0);
+}
+
+// An idle command that never sees an idle Mac times out and marks its phase
+static void test_timeout(void)
+{
+	phases.clear();
+	adb_log.clear();
+	quit_requested = quit_called = false;
+	script_cancel = false;
+	CHECK(parse("phase busy\nidle 1 3\nquit\n"));
+	mac_idle = false;
+	uint64 start = fake_time;
+	BenchStart();
+	for (int i = 0; i < 5000 && !quit_requested; i++)
+		usleep(1000);
+	BenchInterrupt();
+	BenchExit();
+	CHECK(quit_called);
+	CHECK(phases.size() == 1 && phases[0].timed_out);
+	CHECK(fake_time - start >= 3000000 && fake_time - start < 3000000 + 2 * IDLE_POLL);
+}
+
+int main(void)
+{
+	char dir[] = "/tmp/bench_test.XXXXXX";
+	if (mkdtemp(dir) == NULL) {
+		perror("mkdtemp");
+		return 1;
+	}
+	script_pref = std::string(dir) + "/script";
+	result_pref = std::string(dir) + "/result.json";
+
+	test_keys();
+	test_parse();
+	test_run();
+	test_timeout();
+
+	unlink(script_pref.c_str());
+	unlink(result_pref.c_str());
+	rmdir(dir);
+	if (failures) {
+		printf("bench_test: %d failures\n", failures);
+		return 1;
+	}
+	printf("bench_test: OK\n");
+	return 0;
+}
+#endif
+
+#endif
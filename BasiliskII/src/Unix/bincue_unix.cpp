@@ -40,6 +40,7 @@
 #include <unistd.h>
 #include <sys/stat.h>
 #include <errno.h>
+#include <pthread.h>
 
 #ifdef OSX_CORE_AUDIO
 #include "../MacOSX/MacOSX_sound_if.h"
@@ -51,6 +52,8 @@ static int bincue_core_audio_callback(void);
 #include <SDL_audio.h>
 #endif
 
+#include "audio_convert.h"
+
 #include "bincue_unix.h"
 #define DEBUG 0
 #include "debug.h"
@@ -131,6 +134,39 @@ static unsigned int prestart;
 
 static bool audio_enabled = false;
 static uint8 silence_byte;
+static uint8 volume_left = 255, volume_right = 255;	// CD audio volume (0..255)
+static bool audio_float = false;		// Flag: device format is float
+static int audio_channels = 2;			// Device channel count
+
+#ifdef USE_SDL_AUDIO
+static bool audio_convert = false;		// Flag: device is not 44.1kHz 16-bit big-endian stereo
+static audio_converter converter;		// CD-DA -> device format
+static std::vector<uint8> convert_buf;	// Converted data not yet played
+#endif
+
+// Prefetch state. The prefetch thread reads CD-DA data ahead of playback
+// into a ring indexed by the stream position (player.audioposition), so
+// the audio callback never touches the disk. All fields and the player
+// positions are protected by prefetch_lock.
+
+#define PREFETCH_SECTORS	256		// Ring size (about 3.4 seconds)
+#define PREFETCH_CHUNK		16		// Sectors read at once
+#define PREFETCH_SIZE		(PREFETCH_SECTORS * RAW_SECTOR_SIZE)
+
+static pthread_t prefetch_thread;
+static pthread_attr_t prefetch_thread_attr;
+static bool prefetch_thread_active = false;
+static volatile bool prefetch_thread_cancel = false;
+static pthread_mutex_t prefetch_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t prefetch_cond = PTHREAD_COND_INITIALIZER;
+static uint8 *prefetch_buf = NULL;
+static unsigned int prefetch_pos = 0;		// Stream position up to which the ring is valid (bytes)
+static unsigned int prefetch_gen = 0;		// Incremented on every seek
+static unsigned int prefetch_underruns = 0;
+
+#ifdef BINCUE_TEST
+static unsigned int test_read_delay = 0;	// Artificial delay per chunk read (usec)
+#endif
 
 
 // CD Player state.  Note only one player is supported !
@@ -450,10 +486,13 @@ void *open_bincue(const char *name)
 	return NULL;
 }
 
+static void start_prefetch(void);
+static void stop_prefetch(void);
+
 void close_bincue(void *fh)
 {
-
-
+	if (fh && fh == player.cs)
+		stop_prefetch();
 }
 
 /*
@@ -675,6 +714,7 @@ bool CDPlay_bincue(void *fh, uint8 start_m, uint8 start_s, uint8 start_f,
 
 		track = PositionToTrack(player.cs, player.audiostart);
 
+		pthread_mutex_lock(&prefetch_lock);
 		if (track < player.cs->tcnt) {
 			player.audioposition = 0;
 
@@ -708,11 +748,22 @@ bool CDPlay_bincue(void *fh, uint8 start_m, uint8 start_s, uint8 start_f,
 		else
 			D(bug("CDPlay_bincue: play beyond last track !\n"));
 
+		// Drop prefetched data and start reading at the new position
+		prefetch_pos = player.audioposition;
+		prefetch_gen++;
+#ifdef USE_SDL_AUDIO
+		converter.reset();
+		convert_buf.clear();
+#endif
+		pthread_cond_signal(&prefetch_cond);
+		pthread_mutex_unlock(&prefetch_lock);
+
 #ifdef USE_SDL_AUDIO
 		SDL_UnlockAudio();
 #endif
 
 		if (audio_enabled) {
+			start_prefetch();
 			player.audiostatus = CDROM_AUDIO_PLAY;
 #ifdef OSX_CORE_AUDIO
 			D(bug("starting os x sound"));
@@ -726,11 +777,199 @@ bool CDPlay_bincue(void *fh, uint8 start_m, uint8 start_s, uint8 start_f,
 	return false;
 }
 
+/*
+ *  Prefetch thread, keeps the ring ahead of playback
+ */
+
+// Number of bytes from the start of playback to its end
+static unsigned int stream_length(void)
+{
+	if (player.audioend <= player.audiostart)
+		return 0;
+	return (player.audioend - player.audiostart) * RAW_SECTOR_SIZE;
+}
+
+static void *prefetch_func(void *arg)
+{
+	pthread_mutex_lock(&prefetch_lock);
+	while (!prefetch_thread_cancel) {
+
+		// Wait for room in the ring and something left to play
+		unsigned int pos = prefetch_pos;
+		unsigned int end = stream_length();
+		unsigned int room = PREFETCH_SIZE - (pos - player.audioposition);
+		if (pos >= end || room < PREFETCH_CHUNK * RAW_SECTOR_SIZE) {
+			pthread_cond_wait(&prefetch_cond, &prefetch_lock);
+			continue;
+		}
+
+		// Next chunk, the ring size is a multiple of the chunk size
+		unsigned int ofs = pos % PREFETCH_SIZE;
+		unsigned int len = PREFETCH_CHUNK * RAW_SECTOR_SIZE - ofs % (PREFETCH_CHUNK * RAW_SECTOR_SIZE);
+		if (len > end - pos)
+			len = end - pos;
+		unsigned int gen = prefetch_gen;
+		unsigned int silence = player.silence;
+		loff_t fileoffset = player.fileoffset;
+		int fd = player.audiofh;
+
+		// Read without holding the lock; the consumer never looks beyond
+		// prefetch_pos, and a stale chunk is dropped below
+		pthread_mutex_unlock(&prefetch_lock);
+		uint8 *p = prefetch_buf + ofs;
+		unsigned int done = 0;
+		if (pos < silence) {
+			done = silence - pos < len ? silence - pos : len;
+			memset(p, 0, done);
+		}
+		while (done < len) {
+			ssize_t ret = pread(fd, p + done, len - done, fileoffset + pos + done - silence);
+			if (ret <= 0)
+				break;
+			done += ret;
+		}
+		if (done < len)
+			memset(p + done, 0, len - done);	// beyond end of file
+#ifdef BINCUE_TEST
+		usleep(test_read_delay);
+#endif
+		pthread_mutex_lock(&prefetch_lock);
+
+		if (gen == prefetch_gen)
+			prefetch_pos = pos + len;
+	}
+	pthread_mutex_unlock(&prefetch_lock);
+	return NULL;
+}
+
+static void start_prefetch(void)
+{
+	if (prefetch_thread_active)
+		return;
+	if (prefetch_buf == NULL)
+		prefetch_buf = (uint8 *) malloc(PREFETCH_SIZE);
+	if (prefetch_buf == NULL)
+		return;
+	prefetch_thread_cancel = false;
+	Set_pthread_attr(&prefetch_thread_attr, 0);
+	prefetch_thread_active = (pthread_create(&prefetch_thread, &prefetch_thread_attr, prefetch_func, NULL) == 0);
+}
+
+static void stop_prefetch(void)
+{
+	if (prefetch_thread_active) {
+		pthread_mutex_lock(&prefetch_lock);
+		prefetch_thread_cancel = true;
+		pthread_cond_signal(&prefetch_cond);
+		pthread_mutex_unlock(&prefetch_lock);
+		pthread_join(prefetch_thread, NULL);
+		prefetch_thread_active = false;
+	}
+	D(bug("bincue: %u prefetch underruns\n", prefetch_underruns));
+}
+
+// Take up to len bytes of prefetched CD-DA data, returns number of bytes
+static unsigned int take_prefetched(uint8 *dest, unsigned int len)
+{
+	unsigned int avail = prefetch_pos - player.audioposition;
+	if (len > avail) {
+		len = avail;
+		prefetch_underruns++;
+	}
+	for (unsigned int done = 0; done < len; ) {
+		unsigned int ofs = (player.audioposition + done) % PREFETCH_SIZE;
+		unsigned int n = PREFETCH_SIZE - ofs;
+		if (n > len - done)
+			n = len - done;
+		memcpy(dest + done, prefetch_buf + ofs, n);
+		done += n;
+	}
+	player.audioposition += len;
+	pthread_cond_signal(&prefetch_cond);
+	return len;
+}
+
+
+/*
+ *  Apply CD audio volume to samples in device format
+ */
+
+#if defined(__GNUC__)
+typedef int32 vec_s32 __attribute__((vector_size(16)));
+typedef uint32 vec_u32 __attribute__((vector_size(16)));
+typedef float vec_f32 __attribute__((vector_size(16)));
+#endif
+
+static void apply_volume(uint8 *buf, int len, bool big_endian = false)
+{
+	int left = volume_left, right = volume_right;
+	if (left == 255 && right == 255)
+		return;
+	if (audio_channels == 1)
+		left = right = (left + right) / 2;
+	int i = 0;
+
+	if (audio_float) {
+		float gl = left * (1.0f / 255.0f), gr = right * (1.0f / 255.0f);
+#if defined(__GNUC__)
+		const vec_f32 g = { gl, gr, gl, gr };
+		for (; i + 16 <= len; i += 16) {
+			vec_f32 v;
+			memcpy(&v, buf + i, sizeof(v));
+			v *= g;
+			memcpy(buf + i, &v, sizeof(v));
+		}
+#endif
+		for (int ch = 0; i + 4 <= len; i += 4, ch ^= 1) {
+			float v;
+			memcpy(&v, buf + i, 4);
+			v *= ch ? gr : gl;
+			memcpy(buf + i, &v, 4);
+		}
+	} else {
+#ifndef WORDS_BIGENDIAN
+		if (big_endian)
+			audio_swap_16(buf, buf, len);
+#endif
+		int gl = left + (left >> 7), gr = right + (right >> 7);	// 0..256
+#if defined(__GNUC__)
+		// Each 32-bit lane holds one stereo frame
+#ifdef WORDS_BIGENDIAN
+		const vec_s32 glo = { gr, gr, gr, gr }, ghi = { gl, gl, gl, gl };
+#else
+		const vec_s32 glo = { gl, gl, gl, gl }, ghi = { gr, gr, gr, gr };
+#endif
+		for (; i + 16 <= len; i += 16) {
+			vec_s32 v;
+			memcpy(&v, buf + i, sizeof(v));
+			vec_s32 lo = ((vec_s32)((vec_u32)v << 16) >> 16) * glo >> 8;
+			vec_s32 hi = (v >> 16) * ghi >> 8;
+			v = (lo & 0xffff) | (vec_s32)((vec_u32)hi << 16);
+			memcpy(buf + i, &v, sizeof(v));
+		}
+#endif
+		for (int ch = 0; i + 2 <= len; i += 2, ch ^= 1) {
+			int16 v;
+			memcpy(&v, buf + i, 2);
+			v = v * (ch ? gr : gl) >> 8;
+			memcpy(buf + i, &v, 2);
+		}
+#ifndef WORDS_BIGENDIAN
+		if (big_endian)
+			audio_swap_16(buf, buf, len);
+#endif
+	}
+}
+
+
+/*
+ *  Get next block of CD audio in device format
+ */
+
 static uint8 *fill_buffer(int stream_len)
 {
 	static uint8 *buf = 0;
 	static int bufsize = 0;
-	int offset = 0;
 
 	if (bufsize < stream_len) {
 		free(buf);
@@ -746,57 +985,57 @@ static uint8 *fill_buffer(int stream_len)
 
 	memset(buf, silence_byte, stream_len);
 
-	if (player.audiostatus == CDROM_AUDIO_PLAY) {
-		int remaining_silence = player.silence - player.audioposition;
-
-		if (player.audiostart + player.audioposition/RAW_SECTOR_SIZE
-			>= player.audioend) {
+	if (player.audiostatus == CDROM_AUDIO_PLAY && prefetch_buf) {
+		pthread_mutex_lock(&prefetch_lock);
+		if (player.audioposition >= stream_length()) {
 			player.audiostatus = CDROM_AUDIO_COMPLETED;
+			pthread_mutex_unlock(&prefetch_lock);
 			return buf;
 		}
 
-		if (remaining_silence >= stream_len) {
-			player.audioposition += stream_len;
+#ifdef USE_SDL_AUDIO
+		if (audio_convert) {
+			static std::vector<uint8> raw;
+			unsigned int frames = 0;
+			if (convert_buf.size() < (size_t)stream_len) {
+				frames = converter.in_frames((stream_len - convert_buf.size()) / converter.out_frame_size());
+				raw.resize(frames * 4);
+				frames = take_prefetched(&raw[0], frames * 4) / 4;
+			}
+			pthread_mutex_unlock(&prefetch_lock);
+
+			// Resampling may yield a few frames more than needed, they are kept for the next call
+			if (frames)
+				converter.convert(&raw[0], frames, convert_buf);
+			int len = convert_buf.size() < (size_t)stream_len ? convert_buf.size() : stream_len;
+			if (len) {
+				memcpy(buf, &convert_buf[0], len);
+				convert_buf.erase(convert_buf.begin(), convert_buf.begin() + len);
+			}
+			apply_volume(buf, len);
 			return buf;
 		}
+#endif
 
-		if (remaining_silence > 0) {
-			offset += remaining_silence;
-			player.audioposition += remaining_silence;
-		}
-
-		int ret = 0;
-		int available = ((player.audioend - player.audiostart) *
-							 RAW_SECTOR_SIZE) - player.audioposition;
-		if (available > (stream_len - offset))
-			available = stream_len - offset;
-
-		if (lseek(player.audiofh,
-				  player.fileoffset + player.audioposition - player.silence,
-					  SEEK_SET) < 0)
-			return NULL;
-
-		if (available < 0) {
-			player.audioposition += available; // correct end !;
-			available = 0;
-		}
+		int len = take_prefetched(buf, stream_len & ~3);
+		pthread_mutex_unlock(&prefetch_lock);
+		apply_volume(buf, len, true);
+	}
+	return buf;
+}
 
-		if ((ret = read(player.audiofh, &buf[offset], available)) >= 0) {
-			player.audioposition += ret;
-			offset += ret;
-			available -= ret;
-		}
 
-		while (offset < stream_len) {
-			buf[offset++] = silence_byte;
-			if (available-- > 0){
-				player.audioposition++;
-			}
-		}
-	}		
-	return buf;
+void CDSetVolume_bincue(void *fh, uint8 left, uint8 right)
+{
+	volume_left = left;
+	volume_right = right;
 }
 
+void CDGetVolume_bincue(void *fh, uint8 &left, uint8 &right)
+{
+	left = volume_left;
+	right = volume_right;
+}
 
 #ifdef USE_SDL_AUDIO
 void MixAudio_bincue(uint8 *stream, int stream_len)
@@ -812,6 +1051,21 @@ void OpenAudio_bincue(int freq, int format, int channels, uint8 silence)
 {
 	if (freq == 44100 && format == AUDIO_S16MSB && channels == 2) {
 		audio_enabled = true;
+		audio_convert = false;
+		audio_float = false;
+		audio_channels = 2;
+		silence_byte = silence;
+	}
+	else if ((format == AUDIO_S16SYS
+#ifdef AUDIO_F32SYS
+			  || format == AUDIO_F32SYS
+#endif
+			 ) && (channels == 1 || channels == 2)) {
+		audio_enabled = true;
+		audio_convert = true;
+		audio_float = format != AUDIO_S16SYS;
+		audio_channels = channels;
+		converter.init(44100, 16, 2, freq, audio_float ? audio_converter::OUT_F32 : audio_converter::OUT_S16, channels);
 		silence_byte = silence;
 	}
 	else {
@@ -834,3 +1088,154 @@ static int bincue_core_audio_callback(void)
 	return 1;
 }
 #endif
+
+
+#ifdef BINCUE_TEST
+/*
+ *  Plays a synthetic audio track with slowed down disk reads and checks
+ *  that fill_buffer() neither blocks on the reads nor delivers wrong or
+ *  out of order samples, with and without a CD volume set.
+ *
+ *  bincue_test
+ */
+
+#include <sys/time.h>
+#include <string>
+
+void Set_pthread_attr(pthread_attr_t *attr, int priority) {pthread_attr_init(attr);}
+
+static const unsigned int TEST_SECTORS = 1000;
+static const int TEST_BLOCK = 4096;		// Bytes per audio callback
+static int failures;
+
+static uint64 now_usec(void)
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return (uint64)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+// Sample of the test track at the given frame and channel
+static int16 test_sample(unsigned int frame, int ch)
+{
+	return ch ? (int16)(frame * 5 + 1000) : (int16)(frame * 3);
+}
+
+// Expected big-endian sample after volume scaling
+static uint16 expected_sample(unsigned int pos)
+{
+	int ch = (pos >> 1) & 1;
+	int v = ch ? volume_right : volume_left;
+	int g = v + (v >> 7);
+	int16 s = test_sample(pos >> 2, ch);
+	if (volume_left != 255 || volume_right != 255)
+		s = s * g >> 8;
+	return (uint16)s;
+}
+
+// Run audio callbacks every interval usec, returns longest callback time in usec
+static uint64 play(int calls, unsigned int interval)
+{
+	uint64 longest = 0;
+	for (int i = 0; i < calls && player.audiostatus == CDROM_AUDIO_PLAY; i++) {
+		unsigned int pos = player.audioposition;
+		uint64 start = now_usec();
+		uint8 *buf = fill_buffer(TEST_BLOCK);
+		uint64 t = now_usec() - start;
+		if (t > longest)
+			longest = t;
+		unsigned int len = player.audioposition - pos;
+		for (unsigned int j = 0; j < (unsigned int)TEST_BLOCK; j += 2) {
+			uint16 want = j < len ? expected_sample(pos + j) : (silence_byte << 8 | silence_byte);
+			uint16 got = buf[j] << 8 | buf[j + 1];
+			if (got != want) {
+				printf("byte %u of stream: got %04x, expected %04x\n", pos + j, got, want);
+				failures++;
+				return longest;
+			}
+		}
+		usleep(interval);
+	}
+	return longest;
+}
+
+// Start playing from the beginning, wait for the first chunk
+static void restart(void *fh)
+{
+	MSF end;
+	FramesToMSF(TEST_SECTORS, &end);
+	end.f = TEST_SECTORS % CD_FRAMES;
+	CDPlay_bincue(fh, 0, 0, 0, end.m, end.s, end.f);
+	for (int i = 0; i < 1000 && prefetch_pos == 0; i++)
+		usleep(1000);
+	prefetch_underruns = 0;
+}
+
+int main(void)
+{
+	char dir[] = "/tmp/bincue_test.XXXXXX";
+	if (mkdtemp(dir) == NULL) {
+		perror("mkdtemp");
+		return 1;
+	}
+	std::string bin = std::string(dir) + "/test.bin", cue = std::string(dir) + "/test.cue";
+	FILE *f = fopen(bin.c_str(), "wb");
+	for (unsigned int frame = 0; frame < TEST_SECTORS * RAW_SECTOR_SIZE / 4; frame++) {
+		for (int ch = 0; ch < 2; ch++) {
+			int16 s = test_sample(frame, ch);
+			fputc((uint16)s >> 8, f);
+			fputc(s & 0xff, f);
+		}
+	}
+	fclose(f);
+	f = fopen(cue.c_str(), "w");
+	fprintf(f, "FILE \"test.bin\" BINARY\n  TRACK 01 AUDIO\n    INDEX 01 00:00:00\n");
+	fclose(f);
+
+	audio_enabled = true;
+	silence_byte = 0;
+	void *fh = open_bincue(cue.c_str());
+	if (fh == NULL) {
+		printf("can't open %s\n", cue.c_str());
+		return 1;
+	}
+
+	// Reads at about ten times real time, callbacks at four times: the prefetch keeps up
+	test_read_delay = 20000;
+	restart(fh);
+	uint64 longest = play(300, 5000);
+	printf("slow disk, 4x playback: %u underruns, longest callback %llu usec\n", prefetch_underruns, (unsigned long long)longest);
+	if (prefetch_underruns) {
+		printf("unexpected underruns\n");
+		failures++;
+	}
+
+	// Reads at about twice real time, callbacks much faster: underruns, but no blocking and no bad data
+	test_read_delay = 100000;
+	CDSetVolume_bincue(fh, 200, 100);
+	restart(fh);
+	longest = play(300, 1000);
+	printf("slower disk, 23x playback, volume 200/100: %u underruns, longest callback %llu usec\n", prefetch_underruns, (unsigned long long)longest);
+	if (prefetch_underruns == 0) {
+		printf("expected underruns\n");
+		failures++;
+	}
+	if (longest > test_read_delay / 2) {
+		printf("callback waited for the disk\n");
+		failures++;
+	}
+
+	CDStop_bincue(fh);
+	close_bincue(fh);
+	unlink(bin.c_str());
+	unlink(cue.c_str());
+	rmdir(dir);
+
+	if (failures) {
+		printf("bincue_test: %d failures\n", failures);
+		return 1;
+	}
+	printf("bincue_test: OK\n");
+	return 0;
+}
+#endif
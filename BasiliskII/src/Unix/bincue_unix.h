@@ -34,6 +34,8 @@ extern bool CDPlay_bincue(void *, uint8, uint8,
 extern bool CDPause_bincue(void *);
 extern bool CDResume_bincue(void *);
 extern bool CDStop_bincue(void *);
+extern void CDSetVolume_bincue(void *, uint8, uint8);
+extern void CDGetVolume_bincue(void *, uint8 &, uint8 &);
 
 #ifdef USE_SDL_AUDIO
 extern void OpenAudio_bincue(int, int, int, uint8);
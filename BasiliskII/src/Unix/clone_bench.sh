@@ -0,0 +1,112 @@
+#!/bin/sh
+# Start N Basilisk II instances from one snapshot and report how long each
+# one took to resume and how much memory it uses on its own.
+#
+# The snapshot should be saved with "snapshotcompress false", so that the
+# RAM of all instances is mapped from the same file. If the template ran
+# with "diskoverlay", pass its overlay directory with -o; every instance
+# starts with a copy of those overlays, so they all see the disks as they
+# were when the snapshot was taken.
+#
+# Usage: clone_bench.sh [-b binary] [-o overlaydir] [-s seconds] N snapshot [prefs...]
+#   -b   emulator binary (default ./BasiliskII)
+#   -o   overlay directory of the template
+#   -s   seconds to let the instances run before measuring (default 5)
+# Further arguments are passed to every instance, e.g. "--config prefs".
+
+BIN=./BasiliskII
+OVERLAYS=
+SETTLE=5
+
+while getopts b:o:s: opt; do
+	case $opt in
+	b) BIN=$OPTARG ;;
+	o) OVERLAYS=$OPTARG ;;
+	s) SETTLE=$OPTARG ;;
+	*) exit 2 ;;
+	esac
+done
+shift $((OPTIND - 1))
+
+if [ $# -lt 2 ]; then
+	echo "Usage: clone_bench.sh [-b binary] [-o overlaydir] [-s seconds] N snapshot [prefs...]" >&2
+	exit 2
+fi
+N=$1
+SNAPSHOT=$2
+shift 2
+
+WORK=`mktemp -d /tmp/clone_bench.XXXXXX` || exit 1
+PIDS=
+trap 'kill $PIDS 2>/dev/null; wait 2>/dev/null; rm -rf "$WORK"' EXIT INT TERM
+
+now_ms() {
+	echo $((`date +%s%N` / 1000000))
+}
+
+# Sum of a field of /proc/<pid>/smaps_rollup in kB
+mem_kb() {
+	awk -v f="$2:" '$1 == f { print $2 }' /proc/$1/smaps_rollup 2>/dev/null
+}
+
+# Start all instances
+i=1
+while [ $i -le $N ]; do
+	dir=$WORK/clone$i
+	mkdir -p $dir/overlay
+	if [ -n "$OVERLAYS" ]; then
+		cp --sparse=always "$OVERLAYS"/*.overlay $dir/overlay/ 2>/dev/null
+	fi
+	echo `now_ms` > $dir/start
+	"$BIN" --snapshot "$SNAPSHOT" --resume true --diskoverlay $dir/overlay "$@" > $dir/log 2>&1 &
+	echo $! > $dir/pid
+	PIDS="$PIDS $!"
+	i=$((i + 1))
+done
+
+# Wait until every instance has resumed
+waiting=$N
+while [ $waiting -gt 0 ]; do
+	waiting=0
+	i=1
+	while [ $i -le $N ]; do
+		dir=$WORK/clone$i
+		if [ ! -f $dir/ready ]; then
+			if grep -q "Resumed from snapshot" $dir/log 2>/dev/null; then
+				echo `now_ms` > $dir/ready
+			elif ! kill -0 `cat $dir/pid` 2>/dev/null; then
+				echo "clone $i failed:" >&2
+				cat $dir/log >&2
+				exit 1
+			else
+				waiting=$((waiting + 1))
+			fi
+		fi
+		i=$((i + 1))
+	done
+	[ $waiting -gt 0 ] && sleep 0.01
+done
+
+sleep $SETTLE
+
+# Report startup time and memory
+printf "%6s %10s %10s %10s %14s\n" clone "start(ms)" "rss(kB)" "pss(kB)" "private(kB)"
+i=1
+total_ms=0
+total_pss=0
+total_priv=0
+while [ $i -le $N ]; do
+	dir=$WORK/clone$i
+	pid=`cat $dir/pid`
+	ms=$((`cat $dir/ready` - `cat $dir/start`))
+	rss=`mem_kb $pid Rss`
+	pss=`mem_kb $pid Pss`
+	priv=$((`mem_kb $pid Private_Dirty` + `mem_kb $pid Private_Clean`))
+	printf "%6d %10d %10d %10d %14d\n" $i $ms $rss $pss $priv
+	total_ms=$((total_ms + ms))
+	total_pss=$((total_pss + pss))
+	total_priv=$((total_priv + priv))
+	i=$((i + 1))
+done
+printf "%6s %10d %10s %10d %14d\n" avg $((total_ms / N)) - $((total_pss / N)) $((total_priv / N))
+printf "%6s %10s %10s %10d %14d\n" total - - $total_pss $total_priv
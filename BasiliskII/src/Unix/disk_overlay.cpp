@@ -0,0 +1,398 @@
+/*
+ *  disk_overlay.cpp - Copy-on-write overlay for disk image files
+ *
+ *  Basilisk II (C) 1997-2008 Christian Bauer
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/*
+ *  With "diskoverlay" set to a directory, disk image files are opened
+ *  read-only and all writes go to "<directory>/<image name>-<hash>.overlay",
+ *  where <hash> is taken from the full path of the image, so images with
+ *  the same name in different directories get different overlays.
+ *  Many emulator instances can then share one image (and one snapshot
+ *  taken with it), each one with its own overlay.
+ *
+ *  Overlay file layout:
+ *    header        magic, version, block size, size and mtime of the image,
+ *                  full path of the image (truncated to fit)
+ *    bitmap        one bit per block, set if the block is in the overlay
+ *    data          starts on a 4K boundary, block n at data + n * BLOCK_SIZE
+ *
+ *  The data area is sparse, so the overlay only takes the space of the
+ *  blocks actually written. Data and bitmap are written without syncing
+ *  in between, so an overlay may be inconsistent after a host crash.
+ */
+
+#include "sysdeps.h"
+#include "disk_unix.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <vector>
+
+#include "macos_util.h"
+#include "prefs.h"
+#include "file_util.h"
+
+#define DEBUG 0
+#include "debug.h"
+
+static const char OVERLAY_MAGIC[8] = {'B', '2', 'O', 'V', 'R', 'L', 'A', 'Y'};
+const uint32 OVERLAY_VERSION = 2;
+const uint32 HEADER_SIZE = 512;
+const uint32 HEADER_PATH = 32;		// Offset of image path in header
+const uint32 BLOCK_SIZE = 512;
+
+struct disk_overlay : disk_generic {
+	disk_overlay(int base_fd, int fd, loff_t start_byte, loff_t total_size, loff_t data_start, std::vector<uint8> &map)
+	: base_fd(base_fd), fd(fd), start_byte(start_byte), total_size(total_size), data_start(data_start) {
+		bitmap.swap(map);
+	}
+
+	virtual ~disk_overlay() {
+		close(fd);
+		close(base_fd);
+	}
+
+	virtual bool is_read_only() { return false; }
+	virtual loff_t size() { return total_size; }
+
+	virtual size_t read(void *buf, loff_t offset, size_t length) {
+		if (offset >= total_size)
+			return 0;
+		if ((loff_t)length > total_size - offset)
+			length = total_size - offset;
+
+		// Read runs of blocks that are all in the image or all in the overlay
+		uint8 *b = (uint8 *)buf;
+		loff_t end = offset + length;
+		size_t done = 0;
+		while (done < length) {
+			loff_t pos = offset + done;
+			bool in_overlay = present(pos / BLOCK_SIZE);
+			loff_t run_end = (pos / BLOCK_SIZE + 1) * BLOCK_SIZE;
+			while (run_end < end && present(run_end / BLOCK_SIZE) == in_overlay)
+				run_end += BLOCK_SIZE;
+			size_t run = std::min(run_end, end) - pos;
+			ssize_t actual = in_overlay ? pread(fd, b + done, run, data_start + pos)
+			                            : pread(base_fd, b + done, run, start_byte + pos);
+			if (actual <= 0)
+				break;
+			done += actual;
+			if (actual < (ssize_t)run)
+				break;
+		}
+		return done;
+	}
+
+	virtual size_t write(void *buf, loff_t offset, size_t length) {
+		if (offset >= total_size)
+			return 0;
+		if ((loff_t)length > total_size - offset)
+			length = total_size - offset;
+		if (length == 0)
+			return 0;
+
+		// Blocks that are only partly written are copied from the image first
+		loff_t first = offset / BLOCK_SIZE, last = (offset + length - 1) / BLOCK_SIZE;
+		if (offset % BLOCK_SIZE && !fill_block(first))
+			return 0;
+		if ((offset + length) % BLOCK_SIZE && !fill_block(last))
+			return 0;
+
+		ssize_t actual = pwrite(fd, buf, length, data_start + offset);
+		if (actual != (ssize_t)length)
+			return actual < 0 ? 0 : actual;
+
+		// Record the new blocks
+		bool changed = false;
+		for (loff_t i = first; i <= last; i++) {
+			if (!present(i)) {
+				bitmap[i >> 3] |= 0x80 >> (i & 7);
+				changed = true;
+			}
+		}
+		if (changed) {
+			size_t from = first >> 3, to = last >> 3;
+			if (!pwrite_all(fd, &bitmap[from], to - from + 1, HEADER_SIZE + from))
+				return 0;
+		}
+		return length;
+	}
+
+protected:
+	int base_fd;				// Image file (read-only)
+	int fd;						// Overlay file
+	loff_t start_byte;			// Size of image file header
+	loff_t total_size;			// Size of disk
+	loff_t data_start;			// Offset of block data in overlay
+	std::vector<uint8> bitmap;	// Blocks present in overlay
+
+	bool present(loff_t block) const {
+		if (block * BLOCK_SIZE >= total_size)
+			return false;
+		return bitmap[block >> 3] & (0x80 >> (block & 7));
+	}
+
+	// Copy block from image to overlay, unless it is already there
+	bool fill_block(loff_t block) {
+		if (present(block))
+			return true;
+		uint8 data[BLOCK_SIZE];
+		loff_t pos = block * BLOCK_SIZE;
+		size_t len = total_size - pos < BLOCK_SIZE ? total_size - pos : BLOCK_SIZE;
+		return pread_all(base_fd, data, len, start_byte + pos)
+		    && pwrite_all(fd, data, len, data_start + pos);
+	}
+};
+
+
+/*
+ *  Check whether image file gets an overlay, it needs no write access itself then
+ */
+
+bool disk_overlay_wanted(const char *path)
+{
+	const char *dir = PrefsFindString("diskoverlay");
+	if (dir == NULL || *dir == 0)
+		return false;
+	struct stat st;
+	return stat(path, &st) == 0 && S_ISREG(st.st_mode);
+}
+
+disk_generic::status disk_overlay_factory(const char *path, bool read_only, disk_generic **disk)
+{
+	if (read_only || !disk_overlay_wanted(path))
+		return disk_generic::DISK_UNKNOWN;
+
+	int base_fd = open(path, O_RDONLY);
+	if (base_fd < 0)
+		return disk_generic::DISK_UNKNOWN;
+	struct stat st;
+	uint8 data[256];
+	memset(data, 0, sizeof(data));
+	if (fstat(base_fd, &st) < 0 || pread(base_fd, data, sizeof(data), 0) < 0) {
+		close(base_fd);
+		return disk_generic::DISK_UNKNOWN;
+	}
+	loff_t start_byte, total_size;
+	FileDiskLayout(st.st_size, data, start_byte, total_size);
+	loff_t num_blocks = (total_size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+	size_t bitmap_size = (num_blocks + 7) / 8;
+	loff_t data_start = (HEADER_SIZE + bitmap_size + 4095) & ~(loff_t)4095;
+
+	// Overlay is named after the image and a hash (64-bit FNV-1a) of its full path
+	char full_path[PATH_MAX];
+	if (realpath(path, full_path) == NULL) {
+		close(base_fd);
+		return disk_generic::DISK_INVALID;
+	}
+	uint64 hash = UVAL64(0xcbf29ce484222325);
+	for (const char *p = full_path; *p; p++)
+		hash = (hash ^ (uint8)*p) * UVAL64(0x100000001b3);
+	const char *name = strrchr(full_path, '/');
+	name = name ? name + 1 : full_path;
+	char overlay_path[PATH_MAX];
+	if (snprintf(overlay_path, sizeof(overlay_path), "%s/%s-%08x%08x.overlay", PrefsFindString("diskoverlay"), name,
+	             (uint32)(hash >> 32), (uint32)hash) >= (int)sizeof(overlay_path)) {
+		close(base_fd);
+		return disk_generic::DISK_INVALID;
+	}
+	int fd = open(overlay_path, O_RDWR | O_CREAT, 0644);
+	if (fd < 0) {
+		fprintf(stderr, "diskoverlay: Cannot open %s (%s)\n", overlay_path, strerror(errno));
+		close(base_fd);
+		return disk_generic::DISK_INVALID;
+	}
+
+	// New overlay gets a header and an empty bitmap, an existing one must belong to this image
+	uint8 header[HEADER_SIZE];
+	std::vector<uint8> bitmap(bitmap_size);
+	ssize_t actual = pread(fd, header, HEADER_SIZE, 0);
+	if (actual == 0) {
+		memset(header, 0, HEADER_SIZE);
+		memcpy(header, OVERLAY_MAGIC, 8);
+		put_be32(header + 8, OVERLAY_VERSION);
+		put_be32(header + 12, BLOCK_SIZE);
+		put_be32(header + 16, (uint64)st.st_size >> 32);
+		put_be32(header + 20, st.st_size);
+		put_be32(header + 24, (uint64)st.st_mtime >> 32);
+		put_be32(header + 28, st.st_mtime);
+		// Very long paths are cut off here, the hash in the file name covers all of it
+		size_t path_len = std::min(strlen(full_path), (size_t)(HEADER_SIZE - HEADER_PATH - 1));
+		memcpy(header + HEADER_PATH, full_path, path_len);
+		if (pwrite(fd, header, HEADER_SIZE, 0) != HEADER_SIZE
+		 || (bitmap_size && pwrite(fd, &bitmap[0], bitmap_size, HEADER_SIZE) != (ssize_t)bitmap_size)) {
+			fprintf(stderr, "diskoverlay: Cannot write %s (%s)\n", overlay_path, strerror(errno));
+			goto fail;
+		}
+		D(bug("diskoverlay: created %s for %s\n", overlay_path, path));
+	} else {
+		uint64 size = ((uint64)get_be32(header + 16) << 32) | get_be32(header + 20);
+		uint64 mtime = ((uint64)get_be32(header + 24) << 32) | get_be32(header + 28);
+		if (actual != HEADER_SIZE || memcmp(header, OVERLAY_MAGIC, 8) || get_be32(header + 8) != OVERLAY_VERSION
+		 || get_be32(header + 12) != BLOCK_SIZE) {
+			fprintf(stderr, "diskoverlay: %s is not an overlay file\n", overlay_path);
+			goto fail;
+		}
+		header[HEADER_SIZE - 1] = 0;
+		if (strncmp((char *)header + HEADER_PATH, full_path, HEADER_SIZE - HEADER_PATH - 1)) {
+			fprintf(stderr, "diskoverlay: %s belongs to %s, not %s\n", overlay_path, header + HEADER_PATH, path);
+			goto fail;
+		}
+		if (size != (uint64)st.st_size || mtime != (uint64)st.st_mtime) {
+			fprintf(stderr, "diskoverlay: %s was changed after %s was created\n", path, overlay_path);
+			goto fail;
+		}
+		if (bitmap_size && pread(fd, &bitmap[0], bitmap_size, HEADER_SIZE) != (ssize_t)bitmap_size) {
+			fprintf(stderr, "diskoverlay: %s is truncated\n", overlay_path);
+			goto fail;
+		}
+	}
+
+	*disk = new disk_overlay(base_fd, fd, start_byte, total_size, data_start, bitmap);
+	return disk_generic::DISK_VALID;
+
+fail:
+	close(fd);
+	close(base_fd);
+	return disk_generic::DISK_INVALID;
+}
+
+
+#ifdef DISK_OVERLAY_TEST
+/*
+ *  Random reads and writes through an overlay, checked against a copy of
+ *  the image in memory. Reopens the overlay, checks that the image file
+ *  is unchanged and that an image with the same name, size and mtime in
+ *  another directory gets an overlay of its own.
+ *
+ *  disk_overlay_test [operations]
+ */
+
+#include <utime.h>
+#include <string>
+
+static char overlay_dir[PATH_MAX];
+
+const char *PrefsFindString(const char *name, int index) {return strcmp(name, "diskoverlay") == 0 ? overlay_dir : NULL;}
+void FileDiskLayout(loff_t size, uint8 *data, loff_t &start_byte, loff_t &real_size) {start_byte = 0; real_size = size;}
+
+static bool write_file(const char *path, const std::vector<uint8> &data)
+{
+	int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	bool ok = fd >= 0 && write(fd, &data[0], data.size()) == (ssize_t)data.size();
+	if (fd >= 0)
+		close(fd);
+	struct utimbuf t = {1000000000, 1000000000};
+	return ok && utime(path, &t) == 0;
+}
+
+static bool same_as_file(const char *path, const std::vector<uint8> &data)
+{
+	std::vector<uint8> buf(data.size() + 1);
+	int fd = open(path, O_RDONLY);
+	ssize_t actual = fd >= 0 ? read(fd, &buf[0], buf.size()) : -1;
+	if (fd >= 0)
+		close(fd);
+	return actual == (ssize_t)data.size() && memcmp(&buf[0], &data[0], data.size()) == 0;
+}
+
+static bool same_as_disk(disk_generic *disk, const std::vector<uint8> &data)
+{
+	std::vector<uint8> buf(data.size());
+	return disk->read(&buf[0], 0, buf.size()) == buf.size() && buf == data;
+}
+
+static disk_generic *open_overlay(const char *path)
+{
+	disk_generic *disk = NULL;
+	return disk_overlay_factory(path, false, &disk) == disk_generic::DISK_VALID ? disk : NULL;
+}
+
+#define CHECK(cond) do { if (!(cond)) { fprintf(stderr, "FAILED: %s (line %d)\n", #cond, __LINE__); return 1; } } while (0)
+
+int main(int argc, char **argv)
+{
+	int ops = argc > 1 ? atoi(argv[1]) : 20000;
+
+	char dir[] = "/tmp/disk_overlay_test.XXXXXX";
+	CHECK(mkdtemp(dir) != NULL);
+	std::string a = std::string(dir) + "/a", b = std::string(dir) + "/b";
+	std::string image_a = a + "/disk.img", image_b = b + "/disk.img";
+	snprintf(overlay_dir, sizeof(overlay_dir), "%s/overlays", dir);
+	CHECK(mkdir(a.c_str(), 0755) == 0 && mkdir(b.c_str(), 0755) == 0 && mkdir(overlay_dir, 0755) == 0);
+
+	// Two images with the same name, size and mtime, not a multiple of the block size
+	srand(1);
+	std::vector<uint8> orig_a(4 * 1024 * 1024 + 300), orig_b(orig_a.size());
+	for (size_t i = 0; i < orig_a.size(); i++) {
+		orig_a[i] = rand();
+		orig_b[i] = rand();
+	}
+	CHECK(write_file(image_a.c_str(), orig_a) && write_file(image_b.c_str(), orig_b));
+
+	// Random reads and writes
+	disk_generic *disk = open_overlay(image_a.c_str());
+	CHECK(disk != NULL);
+	std::vector<uint8> ref = orig_a, buf(64 * 1024);
+	for (int i = 0; i < ops; i++) {
+		loff_t offset = rand() % (ref.size() + 1000);
+		size_t length = rand() % (i % 10 ? 2000 : buf.size());
+		size_t expected = offset >= (loff_t)ref.size() ? 0 : std::min(length, (size_t)(ref.size() - offset));
+		if (rand() % 2) {
+			for (size_t j = 0; j < length; j++)
+				buf[j] = rand();
+			CHECK(disk->write(&buf[0], offset, length) == expected);
+			if (expected)
+				memcpy(&ref[offset], &buf[0], expected);
+		} else {
+			CHECK(disk->read(&buf[0], offset, length) == expected);
+			CHECK(expected == 0 || memcmp(&buf[0], &ref[offset], expected) == 0);
+		}
+	}
+	CHECK(same_as_disk(disk, ref));
+	delete disk;
+
+	// Reopened overlay has the writes, image files are untouched
+	disk = open_overlay(image_a.c_str());
+	CHECK(disk != NULL && same_as_disk(disk, ref));
+	delete disk;
+	CHECK(same_as_file(image_a.c_str(), orig_a) && same_as_file(image_b.c_str(), orig_b));
+
+	// The other image doesn't see them
+	disk = open_overlay(image_b.c_str());
+	CHECK(disk != NULL && same_as_disk(disk, orig_b));
+	delete disk;
+
+	// An overlay is refused once its image was changed
+	orig_a[0] ^= 1;
+	CHECK(write_file(image_a.c_str(), orig_a));
+	struct utimbuf t = {1000000001, 1000000001};
+	CHECK(utime(image_a.c_str(), &t) == 0);
+	CHECK(open_overlay(image_a.c_str()) == NULL);
+
+	std::string cmd = std::string("rm -rf ") + dir;
+	system(cmd.c_str());
+	printf("disk_overlay_test: %d operations OK\n", ops);
+	return 0;
+}
+#endif
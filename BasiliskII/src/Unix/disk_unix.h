@@ -44,5 +44,8 @@ typedef disk_generic::status (disk_factory)(const char *path, bool read_only,
 
 extern disk_factory disk_sparsebundle_factory;
 extern disk_factory disk_vhd_factory;
+extern disk_factory disk_overlay_factory;
+
+extern bool disk_overlay_wanted(const char *path);
 
 #endif
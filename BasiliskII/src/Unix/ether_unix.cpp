@@ -76,6 +76,7 @@
 #include "user_strings.h"
 #include "ether.h"
 #include "ether_defs.h"
+#include "replay.h"
 
 #ifndef NO_STD_NAMESPACE
 using std::map;
@@ -584,6 +585,9 @@ int16 ether_del_multicast(uint32 pb)
 // Transmit one packet
 int16 ether_write(uint32 wds)
 {
+	// Don't repeat recorded traffic on the real network
+	if (ReplayPlaying)
+		return noErr;
 	return ether_do_write(wds);
 }
 
@@ -918,8 +922,10 @@ void ether_do_interrupt(void)
 			struct sockaddr_in from;
 			socklen_t from_len = sizeof(from);
 			length = recvfrom(fd, Mac2HostAddr(packet), 1514, 0, (struct sockaddr *)&from, &from_len);
+			length = ReplayRead(REPLAY_ETHER, Mac2HostAddr(packet), length, 1514);
 			if (length < 14)
 				break;
+			ReplayBytes(REPLAY_ETHER, &from, sizeof(from));
 			ether_udp_read(packet, length, &from);
 
 		} else
@@ -928,10 +934,12 @@ void ether_do_interrupt(void)
 
 			// Read packet from sheep_net device
 #if defined(__linux__)
-			length = read(fd, Mac2HostAddr(packet), net_if_type == NET_IF_ETHERTAP ? 1516 : 1514);
+			const uint32 packet_size = net_if_type == NET_IF_ETHERTAP ? 1516 : 1514;
 #else
-			length = read(fd, Mac2HostAddr(packet), 1514);
+			const uint32 packet_size = 1514;
 #endif
+			length = read(fd, Mac2HostAddr(packet), packet_size);
+			length = ReplayRead(REPLAY_ETHER, Mac2HostAddr(packet), length, packet_size);
 			if (length < 14)
 				break;
 
@@ -27,9 +27,26 @@
 #include <errno.h>
 #include <utime.h>
 
+#include <map>
+#include <set>
+#include <string>
+
 #include "sysdeps.h"
+#include "prefs.h"
 #include "extfs.h"
 #include "extfs_defs.h"
+#include "bench.h"
+
+#if SUPPORTS_EXTFS_WATCH
+#include <sys/inotify.h>
+#include <pthread.h>
+#endif
+
+// Finder info in extended attributes (Linux API)
+#if defined(HAVE_SYS_XATTR_H) && defined(__linux__)
+#include <sys/xattr.h>
+#define SUPPORTS_XATTR_FINFO 1
+#endif
 
 #define DEBUG 0
 #include "debug.h"
@@ -38,6 +55,30 @@
 // Default Finder flags
 const uint16 DEFAULT_FINDER_FLAGS = kHasBeenInited;
 
+// Where Finder info is kept ("extfsmeta" pref)
+enum {
+	META_FILES,		// Helper files, looked up on every access
+	META_CACHE,		// Helper files, with cached helper directory contents
+	META_XATTR		// Extended attribute, resource forks in cached helper files
+};
+static int meta_mode = META_CACHE;
+
+#if SUPPORTS_XATTR_FINFO
+// Same name and layout (FInfo/DInfo followed by FXInfo/DXInfo) as Mac OS X
+static const char XATTR_FINFO[] = "user.com.apple.FinderInfo";
+#endif
+
+static void helper_cache_clear(void);
+#if SUPPORTS_EXTFS_WATCH
+static void watch_exit(void);
+#endif
+
+// Count system calls made for Finder info and resource fork lookups
+static inline void meta_syscall(void)
+{
+	BenchIO(BENCH_EXTFS_META_SYSCALL, 0);
+}
+
 
 /*
  *  Initialization
@@ -45,6 +86,19 @@ const uint16 DEFAULT_FINDER_FLAGS = kHasBeenInited;
 
 void extfs_init(void)
 {
+	const char *mode = PrefsFindString("extfsmeta");
+	if (mode == NULL || strcmp(mode, "cache") == 0)
+		meta_mode = META_CACHE;
+	else if (strcmp(mode, "files") == 0)
+		meta_mode = META_FILES;
+#if SUPPORTS_XATTR_FINFO
+	else if (strcmp(mode, "xattr") == 0)
+		meta_mode = META_XATTR;
+#endif
+	else {
+		fprintf(stderr, "WARNING: Unknown extfsmeta mode '%s', using \"cache\"\n", mode);
+		meta_mode = META_CACHE;
+	}
 }
 
 
@@ -54,6 +108,10 @@ void extfs_init(void)
 
 void extfs_exit(void)
 {
+	helper_cache_clear();
+#if SUPPORTS_EXTFS_WATCH
+	watch_exit();
+#endif
 }
 
 
@@ -81,7 +139,9 @@ void add_path_component(char *path, const char *component)
  *    /path/.rsrc/file
  *
  *  The .finf files store a FInfo/DInfo, followed by a FXInfo/DXInfo
- *  (16+16 bytes)
+ *  (16+16 bytes). With "extfsmeta xattr", Finder info is kept in an
+ *  extended attribute of the file instead, .finf files are moved there
+ *  when they are read or written.
  */
 
 static void make_helper_path(const char *src, char *dest, const char *add, bool only_dir = false)
@@ -116,6 +176,436 @@ static int create_helper_dir(const char *path, const char *add)
 	return mkdir(helper_dir, 0777);
 }
 
+
+/*
+ *  Host directory watcher: a thread reads inotify events and gives each
+ *  watched directory in which an entry was created, deleted or renamed a
+ *  new generation number. Whoever caches the contents of a directory
+ *  remembers the generation it read and asks extfs_dir_changed() before
+ *  using them again. The thread is started with the first watch.
+ *
+ *  Open files whose contents are buffered are watched for writes the same
+ *  way, by inode, so that forks opened more than once share a watch.
+ */
+
+#if SUPPORTS_EXTFS_WATCH
+struct watched_dir {
+	int wd;				// inotify watch descriptor
+	uint32 generation;	// Changes when an entry is created, deleted or renamed
+};
+
+typedef std::map<std::string, watched_dir> watched_dir_map;
+static watched_dir_map watched_dirs;			// Indexed by path
+static std::map<int, std::string> watch_paths;	// Path of watch descriptor
+
+struct watched_file {
+	uint32 generation;	// Changes when the file is written to
+	int refs;			// Users of the watch
+};
+
+typedef std::map<int, watched_file> watched_file_map;
+static watched_file_map watched_files;			// Indexed by watch descriptor
+static uint32 watch_generation = 0;
+static pthread_mutex_t watch_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int inotify_fd = -1;
+static bool watch_started = false;
+static pthread_t watch_thread;
+static pthread_attr_t watch_thread_attr;
+static bool watch_thread_active = false;
+
+const int WATCH_MAX_DIRS = 4096;
+const uint32 WATCH_EVENTS = IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR;
+const int WATCH_MAX_FILES = 1024;
+const uint32 WATCH_FILE_EVENTS = IN_MODIFY;
+
+// Paths with and without trailing "/" are the same directory
+static std::string watch_key(const char *path)
+{
+	std::string key = path;
+	while (key.size() > 1 && key[key.size() - 1] == '/')
+		key.erase(key.size() - 1);
+	return key;
+}
+
+static void *watch_func(void *arg)
+{
+	char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+	for (;;) {
+		ssize_t length = read(inotify_fd, buf, sizeof(buf));
+		if (length < 0 && errno == EINTR)
+			continue;
+		if (length <= 0)
+			break;
+
+		pthread_mutex_lock(&watch_lock);
+		for (char *p = buf; p < buf + length; ) {
+			const struct inotify_event *ev = (const struct inotify_event *)p;
+			p += sizeof(struct inotify_event) + ev->len;
+
+			if (ev->mask & IN_Q_OVERFLOW) {
+				// Events were lost, all directories and files count as changed
+				D(bug("inotify queue overflow\n"));
+				watched_dirs.clear();
+				watch_paths.clear();
+				for (watched_file_map::iterator f = watched_files.begin(); f != watched_files.end(); ++f)
+					f->second.generation = ++watch_generation;
+				continue;
+			}
+
+			watched_file_map::iterator f = watched_files.find(ev->wd);
+			if (f != watched_files.end()) {
+				f->second.generation = ++watch_generation;
+				continue;
+			}
+
+			std::map<int, std::string>::iterator it = watch_paths.find(ev->wd);
+			if (it == watch_paths.end())
+				continue;
+			if (ev->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED)) {
+				// Directory is gone, or is somewhere else now
+				D(bug("no longer watching %s\n", it->second.c_str()));
+				if (ev->mask & IN_MOVE_SELF)
+					inotify_rm_watch(inotify_fd, ev->wd);
+				watched_dirs.erase(it->second);
+				watch_paths.erase(it);
+			} else
+				watched_dirs[it->second].generation = ++watch_generation;
+		}
+		pthread_mutex_unlock(&watch_lock);
+	}
+	return NULL;
+}
+
+static bool watch_init(void)
+{
+	inotify_fd = inotify_init();
+	if (inotify_fd < 0)
+		return false;
+	Set_pthread_attr(&watch_thread_attr, 0);
+	watch_thread_active = (pthread_create(&watch_thread, &watch_thread_attr, watch_func, NULL) == 0);
+	if (!watch_thread_active) {
+		close(inotify_fd);
+		inotify_fd = -1;
+		return false;
+	}
+	return true;
+}
+
+static void watch_exit(void)
+{
+	if (watch_thread_active) {
+#ifdef HAVE_PTHREAD_CANCEL
+		pthread_cancel(watch_thread);
+#endif
+		pthread_join(watch_thread, NULL);
+		watch_thread_active = false;
+	}
+	if (inotify_fd >= 0) {
+		close(inotify_fd);
+		inotify_fd = -1;
+	}
+	watched_dirs.clear();
+	watch_paths.clear();
+	watched_files.clear();
+	watch_started = false;
+}
+
+static bool watch_start(void)
+{
+	if (!watch_started) {
+		watch_started = true;
+		if (!watch_init())
+			fprintf(stderr, "WARNING: Cannot watch ExtFS directories, %s\n", strerror(errno));
+	}
+	return watch_thread_active;
+}
+
+/*
+ *  Start watching directory "path" (if it isn't watched already) and get
+ *  its current generation, returns false if it can't be watched
+ */
+
+bool extfs_watch_dir(const char *path, uint32 &generation)
+{
+	if (!watch_start())
+		return false;
+
+	std::string key = watch_key(path);
+	bool watched = true;
+	pthread_mutex_lock(&watch_lock);
+	watched_dir_map::iterator it = watched_dirs.find(key);
+	if (it != watched_dirs.end())
+		generation = it->second.generation;
+	else if (watched_dirs.size() >= WATCH_MAX_DIRS)
+		watched = false;
+	else {
+		int wd = inotify_add_watch(inotify_fd, key.c_str(), WATCH_EVENTS);
+		if (wd < 0)
+			watched = false;
+		else {
+			// Same directory known under another path (renamed)?
+			std::map<int, std::string>::iterator w = watch_paths.find(wd);
+			if (w != watch_paths.end())
+				watched_dirs.erase(w->second);
+			watch_paths[wd] = key;
+			watched_dir &d = watched_dirs[key];
+			d.wd = wd;
+			d.generation = ++watch_generation;
+			generation = d.generation;
+		}
+	}
+	pthread_mutex_unlock(&watch_lock);
+	return watched;
+}
+
+/*
+ *  Was an entry of directory "path" created, deleted or renamed since
+ *  "generation"? Always true if the directory isn't watched.
+ */
+
+bool extfs_dir_changed(const char *path, uint32 generation)
+{
+	if (!watch_thread_active)
+		return true;
+	std::string key = watch_key(path);
+	pthread_mutex_lock(&watch_lock);
+	watched_dir_map::iterator it = watched_dirs.find(key);
+	bool changed = it == watched_dirs.end() || it->second.generation != generation;
+	pthread_mutex_unlock(&watch_lock);
+	return changed;
+}
+
+/*
+ *  Start watching open file "fd" for writes, returns the watch or -1
+ */
+
+int extfs_watch_file(int fd)
+{
+	struct stat st;
+	if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode) || !watch_start())
+		return -1;
+
+	char path[64];
+	sprintf(path, "/proc/self/fd/%d", fd);
+	int wd = -1;
+	pthread_mutex_lock(&watch_lock);
+	if (watched_files.size() < WATCH_MAX_FILES) {
+		wd = inotify_add_watch(inotify_fd, path, WATCH_FILE_EVENTS);
+		if (wd >= 0) {
+			watched_file &f = watched_files[wd];
+			if (f.refs++ == 0)
+				f.generation = ++watch_generation;
+		}
+	}
+	pthread_mutex_unlock(&watch_lock);
+	return wd;
+}
+
+void extfs_unwatch_file(int wd)
+{
+	pthread_mutex_lock(&watch_lock);
+	watched_file_map::iterator it = watched_files.find(wd);
+	if (it != watched_files.end() && --it->second.refs == 0) {
+		inotify_rm_watch(inotify_fd, wd);
+		watched_files.erase(it);
+	}
+	pthread_mutex_unlock(&watch_lock);
+}
+
+// Current generation of watched file, take it before reading the file
+uint32 extfs_file_generation(int wd)
+{
+	pthread_mutex_lock(&watch_lock);
+	watched_file_map::iterator it = watched_files.find(wd);
+	uint32 generation = it == watched_files.end() ? 0 : it->second.generation;
+	pthread_mutex_unlock(&watch_lock);
+	return generation;
+}
+
+// Was the file written to since "generation"?
+bool extfs_file_changed(int wd, uint32 generation)
+{
+	return generation == 0 || extfs_file_generation(wd) != generation;
+}
+#endif
+
+
+/*
+ *  Cache of the helper directory contents, so that looking up the Finder
+ *  info or resource fork of a file that has none (most files) doesn't
+ *  touch the disk. With the directory watcher, the cached contents stay
+ *  valid until a helper file is created, deleted or renamed. Otherwise
+ *  they are checked against the modification times of the helper
+ *  directories at most once a second, changes made by other programs
+ *  show up after that.
+ */
+
+struct helper_names {
+	std::set<std::string> names;	// Files in the helper directory
+	time_t mtime;					// Modification time, -1 = no helper directory
+#if SUPPORTS_EXTFS_WATCH
+	bool watched;					// Changes are reported by the watcher
+	std::string watch_path;			// Helper directory, or its parent if there is none
+	uint32 generation;				// Generation of watch_path when read
+#endif
+};
+
+struct helper_dir_cache {
+	helper_names finf, rsrc;
+	uint64 checked;					// GetTicks_usec() of last check
+};
+
+typedef std::map<std::string, helper_dir_cache> helper_cache_map;
+static helper_cache_map helper_cache;
+
+const int HELPER_CACHE_MAX_DIRS = 256;			// Cached directories
+const uint64 HELPER_CACHE_CHECK_USEC = 1000000;	// Check interval
+
+static void helper_cache_clear(void)
+{
+	helper_cache.clear();
+}
+
+// Split path into directory (with trailing "/", as make_helper_path()) and last component
+static void split_path(const char *path, std::string &dir, std::string &name)
+{
+	const char *last_part = strrchr(path, '/');
+	if (last_part)
+		last_part++;
+	else
+		last_part = path;
+	dir.assign(path, last_part - path);
+	name.assign(last_part);
+}
+
+static time_t helper_dir_mtime(const std::string &dir, const char *add)
+{
+	struct stat st;
+	meta_syscall();
+	if (stat((dir + add).c_str(), &st) < 0)
+		return -1;
+	return st.st_mtime;
+}
+
+static void read_helper_dir(const std::string &dir, const char *add, helper_names &h)
+{
+	h.names.clear();
+	h.mtime = -1;
+#if SUPPORTS_EXTFS_WATCH
+	// Watch before reading, so nothing that happens in between is missed
+	h.watch_path = dir + add;
+	h.watched = extfs_watch_dir(h.watch_path.c_str(), h.generation);
+	if (!h.watched && errno == ENOENT) {
+		h.watch_path = dir;
+		h.watched = extfs_watch_dir(h.watch_path.c_str(), h.generation);
+	}
+#endif
+	meta_syscall();
+	DIR *d = opendir((dir + add).c_str());
+	if (d == NULL)
+		return;
+	struct stat st;
+	if (fstat(dirfd(d), &st) == 0) {
+		// Changes in the same second wouldn't change the time, read it again next time
+		h.mtime = st.st_mtime;
+		if (h.mtime >= time(NULL))
+			h.mtime = -2;
+	}
+	struct dirent *de;
+	while ((de = readdir(d)) != NULL) {
+		if (strcmp(de->d_name, ".") && strcmp(de->d_name, ".."))
+			h.names.insert(de->d_name);
+	}
+	closedir(d);
+}
+
+static bool helper_dir_changed(const std::string &dir, const char *add, helper_names &h)
+{
+#if SUPPORTS_EXTFS_WATCH
+	if (h.watched)
+		return extfs_dir_changed(h.watch_path.c_str(), h.generation);
+#endif
+	return helper_dir_mtime(dir, add) != h.mtime;
+}
+
+static bool helper_dir_watched(helper_dir_cache &c)
+{
+#if SUPPORTS_EXTFS_WATCH
+	return c.finf.watched && c.rsrc.watched;
+#else
+	return false;
+#endif
+}
+
+// Get cached helper directory contents for directory "dir"
+static helper_dir_cache *get_helper_dir(const std::string &dir)
+{
+	uint64 now = GetTicks_usec();
+	helper_cache_map::iterator it = helper_cache.find(dir);
+	if (it != helper_cache.end()) {
+		helper_dir_cache &c = it->second;
+		if (!helper_dir_watched(c) && now - c.checked < HELPER_CACHE_CHECK_USEC)
+			return &c;
+		c.checked = now;
+		if (helper_dir_changed(dir, ".finf", c.finf))
+			read_helper_dir(dir, ".finf", c.finf);
+		if (helper_dir_changed(dir, ".rsrc", c.rsrc))
+			read_helper_dir(dir, ".rsrc", c.rsrc);
+		return &c;
+	}
+
+	if (helper_cache.size() >= HELPER_CACHE_MAX_DIRS)
+		helper_cache.clear();
+	helper_dir_cache &c = helper_cache[dir];
+	c.checked = now;
+	read_helper_dir(dir, ".finf", c.finf);
+	read_helper_dir(dir, ".rsrc", c.rsrc);
+	return &c;
+}
+
+static helper_names &helper_dir_names(helper_dir_cache *c, const char *add)
+{
+	return add[1] == 'f' ? c->finf : c->rsrc;
+}
+
+// Does the helper file exist? Always true if helper directories aren't cached.
+static bool helper_exists(const char *path, const char *add)
+{
+	if (meta_mode == META_FILES)
+		return true;
+	std::string dir, name;
+	split_path(path, dir, name);
+	helper_names &h = helper_dir_names(get_helper_dir(dir), add);
+	return h.names.count(name) != 0;
+}
+
+// Helper file was created or removed by us
+static void helper_changed(const char *path, const char *add, bool exists)
+{
+	std::string dir, name;
+	split_path(path, dir, name);
+	helper_cache_map::iterator it = helper_cache.find(dir);
+	if (it == helper_cache.end())
+		return;
+	helper_names &h = helper_dir_names(&it->second, add);
+	if (exists)
+		h.names.insert(name);
+	else
+		h.names.erase(name);
+}
+
+// Forget cached contents of directory "path" and everything below it
+static void helper_cache_forget(const char *path)
+{
+	std::string prefix = path;
+	if (prefix.empty() || prefix[prefix.size() - 1] != '/')
+		prefix += '/';
+	helper_cache_map::iterator it = helper_cache.lower_bound(prefix);
+	while (it != helper_cache.end() && it->first.compare(0, prefix.size(), prefix) == 0)
+		helper_cache.erase(it++);
+}
+
 static int open_helper(const char *path, const char *add, int flag)
 {
 	char helper_path[MAX_PATH_LENGTH];
@@ -123,6 +613,11 @@ static int open_helper(const char *path, const char *add, int flag)
 
 	if ((flag & O_ACCMODE) == O_RDWR || (flag & O_ACCMODE) == O_WRONLY)
 		flag |= O_CREAT;
+	else if (!helper_exists(path, add)) {
+		errno = ENOENT;
+		return -1;
+	}
+	meta_syscall();
 	int fd = open(helper_path, flag, 0666);
 	if (fd < 0) {
 		if (errno == ENOENT && (flag & O_CREAT)) {
@@ -134,6 +629,8 @@ static int open_helper(const char *path, const char *add, int flag)
 			fd = open(helper_path, flag, 0666);
 		}
 	}
+	if (fd >= 0 && (flag & O_CREAT))
+		helper_changed(path, add, true);
 	return fd;
 }
 
@@ -219,6 +716,50 @@ static const ext2type e2t_translation[] = {
 	{NULL, 0, 0}	// End marker
 };
 
+// Read Finder info file, returns false if there is none
+static bool read_finf(const char *path, uint8 *info)
+{
+	memset(info, 0, SIZEOF_FInfo + SIZEOF_FXInfo);
+	int fd = open_finf(path, O_RDONLY);
+	if (fd < 0)
+		return false;
+	meta_syscall();
+	ssize_t actual = read(fd, info, SIZEOF_FInfo + SIZEOF_FXInfo);
+	close(fd);
+	return actual >= SIZEOF_FInfo;
+}
+
+#if SUPPORTS_XATTR_FINFO
+// Read Finder info attribute, returns false if there is none
+static bool get_finfo_xattr(const char *path, uint8 *info)
+{
+	meta_syscall();
+	return getxattr(path, XATTR_FINFO, info, SIZEOF_FInfo + SIZEOF_FXInfo) == SIZEOF_FInfo + SIZEOF_FXInfo;
+}
+
+// Write Finder info attribute, returns false if the file system doesn't support it
+static bool set_finfo_xattr(const char *path, const uint8 *info)
+{
+	meta_syscall();
+	if (setxattr(path, XATTR_FINFO, info, SIZEOF_FInfo + SIZEOF_FXInfo, 0) == 0)
+		return true;
+	D(bug("setxattr failed on %s (%s)\n", path, strerror(errno)));
+	return false;
+}
+
+// Remove Finder info file after moving it to the attribute
+static void remove_finf(const char *path)
+{
+	if (!helper_exists(path, ".finf/"))
+		return;
+	char helper_path[MAX_PATH_LENGTH];
+	make_helper_path(path, helper_path, ".finf/");
+	meta_syscall();
+	if (unlink(helper_path) == 0)
+		helper_changed(path, ".finf/", false);
+}
+#endif
+
 void get_finfo(const char *path, uint32 finfo, uint32 fxinfo, bool is_dir)
 {
 	// Set default finder info
@@ -228,15 +769,25 @@ void get_finfo(const char *path, uint32 finfo, uint32 fxinfo, bool is_dir)
 	WriteMacInt16(finfo + fdFlags, DEFAULT_FINDER_FLAGS);
 	WriteMacInt32(finfo + fdLocation, (uint32)-1);
 
-	// Read Finder info file
-	int fd = open_finf(path, O_RDONLY);
-	if (fd >= 0) {
-		ssize_t actual = read(fd, Mac2HostAddr(finfo), SIZEOF_FInfo);
+	// Read Finder info attribute or file
+	uint8 info[SIZEOF_FInfo + SIZEOF_FXInfo];
+	bool found = false;
+#if SUPPORTS_XATTR_FINFO
+	if (meta_mode == META_XATTR)
+		found = get_finfo_xattr(path, info);
+#endif
+	if (!found && read_finf(path, info)) {
+		found = true;
+#if SUPPORTS_XATTR_FINFO
+		if (meta_mode == META_XATTR && set_finfo_xattr(path, info))
+			remove_finf(path);
+#endif
+	}
+	if (found) {
+		Host2Mac_memcpy(finfo, info, SIZEOF_FInfo);
 		if (fxinfo)
-			actual += read(fd, Mac2HostAddr(fxinfo), SIZEOF_FXInfo);
-		close(fd);
-		if (actual >= SIZEOF_FInfo)
-			return;
+			Host2Mac_memcpy(fxinfo, info + SIZEOF_FInfo, SIZEOF_FXInfo);
+		return;
 	}
 
 	// No Finder info file, translate file name extension to MacOS type/creator
@@ -265,12 +816,30 @@ void set_finfo(const char *path, uint32 finfo, uint32 fxinfo, bool is_dir)
 		D(bug("utime failed on %s\n", path));
 	}
 
+#if SUPPORTS_XATTR_FINFO
+	// Write Finder info attribute, keeping the extended Finder info if none is given
+	if (meta_mode == META_XATTR) {
+		uint8 info[SIZEOF_FInfo + SIZEOF_FXInfo];
+		if (fxinfo)
+			Mac2Host_memcpy(info + SIZEOF_FInfo, fxinfo, SIZEOF_FXInfo);
+		else if (!get_finfo_xattr(path, info))
+			read_finf(path, info);
+		Mac2Host_memcpy(info, finfo, SIZEOF_FInfo);
+		if (set_finfo_xattr(path, info)) {
+			remove_finf(path);
+			return;
+		}
+		// No extended attributes on this file system, use the Finder info file
+	}
+#endif
+
 	// Open Finder info file
 	int fd = open_finf(path, O_RDWR);
 	if (fd < 0)
 		return;
 
 	// Write file
+	meta_syscall();
 	write(fd, Mac2HostAddr(finfo), SIZEOF_FInfo);
 	if (fxinfo)
 		write(fd, Mac2HostAddr(fxinfo), SIZEOF_FXInfo);
@@ -284,17 +853,17 @@ void set_finfo(const char *path, uint32 finfo, uint32 fxinfo, bool is_dir)
 
 uint32 get_rfork_size(const char *path)
 {
-	// Open resource file
-	int fd = open_rsrc(path, O_RDONLY);
-	if (fd < 0)
+	if (!helper_exists(path, ".rsrc/"))
 		return 0;
 
-	// Get size
-	off_t size = lseek(fd, 0, SEEK_END);
-	
-	// Close file and return size
-	close(fd);
-	return size < 0 ? 0 : size;
+	// Get size of resource file
+	char helper_path[MAX_PATH_LENGTH];
+	make_helper_path(path, helper_path, ".rsrc/");
+	struct stat st;
+	meta_syscall();
+	if (stat(helper_path, &st) < 0)
+		return 0;
+	return st.st_size;
 }
 
 int open_rfork(const char *path, int flag)
@@ -309,24 +878,24 @@ void close_rfork(const char *path, int fd)
 
 
 /*
- *  Read "length" bytes from file to "buffer",
+ *  Read "length" bytes at "offset" from file to "buffer",
  *  returns number of bytes read (or -1 on error)
  */
 
-ssize_t extfs_read(int fd, void *buffer, size_t length)
+ssize_t extfs_read(int fd, void *buffer, size_t length, off_t offset)
 {
-	return read(fd, buffer, length);
+	return pread(fd, buffer, length, offset);
 }
 
 
 /*
- *  Write "length" bytes from "buffer" to file,
+ *  Write "length" bytes from "buffer" to file at "offset",
  *  returns number of bytes written (or -1 on error)
  */
 
-ssize_t extfs_write(int fd, void *buffer, size_t length)
+ssize_t extfs_write(int fd, void *buffer, size_t length, off_t offset)
 {
-	return write(fd, buffer, length);
+	return pwrite(fd, buffer, length, offset);
 }
 
 
@@ -341,8 +910,11 @@ bool extfs_remove(const char *path)
 	char helper_path[MAX_PATH_LENGTH];
 	make_helper_path(path, helper_path, ".finf/", false);
 	remove(helper_path);
+	helper_changed(path, ".finf/", false);
 	make_helper_path(path, helper_path, ".rsrc/", false);
 	remove(helper_path);
+	helper_changed(path, ".rsrc/", false);
+	helper_cache_forget(path);
 
 	// Now remove file or directory (and helper directories in the directory)
 	if (remove(path) < 0) {
@@ -381,6 +953,14 @@ bool extfs_rename(const char *old_path, const char *new_path)
 	create_helper_dir(new_path, ".rsrc/");
 	rename(old_helper_path, new_helper_path);
 
+	// Forget cached helper directories of both places
+	std::string dir, name;
+	split_path(old_path, dir, name);
+	helper_cache.erase(dir);
+	helper_cache_forget(old_path);
+	split_path(new_path, dir, name);
+	helper_cache.erase(dir);
+
 	// Now rename file
 	return rename(old_path, new_path) == 0;
 }
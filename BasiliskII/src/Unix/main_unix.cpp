@@ -31,7 +31,7 @@
 # include <SDL_main.h>
 #endif
 
-#ifndef USE_SDL_VIDEO
+#if !defined(USE_SDL_VIDEO) && !defined(USE_HEADLESS_VIDEO)
 # include <X11/Xlib.h>
 #endif
 
@@ -89,6 +89,10 @@ using std::string;
 #include "vm_alloc.h"
 #include "sigsegv.h"
 #include "rpc.h"
+#include "snapshot.h"
+#include "replay.h"
+#include "bench.h"
+#include "startup.h"
 
 #if USE_JIT
 extern void flush_icache_range(uint8 *start, uint32 size); // from compemu_support.cpp
@@ -129,7 +133,7 @@ bool TwentyFourBitAddressing;
 
 
 // Global variables
-#ifndef USE_SDL_VIDEO
+#if !defined(USE_SDL_VIDEO) && !defined(USE_HEADLESS_VIDEO)
 extern char *x_display_name;						// X11 display name
 extern Display *x_display;							// X11 display handle
 #ifdef X11_LOCK_TYPE
@@ -137,17 +141,11 @@ X11_LOCK_TYPE x_display_lock = X11_LOCK_INIT;		// X11 display lock
 #endif
 #endif
 
-static uint8 last_xpram[XPRAM_SIZE];				// Buffer for monitoring XPRAM changes
-
 #ifdef HAVE_PTHREADS
 #if !EMULATED_68K
 static pthread_t emul_thread;						// Handle of MacOS emulation thread (main thread)
 #endif
 
-static bool xpram_thread_active = false;			// Flag: XPRAM watchdog installed
-static volatile bool xpram_thread_cancel = false;	// Flag: Cancel XPRAM thread
-static pthread_t xpram_thread;						// XPRAM watchdog
-
 static bool tick_thread_active = false;				// Flag: 60Hz thread installed
 static volatile bool tick_thread_cancel = false;	// Flag: Cancel 60Hz thread
 static pthread_t tick_thread;						// 60Hz thread
@@ -190,6 +188,12 @@ static struct sigaction sigint_sa;	// sigaction for SIGINT handler
 static void sigint_handler(...);
 #endif
 
+#if EMULATED_68K
+static struct sigaction sigusr2_sa;				// sigaction for SIGUSR2 handler
+static volatile bool snapshot_requested = false;	// Flag: SIGUSR2 received, save snapshot
+static void sigusr2_handler(int sig);
+#endif
+
 #if REAL_ADDRESSING
 static bool lm_area_mapped = false;	// Flag: Low Memory area mmap()ped
 #endif
@@ -199,7 +203,6 @@ static const char *gui_connection_path = NULL;	// GUI connection identifier
 
 
 // Prototypes
-static void *xpram_func(void *arg);
 static void *tick_func(void *arg);
 static void one_tick(...);
 #if !EMULATED_68K
@@ -232,14 +235,14 @@ char *strdup(const char *s)
  */
 
 // NOTE: VM_MAP_32BIT is only used when compiling a 64-bit JIT on specific platforms
-void *vm_acquire_mac(size_t size)
+void *vm_acquire_mac(size_t size, int options = 0)
 {
-	return vm_acquire(size, VM_MAP_DEFAULT | VM_MAP_32BIT);
+	return vm_acquire(size, VM_MAP_DEFAULT | VM_MAP_32BIT | options);
 }
 
-static int vm_acquire_mac_fixed(void *addr, size_t size)
+static int vm_acquire_mac_fixed(void *addr, size_t size, int options = 0)
 {
-	return vm_acquire_fixed(addr, size, VM_MAP_DEFAULT | VM_MAP_32BIT);
+	return vm_acquire_fixed(addr, size, VM_MAP_DEFAULT | VM_MAP_32BIT | options);
 }
 
 
@@ -341,6 +344,7 @@ void cpu_do_check_ticks(void)
 		do {
 			next += 16625;
 		} while (next < now);
+		next = VideoAlignTick(next);
 		emulated_ticks_count++;
 
 		// Recalibrate 1000 Hz quantum every 10 ticks
@@ -388,6 +392,7 @@ int main(int argc, char **argv)
 	char str[256];
 
 	// Initialize variables
+	StartupTraceInit();
 	RAMBaseHost = NULL;
 	ROMBaseHost = NULL;
 	srand(time(NULL));
@@ -401,7 +406,7 @@ int main(int argc, char **argv)
 	for (int i=1; i<argc; i++) {
 		if (strcmp(argv[i], "--help") == 0) {
 			usage(argv[0]);
-#ifndef USE_SDL_VIDEO
+#if !defined(USE_SDL_VIDEO) && !defined(USE_HEADLESS_VIDEO)
 		} else if (strcmp(argv[i], "--display") == 0) {
 			i++; // don't remove the argument, gtk_init() needs it too
 			if (i < argc)
@@ -491,7 +496,9 @@ int main(int argc, char **argv)
 #endif
 
 	// Read preferences
+	int phase = StartupPhaseBegin("PrefsInit");
 	PrefsInit(vmdir, argc, argv);
+	StartupPhaseEnd(phase);
 
 	// Any command line arguments left?
 	for (int i=1; i<argc; i++) {
@@ -501,9 +508,11 @@ int main(int argc, char **argv)
 		}
 	}
 
-#ifndef USE_SDL_VIDEO
+#if !defined(USE_SDL_VIDEO) && !defined(USE_HEADLESS_VIDEO)
 	// Open display
+	phase = StartupPhaseBegin("XOpenDisplay");
 	x_display = XOpenDisplay(x_display_name);
+	StartupPhaseEnd(phase);
 	if (x_display == NULL) {
 		char str[256];
 		sprintf(str, GetString(STR_NO_XSERVER_ERR), XDisplayName(x_display_name));
@@ -527,12 +536,14 @@ int main(int argc, char **argv)
 	sdl_flags |= SDL_INIT_AUDIO;
 #endif
 	assert(sdl_flags != 0);
+	phase = StartupPhaseBegin("SDL_Init");
 	if (SDL_Init(sdl_flags) == -1) {
 		char str[256];
 		sprintf(str, "Could not initialize SDL: %s.\n", SDL_GetError());
 		ErrorAlert(str);
 		QuitEmulator();
 	}
+	StartupPhaseEnd(phase);
 	atexit(SDL_Quit);
 
 #if __MACOSX__ && SDL_VERSION_ATLEAST(2,0,0)
@@ -584,8 +595,24 @@ int main(int argc, char **argv)
 #endif
 	
 	// Initialize VM system
+	phase = StartupPhaseBegin("RAM and ROM areas");
 	vm_init();
 
+	// Bind memory and threads to a NUMA node, before anything big is allocated
+	int32 numa_node = PrefsFindInt32("numanode");
+	if (numa_node >= 0 && vm_bind_numa_node(numa_node) < 0)
+		printf("WARNING: Cannot bind to NUMA node %d (%s)\n", numa_node, strerror(errno));
+
+	// Huge pages for RAM, they save TLB misses on random guest accesses
+	int ram_options = vm_huge_page_options(PrefsFindString("hugepages"));
+
+#if EMULATED_68K
+	// The checkpoint log wants the kernel to track written RAM pages (no huge pages then)
+	const char *checkpoint_path = PrefsFindString("checkpoint");
+	if (checkpoint_path && *checkpoint_path && PrefsFindInt32("checkpointinterval") > 0)
+		ram_options |= VM_MAP_WRITE_WATCH;
+#endif
+
 #if REAL_ADDRESSING
 	// Flag: RAM and ROM are contigously allocated from address 0
 	bool memory_mapped_from_zero = false;
@@ -600,7 +627,7 @@ int main(int argc, char **argv)
 #endif
 	
 	// Try to allocate all memory from 0x0000, if it is not known to crash
-	if (can_map_all_memory && (vm_acquire_mac_fixed(0, RAMSize + 0x100000) == 0)) {
+	if (can_map_all_memory && (vm_acquire_mac_fixed(0, RAMSize + 0x100000, ram_options) == 0)) {
 		D(bug("Could allocate RAM and ROM from 0x0000\n"));
 		memory_mapped_from_zero = true;
 	}
@@ -630,7 +657,9 @@ int main(int argc, char **argv)
 	else
 #endif
 	{
-		uint8 *ram_rom_area = (uint8 *)vm_acquire_mac(RAMSize + 0x100000);
+		uint8 *ram_rom_area = (uint8 *)vm_acquire_mac(RAMSize + 0x100000, ram_options);
+		if (ram_rom_area == VM_MAP_FAILED && (ram_options & VM_MAP_WRITE_WATCH))
+			ram_rom_area = (uint8 *)vm_acquire_mac(RAMSize + 0x100000, ram_options & ~VM_MAP_WRITE_WATCH);
 		if (ram_rom_area == VM_MAP_FAILED) {	
 			ErrorAlert(STR_NO_MEM_ERR);
 			QuitEmulator();
@@ -661,6 +690,7 @@ int main(int argc, char **argv)
 #endif
 	D(bug("Mac RAM starts at %p (%08x)\n", RAMBaseHost, RAMBaseMac));
 	D(bug("Mac ROM starts at %p (%08x)\n", ROMBaseHost, ROMBaseMac));
+	StartupPhaseEnd(phase);
 	
 #if __MACOSX__
 	extern void set_current_directory();
@@ -671,6 +701,7 @@ int main(int argc, char **argv)
 	const char *rom_path = PrefsFindString("rom");
 
 	// Load Mac ROM
+	phase = StartupPhaseBegin("ROM file");
 	int rom_fd = open(rom_path ? rom_path : ROM_FILE_NAME, O_RDONLY);
 	if (rom_fd < 0) {
 		ErrorAlert(STR_NO_ROM_FILE_ERR);
@@ -689,6 +720,7 @@ int main(int argc, char **argv)
 		close(rom_fd);
 		QuitEmulator();
 	}
+	StartupPhaseEnd(phase);
 
 #if !EMULATED_68K
 	// Get CPU model
@@ -719,9 +751,28 @@ int main(int argc, char **argv)
 	TwentyFourBitAddressing = false;
 #endif
 
+#if EMULATED_68K
+	// Open record or replay log, this turns off the JIT compiler
+	if (!ReplayInit()) {
+		const char *replay_path = PrefsFindString("replay");
+		sprintf(str, GetString(STR_REPLAY_ERR), replay_path && *replay_path ? replay_path : PrefsFindString("record"));
+		ErrorAlert(str);
+		QuitEmulator();
+	}
+
+	// Read benchmark script
+	if (!BenchInit()) {
+		sprintf(str, GetString(STR_BENCH_ERR), PrefsFindString("benchscript"));
+		ErrorAlert(str);
+		QuitEmulator();
+	}
+#endif
+
 	// Initialize everything
+	phase = StartupPhaseBegin("InitAll");
 	if (!InitAll(vmdir))
 		QuitEmulator();
+	StartupPhaseEnd(phase);
 	D(bug("Initialization complete\n"));
 
 #if !EMULATED_68K
@@ -783,6 +834,47 @@ int main(int argc, char **argv)
 	sigaction(SIGINT, &sigint_sa, NULL);
 #endif
 
+#if EMULATED_68K
+	// Resume from checkpoint log or snapshot file if there is one, instead of booting the ROM
+	const char *snapshot_path = PrefsFindString("snapshot");
+	if (checkpoint_path && *checkpoint_path && PrefsFindBool("resume") && access(checkpoint_path, F_OK) == 0) {
+		phase = StartupPhaseBegin("CheckpointLoad");
+		if (!CheckpointLoad(checkpoint_path)) {
+			sprintf(str, GetString(STR_SNAPSHOT_ERR), checkpoint_path);
+			ErrorAlert(str);
+			QuitEmulator();
+		}
+		StartupPhaseEnd(phase);
+		printf("Resumed from checkpoint log %s\n", checkpoint_path);
+		fflush(stdout);
+	} else if (snapshot_path && *snapshot_path && PrefsFindBool("resume") && access(snapshot_path, F_OK) == 0) {
+		phase = StartupPhaseBegin("SnapshotLoad");
+		if (!SnapshotLoad(snapshot_path)) {
+			sprintf(str, GetString(STR_SNAPSHOT_ERR), snapshot_path);
+			ErrorAlert(str);
+			QuitEmulator();
+		}
+		StartupPhaseEnd(phase);
+		printf("Resumed from snapshot %s\n", snapshot_path);
+		fflush(stdout);
+	}
+
+	// Setup SIGUSR2 handler to save a snapshot
+	sigemptyset(&sigusr2_sa.sa_mask);
+	sigusr2_sa.sa_handler = sigusr2_handler;
+	sigusr2_sa.sa_flags = SA_RESTART;
+	sigaction(SIGUSR2, &sigusr2_sa, NULL);
+
+	// Start writing checkpoint log
+	CheckpointInit();
+
+	// Start recording or replaying input from the current state
+	ReplayStart();
+
+	// Start benchmark script
+	BenchStart();
+#endif
+
 #ifndef USE_CPU_EMUL_SERVICES
 #if defined(HAVE_PTHREADS)
 
@@ -849,12 +941,11 @@ int main(int argc, char **argv)
 #endif
 #endif
 
-#ifdef USE_PTHREADS_SERVICES
-	// Start XPRAM watchdog thread
-	memcpy(last_xpram, XPRAM, XPRAM_SIZE);
-	xpram_thread_active = (pthread_create(&xpram_thread, NULL, xpram_func, NULL) == 0);
-	D(bug("XPRAM thread started\n"));
-#endif
+	// Write startup trace, it ends with the first instruction
+	StartupMark("first instruction");
+	const char *trace_path = PrefsFindString("startuptrace");
+	if (trace_path && *trace_path && !StartupTraceWrite(trace_path))
+		printf("WARNING: Cannot write startup trace to %s (%s)\n", trace_path, strerror(errno));
 
 	// Start 68k and jump to ROM boot routine
 	D(bug("Starting emulation...\n"));
@@ -903,15 +994,11 @@ void QuitEmulator(void)
 	setitimer(ITIMER_REAL, &req, NULL);
 #endif
 
-#ifdef USE_PTHREADS_SERVICES
-	// Stop XPRAM watchdog thread
-	if (xpram_thread_active) {
-		xpram_thread_cancel = true;
-#ifdef HAVE_PTHREAD_CANCEL
-		pthread_cancel(xpram_thread);
-#endif
-		pthread_join(xpram_thread, NULL);
-	}
+#if EMULATED_68K
+	// Finish checkpoint log and replay log, write benchmark results
+	CheckpointExit();
+	ReplayExit();
+	BenchExit();
 #endif
 
 	// Deinitialize everything
@@ -948,7 +1035,7 @@ void QuitEmulator(void)
 	PrefsExit();
 
 	// Close X11 server connection
-#ifndef USE_SDL_VIDEO
+#if !defined(USE_SDL_VIDEO) && !defined(USE_HEADLESS_VIDEO)
 	if (x_display)
 		XCloseDisplay(x_display);
 #endif
@@ -1000,6 +1087,18 @@ static void sigint_handler(...)
 #endif
 
 
+/*
+ *  SIGUSR2 handler, the snapshot is saved from the 60Hz tick
+ */
+
+#if EMULATED_68K
+static void sigusr2_handler(int sig)
+{
+	snapshot_requested = true;
+}
+#endif
+
+
 #ifdef HAVE_PTHREADS
 /*
  *  Pthread configuration
@@ -1151,49 +1250,25 @@ void TriggerNMI(void)
 #endif
 
 
-/*
- *  XPRAM watchdog thread (saves XPRAM every minute)
- */
-
-static void xpram_watchdog(void)
-{
-	if (memcmp(last_xpram, XPRAM, XPRAM_SIZE)) {
-		memcpy(last_xpram, XPRAM, XPRAM_SIZE);
-		SaveXPRAM();
-	}
-}
-
-#ifdef USE_PTHREADS_SERVICES
-static void *xpram_func(void *arg)
-{
-	while (!xpram_thread_cancel) {
-		for (int i=0; i<60 && !xpram_thread_cancel; i++)
-			Delay_usec(999999);		// Only wait 1 second so we quit promptly when xpram_thread_cancel becomes true
-		xpram_watchdog();
-	}
-	return NULL;
-}
-#endif
-
-
 /*
  *  60Hz thread (really 60.15Hz)
  */
 
 static void one_second(void)
 {
-	// Pseudo Mac 1Hz interrupt, update local time
-	WriteMacInt32(0x20c, TimerDateTime());
+	// Pseudo Mac 1Hz interrupt, update local time (done by the interrupt when recording or replaying)
+	if (!ReplayRecording && !ReplayPlaying)
+		WriteMacInt32(0x20c, TimerDateTime());
 
 	SetInterruptFlag(INTFLAG_1HZ);
 	TriggerInterrupt();
 
-#ifndef USE_PTHREADS_SERVICES
-	static int second_counter = 0;
-	if (++second_counter > 60) {
-		second_counter = 0;
-		xpram_watchdog();
-	}
+	// Save XPRAM if the Mac has changed it
+	XPRAMSaveIfDirty();
+
+#if EMULATED_68K
+	// Periodic checkpoint
+	CheckpointTick();
 #endif
 }
 
@@ -1215,6 +1290,14 @@ static void one_tick(...)
 	SetInterruptFlag(INTFLAG_ETHER);
 #endif
 
+#if EMULATED_68K
+	// Snapshot requested by SIGUSR2
+	if (snapshot_requested) {
+		snapshot_requested = false;
+		SnapshotRequest();
+	}
+#endif
+
 	// Trigger 60Hz interrupt
 	if (ROMVersion != ROM_VERSION_CLASSIC || HasMacStarted()) {
 		SetInterruptFlag(INTFLAG_60HZ);
@@ -1230,7 +1313,7 @@ static void *tick_func(void *arg)
 	uint64 next = GetTicks_usec();
 	while (!tick_thread_cancel) {
 		one_tick();
-		next += 16625;
+		next = VideoAlignTick(next + 16625);
 		int64 delay = next - GetTicks_usec();
 		if (delay > 0)
 			Delay_usec(delay);
@@ -1599,12 +1682,14 @@ void display_alert(int title_id, int prefix_id, int button_id, const char *text)
 
 void ErrorAlert(const char *text)
 {
+	if (StartupDeferAlert(text, true))
+		return;
 	if (gui_connection) {
 		if (rpc_method_invoke(gui_connection, RPC_METHOD_ERROR_ALERT, RPC_TYPE_STRING, text, RPC_TYPE_INVALID) == RPC_ERROR_NO_ERROR &&
 			rpc_method_wait_for_reply(gui_connection, RPC_TYPE_INVALID) == RPC_ERROR_NO_ERROR)
 			return;
 	}
-#if defined(ENABLE_GTK) && !defined(USE_SDL_VIDEO)
+#if defined(ENABLE_GTK) && !defined(USE_SDL_VIDEO) && !defined(USE_HEADLESS_VIDEO)
 	if (PrefsFindBool("nogui") || x_display == NULL) {
 		printf(GetString(STR_SHELL_ERROR_PREFIX), text);
 		return;
@@ -1623,12 +1708,14 @@ void ErrorAlert(const char *text)
 
 void WarningAlert(const char *text)
 {
+	if (StartupDeferAlert(text, false))
+		return;
 	if (gui_connection) {
 		if (rpc_method_invoke(gui_connection, RPC_METHOD_WARNING_ALERT, RPC_TYPE_STRING, text, RPC_TYPE_INVALID) == RPC_ERROR_NO_ERROR &&
 			rpc_method_wait_for_reply(gui_connection, RPC_TYPE_INVALID) == RPC_ERROR_NO_ERROR)
 			return;
 	}
-#if defined(ENABLE_GTK) && !defined(USE_SDL_VIDEO)
+#if defined(ENABLE_GTK) && !defined(USE_SDL_VIDEO) && !defined(USE_HEADLESS_VIDEO)
 	if (PrefsFindBool("nogui") || x_display == NULL) {
 		printf(GetString(STR_SHELL_WARNING_PREFIX), text);
 		return;
@@ -45,6 +45,26 @@ prefs_desc platform_prefs_items[] = {
 #ifdef USE_SDL_VIDEO
 	{"sdlrender", TYPE_STRING, false,      "SDL_Renderer driver (\"auto\", \"software\" (may be faster), etc.)"},
 #endif
+#ifdef USE_HEADLESS_VIDEO
+	{"dumpframes", TYPE_STRING, false,     "file name prefix for frame dumps of headless video"},
+	{"dumpinterval", TYPE_INT32, false,    "dump every n-th refreshed frame"},
+	{"dumpformat", TYPE_STRING, false,     "frame dump format (\"ppm\" or \"raw\")"},
+#endif
+	{"diskoverlay", TYPE_STRING, false,    "directory for copy-on-write overlays of disk image files"},
+	{"snapshot", TYPE_STRING, false,       "snapshot file, saved on SIGUSR2"},
+	{"resume", TYPE_BOOLEAN, false,        "resume from checkpoint log or snapshot file on startup"},
+	{"snapshotcompress", TYPE_BOOLEAN, false, "compress snapshot files"},
+	{"checkpoint", TYPE_STRING, false,     "checkpoint log file, written while running"},
+	{"checkpointinterval", TYPE_INT32, false, "seconds between checkpoints"},
+	{"record", TYPE_STRING, false,         "file to record mouse, keyboard, timer and network input to"},
+	{"replay", TYPE_STRING, false,         "file to replay recorded input from, quits at the end"},
+	{"benchscript", TYPE_STRING, false,    "benchmark script driving the Mac with mouse and keyboard input"},
+	{"benchresult", TYPE_STRING, false,    "file to write benchmark results to (JSON)"},
+	{"hugepages", TYPE_STRING, false,      "huge pages for RAM and JIT cache (\"thp\" or \"hugetlb\")"},
+	{"numanode", TYPE_INT32, false,        "NUMA node to bind memory and threads to"},
+	{"startuptrace", TYPE_STRING, false,   "file to write startup phase trace to (Chrome trace-event JSON)"},
+	{"romcachedir", TYPE_STRING, false,    "directory to cache ROM search indexes and patched ROMs in"},
+	{"extfsmeta", TYPE_STRING, false,      "where ExtFS keeps Finder info (\"files\", \"cache\" or \"xattr\")"},
 	{NULL, TYPE_END, false, NULL} // End of list
 };
 
@@ -123,6 +143,10 @@ void AddPlatformPrefsDefaults(void)
 	PrefsReplaceString("extfs", "/");
 	PrefsReplaceInt32("mousewheelmode", 1);
 	PrefsReplaceInt32("mousewheellines", 3);
+	PrefsAddBool("resume", false);
+	PrefsAddBool("snapshotcompress", true);
+	PrefsAddInt32("checkpointinterval", 60);
+	PrefsAddInt32("numanode", -1);
 #ifdef __linux__
 	if (access("/dev/sound/dsp", F_OK) == 0) {
 		PrefsReplaceString("dsp", "/dev/sound/dsp");
@@ -142,4 +166,8 @@ void AddPlatformPrefsDefaults(void)
 	PrefsAddBool("ignoresegv", false);
 #endif
 	PrefsAddBool("idlewait", true);
+#ifdef USE_HEADLESS_VIDEO
+	PrefsAddInt32("dumpinterval", 60);
+	PrefsAddString("dumpformat", "ppm");
+#endif
 }
@@ -0,0 +1,377 @@
+/*
+ *  rom_cache_unix.cpp - Cache of patched ROMs, Unix specific stuff
+ *
+ *  Basilisk II (C) 1997-2008 Christian Bauer
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include "sysdeps.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#ifdef HAVE_DLADDR
+#include <dlfcn.h>
+#endif
+#ifdef __APPLE__
+#include <mach-o/dyld.h>
+#endif
+
+#include "cpu_emulation.h"
+#include "main.h"
+#include "macos_util.h"
+#include "prefs.h"
+#include "rom_patches.h"
+#include "emul_op.h"
+#include "version.h"
+
+#define DEBUG 0
+#include "debug.h"
+
+
+/*
+ *  The cache file holds the patched ROM at offset 0, so it can be mapped
+ *  copy-on-write at ROMBaseHost and all instances using the same ROM share
+ *  its pages, followed by the patch state and a trailer
+ */
+
+const uint32 ROM_CACHE_MAGIC = FOURCC('B','2','p','r');
+const uint32 ROM_CACHE_VERSION = 1;
+
+struct rom_cache_trailer {
+	uint32 magic;
+	uint32 version;
+	uint32 rom_size;
+	uint32 state_size;
+};
+
+
+// Stat the running executable, returns false if it can't be found
+static bool stat_executable(struct stat *st)
+{
+	if (stat("/proc/self/exe", st) == 0)
+		return true;
+#ifdef __APPLE__
+	char path[1024];
+	uint32_t size = sizeof(path);
+	if (_NSGetExecutablePath(path, &size) == 0 && stat(path, st) == 0)
+		return true;
+#endif
+#ifdef HAVE_DLADDR
+	Dl_info info;
+	if (dladdr((void *)stat_executable, &info) && info.dli_fname && info.dli_fname[0] && stat(info.dli_fname, st) == 0)
+		return true;
+#endif
+	return false;
+}
+
+static uint64 fnv1a(uint64 h, uint64 v)
+{
+	for (int i = 0; i < 8; i++, v >>= 8)
+		h = (h ^ uint8(v)) * 0x100000001b3ULL;
+	return h;
+}
+
+// Build the cache file path for KEY, returns false if caching is disabled
+static bool rom_cache_path(const char *key, char *path, size_t path_size)
+{
+	const char *dir = PrefsFindString("romcachedir");
+	if (dir == NULL || dir[0] == 0)
+		return false;
+
+	// Patches contain addresses of emulator code and EMUL_OP numbers, so
+	// the cache is only valid for the executable that wrote it. Without
+	// the executable there's no cache, a build date would miss rebuilds
+	// of unchanged files.
+	struct stat st;
+	if (!stat_executable(&st)) {
+		D(bug("ROM cache disabled, executable not found\n"));
+		return false;
+	}
+	long mtime_nsec = 0;
+#if defined(HAVE_STRUCT_STAT_ST_MTIM)
+	mtime_nsec = st.st_mtim.tv_nsec;
+#elif defined(HAVE_STRUCT_STAT_ST_MTIMESPEC)
+	mtime_nsec = st.st_mtimespec.tv_nsec;
+#endif
+	uint64 h = 0xcbf29ce484222325ULL;
+	h = fnv1a(h, st.st_dev);
+	h = fnv1a(h, st.st_ino);
+	h = fnv1a(h, st.st_size);
+	h = fnv1a(h, st.st_mtime);
+	h = fnv1a(h, mtime_nsec);
+	h = fnv1a(h, M68K_EMUL_OP_MAX);
+	h = fnv1a(h, (VERSION_MAJOR << 16) | VERSION_MINOR);
+
+	return snprintf(path, path_size, "%s/rom-%s-%016llx.patched", dir, key, (unsigned long long)h) < (int)path_size;
+}
+
+
+// Put the ROM image of an open cache file at ROMBaseHost, shared with other instances if possible
+static bool map_rom(int fd)
+{
+	long page_size = getpagesize();
+	if (((uintptr)ROMBaseHost % page_size) == 0 && (ROMSize % page_size) == 0
+	 && mmap(ROMBaseHost, ROMSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, 0) != MAP_FAILED)
+		return true;
+	return pread(fd, ROMBaseHost, ROMSize, 0) == (ssize_t)ROMSize;
+}
+
+
+/*
+ *  Load patched ROM saved under KEY and its patch state
+ */
+
+bool LoadPatchedROM(const char *key, void *state, uint32 state_size)
+{
+	char path[1024];
+	if (!rom_cache_path(key, path, sizeof(path)))
+		return false;
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return false;
+
+	// Check trailer and read state before touching the ROM
+	bool ok = false;
+	struct stat st;
+	rom_cache_trailer t;
+	if (fstat(fd, &st) == 0 && st.st_size == (off_t)(ROMSize + state_size + sizeof(t))
+	 && pread(fd, &t, sizeof(t), ROMSize + state_size) == sizeof(t)
+	 && t.magic == ROM_CACHE_MAGIC && t.version == ROM_CACHE_VERSION && t.rom_size == ROMSize && t.state_size == state_size
+	 && pread(fd, state, state_size, ROMSize) == (ssize_t)state_size)
+		ok = map_rom(fd);
+	close(fd);
+	D(bug("LoadPatchedROM %s: %s\n", path, ok ? "hit" : "invalid"));
+	return ok;
+}
+
+
+/*
+ *  Save patched ROM at ROMBaseHost and its patch state under KEY
+ */
+
+void SavePatchedROM(const char *key, const void *state, uint32 state_size)
+{
+	char path[1024], tmp_path[1040];
+	if (!rom_cache_path(key, path, sizeof(path)))
+		return;
+
+	// Write new file and rename it, so other instances never see a partly written file
+	snprintf(tmp_path, sizeof(tmp_path), "%s.%d", path, getpid());
+	int fd = open(tmp_path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+		return;
+	rom_cache_trailer t;
+	t.magic = ROM_CACHE_MAGIC;
+	t.version = ROM_CACHE_VERSION;
+	t.rom_size = ROMSize;
+	t.state_size = state_size;
+	bool ok = write(fd, ROMBaseHost, ROMSize) == (ssize_t)ROMSize
+	       && write(fd, state, state_size) == (ssize_t)state_size
+	       && write(fd, &t, sizeof(t)) == sizeof(t);
+	if (ok && rename(tmp_path, path) == 0) {
+		// Share the pages with the instances started later
+		map_rom(fd);
+	} else
+		unlink(tmp_path);
+	close(fd);
+	D(bug("SavePatchedROM %s: %s\n", path, ok ? "saved" : "failed"));
+}
+
+
+#ifdef ROM_CACHE_TEST
+/*
+ *  Round trip of a synthetic ROM through the cache the way PatchROM() uses
+ *  it: patch, install the slot ROM, save with the unpatched ROM end in the
+ *  state, then load into a scrambled ROM area and reinstall the slot ROM,
+ *  with the same and with other video modes.
+ */
+
+#include <stdlib.h>
+
+#include "video.h"
+#include "slot_rom.h"
+
+uint32 RAMBaseMac, ROMBaseMac, RAMSize, ROMSize;
+uint8 *RAMBaseHost, *ROMBaseHost;
+#if DIRECT_ADDRESSING
+uintptr MEMBaseDiff;
+#endif
+
+static char cache_dir[] = "/tmp/rom_cache_test.XXXXXX";
+static bool cache_enabled = true;
+
+const char *PrefsFindString(const char *name, int index) {return cache_enabled ? cache_dir : NULL;}
+bool PrefsFindBool(const char *name) {return false;}
+int32 PrefsFindInt32(const char *name) {return 0;}
+void Execute68kTrap(uint16 trap, M68kRegisters *r) {}
+void ErrorAlert(const char *text) {printf("ERROR: %s\n", text);}
+
+class test_monitor : public monitor_desc {
+public:
+	test_monitor(const vector<video_mode> &modes) : monitor_desc(modes, modes[0].depth, modes[0].resolution_id) {}
+	virtual void switch_to_current_mode(void) {}
+	virtual void set_palette(uint8 *pal, int num) {}
+};
+
+static void use_modes(uint32 width, uint32 height)
+{
+	vector<video_mode> modes;
+	static const video_depth depths[] = {VDEPTH_8BIT, VDEPTH_32BIT};
+	for (int d = 0; d < 2; d++) {
+		video_mode mode;
+		mode.x = width;
+		mode.y = height;
+		mode.resolution_id = 0x80;
+		mode.depth = depths[d];
+		mode.bytes_per_row = TrivialBytesPerRow(width, depths[d]);
+		mode.user_data = 0;
+		modes.push_back(mode);
+	}
+	for (size_t i = 0; i < VideoMonitors.size(); i++)
+		delete VideoMonitors[i];
+	VideoMonitors.clear();
+	VideoMonitors.push_back(new test_monitor(modes));
+}
+
+static int failures;
+
+#define CHECK(cond) do { \
+	if (!(cond)) { \
+		printf("%s:%d: %s failed\n", __FILE__, __LINE__, #cond); \
+		failures++; \
+	} \
+} while (0)
+
+const uint32 TAIL_SIZE = 4096;	// Like ROM_TAIL_SIZE of rom_patches.cpp
+
+struct test_state {
+	uint32 universal_info;
+	uint8 rom_tail[TAIL_SIZE];
+};
+
+// Is the ROM area a private mapping of the cache file?
+static bool rom_mapped_from_cache(void)
+{
+	FILE *f = fopen("/proc/self/maps", "r");
+	if (f == NULL)
+		return false;
+	char line[1024];
+	bool found = false;
+	while (fgets(line, sizeof(line), f)) {
+		unsigned long start, end;
+		char perms[8];
+		if (sscanf(line, "%lx-%lx %7s", &start, &end, perms) == 3 && start <= (uintptr)ROMBaseHost && end > (uintptr)ROMBaseHost)
+			found = perms[3] == 'p' && strstr(line, cache_dir) != NULL;
+	}
+	fclose(f);
+	return found;
+}
+
+int main(void)
+{
+	RAMSize = 0x100000;
+	ROMSize = 0x100000;
+	RAMBaseHost = (uint8 *)mmap(NULL, RAMSize + ROMSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (RAMBaseHost == MAP_FAILED || mkdtemp(cache_dir) == NULL) {
+		perror("rom_cache_test");
+		return 1;
+	}
+	ROMBaseHost = RAMBaseHost + RAMSize;
+	ROMBaseMac = RAMSize;
+#if DIRECT_ADDRESSING
+	MEMBaseDiff = (uintptr)RAMBaseHost;
+#endif
+	const char *key = "0123456789abcdef";
+	uint8 *tail = ROMBaseHost + ROMSize - TAIL_SIZE;
+
+	// Unpatched ROM
+	srand(1);
+	for (uint32 i = 0; i < ROMSize; i++)
+		ROMBaseHost[i] = rand();
+	std::vector<uint8> unpatched(ROMBaseHost, ROMBaseHost + ROMSize);
+
+	// Nothing cached yet
+	test_state state;
+	CHECK(!LoadPatchedROM(key, &state, sizeof(state)));
+	CHECK(memcmp(ROMBaseHost, &unpatched[0], ROMSize) == 0);
+
+	// Patch, install the slot ROM for 640x480 and save
+	use_modes(640, 480);
+	for (uint32 i = 0; i < ROMSize; i += 97)
+		ROMBaseHost[i] = 0x4e;
+	memcpy(state.rom_tail, &unpatched[ROMSize - TAIL_SIZE], TAIL_SIZE);
+	memcpy(tail, state.rom_tail, TAIL_SIZE);
+	CHECK(InstallSlotROM());
+	state.universal_info = 0x12345678;
+	std::vector<uint8> patched(ROMBaseHost, ROMBaseHost + ROMSize);
+	SavePatchedROM(key, &state, sizeof(state));
+	CHECK(rom_mapped_from_cache());
+
+	// Load into a scrambled ROM area, same video modes
+	memset(ROMBaseHost, 0xaa, ROMSize);
+	memset(&state, 0, sizeof(state));
+	CHECK(LoadPatchedROM(key, &state, sizeof(state)));
+	CHECK(rom_mapped_from_cache());
+	CHECK(state.universal_info == 0x12345678);
+	CHECK(memcmp(state.rom_tail, &unpatched[ROMSize - TAIL_SIZE], TAIL_SIZE) == 0);
+	memcpy(tail, state.rom_tail, TAIL_SIZE);
+	CHECK(InstallSlotROM());
+	CHECK(memcmp(ROMBaseHost, &patched[0], ROMSize) == 0);
+
+	// The Mac may write to its ROM, that stays private
+	memset(ROMBaseHost, 0x55, 4096);
+	CHECK(LoadPatchedROM(key, &state, sizeof(state)));
+	CHECK(memcmp(ROMBaseHost, &patched[0], ROMSize - TAIL_SIZE) == 0);
+
+	// Other video modes: the slot ROM is the one patching from scratch would give
+	use_modes(1024, 768);
+	memcpy(ROMBaseHost, &unpatched[0], ROMSize);
+	CHECK(InstallSlotROM());
+	std::vector<uint8> other_tail(tail, tail + TAIL_SIZE);
+	CHECK(memcmp(&other_tail[0], &patched[ROMSize - TAIL_SIZE], TAIL_SIZE) != 0);
+	CHECK(LoadPatchedROM(key, &state, sizeof(state)));
+	memcpy(tail, state.rom_tail, TAIL_SIZE);
+	CHECK(InstallSlotROM());
+	CHECK(memcmp(tail, &other_tail[0], TAIL_SIZE) == 0);
+	CHECK(memcmp(ROMBaseHost, &patched[0], ROMSize - TAIL_SIZE) == 0);
+
+	// Cache files that don't fit are not used, and the ROM is left alone
+	char path[1024];
+	CHECK(rom_cache_path(key, path, sizeof(path)));
+	memcpy(ROMBaseHost, &unpatched[0], ROMSize);
+	CHECK(!LoadPatchedROM(key, &state, sizeof(state) - 4));
+	CHECK(!LoadPatchedROM("fedcba9876543210", &state, sizeof(state)));
+	CHECK(truncate(path, ROMSize + sizeof(state)) == 0);
+	CHECK(!LoadPatchedROM(key, &state, sizeof(state)));
+	CHECK(memcmp(ROMBaseHost, &unpatched[0], ROMSize) == 0);
+
+	// No cache directory, no cache
+	cache_enabled = false;
+	SavePatchedROM(key, &state, sizeof(state));
+	CHECK(!LoadPatchedROM(key, &state, sizeof(state)));
+	cache_enabled = true;
+
+	unlink(path);
+	rmdir(cache_dir);
+	if (failures) {
+		printf("rom_cache_test: %d failures\n", failures);
+		return 1;
+	}
+	printf("rom_cache_test: OK\n");
+	return 0;
+}
+#endif
@@ -55,6 +55,7 @@
 #include "macos_util.h"
 #include "prefs.h"
 #include "user_strings.h"
+#include "bench.h"
 #include "sys.h"
 #include "disk_unix.h"
 
@@ -73,6 +74,7 @@ static disk_factory *disk_factories[] = {
 #if defined(HAVE_LIBVHD)
 	disk_vhd_factory,
 #endif
+	disk_overlay_factory,
 #endif
 	NULL
 };
@@ -570,9 +572,14 @@ void *Sys_open(const char *name, bool read_only)
 
 	D(bug("Sys_open(%s, %s)\n", name, read_only ? "read-only" : "read/write"));
 
-	// Check if write access is allowed, set read-only flag if not
+	// Check if write access is allowed, set read-only flag if not (writes to an overlay don't need it)
+#ifndef STANDALONE_GUI
+	if (!read_only && access(name, W_OK) && !disk_overlay_wanted(name))
+		read_only = true;
+#else
 	if (!read_only && access(name, W_OK))
 		read_only = true;
+#endif
 
 	// Print warning message and eventually unmount drive when this is an HFS volume mounted under Linux (double mounting will corrupt the volume)
 	char mount_name[256];
@@ -751,6 +758,7 @@ size_t Sys_read(void *arg, void *buffer, loff_t offset, size_t length)
 	mac_file_handle *fh = (mac_file_handle *)arg;
 	if (!fh)
 		return 0;
+	BenchIO(BENCH_DISK_READ, length);
 
 #if defined(BINCUE)
 	if (fh->is_bincue)
@@ -779,6 +787,7 @@ size_t Sys_write(void *arg, void *buffer, loff_t offset, size_t length)
 	mac_file_handle *fh = (mac_file_handle *)arg;
 	if (!fh)
 		return 0;
+	BenchIO(BENCH_DISK_WRITE, length);
 
 	if (fh->generic_disk)
 		return fh->generic_disk->write(buffer, offset, length);
@@ -1423,6 +1432,13 @@ void SysCDSetVolume(void *arg, uint8 left, uint8 right)
 	if (!fh)
 		return;
 
+#if defined(BINCUE)
+	if (fh->is_bincue) {
+		CDSetVolume_bincue(fh->bincue_fd, left, right);
+		return;
+	}
+#endif
+
 	if (fh->is_cdrom) {
 #if defined(__linux__)
 		cdrom_volctrl vol;
@@ -1449,6 +1465,13 @@ void SysCDGetVolume(void *arg, uint8 &left, uint8 &right)
 	if (!fh)
 		return;
 
+#if defined(BINCUE)
+	if (fh->is_bincue) {
+		CDGetVolume_bincue(fh->bincue_fd, left, right);
+		return;
+	}
+#endif
+
 	left = right = 0;
 	if (fh->is_cdrom) {
 #if defined(__linux__)
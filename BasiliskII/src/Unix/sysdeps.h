@@ -104,7 +104,7 @@
 #endif
 
 /* Direct Addressing requires Video on SEGV signals in plain X11 mode */
-#if DIRECT_ADDRESSING && (!ENABLE_VOSF && !USE_SDL_VIDEO)
+#if DIRECT_ADDRESSING && (!ENABLE_VOSF && !USE_SDL_VIDEO && !USE_HEADLESS_VIDEO)
 # undef  ENABLE_VOSF
 # define ENABLE_VOSF 1
 #endif
@@ -112,6 +112,22 @@
 /* ExtFS is supported */
 #define SUPPORTS_EXTFS 1
 
+/* Patched ROMs can be cached */
+#define SUPPORTS_ROM_CACHE 1
+
+/* Machine state can be saved to snapshot files and the checkpoint log */
+#define SUPPORTS_SNAPSHOT 1
+
+/* Input can be recorded and replayed, timed by the CPU emulator */
+#if EMULATED_68K
+#define SUPPORTS_REPLAY 1
+#endif
+
+/* Guest benchmarks can be scripted, instructions are counted like for replays */
+#if EMULATED_68K
+#define SUPPORTS_BENCH 1
+#endif
+
 /* BSD socket API supported */
 #define SUPPORTS_UDP_TUNNEL 1
 
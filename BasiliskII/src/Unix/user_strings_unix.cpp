@@ -46,6 +46,9 @@ user_string_def platform_strings[] = {
 	{STR_TIMER_CREATE_ERR, "Cannot create timer (%s)."},
 	{STR_TIMER_SETTIME_ERR, "Cannot start timer (%s)."},
 	{STR_TICK_THREAD_ERR, "Cannot create 60Hz thread (%s)."},
+	{STR_SNAPSHOT_ERR, "Cannot resume from snapshot %s."},
+	{STR_REPLAY_ERR, "Cannot open replay log %s, or it was recorded with a different ROM or RAM size."},
+	{STR_BENCH_ERR, "Cannot read benchmark script %s."},
 
 	{STR_BLOCKING_NET_SOCKET_WARN, "Cannot set non-blocking I/O to net socket (%s). Ethernet will not be available."},
 	{STR_NO_SHEEP_NET_DRIVER_WARN, "Cannot open %s (%s). Ethernet will not be available."},
@@ -37,6 +37,9 @@ enum {
 	STR_TIMER_CREATE_ERR,
 	STR_TIMER_SETTIME_ERR,
 	STR_TICK_THREAD_ERR,
+	STR_SNAPSHOT_ERR,
+	STR_REPLAY_ERR,
+	STR_BENCH_ERR,
 
 	STR_BLOCKING_NET_SOCKET_WARN,
 	STR_NO_SHEEP_NET_DRIVER_WARN,
@@ -0,0 +1,1177 @@
+/*
+ *  video_headless.cpp - Video/graphics emulation without a display
+ *
+ *  Basilisk II (C) 1997-2008 Christian Bauer
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/*
+ *  NOTES:
+ *    The Mac frame buffer is converted into an off-screen host frame buffer
+ *    by the same VOSF and blitter code the X11 driver uses, but nothing is
+ *    displayed. This allows measuring the refresh path on machines without
+ *    X server or GPU.
+ *
+ *    "screen win/<width>/<height>" selects the page-based VOSF update of
+ *    windowed mode, "screen dga/<width>/<height>" the chunked update of DGA
+ *    mode. Without VOSF, changed scanlines are found by comparing against a
+ *    copy of the frame buffer.
+ *
+ *    Every "dumpinterval"-th refresh is written to a file named after the
+ *    "dumpframes" prefix, either as PPM image or as raw host frame buffer
+ *    contents ("dumpformat raw"). Refresh statistics are printed on exit.
+ */
+
+#include "sysdeps.h"
+
+#include <errno.h>
+#include <limits.h>
+
+#ifdef HAVE_PTHREADS
+# include <pthread.h>
+#endif
+
+#include "cpu_emulation.h"
+#include "main.h"
+#include "prefs.h"
+#include "user_strings.h"
+#include "video.h"
+#include "video_blit.h"
+
+#define DEBUG 0
+#include "debug.h"
+
+
+// Supported video modes
+static vector<video_mode> VideoModes;
+
+// Display types
+enum {
+	DISPLAY_WINDOW,	// Page-based refresh, as in X11 windowed mode
+	DISPLAY_DGA		// Chunked refresh, as in X11 DGA mode
+};
+
+// Global variables
+static int32 frame_skip;							// Prefs items
+static int display_type = DISPLAY_WINDOW;			// See enum above
+static uint8 *the_buffer = NULL;					// Mac frame buffer (where MacOS draws into)
+static uint8 *the_buffer_copy = NULL;				// Copy of Mac frame buffer (for refreshed modes)
+static uint32 the_buffer_size;						// Size of allocated the_buffer
+
+static bool redraw_thread_active = false;			// Flag: Redraw thread installed
+#ifdef HAVE_PTHREADS
+static pthread_attr_t redraw_thread_attr;			// Redraw thread attributes
+static volatile bool redraw_thread_cancel;			// Flag: Cancel Redraw thread
+static pthread_t redraw_thread;						// Redraw thread
+#endif
+
+#ifdef ENABLE_VOSF
+static bool use_vosf = true;						// Flag: VOSF enabled
+#else
+static const bool use_vosf = false;					// VOSF not possible
+#endif
+
+static bool classic_mode = false;					// Flag: Classic Mac video mode
+
+static VisualFormat visualFormat;					// Pixel format of the host frame buffer
+static uint8 host_palette[256 * 3];					// Colors of indexed host frame buffers
+static bool palette_changed = false;				// Flag: Palette changed, redraw everything
+
+static const char *dump_prefix = NULL;				// File name prefix for frame dumps, NULL = no dumps
+static int32 dump_interval;							// Dump every n-th refresh
+static bool dump_raw;								// Flag: Dump raw host frame buffer instead of PPM
+static uint32 dump_count = 0;						// Number of frames dumped
+
+// Refresh statistics
+const int DIRTY_HIST_BUCKETS = 5;
+static const int dirty_hist_limit[DIRTY_HIST_BUCKETS - 1] = { 1, 10, 25, 50 };	// Percent of scanlines
+static uint64 stat_refreshes = 0;					// Refreshes performed
+static uint64 stat_updates = 0;						// Refreshes that found something to update
+static uint64 stat_rows = 0;						// Scanlines converted to the host frame buffer
+static uint64 stat_usec = 0;						// Time spent in updates
+static uint32 stat_max_usec = 0;					// Longest update
+static uint32 dirty_hist[DIRTY_HIST_BUCKETS];		// Updates by fraction of the screen converted
+static uint32 frame_rows;							// Scanlines converted by the current refresh
+
+// Scanlines reported changed by QuickDraw acceleration (non-VOSF refresh)
+static int dirty_y1 = INT_MAX, dirty_y2 = -1;
+
+// Mutex to protect palette
+#ifdef HAVE_PTHREADS
+static pthread_mutex_t palette_lock = PTHREAD_MUTEX_INITIALIZER;
+#define LOCK_PALETTE pthread_mutex_lock(&palette_lock)
+#define UNLOCK_PALETTE pthread_mutex_unlock(&palette_lock)
+#else
+#define LOCK_PALETTE
+#define UNLOCK_PALETTE
+#endif
+
+// Mutex to protect dirty scanline range
+#ifdef HAVE_PTHREADS
+static pthread_mutex_t dirty_lock = PTHREAD_MUTEX_INITIALIZER;
+#define LOCK_DIRTY pthread_mutex_lock(&dirty_lock)
+#define UNLOCK_DIRTY pthread_mutex_unlock(&dirty_lock)
+#else
+#define LOCK_DIRTY
+#define UNLOCK_DIRTY
+#endif
+
+// Mutex to protect frame buffer
+#ifdef HAVE_PTHREADS
+static pthread_mutex_t frame_buffer_lock = PTHREAD_MUTEX_INITIALIZER;
+#define LOCK_FRAME_BUFFER pthread_mutex_lock(&frame_buffer_lock);
+#define UNLOCK_FRAME_BUFFER pthread_mutex_unlock(&frame_buffer_lock);
+#else
+#define LOCK_FRAME_BUFFER
+#define UNLOCK_FRAME_BUFFER
+#endif
+
+// Prototypes
+static void *redraw_func(void *arg);
+
+
+/*
+ *  monitor_desc subclass for headless display
+ */
+
+class Headless_monitor_desc : public monitor_desc {
+public:
+	Headless_monitor_desc(const vector<video_mode> &available_modes, video_depth default_depth, uint32 default_id) : monitor_desc(available_modes, default_depth, default_id) {}
+	~Headless_monitor_desc() {}
+
+	virtual void switch_to_current_mode(void);
+	virtual void set_palette(uint8 *pal, int num);
+
+	bool video_open(void);
+	void video_close(void);
+};
+
+
+/*
+ *  Utility functions
+ */
+
+// Map video_mode depth ID to numerical depth value
+static inline int depth_of_video_mode(video_mode const & mode)
+{
+	int depth = -1;
+	switch (mode.depth) {
+	case VDEPTH_1BIT:
+		depth = 1;
+		break;
+	case VDEPTH_2BIT:
+		depth = 2;
+		break;
+	case VDEPTH_4BIT:
+		depth = 4;
+		break;
+	case VDEPTH_8BIT:
+		depth = 8;
+		break;
+	case VDEPTH_16BIT:
+		depth = 16;
+		break;
+	case VDEPTH_32BIT:
+		depth = 32;
+		break;
+	default:
+		abort();
+	}
+	return depth;
+}
+
+// Map RGB color to pixel value of a 32-bit host frame buffer
+static inline uint32 map_rgb(uint8 red, uint8 green, uint8 blue)
+{
+	return (red << 16) | (green << 8) | blue;
+}
+
+// Choose host pixel format for Mac mode: direct modes become RGB 555 or
+// RGB 888 in host byte order, 2/4/8-bit modes are expanded to RGB 888 if
+// the blitters can do so, the remaining modes are copied as they are
+static void set_host_format(video_mode const & mode)
+{
+	const int mac_depth = depth_of_video_mode(mode);
+	visualFormat.fullscreen = false;
+	visualFormat.Rmask = visualFormat.Gmask = visualFormat.Bmask = 0;
+	if (mac_depth == 16) {
+		visualFormat.depth = 16;
+		visualFormat.Rmask = 0x7c00;
+		visualFormat.Gmask = 0x03e0;
+		visualFormat.Bmask = 0x001f;
+	}
+#if REAL_ADDRESSING || DIRECT_ADDRESSING
+	else if (mac_depth > 1) {
+#else
+	else if (mac_depth == 32) {
+#endif
+		visualFormat.depth = 32;
+		visualFormat.Rmask = 0xff0000;
+		visualFormat.Gmask = 0x00ff00;
+		visualFormat.Bmask = 0x0000ff;
+	} else
+		visualFormat.depth = mac_depth;
+}
+
+// Add mode to list of supported modes
+static void add_mode(uint32 width, uint32 height, uint32 resolution_id, uint32 bytes_per_row, video_depth depth)
+{
+	video_mode mode;
+	mode.x = width;
+	mode.y = height;
+	mode.resolution_id = resolution_id;
+	mode.bytes_per_row = bytes_per_row;
+	mode.depth = depth;
+	mode.user_data = 0;
+	VideoModes.push_back(mode);
+}
+
+// Add standard list of modes for given color depth, plus the requested size if it is not among them
+static void add_window_modes(video_depth depth, int width, int height)
+{
+	static const int sizes[][2] = {
+		{512, 384}, {640, 480}, {800, 600}, {1024, 768}, {1152, 870}, {1280, 1024}, {1600, 1200}
+	};
+	const int num_sizes = sizeof(sizes) / sizeof(sizes[0]);
+	bool found = false;
+	for (int i=0; i<num_sizes; i++) {
+		add_mode(sizes[i][0], sizes[i][1], 0x80 + i, TrivialBytesPerRow(sizes[i][0], depth), depth);
+		if (sizes[i][0] == width && sizes[i][1] == height)
+			found = true;
+	}
+	if (!found)
+		add_mode(width, height, 0x80 + num_sizes, TrivialBytesPerRow(width, depth), depth);
+}
+
+// Set Mac frame layout and base address (uses the_buffer/MacFrameBaseMac)
+static void set_mac_frame_buffer(Headless_monitor_desc &monitor, video_depth depth)
+{
+#if !REAL_ADDRESSING && !DIRECT_ADDRESSING
+	int layout = FLAYOUT_DIRECT;
+	if (depth == VDEPTH_16BIT)
+		layout = FLAYOUT_HOST_555;
+	else if (depth == VDEPTH_32BIT)
+		layout = FLAYOUT_HOST_888;
+	MacFrameLayout = layout;
+	monitor.set_mac_frame_base(MacFrameBaseMac);
+
+	// Set variables used by UAE memory banking
+	const video_mode &mode = monitor.get_current_mode();
+	MacFrameBaseHost = the_buffer;
+	MacFrameSize = mode.bytes_per_row * mode.y;
+	InitFrameBufferMapping();
+#else
+	monitor.set_mac_frame_base(Host2MacAddr(the_buffer));
+#endif
+	D(bug("monitor.mac_frame_base = %08x\n", monitor.get_mac_frame_base()));
+}
+
+
+/*
+ *  Framebuffer allocation routines
+ */
+
+#include "vm_alloc.h"
+
+static void *vm_acquire_framebuffer(uint32 size)
+{
+	// always try to allocate framebuffer at the same address
+	static void *fb = VM_MAP_FAILED;
+	if (fb != VM_MAP_FAILED) {
+		if (vm_acquire_fixed(fb, size, VM_MAP_DEFAULT | VM_MAP_WRITE_WATCH) < 0 &&
+			vm_acquire_fixed(fb, size) < 0)
+			fb = VM_MAP_FAILED;
+	}
+	// prefer host write-tracking over SIGSEGV for VOSF, if available
+	if (fb == VM_MAP_FAILED)
+		fb = vm_acquire(size, VM_MAP_DEFAULT | VM_MAP_32BIT | VM_MAP_WRITE_WATCH);
+	if (fb == VM_MAP_FAILED)
+		fb = vm_acquire(size, VM_MAP_DEFAULT | VM_MAP_32BIT);
+	return fb;
+}
+
+static inline void vm_release_framebuffer(void *fb, uint32 size)
+{
+	vm_release(fb, size);
+}
+
+
+/*
+ *  Display "driver" class
+ */
+
+class driver_headless {
+public:
+	driver_headless(Headless_monitor_desc &m);
+	~driver_headless();
+
+public:
+	Headless_monitor_desc &monitor;	// Associated video monitor
+	const video_mode &mode;			// Video mode handled by the driver
+
+	bool init_ok;		// Initialization succeeded (we can't use exceptions because of -fomit-frame-pointer)
+	int depth;			// Depth of host frame buffer
+	int bytes_per_row;	// Bytes per row of host frame buffer
+	uint8 *pixels;		// Host frame buffer
+};
+
+static driver_headless *drv = NULL;	// Pointer to currently used driver object
+
+#ifdef ENABLE_VOSF
+# include "video_vosf.h"
+#endif
+
+// Open display
+driver_headless::driver_headless(Headless_monitor_desc &m)
+ : monitor(m), mode(m.get_current_mode()), init_ok(false), pixels(NULL)
+{
+	the_buffer = NULL;
+	the_buffer_copy = NULL;
+
+	// Allocate host frame buffer ("height + 2" for safety)
+	depth = visualFormat.depth;
+	bytes_per_row = TrivialBytesPerRow(mode.x, DepthModeForPixelDepth(depth));
+	pixels = (uint8 *)calloc(mode.y + 2, bytes_per_row);
+	if (pixels == NULL)
+		return;
+
+#ifdef ENABLE_VOSF
+#ifdef VIDEO_HEADLESS_NO_VOSF
+	use_vosf = false;	// Test build for the non-VOSF refresh
+#else
+	use_vosf = true;
+#endif
+	// Allocate memory for frame buffer (SIZE is extended to page-boundary)
+	the_host_buffer = pixels;
+	the_buffer_size = page_extend((mode.y + 2) * mode.bytes_per_row);
+	the_buffer = (uint8 *)vm_acquire_framebuffer(the_buffer_size);
+	the_buffer_copy = (uint8 *)malloc(the_buffer_size);
+	D(bug("the_buffer = %p, the_buffer_copy = %p, the_host_buffer = %p\n", the_buffer, the_buffer_copy, the_host_buffer));
+#else
+	// Allocate memory for frame buffer (mapped, so that the Mac can address it)
+	the_buffer_size = (mode.y + 2) * mode.bytes_per_row;
+	the_buffer = (uint8 *)vm_acquire_framebuffer(the_buffer_size);
+	the_buffer_copy = (uint8 *)calloc(1, the_buffer_size);
+	D(bug("the_buffer = %p, the_buffer_copy = %p\n", the_buffer, the_buffer_copy));
+#endif
+	if (the_buffer == VM_MAP_FAILED) {
+		the_buffer = NULL;
+		return;
+	}
+	if (the_buffer_copy == NULL)
+		return;
+
+	// Init blitting routines
+	Screen_blitter_init(visualFormat, true, depth_of_video_mode(mode));
+
+	// Set frame buffer base
+	set_mac_frame_buffer(monitor, mode.depth);
+
+	// Everything went well
+	init_ok = true;
+}
+
+// Close display
+driver_headless::~driver_headless()
+{
+	// the_buffer shall always be mapped through vm_acquire_framebuffer()
+	if (the_buffer) {
+		D(bug(" releasing the_buffer at %p (%d bytes)\n", the_buffer, the_buffer_size));
+		vm_release_framebuffer(the_buffer, the_buffer_size);
+		the_buffer = NULL;
+	}
+#ifdef ENABLE_VOSF
+	the_host_buffer = NULL;	// freed below
+#endif
+	if (the_buffer_copy) {
+		free(the_buffer_copy);
+		the_buffer_copy = NULL;
+	}
+	free(pixels);
+}
+
+
+/*
+ *  Initialization
+ */
+
+// Open display for current mode
+bool Headless_monitor_desc::video_open(void)
+{
+	D(bug("video_open()\n"));
+	const video_mode &mode = get_current_mode();
+
+	// Build up visualFormat structure
+	set_host_format(mode);
+
+	// Load gray ramp (black on white in 1-bit mode)
+	for (int i=0; i<256; i++) {
+		uint8 c = (mode.depth == VDEPTH_1BIT ? ((i & 1) ? 0x00 : 0xff) : i);
+		host_palette[i*3 + 0] = host_palette[i*3 + 1] = host_palette[i*3 + 2] = c;
+		ExpandMap[i] = map_rgb(c, c, c);
+	}
+
+	// Create display driver object
+	drv = new driver_headless(*this);
+	if (!drv->init_ok) {
+		delete drv;
+		drv = NULL;
+		return false;
+	}
+
+#ifdef ENABLE_VOSF
+	if (use_vosf) {
+		// Initialize the VOSF system
+		if (!video_vosf_init(*this)) {
+			ErrorAlert(STR_VOSF_INIT_ERR);
+			return false;
+		}
+	}
+#endif
+
+	// Lock down frame buffer
+	LOCK_FRAME_BUFFER;
+
+	// Start redraw thread
+#ifdef USE_PTHREADS_SERVICES
+	redraw_thread_cancel = false;
+	Set_pthread_attr(&redraw_thread_attr, 0);
+	redraw_thread_active = (pthread_create(&redraw_thread, &redraw_thread_attr, redraw_func, NULL) == 0);
+	if (!redraw_thread_active) {
+		printf("FATAL: cannot create redraw thread\n");
+		return false;
+	}
+#else
+	redraw_thread_active = true;
+#endif
+
+	return true;
+}
+
+bool VideoInit(bool classic)
+{
+	classic_mode = classic;
+
+#ifdef ENABLE_VOSF
+	// Zero the mainBuffer structure
+	mainBuffer.dirtyPages = NULL;
+	mainBuffer.refreshPages = NULL;
+	mainBuffer.pageInfo = NULL;
+#endif
+
+	// Read prefs
+	frame_skip = PrefsFindInt32("frameskip");
+	if (frame_skip < 1)
+		frame_skip = 1;
+	dump_prefix = PrefsFindString("dumpframes");
+	dump_interval = PrefsFindInt32("dumpinterval");
+	if (dump_interval < 1)
+		dump_interval = 1;
+	const char *dump_format = PrefsFindString("dumpformat");
+	dump_raw = (dump_format && strcmp(dump_format, "raw") == 0);
+
+	// Get screen mode from preferences
+	const char *mode_str;
+	if (classic_mode)
+		mode_str = "win/512/342";
+	else
+		mode_str = PrefsFindString("screen");
+
+	// Determine display type and default dimensions
+	int default_width = 640, default_height = 480;
+	display_type = DISPLAY_WINDOW;
+	if (mode_str) {
+		if (sscanf(mode_str, "win/%d/%d", &default_width, &default_height) == 2)
+			display_type = DISPLAY_WINDOW;
+#if ENABLE_VOSF && (REAL_ADDRESSING || DIRECT_ADDRESSING)
+		else if (sscanf(mode_str, "dga/%d/%d", &default_width, &default_height) == 2)
+			display_type = DISPLAY_DGA;
+#endif
+	}
+	if (default_width <= 0)
+		default_width = 640;
+	if (default_height <= 0)
+		default_height = 480;
+
+	// Mac screen depth follows prefs, there is no host screen to match
+	video_depth default_depth = VDEPTH_32BIT;
+	switch (PrefsFindInt32("displaycolordepth")) {
+		case 1:
+			default_depth = VDEPTH_1BIT;
+			break;
+		case 2:
+			default_depth = VDEPTH_2BIT;
+			break;
+		case 4:
+			default_depth = VDEPTH_4BIT;
+			break;
+		case 8:
+			default_depth = VDEPTH_8BIT;
+			break;
+		case 15: case 16:
+			default_depth = VDEPTH_16BIT;
+			break;
+	}
+
+	// Construct list of supported modes, all depths can be converted
+	if (classic)
+		add_mode(512, 342, 0x80, 64, VDEPTH_1BIT);
+	else {
+		for (unsigned d=VDEPTH_1BIT; d<=VDEPTH_32BIT; d++)
+			add_window_modes(video_depth(d), default_width, default_height);
+	}
+
+	// Find requested default mode with specified dimensions
+	uint32 default_id;
+	std::vector<video_mode>::const_iterator i, end = VideoModes.end();
+	for (i = VideoModes.begin(); i != end; ++i) {
+		if (i->x == (uint32)default_width && i->y == (uint32)default_height && i->depth == default_depth) {
+			default_id = i->resolution_id;
+			break;
+		}
+	}
+	if (i == end) { // not found, use first available mode
+		default_depth = VideoModes[0].depth;
+		default_id = VideoModes[0].resolution_id;
+	}
+
+	// Create Headless_monitor_desc for this (the only) display
+	Headless_monitor_desc *monitor = new Headless_monitor_desc(VideoModes, default_depth, default_id);
+	VideoMonitors.push_back(monitor);
+
+	// Open display
+	return monitor->video_open();
+}
+
+
+/*
+ *  Deinitialization
+ */
+
+// Close display
+void Headless_monitor_desc::video_close(void)
+{
+	D(bug("video_close()\n"));
+
+	// Stop redraw thread
+#ifdef USE_PTHREADS_SERVICES
+	if (redraw_thread_active) {
+		redraw_thread_cancel = true;
+		pthread_join(redraw_thread, NULL);
+	}
+#endif
+	redraw_thread_active = false;
+
+	// Unlock frame buffer
+	UNLOCK_FRAME_BUFFER;
+	D(bug(" frame buffer unlocked\n"));
+
+#ifdef ENABLE_VOSF
+	if (use_vosf) {
+		// Deinitialize VOSF
+		video_vosf_exit();
+	}
+#endif
+
+	// Close display
+	delete drv;
+	drv = NULL;
+}
+
+// Print refresh statistics
+static void print_refresh_stats(void)
+{
+	printf("Headless video: %llu refreshes, %llu updates, %llu scanlines converted\n",
+		(unsigned long long)stat_refreshes, (unsigned long long)stat_updates, (unsigned long long)stat_rows);
+	if (stat_updates == 0)
+		return;
+	printf(" update time: %llu usec average, %u usec maximum\n",
+		(unsigned long long)(stat_usec / stat_updates), stat_max_usec);
+	for (int i = 0; i < DIRTY_HIST_BUCKETS; i++) {
+		if (i < DIRTY_HIST_BUCKETS - 1)
+			printf(" <= %2d%% of screen: %u\n", dirty_hist_limit[i], dirty_hist[i]);
+		else
+			printf("  > %2d%% of screen: %u\n", dirty_hist_limit[i - 1], dirty_hist[i]);
+	}
+}
+
+void VideoExit(void)
+{
+	// Close displays
+	vector<monitor_desc *>::iterator i, end = VideoMonitors.end();
+	for (i = VideoMonitors.begin(); i != end; ++i)
+		dynamic_cast<Headless_monitor_desc *>(*i)->video_close();
+
+	// Stop the blitter threads
+	Screen_blitter_exit();
+
+	print_refresh_stats();
+}
+
+
+/*
+ *  Close down full-screen mode (if bringing up error alerts is unsafe while in full-screen mode)
+ */
+
+void VideoQuitFullScreen(void)
+{
+	D(bug("VideoQuitFullScreen()\n"));
+}
+
+
+/*
+ *  Mac VBL interrupt
+ */
+
+void VideoInterrupt(void)
+{
+	// Temporarily give up frame buffer lock
+	UNLOCK_FRAME_BUFFER;
+	LOCK_FRAME_BUFFER;
+}
+
+
+/*
+ *  Set palette
+ */
+
+void Headless_monitor_desc::set_palette(uint8 *pal, int num_in)
+{
+	const video_mode &mode = get_current_mode();
+
+	// There is no gamma table, direct modes are left alone
+	if (IsDirectMode(mode))
+		return;
+
+	LOCK_PALETTE;
+
+	// Recalculate host colors and pixel color expansion map
+	for (int i=0; i<256; i++) {
+		int c = i & (num_in-1); // If there are less than 256 colors, we repeat the first entries (this makes color expansion easier)
+		host_palette[i*3 + 0] = pal[c*3 + 0];
+		host_palette[i*3 + 1] = pal[c*3 + 1];
+		host_palette[i*3 + 2] = pal[c*3 + 2];
+		ExpandMap[i] = map_rgb(pal[c*3 + 0], pal[c*3 + 1], pal[c*3 + 2]);
+	}
+
+#ifdef ENABLE_VOSF
+	if (use_vosf) {
+		// We have to redraw everything because the interpretation of pixel values changed
+		LOCK_VOSF;
+		PFLAG_SET_ALL;
+		UNLOCK_VOSF;
+		memset(the_buffer_copy, 0, mode.bytes_per_row * mode.y);
+	}
+#endif
+
+	// Tell redraw thread to convert the whole screen
+	palette_changed = true;
+
+	UNLOCK_PALETTE;
+}
+
+
+/*
+ *  Switch video mode
+ */
+
+void Headless_monitor_desc::switch_to_current_mode(void)
+{
+	// Close and reopen display
+	video_close();
+	video_open();
+
+	if (drv == NULL) {
+		ErrorAlert(STR_OPEN_WINDOW_ERR);
+		QuitEmulator();
+	}
+}
+
+
+/*
+ *  Frame dumps
+ */
+
+// Get color of host frame buffer pixel
+static inline void get_host_rgb(const uint8 *row, int x, int depth, uint8 *rgb)
+{
+	switch (depth) {
+	case 32: {
+		uint32 v;
+		memcpy(&v, row + x * 4, 4);
+		rgb[0] = v >> 16;
+		rgb[1] = v >> 8;
+		rgb[2] = v;
+		break;
+	}
+	case 16: {
+		uint16 v;
+		memcpy(&v, row + x * 2, 2);
+		rgb[0] = ((v >> 10) & 0x1f) * 255 / 31;
+		rgb[1] = ((v >> 5) & 0x1f) * 255 / 31;
+		rgb[2] = (v & 0x1f) * 255 / 31;
+		break;
+	}
+	default: {	// Indexed, leftmost pixel in the most significant bits
+		const int bit = x * depth;
+		const int c = (row[bit >> 3] >> (8 - depth - (bit & 7))) & ((1 << depth) - 1);
+		memcpy(rgb, host_palette + c * 3, 3);
+		break;
+	}
+	}
+}
+
+// Write host frame buffer to file
+static void dump_frame(void)
+{
+	char name[1024];
+	snprintf(name, sizeof(name), "%s%06u.%s", dump_prefix, dump_count++, dump_raw ? "raw" : "ppm");
+	FILE *f = fopen(name, "wb");
+	if (f == NULL) {
+		fprintf(stderr, "WARNING: Cannot write frame dump %s (%s), frame dumps disabled\n", name, strerror(errno));
+		dump_prefix = NULL;
+		return;
+	}
+
+	const video_mode &mode = drv->mode;
+	if (dump_raw)
+		fwrite(drv->pixels, drv->bytes_per_row, mode.y, f);
+	else {
+		fprintf(f, "P6\n%d %d\n255\n", mode.x, mode.y);
+		vector<uint8> line(mode.x * 3);
+		LOCK_PALETTE;
+		for (uint32 y=0; y<mode.y; y++) {
+			const uint8 *row = drv->pixels + y * drv->bytes_per_row;
+			for (uint32 x=0; x<mode.x; x++)
+				get_host_rgb(row, x, drv->depth, &line[x * 3]);
+			fwrite(&line[0], 1, line.size(), f);
+		}
+		UNLOCK_PALETTE;
+	}
+	fclose(f);
+}
+
+
+/*
+ *  Screen refresh functions
+ */
+
+// Scanlines Y..Y+H-1 of the host frame buffer were updated
+static void update_headless_video(int y, int h)
+{
+	frame_rows += h;
+}
+
+// Convert changed scanlines, found by comparing against the_buffer_copy
+static void update_display_static(driver_headless *drv, bool full)
+{
+	const video_mode &mode = drv->mode;
+	const int bytes_per_row = mode.bytes_per_row;
+
+	// Scanlines reported by QuickDraw are known to have changed
+	LOCK_DIRTY;
+	const int dirty_top = dirty_y1, dirty_bottom = dirty_y2;
+	dirty_y1 = INT_MAX;
+	dirty_y2 = -1;
+	UNLOCK_DIRTY;
+
+	// Check for first line from top and first line from bottom that have changed
+	int y1 = 0, y2 = mode.y - 1;
+	if (!full) {
+		while (y1 <= y2 && y1 < dirty_top && memcmp(&the_buffer[y1 * bytes_per_row], &the_buffer_copy[y1 * bytes_per_row], bytes_per_row) == 0)
+			y1++;
+		if (y1 > y2)
+			return;
+		while (y2 > y1 && y2 > dirty_bottom && memcmp(&the_buffer[y2 * bytes_per_row], &the_buffer_copy[y2 * bytes_per_row], bytes_per_row) == 0)
+			y2--;
+	}
+
+	// Convert them and update the_buffer_copy
+	const int height = y2 - y1 + 1;
+	Screen_blit_rows(drv->pixels + y1 * drv->bytes_per_row, drv->bytes_per_row,
+					 the_buffer + y1 * bytes_per_row, bytes_per_row,
+					 bytes_per_row, height, the_buffer_copy + y1 * bytes_per_row);
+	update_headless_video(y1, height);
+}
+
+static void video_refresh(void)
+{
+	static int tick_counter = 0;
+	if (++tick_counter < frame_skip)
+		return;
+	tick_counter = 0;
+
+	// Handle palette changes
+	LOCK_PALETTE;
+	bool full = palette_changed;
+	palette_changed = false;
+	UNLOCK_PALETTE;
+
+	// Update host frame buffer
+	frame_rows = 0;
+	uint64 start = GetTicks_usec();
+#ifdef ENABLE_VOSF
+	if (use_vosf) {
+		if (video_vosf_dirty()) {
+			LOCK_VOSF;
+#if REAL_ADDRESSING || DIRECT_ADDRESSING
+			if (display_type == DISPLAY_DGA)
+				update_display_dga_vosf(drv);
+			else
+#endif
+				update_display_window_vosf(drv);
+			UNLOCK_VOSF;
+		}
+	} else
+#endif
+	update_display_static(drv, full);
+	uint32 duration = uint32(GetTicks_usec() - start);
+
+	// Account for refresh
+	stat_refreshes++;
+	if (frame_rows) {
+		stat_updates++;
+		stat_rows += frame_rows;
+		stat_usec += duration;
+		if (duration > stat_max_usec)
+			stat_max_usec = duration;
+		uint32 percent = (uint64)frame_rows * 100 / drv->mode.y;
+		int i = 0;
+		while (i < DIRTY_HIST_BUCKETS - 1 && percent > (uint32)dirty_hist_limit[i])
+			i++;
+		dirty_hist[i]++;
+	}
+
+	// Dump frame
+	if (dump_prefix && stat_refreshes % dump_interval == 0)
+		dump_frame();
+}
+
+// This function is called on non-threaded platforms from a timer interrupt
+void VideoRefresh(void)
+{
+	// We need to check redraw_thread_active to inhibit refreshed during
+	// mode changes on non-threaded platforms
+	if (!redraw_thread_active)
+		return;
+
+	// Update display
+	video_refresh();
+}
+
+const int VIDEO_REFRESH_HZ = 60;
+const int VIDEO_REFRESH_DELAY = 1000000 / VIDEO_REFRESH_HZ;
+
+#ifdef USE_PTHREADS_SERVICES
+static void *redraw_func(void *arg)
+{
+	uint64 next = GetTicks_usec() + VIDEO_REFRESH_DELAY;
+
+	while (!redraw_thread_cancel) {
+
+		int64 delay = next - GetTicks_usec();
+		if (delay < -VIDEO_REFRESH_DELAY) {
+
+			// We are lagging far behind, so we reset the delay mechanism
+			next = GetTicks_usec();
+
+		} else if (delay <= 0) {
+
+			// Delay expired, refresh display
+			video_refresh();
+			next += VIDEO_REFRESH_DELAY;
+
+		} else
+			Delay_usec(delay);
+	}
+	return NULL;
+}
+#endif
+
+
+/*
+ *  Record dirty area from QuickDraw acceleration
+ */
+
+void video_set_dirty_area(int x, int y, int w, int h)
+{
+#ifdef ENABLE_VOSF
+	if (use_vosf && drv) {
+		const video_mode &mode = drv->mode;
+		vosf_set_dirty_area(x, y, w, h, mode.x, mode.y, mode.bytes_per_row);
+		return;
+	}
+#endif
+
+	// Remember the scanlines, the next refresh converts them without comparing
+	if (h <= 0)
+		return;
+	LOCK_DIRTY;
+	if (y < dirty_y1)
+		dirty_y1 = y < 0 ? 0 : y;
+	if (y + h - 1 > dirty_y2)
+		dirty_y2 = y + h - 1;
+	UNLOCK_DIRTY;
+}
+
+
+/*
+ *  Align 60Hz tick to the host's vertical blank (there is none, the tick runs freely)
+ */
+
+uint64 VideoAlignTick(uint64 next)
+{
+	return next;
+}
+
+
+#ifdef VIDEO_HEADLESS_TEST
+/*
+ *  Smoke test: opens the headless display, draws a pattern into the Mac
+ *  frame buffer, switches to another mode and depth the way a snapshot
+ *  restore does, and checks the frame dumps of both modes against the
+ *  pattern. Built with VOSF and, as video_headless_static_test, with the
+ *  non-VOSF refresh.
+ *
+ *  video_headless_test
+ */
+
+#include "sigsegv.h"
+#include "snapshot.h"
+
+#include <string>
+
+static uint8 mac_mem[4];
+uintptr MEMBaseDiff = 0;
+uint32 ROMBaseMac;
+uint8 *ROMBaseHost = mac_mem;
+void Execute68kTrap(uint16 trap, M68kRegisters *r) {}
+void ChecksumSlotROM(void) {}
+void ErrorAlert(int string_id) {printf("ERROR: alert %d\n", string_id);}
+void QuitEmulator(void) {exit(1);}
+void Set_pthread_attr(pthread_attr_t *attr, int priority) {pthread_attr_init(attr);}
+uint64 GetTicks_usec(void) {struct timeval tv; gettimeofday(&tv, NULL); return (uint64)tv.tv_sec * 1000000 + tv.tv_usec;}
+void Delay_usec(uint64 usec) {usleep(usec);}
+
+static char dump_dir[] = "/tmp/video_headless_test.XXXXXX";
+static std::string dump_path;
+
+int32 PrefsFindInt32(const char *name)
+{
+	if (strcmp(name, "displaycolordepth") == 0)
+		return 32;
+	return 1;	// frameskip, dumpinterval
+}
+
+const char *PrefsFindString(const char *name, int index)
+{
+	if (strcmp(name, "screen") == 0)
+		return "win/640/480";
+	if (strcmp(name, "dumpframes") == 0)
+		return dump_path.c_str();
+	return NULL;
+}
+
+bool PrefsFindBool(const char *name) {return false;}
+
+static sigsegv_return_t test_sigsegv_handler(sigsegv_info_t *sip)
+{
+#ifdef ENABLE_VOSF
+	if (Screen_fault_handler(sip))
+		return SIGSEGV_RETURN_SUCCESS;
+#endif
+	return SIGSEGV_RETURN_FAILURE;
+}
+
+// Test pattern, as RGB and as Mac pixel
+static void pattern_rgb(int x, int y, uint8 *rgb)
+{
+	rgb[0] = x;
+	rgb[1] = y;
+	rgb[2] = (x ^ y) * 3;
+}
+
+static uint8 pattern_index(int x, int y)
+{
+	return x + 3 * y;
+}
+
+// Draw pattern into the Mac frame buffer
+static void draw_pattern(const video_mode &mode, uint8 *fb)
+{
+	for (uint32 y = 0; y < mode.y; y++) {
+		uint8 *row = fb + y * mode.bytes_per_row;
+		for (uint32 x = 0; x < mode.x; x++) {
+			if (mode.depth == VDEPTH_32BIT) {
+				row[x * 4] = 0;
+				pattern_rgb(x, y, row + x * 4 + 1);
+			} else
+				row[x] = pattern_index(x, y);
+		}
+	}
+}
+
+// Check dump number n against the pattern, a blank (black) frame is accepted if allow_blank is set
+static bool check_dump(uint32 n, const video_mode &mode, const uint8 *pal, bool allow_blank = false)
+{
+	char name[1024];
+	snprintf(name, sizeof(name), "%s%06u.ppm", dump_path.c_str(), n);
+	FILE *f = fopen(name, "rb");
+	if (f == NULL) {
+		printf("%s missing\n", name);
+		return false;
+	}
+	unsigned w, h, max;
+	bool ok = fscanf(f, "P6 %u %u %u", &w, &h, &max) == 3 && fgetc(f) == '\n';
+	if (!ok || w != mode.x || h != mode.y || max != 255) {
+		printf("%s: bad header\n", name);
+		fclose(f);
+		return false;
+	}
+	bool blank = allow_blank, match = true;
+	for (uint32 y = 0; y < mode.y && (blank || match); y++) {
+		for (uint32 x = 0; x < mode.x; x++) {
+			uint8 rgb[3], want[3];
+			if (mode.depth == VDEPTH_32BIT)
+				pattern_rgb(x, y, want);
+			else
+				memcpy(want, pal + pattern_index(x, y) * 3, 3);
+			if (fread(rgb, 1, 3, f) != 3) {
+				blank = match = false;
+				break;
+			}
+			if (memcmp(rgb, want, 3) != 0)
+				match = false;
+			if (rgb[0] || rgb[1] || rgb[2])
+				blank = false;
+		}
+	}
+	fclose(f);
+	if (!blank && !match)
+		printf("%s: frame differs from pattern\n", name);
+	return blank || match;
+}
+
+// Switch display to the given mode through the snapshot restore path, with the frame buffer drawn
+static bool switch_mode(monitor_desc *mon, const video_mode &mode, const uint8 *pal)
+{
+	const uint16 apple_mode = mon->depth_to_apple_mode(mode.depth);
+	snapshot_out s;
+	s.put16(apple_mode);
+	s.put32(mode.resolution_id);
+	s.put16(apple_mode);
+	s.put32(mode.resolution_id);
+	s.put_bool(false);		// luminance_mapping
+	s.put_bool(true);		// interrupts_enabled
+	s.put_bool(true);		// dm_present
+	s.put32(0);				// gamma_table
+	s.put32(0);				// alloc_gamma_table_size
+	s.put32(0);				// slot_param
+	s.put_bytes(pal, 256 * 3);
+	s.put32(mon->get_mac_frame_base());
+	const uint32 size = mode.bytes_per_row * mode.y;
+	s.put32(size);
+	std::vector<uint8> fb(size);
+	draw_pattern(mode, &fb[0]);
+	s.put_bytes(&fb[0], size);
+	snapshot_in in(&s.data[0], s.data.size());
+	return mon->load_state(in);
+}
+
+int main(void)
+{
+	if (mkdtemp(dump_dir) == NULL) {
+		perror("mkdtemp");
+		return 1;
+	}
+	dump_path = std::string(dump_dir) + "/frame";
+	if (vm_init() < 0 || !sigsegv_install_handler(test_sigsegv_handler)) {
+		printf("can't set up memory\n");
+		return 1;
+	}
+
+	int failures = 0;
+	if (!VideoInit(false)) {
+		printf("VideoInit() failed\n");
+		return 1;
+	}
+	monitor_desc *mon = VideoMonitors[0];
+	const video_mode first = mon->get_current_mode();
+	if (first.x != 640 || first.y != 480 || first.depth != VDEPTH_32BIT) {
+		printf("wrong default mode %ux%u, depth %d\n", first.x, first.y, first.depth);
+		failures++;
+	}
+
+	// Draw in the initial mode, part of it as reported by QuickDraw, holding
+	// off refreshes so that the next one sees all changes at once
+	uint8 *fb = Mac2HostAddr(mon->get_mac_frame_base());
+	LOCK_PALETTE;
+	draw_pattern(first, fb);
+	video_set_dirty_area(0, 100, first.x, 50);
+	UNLOCK_PALETTE;
+	usleep(200000);
+
+	// Switch to 800x600, 8 bit, all dumps of the first mode are complete when this returns
+	uint8 pal[256 * 3];
+	for (int i = 0; i < 256; i++) {
+		pal[i * 3 + 0] = i;
+		pal[i * 3 + 1] = 255 - i;
+		pal[i * 3 + 2] = i * 7;
+	}
+	video_mode second = first;
+	second.x = 800;
+	second.y = 600;
+	second.depth = VDEPTH_8BIT;
+	second.bytes_per_row = TrivialBytesPerRow(second.x, second.depth);
+	second.resolution_id = 0x82;
+	const uint32 first_dumps = dump_count;
+	if (!switch_mode(mon, second, pal)) {
+		printf("mode switch failed\n");
+		failures++;
+	}
+	const video_mode &cur = mon->get_current_mode();
+	if (cur.x != second.x || cur.y != second.y || cur.depth != second.depth) {
+		printf("mode switch ended in %ux%u, depth %d\n", cur.x, cur.y, cur.depth);
+		failures++;
+	}
+	// Refreshes were held off while drawing, so every frame is either blank or complete
+	for (uint32 n = 0; n + 1 < first_dumps; n++) {
+		if (!check_dump(n, first, pal, true))
+			failures++;
+	}
+	if (first_dumps == 0 || !check_dump(first_dumps - 1, first, pal))
+		failures++;
+	usleep(200000);
+
+	VideoExit();
+	if (dump_count == first_dumps || !check_dump(dump_count - 1, second, pal))
+		failures++;
+
+	for (uint32 n = 0; n < dump_count; n++) {
+		char name[1024];
+		snprintf(name, sizeof(name), "%s%06u.ppm", dump_path.c_str(), n);
+		unlink(name);
+	}
+	rmdir(dump_dir);
+
+	if (failures) {
+		printf("video_headless_test: %d failures\n", failures);
+		return 1;
+	}
+	printf("video_headless_test: OK, %u frames dumped\n", dump_count);
+	return 0;
+}
+#endif
@@ -591,9 +591,13 @@ static void *vm_acquire_framebuffer(uint32 size)
 	// always try to allocate framebuffer at the same address
 	static void *fb = VM_MAP_FAILED;
 	if (fb != VM_MAP_FAILED) {
-		if (vm_acquire_fixed(fb, size) < 0)
+		if (vm_acquire_fixed(fb, size, VM_MAP_DEFAULT | VM_MAP_WRITE_WATCH) < 0 &&
+			vm_acquire_fixed(fb, size) < 0)
 			fb = VM_MAP_FAILED;
 	}
+	// prefer host write-tracking over SIGSEGV for VOSF, if available
+	if (fb == VM_MAP_FAILED)
+		fb = vm_acquire(size, VM_MAP_DEFAULT | VM_MAP_32BIT | VM_MAP_WRITE_WATCH);
 	if (fb == VM_MAP_FAILED)
 		fb = vm_acquire(size, VM_MAP_DEFAULT | VM_MAP_32BIT);
 	return fb;
@@ -1695,6 +1699,7 @@ bool VideoInit(bool classic)
 #ifdef ENABLE_VOSF
 	// Zero the mainBuffer structure
 	mainBuffer.dirtyPages = NULL;
+	mainBuffer.refreshPages = NULL;
 	mainBuffer.pageInfo = NULL;
 #endif
 	
@@ -1914,6 +1919,9 @@ void VideoExit(void)
 	for (i = VideoMonitors.begin(); i != end; ++i)
 		dynamic_cast<X11_monitor_desc *>(*i)->video_close();
 
+	// Stop the blitter threads
+	Screen_blitter_exit();
+
 #ifdef ENABLE_XF86_VIDMODE
 	// Free video mode list
 	if (x_video_modes) {
@@ -2618,7 +2626,7 @@ static void video_refresh_dga_vosf(void)
 	static int tick_counter = 0;
 	if (++tick_counter >= frame_skip) {
 		tick_counter = 0;
-		if (mainBuffer.dirty) {
+		if (video_vosf_dirty()) {
 			LOCK_VOSF;
 			update_display_dga_vosf(static_cast<driver_dga *>(drv));
 			UNLOCK_VOSF;
@@ -2636,7 +2644,7 @@ static void video_refresh_window_vosf(void)
 	static int tick_counter = 0;
 	if (++tick_counter >= frame_skip) {
 		tick_counter = 0;
-		if (mainBuffer.dirty) {
+		if (video_vosf_dirty()) {
 			XDisplayLock();
 			LOCK_VOSF;
 			update_display_window_vosf(static_cast<driver_window *>(drv));
@@ -2769,3 +2777,31 @@ static void *redraw_func(void *arg)
 	return NULL;
 }
 #endif
+
+
+/*
+ *  Record dirty area from QuickDraw acceleration
+ */
+
+void video_set_dirty_area(int x, int y, int w, int h)
+{
+#ifdef ENABLE_VOSF
+	if (use_vosf && drv) {
+		const video_mode &mode = drv->mode;
+		vosf_set_dirty_area(x, y, w, h, mode.x, mode.y, mode.bytes_per_row);
+		return;
+	}
+#endif
+
+	// XXX handle dirty bounding boxes for non-VOSF modes
+}
+
+
+/*
+ *  Align 60Hz tick to the host's vertical blank (not supported, the tick runs freely)
+ */
+
+uint64 VideoAlignTick(uint64 next)
+{
+	return next;
+}
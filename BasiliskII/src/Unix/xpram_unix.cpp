@@ -72,10 +72,15 @@ void LoadXPRAM(const char *vmdir)
 
 void SaveXPRAM(void)
 {
+	// Write new file and rename it, so a crash can't leave a partly written XPRAM file
+	char tmp_path[1040];
+	snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", xpram_path);
 	int fd;
-	if ((fd = open(xpram_path, O_WRONLY | O_CREAT, 0666)) >= 0) {
-		write(fd, XPRAM, XPRAM_SIZE);
-		close(fd);
+	if ((fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0666)) >= 0) {
+		bool ok = write(fd, XPRAM, XPRAM_SIZE) == XPRAM_SIZE;
+		ok = (close(fd) == 0) && ok;
+		if (!ok || rename(tmp_path, xpram_path) < 0)
+			unlink(tmp_path);
 	}
 }
 
@@ -605,7 +605,7 @@ static int tick_func(void *arg)
 	uint64 next = GetTicks_usec();
 	while (!tick_thread_cancel) {
 		one_tick();
-		next += 16625;
+		next = VideoAlignTick(next + 16625);
 		int64 delay = next - GetTicks_usec();
 		if (delay > 0)
 			Delay_usec(uint32(delay));
@@ -33,6 +33,8 @@
 #include "prefs.h"
 #include "video.h"
 #include "adb.h"
+#include "snapshot.h"
+#include "replay.h"
 
 #ifdef POWERPC_ROM
 #include "thunks.h"
@@ -67,6 +69,18 @@ static uint8 m_keyboard_type = 0x05;
 // ADB mouse motion lock (for platforms that use separate input thread)
 static B2_mutex *mouse_lock;
 
+// Host input waiting for ADBReplayInput() while recording (type, two 32-bit arguments)
+enum {
+	INPUT_MOUSE_MOVED,
+	INPUT_MOUSE_DOWN,
+	INPUT_MOUSE_UP,
+	INPUT_KEY_DOWN,
+	INPUT_KEY_UP,
+	INPUT_REL_MOUSE_MODE
+};
+const int INPUT_EVENT_SIZE = 9;
+static std::vector<uint8> input_queue;
+
 
 /*
  *  Initialize ADB emulation
@@ -228,10 +242,29 @@ void ADBOp(uint8 op, uint8 *data)
 
 
 /*
- *  Mouse was moved (x/y are absolute or relative, depending on ADBSetRelMouseMode())
+ *  Queue host input while recording, so it reaches the Mac at a point that
+ *  can be replayed; host input is ignored while replaying. Returns false
+ *  if the input is to be applied right away.
  */
 
-void ADBMouseMoved(int x, int y)
+static bool queue_input(uint8 type, int32 a, int32 b)
+{
+	if (ReplayPlaying)
+		return true;
+	if (!ReplayRecording)
+		return false;
+
+	uint8 e[INPUT_EVENT_SIZE];
+	e[0] = type;
+	memcpy(e + 1, &a, 4);
+	memcpy(e + 5, &b, 4);
+	B2_lock_mutex(mouse_lock);
+	input_queue.insert(input_queue.end(), e, e + INPUT_EVENT_SIZE);
+	B2_unlock_mutex(mouse_lock);
+	return true;
+}
+
+static void mouse_moved(int x, int y)
 {
 	B2_lock_mutex(mouse_lock);
 	if (relative_mouse) {
@@ -240,6 +273,45 @@ void ADBMouseMoved(int x, int y)
 		mouse_x = x; mouse_y = y;
 	}
 	B2_unlock_mutex(mouse_lock);
+}
+
+static void set_rel_mouse_mode(bool relative)
+{
+	if (relative_mouse != relative) {
+		relative_mouse = relative;
+		mouse_x = mouse_y = 0;
+	}
+}
+
+static void key_down(int code)
+{
+	// Add keycode to buffer
+	key_buffer[key_write_ptr] = code;
+	key_write_ptr = (key_write_ptr + 1) % KEY_BUFFER_SIZE;
+
+	// Set key in matrix
+	key_states[code >> 3] |= (1 << (~code & 7));
+}
+
+static void key_up(int code)
+{
+	// Add keycode to buffer
+	key_buffer[key_write_ptr] = code | 0x80;	// Key-up flag
+	key_write_ptr = (key_write_ptr + 1) % KEY_BUFFER_SIZE;
+
+	// Clear key in matrix
+	key_states[code >> 3] &= ~(1 << (~code & 7));
+}
+
+
+/*
+ *  Mouse was moved (x/y are absolute or relative, depending on ADBSetRelMouseMode())
+ */
+
+void ADBMouseMoved(int x, int y)
+{
+	if (!queue_input(INPUT_MOUSE_MOVED, x, y))
+		mouse_moved(x, y);
 	SetInterruptFlag(INTFLAG_ADB);
 	TriggerInterrupt();
 }
@@ -251,7 +323,8 @@ void ADBMouseMoved(int x, int y)
 
 void ADBMouseDown(int button)
 {
-	mouse_button[button] = true;
+	if (!queue_input(INPUT_MOUSE_DOWN, button, 0))
+		mouse_button[button] = true;
 	SetInterruptFlag(INTFLAG_ADB);
 	TriggerInterrupt();
 }
@@ -263,7 +336,8 @@ void ADBMouseDown(int button)
 
 void ADBMouseUp(int button)
 {
-	mouse_button[button] = false;
+	if (!queue_input(INPUT_MOUSE_UP, button, 0))
+		mouse_button[button] = false;
 	SetInterruptFlag(INTFLAG_ADB);
 	TriggerInterrupt();
 }
@@ -275,10 +349,8 @@ void ADBMouseUp(int button)
 
 void ADBSetRelMouseMode(bool relative)
 {
-	if (relative_mouse != relative) {
-		relative_mouse = relative;
-		mouse_x = mouse_y = 0;
-	}
+	if (!queue_input(INPUT_REL_MOUSE_MODE, relative, 0))
+		set_rel_mouse_mode(relative);
 }
 
 
@@ -288,12 +360,8 @@ void ADBSetRelMouseMode(bool relative)
 
 void ADBKeyDown(int code)
 {
-	// Add keycode to buffer
-	key_buffer[key_write_ptr] = code;
-	key_write_ptr = (key_write_ptr + 1) % KEY_BUFFER_SIZE;
-
-	// Set key in matrix
-	key_states[code >> 3] |= (1 << (~code & 7));
+	if (!queue_input(INPUT_KEY_DOWN, code, 0))
+		key_down(code);
 
 	// Trigger interrupt
 	SetInterruptFlag(INTFLAG_ADB);
@@ -307,12 +375,8 @@ void ADBKeyDown(int code)
 
 void ADBKeyUp(int code)
 {
-	// Add keycode to buffer
-	key_buffer[key_write_ptr] = code | 0x80;	// Key-up flag
-	key_write_ptr = (key_write_ptr + 1) % KEY_BUFFER_SIZE;
-
-	// Clear key in matrix
-	key_states[code >> 3] &= ~(1 << (~code & 7));
+	if (!queue_input(INPUT_KEY_UP, code, 0))
+		key_up(code);
 
 	// Trigger interrupt
 	SetInterruptFlag(INTFLAG_ADB);
@@ -320,6 +384,49 @@ void ADBKeyUp(int code)
 }
 
 
+/*
+ *  Apply host input queued while recording, or logged input while replaying
+ *  (executed at the start of the level 1 interrupt)
+ */
+
+void ADBReplayInput(void)
+{
+	if (!ReplayRecording && !ReplayPlaying)
+		return;
+
+	std::vector<uint8> events;
+	B2_lock_mutex(mouse_lock);
+	events.swap(input_queue);
+	B2_unlock_mutex(mouse_lock);
+	ReplayData(REPLAY_ADB, events);
+
+	for (size_t i = 0; i + INPUT_EVENT_SIZE <= events.size(); i += INPUT_EVENT_SIZE) {
+		int32 a, b;
+		memcpy(&a, &events[i + 1], 4);
+		memcpy(&b, &events[i + 5], 4);
+		switch (events[i]) {
+			case INPUT_MOUSE_MOVED:
+				mouse_moved(a, b);
+				break;
+			case INPUT_MOUSE_DOWN:
+			case INPUT_MOUSE_UP:
+				if (a >= 0 && a < 3)
+					mouse_button[a] = events[i] == INPUT_MOUSE_DOWN;
+				break;
+			case INPUT_KEY_DOWN:
+				key_down(a & 0x7f);
+				break;
+			case INPUT_KEY_UP:
+				key_up(a & 0x7f);
+				break;
+			case INPUT_REL_MOUSE_MODE:
+				set_rel_mouse_mode(a != 0);
+				break;
+		}
+	}
+}
+
+
 /*
  *  ADB interrupt function (executed as part of 60Hz interrupt)
  */
@@ -458,3 +565,43 @@ void ADBInterrupt(void)
 	WriteMacInt32(tmp_data, 0);
 	WriteMacInt32(tmp_data + 4, 0);
 }
+
+
+/*
+ *  Save/restore ADB state for snapshots (keys and buttons are released on restore)
+ */
+
+void ADBSaveState(snapshot_out &s)
+{
+	B2_lock_mutex(mouse_lock);
+	s.put32(mouse_x);
+	s.put32(mouse_y);
+	s.put32(old_mouse_x);
+	s.put32(old_mouse_y);
+	for (int i=0; i<3; i++)
+		s.put_bool(old_mouse_button[i]);
+	B2_unlock_mutex(mouse_lock);
+	s.put_bytes(mouse_reg_3, 2);
+	s.put_bytes(key_reg_2, 2);
+	s.put_bytes(key_reg_3, 2);
+}
+
+bool ADBLoadState(snapshot_in &s)
+{
+	B2_lock_mutex(mouse_lock);
+	mouse_x = (int32)s.get32();
+	mouse_y = (int32)s.get32();
+	old_mouse_x = (int32)s.get32();
+	old_mouse_y = (int32)s.get32();
+	for (int i=0; i<3; i++) {
+		old_mouse_button[i] = s.get_bool();
+		mouse_button[i] = false;
+	}
+	B2_unlock_mutex(mouse_lock);
+	s.get_bytes(mouse_reg_3, 2);
+	s.get_bytes(key_reg_2, 2);
+	s.get_bytes(key_reg_3, 2);
+	memset(key_states, 0, sizeof(key_states));
+	key_read_ptr = key_write_ptr = 0;
+	return s.ok();
+}
@@ -31,6 +31,7 @@
 #include "main.h"
 #include "audio.h"
 #include "audio_defs.h"
+#include "snapshot.h"
 
 #define DEBUG 0
 #include "debug.h"
@@ -657,3 +658,54 @@ int16 SoundInClose(uint32 pb, uint32 dce)
 	D(bug("SoundInClose\n"));
 	return noErr;
 }
+
+
+/*
+ *  Save/restore audio component status for snapshots
+ */
+
+void AudioSaveState(snapshot_out &s)
+{
+	s.put32(AudioStatus.sample_rate);
+	s.put32(AudioStatus.sample_size);
+	s.put32(AudioStatus.channels);
+	s.put32(AudioStatus.mixer);
+	s.put32(AudioStatus.num_sources);
+	s.put32(audio_data);
+	s.put32(open_count);
+}
+
+// Switch host to saved format value
+template <class T>
+static bool restore_format(const vector<T> &values, uint32 value, uint32 current, bool (*set)(int))
+{
+	if (value == current)
+		return true;
+	for (unsigned i=0; i<values.size(); i++)
+		if (values[i] == value)
+			return set(i);
+	return false;
+}
+
+bool AudioLoadState(snapshot_in &s)
+{
+	uint32 sample_rate = s.get32();
+	uint32 sample_size = s.get32();
+	uint32 channels = s.get32();
+	AudioStatus.mixer = s.get32();
+	AudioStatus.num_sources = s.get32();
+	audio_data = s.get32();
+	open_count = s.get32();
+	if (!s.ok())
+		return false;
+
+	if (!restore_format(audio_sample_rates, sample_rate, AudioStatus.sample_rate, audio_set_sample_rate)
+	 || !restore_format(audio_sample_sizes, sample_size, AudioStatus.sample_size, audio_set_sample_size)
+	 || !restore_format(audio_channel_counts, channels, AudioStatus.channels, audio_set_channels)) {
+		// Keep going with the host format, the Mac will get it from GetInfo
+		printf("WARNING: Cannot restore audio format from snapshot\n");
+	}
+	if (open_count)
+		audio_enter_stream();
+	return true;
+}
@@ -43,6 +43,7 @@ using std::vector;
 #include "sys.h"
 #include "prefs.h"
 #include "cdrom.h"
+#include "snapshot.h"
 
 #define DEBUG 0
 #include "debug.h"
@@ -287,11 +288,7 @@ static bool position2msf(const cdrom_drive_info &info, uint16 postype, uint32 po
 
 void CDROMInit(void)
 {
-	// No drives specified in prefs? Then add defaults
-	if (PrefsFindString("cdrom", 0) == NULL)
-		SysAddCDROMPrefs();
-
-	// Add drives specified in preferences
+	// Add drives specified in preferences (InitAll() adds defaults if there are none)
 	int index = 0;
 	const char *str;
 	while ((str = PrefsFindString("cdrom", index++)) != NULL) {
@@ -1002,3 +999,52 @@ void CDROMInterrupt(void)
 
 	mount_mountable_volumes();
 }
+
+
+/*
+ *  Save/restore drive table for snapshots (the same CD-ROM images must be configured)
+ */
+
+void CDROMSaveState(snapshot_out &s)
+{
+	s.put_bool(acc_run_called);
+	s.put32(drives.size());
+	drive_vec::const_iterator info, end = drives.end();
+	for (info = drives.begin(); info != end; ++info) {
+		s.put32(info->num);
+		s.put32(info->block_size);
+		s.put32(info->twok_offset);
+		s.put64(info->start_byte);
+		s.put_bool(info->to_be_mounted);
+		s.put_bool(info->mount_non_hfs);
+		s.put_bytes(info->toc, sizeof(info->toc));
+		s.put_bytes(info->lead_out, sizeof(info->lead_out));
+		s.put_bytes(info->stop_at, sizeof(info->stop_at));
+		s.put8(info->play_mode);
+		s.put8(info->power_mode);
+		s.put32(info->status);
+	}
+}
+
+bool CDROMLoadState(snapshot_in &s)
+{
+	acc_run_called = s.get_bool();
+	if (s.get32() != drives.size())
+		return false;
+	drive_vec::iterator info, end = drives.end();
+	for (info = drives.begin(); info != end; ++info) {
+		info->num = s.get32();
+		info->block_size = s.get32();
+		info->twok_offset = s.get32();
+		info->start_byte = s.get64();
+		info->to_be_mounted = s.get_bool();
+		info->mount_non_hfs = s.get_bool();
+		s.get_bytes(info->toc, sizeof(info->toc));
+		s.get_bytes(info->lead_out, sizeof(info->lead_out));
+		s.get_bytes(info->stop_at, sizeof(info->stop_at));
+		info->play_mode = s.get8();
+		info->power_mode = s.get8();
+		info->status = s.get32();
+	}
+	return s.ok();
+}
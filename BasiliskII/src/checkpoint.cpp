@@ -0,0 +1,773 @@
+/*
+ *  checkpoint.cpp - Incremental checkpoint log
+ *
+ *  Basilisk II (C) 1997-2008 Christian Bauer
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/*
+ *  The checkpoint log keeps the state of a running Mac on disk without
+ *  stopping it for a full snapshot. Every "checkpointinterval" seconds,
+ *  at the same safe point as snapshots, the emulation thread copies the
+ *  RAM pages written since the last checkpoint and the module states that
+ *  changed into a record. A writer thread appends the record to the log
+ *  and syncs it, while the Mac keeps running.
+ *
+ *  Written pages come from the write-watch of vm_alloc (asynchronous
+ *  userfaultfd write-protection on Linux, no signals involved), if RAM
+ *  was allocated with it. Otherwise each page is hashed at every
+ *  checkpoint and compared to the hash of the last one.
+ *
+ *  File layout (all values big-endian):
+ *    header        magic, version, RAM size, page size
+ *    records       magic, sequence number, number of sections, number of
+ *                  pages, payload size
+ *                  payload: sections (tag, size, data), page numbers,
+ *                  page data
+ *                  end magic, sequence number, checksum of the payload
+ *
+ *  The first record of a log holds all non-zero pages and all sections,
+ *  the following ones what changed since the previous record. A record
+ *  that is cut off or fails its checksum ends the log when loading. Once
+ *  the log is more than twice as big as its live data, the writer thread
+ *  rewrites it as a single record and renames it over the old one.
+ */
+
+#include "sysdeps.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <map>
+#include <string>
+
+#include "cpu_emulation.h"
+#include "prefs.h"
+#include "vm_alloc.h"
+#include "snapshot.h"
+#include "file_util.h"
+
+#define DEBUG 0
+#include "debug.h"
+
+
+// File format
+static const char CHECKPOINT_MAGIC[8] = {'B', '2', 'C', 'K', 'P', 'T', 0x0d, 0x0a};
+const uint32 CHECKPOINT_VERSION = 1;
+const uint32 LOG_HEADER_SIZE = 20;
+const uint32 LOG_PAGE_SIZE = 4096;			// Unit of RAM in the log, host pages may be bigger
+const uint32 RECORD_HEAD_SIZE = 24;
+const uint32 RECORD_TAIL_SIZE = 16;
+
+#define FOURCC(a, b, c, d) (((uint32)(a) << 24) | ((b) << 16) | ((c) << 8) | (d))
+const uint32 RECORD_MAGIC = FOURCC('C', 'K', 'P', 'T');
+const uint32 RECORD_END = FOURCC('C', 'E', 'N', 'D');
+
+// Log is compacted when it exceeds COMPACT_RATIO times its live data plus COMPACT_SLACK
+const uint64 COMPACT_RATIO = 2;
+const uint64 COMPACT_SLACK = 8 * 1024 * 1024;
+
+// Log file (writer thread only, once it runs)
+static std::string log_path;
+static int log_fd = -1;
+static uint64 log_size;						// End of last complete record
+static uint32 log_sequence;					// Sequence number of last record
+
+// Latest version of each page and section in the log, for compaction
+struct section_pos {
+	uint64 pos;
+	uint32 size;
+};
+static std::vector<uint64> page_pos;		// File offset of page data, 0 = not in log
+static std::map<uint32, section_pos> section_index;
+static uint64 live_size;					// Size of the latest versions
+
+// Writer thread
+static pthread_t writer_thread;
+static bool writer_active = false;
+static pthread_mutex_t writer_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t writer_cond = PTHREAD_COND_INITIALIZER;
+static bool writer_busy = false;			// Record handed to the writer thread
+static bool writer_quit = false;
+static bool writer_failed = false;			// Last record couldn't be written
+
+// Record handed to the writer thread
+static std::vector<uint8> record_data;		// Payload
+static uint32 record_sections, record_pages;
+static bool record_full;					// Starts a new log file
+
+// Written page tracking (emulation thread)
+static bool use_write_watch = false;		// vm_get_write_watch() works on RAM
+static std::vector<void *> watch_pages;
+static std::vector<uint64> page_hashes;		// Otherwise, page contents at the last checkpoint
+static std::vector<uint32> dirty_pages;
+static std::map<uint32, std::vector<uint8> > last_sections;	// Module states in the log
+static bool need_full = true;				// Next record starts a new log
+
+// Checkpoint scheduling
+static volatile bool checkpoint_pending = false;
+static volatile int32 seconds_to_checkpoint = 0;
+static int32 checkpoint_interval = 0;
+
+// Statistics
+static uint32 num_checkpoints, num_skipped;
+static uint64 total_pause, max_pause, total_written;
+
+
+/*
+ *  Helper functions
+ */
+
+// 64-bit FNV-1a over words, for page contents and record checksums
+static uint64 hash_data(const uint8 *p, uint64 len)
+{
+	uint64 h = UVAL64(0xcbf29ce484222325);
+	uint64 i = 0;
+	for (; i + 8 <= len; i += 8) {
+		uint64 w;
+		memcpy(&w, p + i, 8);
+		h = (h ^ w) * UVAL64(0x100000001b3);
+	}
+	for (; i < len; i++)
+		h = (h ^ p[i]) * UVAL64(0x100000001b3);
+	return h;
+}
+
+static inline uint32 num_log_pages(void)
+{
+	return RAMSize / LOG_PAGE_SIZE;
+}
+
+
+/*
+ *  Writer thread: append records, start new log files, compact
+ */
+
+// Write record with the given payload at POS
+static bool write_record(int fd, uint64 pos, uint32 seq, const std::vector<uint8> &payload, uint32 num_sections, uint32 num_pages)
+{
+	uint8 head[RECORD_HEAD_SIZE], tail[RECORD_TAIL_SIZE];
+	uint64 len = payload.size();
+	put_be32(head, RECORD_MAGIC);
+	put_be32(head + 4, seq);
+	put_be32(head + 8, num_sections);
+	put_be32(head + 12, num_pages);
+	put_be32(head + 16, len >> 32);
+	put_be32(head + 20, len);
+	uint64 sum = hash_data(len ? &payload[0] : NULL, len);
+	put_be32(tail, RECORD_END);
+	put_be32(tail + 4, seq);
+	put_be32(tail + 8, sum >> 32);
+	put_be32(tail + 12, sum);
+	return pwrite_all(fd, head, RECORD_HEAD_SIZE, pos)
+	    && (len == 0 || pwrite_all(fd, &payload[0], len, pos + RECORD_HEAD_SIZE))
+	    && pwrite_all(fd, tail, RECORD_TAIL_SIZE, pos + RECORD_HEAD_SIZE + len)
+	    && fsync(fd) == 0;
+}
+
+// Remember where the latest versions of the pages and sections of a record written at POS are
+static void index_record(uint64 pos, const std::vector<uint8> &payload, uint32 num_sections, uint32 num_pages)
+{
+	const uint8 *base = payload.empty() ? NULL : &payload[0];
+	uint64 ofs = 0;
+	pos += RECORD_HEAD_SIZE;
+	for (uint32 i = 0; i < num_sections; i++) {
+		uint32 tag = get_be32(base + ofs);
+		uint32 size = get_be32(base + ofs + 4);
+		section_pos &s = section_index[tag];
+		live_size += size;
+		live_size -= s.size;
+		s.pos = pos + ofs + 8;
+		s.size = size;
+		ofs += 8 + size;
+	}
+	const uint8 *numbers = base + ofs;
+	uint64 data = pos + ofs + num_pages * 4;
+	for (uint32 i = 0; i < num_pages; i++) {
+		uint32 page = get_be32(numbers + i * 4);
+		if (page_pos[page] == 0)
+			live_size += LOG_PAGE_SIZE;
+		page_pos[page] = data + (uint64)i * LOG_PAGE_SIZE;
+	}
+}
+
+// Write payload as the only record of a new log file, which replaces the old one
+static bool write_log_file(const std::vector<uint8> &payload, uint32 num_sections, uint32 num_pages)
+{
+	std::string tmp_path = log_path + ".tmp";
+	int fd = open(tmp_path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0666);
+	if (fd < 0)
+		return false;
+	uint8 header[LOG_HEADER_SIZE];
+	memcpy(header, CHECKPOINT_MAGIC, 8);
+	put_be32(header + 8, CHECKPOINT_VERSION);
+	put_be32(header + 12, RAMSize);
+	put_be32(header + 16, LOG_PAGE_SIZE);
+	if (!pwrite_all(fd, header, LOG_HEADER_SIZE, 0)
+	 || !write_record(fd, LOG_HEADER_SIZE, log_sequence, payload, num_sections, num_pages)
+	 || rename(tmp_path.c_str(), log_path.c_str()) < 0) {
+		close(fd);
+		unlink(tmp_path.c_str());
+		return false;
+	}
+	if (log_fd >= 0)
+		close(log_fd);
+	log_fd = fd;
+	log_size = LOG_HEADER_SIZE + RECORD_HEAD_SIZE + payload.size() + RECORD_TAIL_SIZE;
+
+	page_pos.assign(num_log_pages(), 0);
+	section_index.clear();
+	live_size = 0;
+	index_record(LOG_HEADER_SIZE, payload, num_sections, num_pages);
+	return true;
+}
+
+// Rewrite the log with the latest version of every page and section
+static void compact_log(void)
+{
+	std::vector<uint8> payload;
+	payload.reserve(live_size + section_index.size() * 8 + page_pos.size() * 4);
+	uint32 num_sections = 0, num_pages = 0;
+	for (std::map<uint32, section_pos>::const_iterator i = section_index.begin(); i != section_index.end(); ++i) {
+		append_be32(payload, i->first);
+		append_be32(payload, i->second.size);
+		payload.resize(payload.size() + i->second.size);
+		if (i->second.size && !pread_all(log_fd, &payload[payload.size() - i->second.size], i->second.size, i->second.pos))
+			return;
+		num_sections++;
+	}
+
+	// Pages that are zero now don't need to be kept, loading clears the pages not in the log
+	std::vector<uint8> data;
+	std::vector<uint8> page(LOG_PAGE_SIZE);
+	for (uint32 p = 0; p < page_pos.size(); p++) {
+		if (page_pos[p] == 0)
+			continue;
+		if (!pread_all(log_fd, &page[0], LOG_PAGE_SIZE, page_pos[p]))
+			return;
+		if (is_zero(&page[0], LOG_PAGE_SIZE))
+			continue;
+		append_be32(payload, p);
+		data.insert(data.end(), page.begin(), page.end());
+		num_pages++;
+	}
+	payload.insert(payload.end(), data.begin(), data.end());
+
+	if (write_log_file(payload, num_sections, num_pages)) {
+		D(bug("Checkpoint log compacted to %llu bytes\n", (unsigned long long)log_size));
+	}
+}
+
+static void *writer_func(void *arg)
+{
+	pthread_mutex_lock(&writer_lock);
+	for (;;) {
+		while (!writer_busy && !writer_quit)
+			pthread_cond_wait(&writer_cond, &writer_lock);
+		if (!writer_busy)
+			break;
+		pthread_mutex_unlock(&writer_lock);
+
+		log_sequence++;
+		bool ok;
+		if (record_full)
+			ok = write_log_file(record_data, record_sections, record_pages);
+		else {
+			ok = write_record(log_fd, log_size, log_sequence, record_data, record_sections, record_pages);
+			if (ok) {
+				index_record(log_size, record_data, record_sections, record_pages);
+				log_size += RECORD_HEAD_SIZE + record_data.size() + RECORD_TAIL_SIZE;
+			}
+		}
+		if (!ok)
+			fprintf(stderr, "Checkpoint log %s: %s\n", log_path.c_str(), strerror(errno));
+		else if (log_size > COMPACT_RATIO * live_size + COMPACT_SLACK)
+			compact_log();
+
+		pthread_mutex_lock(&writer_lock);
+		total_written += ok ? RECORD_HEAD_SIZE + record_data.size() + RECORD_TAIL_SIZE : 0;
+		writer_failed = !ok;
+		writer_busy = false;
+		pthread_cond_broadcast(&writer_cond);
+	}
+	pthread_mutex_unlock(&writer_lock);
+	return NULL;
+}
+
+
+/*
+ *  Take checkpoint (emulation thread)
+ */
+
+// Find the pages written since the last checkpoint, or all non-zero pages
+static void find_dirty_pages(bool full)
+{
+	const uint32 num_pages = num_log_pages();
+	dirty_pages.clear();
+
+	if (use_write_watch) {
+		unsigned int n = watch_pages.size();
+		if (vm_get_write_watch(RAMBaseHost, RAMSize, &watch_pages[0], &n, VM_WRITE_WATCH_RESET) < 0) {
+			// Parts of RAM were remapped (e.g. by a snapshot restore), compare contents from now on
+			D(bug("Checkpoint: write-watch failed, hashing pages\n"));
+			use_write_watch = false;
+		} else if (full) {
+			for (uint32 p = 0; p < num_pages; p++)
+				if (!is_zero(RAMBaseHost + p * LOG_PAGE_SIZE, LOG_PAGE_SIZE))
+					dirty_pages.push_back(p);
+			return;
+		} else {
+			const uint32 per_host_page = vm_get_page_size() / LOG_PAGE_SIZE;
+			for (unsigned int i = 0; i < n; i++) {
+				uint32 first = ((uint8 *)watch_pages[i] - RAMBaseHost) / LOG_PAGE_SIZE;
+				for (uint32 p = first; p < first + per_host_page && p < num_pages; p++)
+					dirty_pages.push_back(p);
+			}
+			return;
+		}
+	}
+
+	// Without hashes from the last checkpoint, every page may have changed
+	bool known = !page_hashes.empty();
+	page_hashes.resize(num_pages);
+	for (uint32 p = 0; p < num_pages; p++) {
+		const uint8 *data = RAMBaseHost + p * LOG_PAGE_SIZE;
+		uint64 h = hash_data(data, LOG_PAGE_SIZE);
+		bool changed = full ? !is_zero(data, LOG_PAGE_SIZE) : !known || h != page_hashes[p];
+		page_hashes[p] = h;
+		if (changed)
+			dirty_pages.push_back(p);
+	}
+}
+
+static bool take_checkpoint(void)
+{
+	// The Mac keeps running while a record is written, a checkpoint is skipped if the writer is still busy
+	pthread_mutex_lock(&writer_lock);
+	bool busy = writer_busy;
+	if (writer_failed) {
+		writer_failed = false;
+		need_full = true;
+	}
+	pthread_mutex_unlock(&writer_lock);
+	if (busy) {
+		num_skipped++;
+		return false;
+	}
+
+	uint64 start = GetTicks_usec();
+	bool full = need_full;
+	find_dirty_pages(full);
+
+	// Module states that changed since the last record
+	snapshot_section_vec sections;
+	SnapshotSaveSections(sections);
+	record_data.clear();
+	record_sections = 0;
+	for (snapshot_section_vec::iterator i = sections.begin(); i != sections.end(); ++i) {
+		std::vector<uint8> &last = last_sections[i->tag];
+		if (!full && last == i->data)
+			continue;
+		append_be32(record_data, i->tag);
+		append_be32(record_data, i->data.size());
+		record_data.insert(record_data.end(), i->data.begin(), i->data.end());
+		last.swap(i->data);
+		record_sections++;
+	}
+
+	// Written pages
+	record_pages = dirty_pages.size();
+	for (uint32 i = 0; i < record_pages; i++)
+		append_be32(record_data, dirty_pages[i]);
+	uint64 data = record_data.size();
+	record_data.resize(data + (uint64)record_pages * LOG_PAGE_SIZE);
+	for (uint32 i = 0; i < record_pages; i++)
+		memcpy(&record_data[data + (uint64)i * LOG_PAGE_SIZE], RAMBaseHost + dirty_pages[i] * LOG_PAGE_SIZE, LOG_PAGE_SIZE);
+	record_full = full;
+	need_full = false;
+
+	uint64 pause = GetTicks_usec() - start;
+	num_checkpoints++;
+	total_pause += pause;
+	if (pause > max_pause)
+		max_pause = pause;
+	D(bug("Checkpoint %u: %u pages, %u sections, %llu usec\n", num_checkpoints, record_pages, record_sections, (unsigned long long)pause));
+
+	pthread_mutex_lock(&writer_lock);
+	writer_busy = true;
+	pthread_cond_signal(&writer_cond);
+	pthread_mutex_unlock(&writer_lock);
+	return true;
+}
+
+#ifdef CHECKPOINT_BENCHMARK
+// Wait until the writer thread is done with the last record
+static void wait_writer(void)
+{
+	pthread_mutex_lock(&writer_lock);
+	while (writer_busy)
+		pthread_cond_wait(&writer_cond, &writer_lock);
+	pthread_mutex_unlock(&writer_lock);
+}
+#endif
+
+
+/*
+ *  Start/stop checkpoint log
+ */
+
+static bool start_log(const char *path)
+{
+	log_path = path;
+	log_fd = -1;
+	log_sequence = 0;
+	need_full = true;
+	last_sections.clear();
+	page_hashes.clear();
+
+	// Use the write-watch if RAM was allocated with it
+	watch_pages.resize(RAMSize / vm_get_page_size());
+	use_write_watch = vm_reset_write_watch(RAMBaseHost, RAMSize) == 0;
+	D(bug("Checkpoint log %s, %s\n", path, use_write_watch ? "write-watch" : "page hashes"));
+
+	writer_quit = false;
+	writer_busy = false;
+	writer_failed = false;
+	writer_active = pthread_create(&writer_thread, NULL, writer_func, NULL) == 0;
+	return writer_active;
+}
+
+static void stop_log(void)
+{
+	if (writer_active) {
+		pthread_mutex_lock(&writer_lock);
+		writer_quit = true;
+		pthread_cond_signal(&writer_cond);
+		pthread_mutex_unlock(&writer_lock);
+		pthread_join(writer_thread, NULL);
+		writer_active = false;
+	}
+	if (log_fd >= 0) {
+		close(log_fd);
+		log_fd = -1;
+	}
+	D(bug("Checkpoints: %u taken, %u skipped, %llu usec average pause, %llu usec max, %llu bytes written\n",
+		num_checkpoints, num_skipped, (unsigned long long)(num_checkpoints ? total_pause / num_checkpoints : 0),
+		(unsigned long long)max_pause, (unsigned long long)total_written));
+}
+
+void CheckpointInit(void)
+{
+	const char *path = PrefsFindString("checkpoint");
+	if (path == NULL || *path == 0)
+		return;
+	checkpoint_interval = PrefsFindInt32("checkpointinterval");
+	if (checkpoint_interval <= 0)
+		return;
+	if (!start_log(path)) {
+		fprintf(stderr, "Checkpoint log %s: cannot start writer thread\n", path);
+		return;
+	}
+
+	// First checkpoint at the next tick
+	seconds_to_checkpoint = 1;
+}
+
+void CheckpointExit(void)
+{
+	stop_log();
+}
+
+
+/*
+ *  Request checkpoint once per "checkpointinterval" seconds (any thread),
+ *  the CPU emulation calls CheckpointSafePoint() when it can be taken
+ */
+
+void CheckpointTick(void)
+{
+	if (!writer_active || --seconds_to_checkpoint > 0)
+		return;
+	seconds_to_checkpoint = checkpoint_interval;
+	checkpoint_pending = true;
+	TriggerSnapshot();
+}
+
+void CheckpointSafePoint(void)
+{
+	if (!checkpoint_pending)
+		return;
+	checkpoint_pending = false;
+	take_checkpoint();
+}
+
+
+/*
+ *  Restore the last complete checkpoint of a log
+ */
+
+static const char *read_log(int fd)
+{
+	// Check header
+	uint8 header[LOG_HEADER_SIZE];
+	struct stat st;
+	if (fstat(fd, &st) < 0 || !pread_all(fd, header, LOG_HEADER_SIZE, 0) || memcmp(header, CHECKPOINT_MAGIC, 8))
+		return "not a checkpoint log";
+	if (get_be32(header + 8) != CHECKPOINT_VERSION)
+		return "unsupported checkpoint log version";
+	if (get_be32(header + 12) != RAMSize || get_be32(header + 16) != LOG_PAGE_SIZE)
+		return "RAM size differs";
+
+	// Apply complete records
+	const uint32 num_pages = num_log_pages();
+	const uint64 file_size = st.st_size;
+	std::map<uint32, std::vector<uint8> > sections;
+	std::vector<bool> restored(num_pages);
+	std::vector<uint8> payload;
+	uint32 num_records = 0;
+	uint64 pos = LOG_HEADER_SIZE;
+	while (pos + RECORD_HEAD_SIZE + RECORD_TAIL_SIZE <= file_size) {
+		uint8 head[RECORD_HEAD_SIZE], tail[RECORD_TAIL_SIZE];
+		if (!pread_all(fd, head, RECORD_HEAD_SIZE, pos) || get_be32(head) != RECORD_MAGIC)
+			break;
+		uint32 seq = get_be32(head + 4);
+		uint32 rec_sections = get_be32(head + 8);
+		uint32 rec_pages = get_be32(head + 12);
+		uint64 len = ((uint64)get_be32(head + 16) << 32) | get_be32(head + 20);
+		if (len > file_size - pos - RECORD_HEAD_SIZE - RECORD_TAIL_SIZE || (uint64)rec_pages * (4 + LOG_PAGE_SIZE) > len)
+			break;
+		payload.resize(len);
+		if ((len && !pread_all(fd, &payload[0], len, pos + RECORD_HEAD_SIZE))
+		 || !pread_all(fd, tail, RECORD_TAIL_SIZE, pos + RECORD_HEAD_SIZE + len))
+			break;
+		uint64 sum = hash_data(len ? &payload[0] : NULL, len);
+		if (get_be32(tail) != RECORD_END || get_be32(tail + 4) != seq
+		 || get_be32(tail + 8) != (uint32)(sum >> 32) || get_be32(tail + 12) != (uint32)sum)
+			break;
+
+		// Split payload
+		const uint8 *base = len ? &payload[0] : NULL;
+		snapshot_section_vec rec;
+		uint64 ofs = 0;
+		for (uint32 i = 0; i < rec_sections && ofs + 8 <= len; i++) {
+			uint32 size = get_be32(base + ofs + 4);
+			if (size > len - ofs - 8)
+				return "corrupt record";
+			snapshot_section sec;
+			sec.tag = get_be32(base + ofs);
+			sec.data.assign(base + ofs + 8, base + ofs + 8 + size);
+			rec.push_back(sec);
+			ofs += 8 + size;
+		}
+		if (rec.size() != rec_sections || len - ofs != (uint64)rec_pages * (4 + LOG_PAGE_SIZE))
+			return "corrupt record";
+
+		// Check machine configuration before anything is changed
+		const char *err;
+		if (num_records == 0 && (err = SnapshotCheckSections(rec)) != NULL)
+			return err;
+
+		for (snapshot_section_vec::iterator i = rec.begin(); i != rec.end(); ++i)
+			sections[i->tag].swap(i->data);
+		const uint8 *data = base + ofs + rec_pages * 4;
+		for (uint32 i = 0; i < rec_pages; i++) {
+			uint32 page = get_be32(base + ofs + i * 4);
+			if (page >= num_pages)
+				return "corrupt record";
+			memcpy(RAMBaseHost + page * LOG_PAGE_SIZE, data + (uint64)i * LOG_PAGE_SIZE, LOG_PAGE_SIZE);
+			restored[page] = true;
+		}
+
+		num_records++;
+		pos += RECORD_HEAD_SIZE + len + RECORD_TAIL_SIZE;
+	}
+	if (num_records == 0)
+		return "no complete checkpoint";
+	D(bug("Checkpoint log: %u records, %llu of %llu bytes used\n", num_records, (unsigned long long)pos, (unsigned long long)file_size));
+
+	// Pages not in the log are zero
+	for (uint32 p = 0; p < num_pages; p++) {
+		uint8 *data = RAMBaseHost + p * LOG_PAGE_SIZE;
+		if (!restored[p] && !is_zero(data, LOG_PAGE_SIZE))
+			memset(data, 0, LOG_PAGE_SIZE);
+	}
+
+	snapshot_section_vec latest;
+	for (std::map<uint32, std::vector<uint8> >::iterator i = sections.begin(); i != sections.end(); ++i) {
+		snapshot_section sec;
+		sec.tag = i->first;
+		sec.data.swap(i->second);
+		latest.push_back(sec);
+	}
+	return SnapshotLoadSections(latest);
+}
+
+bool CheckpointLoad(const char *path)
+{
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		fprintf(stderr, "Checkpoint log %s: %s\n", path, strerror(errno));
+		return false;
+	}
+	const char *err = read_log(fd);
+	close(fd);
+	if (err) {
+		fprintf(stderr, "Checkpoint log %s: %s\n", path, err);
+		return false;
+	}
+	D(bug("Resumed from checkpoint log %s\n", path));
+	return true;
+}
+
+
+#ifdef CHECKPOINT_BENCHMARK
+/*
+ *  Compare checkpoints with full snapshots on a synthetic workload: a
+ *  guest that writes a few pages of its RAM between checkpoints, most of
+ *  them in a small hot set. Reports the time the guest is stopped and the
+ *  bytes written for each, then restores RAM from the log and compares.
+ *
+ *  checkpoint_bench [RAM MB] [checkpoints] [pages written per interval]
+ */
+
+#include <sys/time.h>
+
+uint8 *RAMBaseHost;
+uint32 RAMSize;
+static uint32 bench_counter;
+
+uint64 GetTicks_usec(void)
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return (uint64)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+void TriggerSnapshot(void) {}
+const char *PrefsFindString(const char *name, int index) {return NULL;}
+int32 PrefsFindInt32(const char *name) {return 0;}
+
+// Like a real machine: ROM-sized constant section, CPU state changing every time
+void SnapshotSaveSections(snapshot_section_vec &sections)
+{
+	snapshot_section rom, cpu;
+	rom.tag = FOURCC('R', 'O', 'M', ' ');
+	rom.data.assign(1024 * 1024, 0x4e);
+	cpu.tag = FOURCC('C', 'P', 'U', ' ');
+	cpu.data.assign(256, 0);
+	put_be32(&cpu.data[0], bench_counter++);
+	sections.push_back(rom);
+	sections.push_back(cpu);
+}
+
+const char *SnapshotCheckSections(const snapshot_section_vec &sections) {return NULL;}
+const char *SnapshotLoadSections(const snapshot_section_vec &sections) {return NULL;}
+
+// Write pages at random, 90% of them in the first 5% of RAM
+static void write_pages(uint32 n, std::vector<bool> &touched)
+{
+	const uint32 num_pages = num_log_pages();
+	const uint32 hot = num_pages / 20;
+	for (uint32 i = 0; i < n; i++) {
+		uint32 p = (rand() % 10) ? rand() % hot : rand() % num_pages;
+		uint8 *data = RAMBaseHost + p * LOG_PAGE_SIZE;
+		for (uint32 j = 0; j < LOG_PAGE_SIZE; j += 64)
+			data[j + rand() % 64] = rand();
+		touched[p] = true;
+	}
+}
+
+int main(int argc, char **argv)
+{
+	uint32 ram_mb = argc > 1 ? atoi(argv[1]) : 64;
+	uint32 rounds = argc > 2 ? atoi(argv[2]) : 50;
+	uint32 per_round = argc > 3 ? atoi(argv[3]) : 1000;
+	RAMSize = ram_mb * 1024 * 1024;
+
+	vm_init();
+	RAMBaseHost = (uint8 *)vm_acquire(RAMSize, VM_MAP_DEFAULT | VM_MAP_WRITE_WATCH);
+	if (RAMBaseHost == VM_MAP_FAILED)
+		RAMBaseHost = (uint8 *)vm_acquire(RAMSize);
+	if (RAMBaseHost == VM_MAP_FAILED) {
+		fprintf(stderr, "cannot allocate %u MB\n", ram_mb);
+		return 1;
+	}
+	srand(1);
+	std::vector<bool> touched(num_log_pages());
+	write_pages(num_log_pages() / 4, touched);
+
+	// Full snapshot: the guest is stopped while the whole RAM and the sections are written
+	char path[] = "/tmp/checkpoint_bench.XXXXXX";
+	int fd = mkstemp(path);
+	uint64 t = GetTicks_usec();
+	snapshot_section_vec sections;
+	SnapshotSaveSections(sections);
+	uint64 snapshot_bytes = RAMSize;
+	pwrite_all(fd, RAMBaseHost, RAMSize, 0);
+	for (uint32 i = 0; i < sections.size(); i++) {
+		pwrite_all(fd, &sections[i].data[0], sections[i].data.size(), snapshot_bytes);
+		snapshot_bytes += sections[i].data.size();
+	}
+	uint64 snapshot_time = GetTicks_usec() - t;
+	close(fd);
+	unlink(path);
+
+	// Checkpoints, each after PER_ROUND page writes
+	std::string log = std::string(path) + ".log";
+	start_log(log.c_str());
+	bool watched = use_write_watch;
+	uint64 changed_bytes = 0;
+	take_checkpoint();
+	wait_writer();
+	uint64 first_pause = max_pause, first_written = total_written;
+	total_pause = max_pause = total_written = 0;
+	num_checkpoints = 0;
+	for (uint32 r = 0; r < rounds; r++) {
+		std::vector<bool> round_touched(num_log_pages());
+		write_pages(per_round, round_touched);
+		for (uint32 p = 0; p < round_touched.size(); p++)
+			changed_bytes += round_touched[p] ? LOG_PAGE_SIZE : 0;
+		take_checkpoint();
+		wait_writer();
+	}
+	struct stat st;
+	stat(log.c_str(), &st);
+	std::vector<uint8> reference(RAMBaseHost, RAMBaseHost + RAMSize);
+	uint32 n = num_checkpoints;
+	uint64 pause = total_pause, worst = max_pause, written = total_written;
+	stop_log();
+
+	// Restore and compare
+	memset(RAMBaseHost, 0xaa, RAMSize);
+	bool restored = CheckpointLoad(log.c_str()) && memcmp(RAMBaseHost, &reference[0], RAMSize) == 0;
+	unlink(log.c_str());
+
+	printf("RAM %u MB, %u checkpoints of %u page writes, dirty pages from %s\n", ram_mb, n, per_round, watched ? "write-watch" : "page hashes");
+	printf("full snapshot:      pause %8.2f ms, %10llu bytes\n", snapshot_time / 1000.0, (unsigned long long)snapshot_bytes);
+	printf("first checkpoint:   pause %8.2f ms, %10llu bytes\n", first_pause / 1000.0, (unsigned long long)first_written);
+	printf("checkpoint average: pause %8.2f ms, %10llu bytes (max pause %.2f ms)\n",
+		pause / 1000.0 / n, (unsigned long long)(written / n), worst / 1000.0);
+	printf("write amplification: %.2fx of changed pages, %.3fx of a full snapshot per interval\n",
+		(double)written / changed_bytes, (double)written / n / snapshot_bytes);
+	printf("log size %llu bytes after compaction, restore %s\n", (unsigned long long)st.st_size, restored ? "matches" : "DIFFERS");
+	return restored ? 0 : 1;
+}
+#endif
@@ -41,6 +41,7 @@ using std::vector;
 #include "sys.h"
 #include "prefs.h"
 #include "disk.h"
+#include "snapshot.h"
 
 #define DEBUG 0
 #include "debug.h"
@@ -151,11 +152,7 @@ static void find_hfs_partition(disk_drive_info &info)
 
 void DiskInit(void)
 {
-	// No drives specified in prefs? Then add defaults
-	if (PrefsFindString("disk", 0) == NULL)
-		SysAddDiskPrefs();
-
-	// Add drives specified in preferences
+	// Add drives specified in preferences (InitAll() adds defaults if there are none)
 	int index = 0;
 	const char *str;
 	while ((str = PrefsFindString("disk", index++)) != NULL) {
@@ -544,3 +541,44 @@ void DiskInterrupt(void)
 
 	mount_mountable_volumes();
 }
+
+
+/*
+ *  Save/restore drive table for snapshots (the same disks must be configured,
+ *  and their contents must not have changed since the snapshot was taken)
+ */
+
+void DiskSaveState(snapshot_out &s)
+{
+	s.put_bool(acc_run_called);
+	s.put32(drives.size());
+	drive_vec::const_iterator info, end = drives.end();
+	for (info = drives.begin(); info != end; ++info) {
+		s.put32(info->num);
+		s.put64(info->start_byte);
+		s.put32(info->num_blocks);
+		s.put_bool(info->to_be_mounted);
+		s.put_bool(info->read_only);
+		s.put32(info->status);
+	}
+}
+
+bool DiskLoadState(snapshot_in &s)
+{
+	acc_run_called = s.get_bool();
+	if (s.get32() != drives.size())
+		return false;
+	drive_vec::iterator info, end = drives.end();
+	for (info = drives.begin(); info != end; ++info) {
+		info->num = s.get32();
+		info->start_byte = s.get64();
+		info->num_blocks = s.get32();
+		info->to_be_mounted = s.get_bool();
+		info->read_only = s.get_bool();
+		info->status = s.get32();
+		if (info->status && info->start_byte == 0 && ReadMacInt8(info->status + dsDiskInPlace)
+		 && info->num_blocks != uint32(SysGetFileSize(info->fh) / 512))
+			return false;
+	}
+	return s.ok();
+}
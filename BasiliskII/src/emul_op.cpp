@@ -40,6 +40,8 @@
 #include "audio.h"
 #include "ether.h"
 #include "extfs.h"
+#include "replay.h"
+#include "bench.h"
 #include "emul_op.h"
 
 #ifdef ENABLE_MON
@@ -149,6 +151,7 @@ void EmulOp(uint16 opcode, M68kRegisters *r)
 					if (reg == 0x8a && !TwentyFourBitAddressing)
 						r->d[2] |= 0x05;	// 32bit mode is always enabled if possible
 					XPRAM[reg] = r->d[2];
+					XPRAMMarkDirty();
 				}
 			} else {
 				// PRAM, RTC and other clock registers
@@ -160,9 +163,10 @@ void EmulOp(uint16 opcode, M68kRegisters *r)
 					} else {
 						D(bug("Write PRAM %02x<-%02lx\n", reg, r->d[2]));
 						XPRAM[reg] = r->d[2];
+						XPRAMMarkDirty();
 					}
 				} else if (reg < 0x08 && is_read) {
-					uint32 t = TimerDateTime();
+					uint32 t = ReplayValue(REPLAY_TIME, TimerDateTime());
 					uint8 b = t;
 					switch (reg & 3) {
 						case 1: b = t >> 8; break;
@@ -225,9 +229,14 @@ void EmulOp(uint16 opcode, M68kRegisters *r)
 			r->d[0] = PrimeTime(r->a[0], r->d[0]);
 			break;
 
-		case M68K_EMUL_OP_MICROSECONDS: 	// Microseconds() replacement
-			Microseconds(r->a[0], r->d[0]);
+		case M68K_EMUL_OP_MICROSECONDS: {	// Microseconds() replacement
+			uint32 t[2];
+			Microseconds(t[0], t[1]);
+			ReplayBytes(REPLAY_TIME, t, sizeof(t));
+			r->a[0] = t[0];
+			r->d[0] = t[1];
 			break;
+		}
 
 		case M68K_EMUL_OP_INSTALL_DRIVERS: {// Patch to install our own drivers during startup
 			// Install drivers
@@ -249,6 +258,10 @@ void EmulOp(uint16 opcode, M68kRegisters *r)
 				Execute68kTrap(0xa647, &r);	// SetToolTrap()
 			}
 
+			// Install QuickDraw acceleration patches
+			if (QDAccelPatch)
+				VideoInstallAccel(QDAccelPatch);
+
 			// Setup fake ASC registers
 			if (ROMVersion == ROM_VERSION_32) {
 				r.d[0] = 0x1000;
@@ -441,10 +454,14 @@ void EmulOp(uint16 opcode, M68kRegisters *r)
 			break;
 		}
 
-		case M68K_EMUL_OP_IRQ:			// Level 1 interrupt
+		case M68K_EMUL_OP_IRQ: {		// Level 1 interrupt
 			r->d[0] = 0;
 
-			if (InterruptFlags & INTFLAG_60HZ) {
+			// Host input and the interrupts handled here come from the replay log when replaying
+			ADBReplayInput();
+			uint32 flags = ReplayValue(REPLAY_IRQ, InterruptFlags);
+
+			if (flags & INTFLAG_60HZ) {
 				ClearInterruptFlag(INTFLAG_60HZ);
 
 				// Increment Ticks variable
@@ -467,42 +484,51 @@ void EmulOp(uint16 opcode, M68kRegisters *r)
 				}
 			}
 
-			if (InterruptFlags & INTFLAG_1HZ) {
+			if (flags & INTFLAG_1HZ) {
 				ClearInterruptFlag(INTFLAG_1HZ);
+
+				// Update local time here instead of the tick thread, so it can be replayed
+				if (ReplayRecording || ReplayPlaying)
+					WriteMacInt32(0x20c, ReplayValue(REPLAY_TIME, TimerDateTime()));
+
 				if (HasMacStarted()) {
 					SonyInterrupt();
 					DiskInterrupt();
 					CDROMInterrupt();
 				}
+
+				// Benchmark script done?
+				BenchInterrupt();
 			}
 
-			if (InterruptFlags & INTFLAG_SERIAL) {
+			if (flags & INTFLAG_SERIAL) {
 				ClearInterruptFlag(INTFLAG_SERIAL);
 				SerialInterrupt();
 			}
 
-			if (InterruptFlags & INTFLAG_ETHER) {
+			if (flags & INTFLAG_ETHER) {
 				ClearInterruptFlag(INTFLAG_ETHER);
 				EtherInterrupt();
 			}
 
-			if (InterruptFlags & INTFLAG_AUDIO) {
+			if (flags & INTFLAG_AUDIO) {
 				ClearInterruptFlag(INTFLAG_AUDIO);
 				AudioInterrupt();
 			}
 
-			if (InterruptFlags & INTFLAG_ADB) {
+			if (flags & INTFLAG_ADB) {
 				ClearInterruptFlag(INTFLAG_ADB);
 				if (HasMacStarted())
 					ADBInterrupt();
 			}
 
-			if (InterruptFlags & INTFLAG_NMI) {
+			if (flags & INTFLAG_NMI) {
 				ClearInterruptFlag(INTFLAG_NMI);
 				if (HasMacStarted())
 					TriggerNMI();
 			}
 			break;
+		}
 
 		case M68K_EMUL_OP_PUT_SCRAP: {		// PutScrap() patch
 			void *scrap = Mac2HostAddr(ReadMacInt32(r->a[7] + 4));
@@ -516,7 +542,8 @@ void EmulOp(uint16 opcode, M68kRegisters *r)
 			void **scrap_handle = (void **)Mac2HostAddr(ReadMacInt32(r->a[7] + 4));
 			uint32 type = ReadMacInt32(r->a[7] + 8);
 			int32 length = ReadMacInt32(r->a[7] + 12);
-			GetScrap(scrap_handle, type, length);
+			if (!ReplayRecording && !ReplayPlaying)	// Host clipboard can't be replayed
+				GetScrap(scrap_handle, type, length);
 			break;
 		}
 
@@ -558,12 +585,19 @@ void EmulOp(uint16 opcode, M68kRegisters *r)
 			break;
 
 		case M68K_EMUL_OP_IDLE_TIME:	// SynchIdleTime() patch
-			// Sleep if no events pending
-			if (ReadMacInt32(0x14c) == 0)
+			// Sleep if no events pending, replays run at full speed
+			if (ReadMacInt32(0x14c) == 0 && !ReplayPlaying) {
+				BenchIdleBegin();
 				idle_wait();
+				BenchIdleEnd();
+			}
 			r->a[0] = ReadMacInt32(0x2b6);
 			break;
 
+		case M68K_EMUL_OP_QDACCEL:		// QuickDraw trap patches
+			r->d[0] = VideoAccelDispatch(r->d[0], r) ? 1 : 0;
+			break;
+
 		case M68K_EMUL_OP_SUSPEND: {
 			printf("*** Suspend\n");
 			printf("d0 %08x d1 %08x d2 %08x d3 %08x\n"
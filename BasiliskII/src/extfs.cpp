@@ -42,6 +42,9 @@
 #include <stdlib.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <string>
+#include <vector>
+#include <map>
 
 #ifndef WIN32
 #include <unistd.h>
@@ -60,6 +63,8 @@
 #include "user_strings.h"
 #include "extfs.h"
 #include "extfs_defs.h"
+#include "snapshot.h"
+#include "bench.h"
 
 #ifdef WIN32
 # include "posix_emu.h"
@@ -160,8 +165,13 @@ struct FSItem {
 	FSItem *parent;			// Pointer to parent
 	char *name;				// Object name (C string) - Host OS
 	char guest_name[32];	// Object name (C string) - Guest OS
-	time_t mtime;			// Modification time for get_cat_info caching
-	int cache_dircount;		// Cached number of files in directory
+	bool entries_valid;		// Directory entries are cached
+	std::vector<std::string> entries;	// Cached directory entries (host names)
+	time_t entries_mtime;	// Modification time of directory when entries were read
+#if SUPPORTS_EXTFS_WATCH
+	bool entries_watched;	// Directory is watched for changes
+	uint32 entries_generation;	// Watcher generation when entries were read
+#endif
 };
 
 static FSItem *first_fs_item, *last_fs_item;
@@ -239,7 +249,7 @@ static FSItem *create_fsitem(const char *name, const char *guest_name, FSItem *p
 	strcpy(p->name, name);
 	strncpy(p->guest_name, guest_name, 31);
 	p->guest_name[31] = 0;
-	p->mtime = 0;
+	p->entries_valid = false;
 	return p;
 }
 
@@ -319,6 +329,83 @@ static void swap_parent_ids(uint32 parent1, uint32 parent2)
 }
 
 
+/*
+ *  Cached directory entries, so that looking up items by index and
+ *  counting them doesn't read the whole directory each time. With the
+ *  host directory watcher the entries stay valid until an entry is
+ *  created, deleted or renamed, otherwise until the modification time
+ *  of the directory changes. Changes made through ExtFS drop them at once.
+ *  Like the helper directory cache, at most DIR_CACHE_MAX_DIRS directories
+ *  keep their entries, when there are more all of them are dropped.
+ */
+
+const int DIR_CACHE_MAX_DIRS = 256;		// Directories with cached entries
+static int num_cached_dirs = 0;
+
+static void drop_dir_entries(FSItem *p)
+{
+	if (p->entries_valid)
+		num_cached_dirs--;
+	p->entries_valid = false;
+	std::vector<std::string>().swap(p->entries);
+}
+
+// Get entries of directory "p", full_path must be its path; "st" are its stats if known
+static bool get_dir_entries(FSItem *p, const struct stat *st = NULL)
+{
+	struct stat dir_st;
+	if (p->entries_valid) {
+#if SUPPORTS_EXTFS_WATCH
+		if (p->entries_watched) {
+			if (!extfs_dir_changed(full_path, p->entries_generation))
+				return true;
+		} else
+#endif
+		{
+			if (st == NULL && stat(full_path, &dir_st) == 0)
+				st = &dir_st;
+			if (st && st->st_mtime == p->entries_mtime)
+				return true;
+		}
+	}
+
+	// Read directory
+	drop_dir_entries(p);
+	if (num_cached_dirs >= DIR_CACHE_MAX_DIRS) {
+		D(bug("dropping cached entries of %d directories\n", num_cached_dirs));
+		for (FSItem *q = first_fs_item; q; q = q->next)
+			drop_dir_entries(q);
+	}
+#if SUPPORTS_EXTFS_WATCH
+	p->entries_watched = extfs_watch_dir(full_path, p->entries_generation);
+#endif
+	DIR *d = opendir(full_path);
+	if (d == NULL)
+		return false;
+	if (stat(full_path, &dir_st) == 0 && dir_st.st_mtime < time(NULL))
+		p->entries_mtime = dir_st.st_mtime;
+	else
+		p->entries_mtime = -1;		// Changes in the same second wouldn't change the time
+	struct dirent *de;
+	while ((de = readdir(d)) != NULL) {
+		if (de->d_name[0] == '.')
+			continue;	// Suppress names beginning with '.' (MacOS could interpret these as driver names)
+		p->entries.push_back(de->d_name);
+	}
+	closedir(d);
+	p->entries_valid = true;
+	num_cached_dirs++;
+	return true;
+}
+
+// Entries of directory "p" were changed by us
+static void forget_dir_entries(FSItem *p)
+{
+	if (p)
+		drop_dir_entries(p);
+}
+
+
 /*
  *  String handling functions
  */
@@ -419,6 +506,7 @@ void ExtFSInit(void)
 	p->name = new char[1];
 	p->name[0] = 0;
 	p->guest_name[0] = 0;
+	p->entries_valid = false;
 
 	// Create root FSItem
 	p = new FSItem;
@@ -433,6 +521,7 @@ void ExtFSInit(void)
 	strcpy(p->name, volume_name);
 	strncpy(p->guest_name, host_encoding_to_macroman(p->name), 32);
 	p->guest_name[31] = 0;
+	p->entries_valid = false;
 
 	// Find path for root
 	*RootPath = 0;
@@ -449,6 +538,223 @@ void ExtFSInit(void)
 }
 
 
+/*
+ *  The mark of an open fork is kept in fcbCrPs, reads and writes are
+ *  positional. Forks that are read sequentially in small pieces get a
+ *  read-ahead buffer; writes and size changes drop the buffers of all
+ *  open forks of the file. Buffered data is also dropped when another
+ *  program writes to the host file: the file watcher reports it, or
+ *  without the watcher the size or modification time (with nanoseconds
+ *  where available) changes.
+ */
+
+struct read_ahead {
+	uint32 id;					// CNID of file
+	bool rsrc;					// Resource fork
+	off_t next;					// Position after the last read
+	int sequential;				// Sequential reads in a row
+	off_t start;				// Position of buffered data
+	size_t size;				// Bytes in buffer
+#if SUPPORTS_EXTFS_WATCH
+	int wd;						// Watch of host file, -1 = not watched
+	uint32 generation;			// Generation of host file when the buffer was filled
+#endif
+	off_t file_size;			// Size and modification time of host file when the buffer was filled
+	time_t mtime;
+	long mtime_nsec;
+	uint8 *buffer;				// Allocated when needed
+};
+
+typedef std::map<int, read_ahead> read_ahead_map;
+static read_ahead_map read_aheads;	// Indexed by fd
+
+const size_t READ_AHEAD_SIZE = 0x10000;
+const int READ_AHEAD_AFTER = 2;		// Sequential reads before reading ahead
+
+// Newline mode of ioPosMode, the newline character is in the high byte
+const uint16 NEWLINE_MODE = 0x80;
+
+// Get position for ioPosMode/ioPosOffset, returns false if invalid
+static bool get_new_mark(uint32 pb, uint32 fcb, int fd, off_t &pos)
+{
+	int32 offset = ReadMacInt32(pb + ioPosOffset);
+	switch (ReadMacInt16(pb + ioPosMode) & 3) {
+		case fsFromStart:
+			pos = (uint32)offset;
+			break;
+		case fsFromLEOF: {
+			struct stat st;
+			if (fstat(fd, &st) < 0)
+				return false;
+			pos = st.st_size + offset;
+			break;
+		}
+		case fsFromMark:
+			pos = (off_t)ReadMacInt32(fcb + fcbCrPs) + offset;
+			break;
+		default:
+			pos = ReadMacInt32(fcb + fcbCrPs);
+			break;
+	}
+	return pos >= 0;
+}
+
+// Nanoseconds of modification time
+static inline long get_mtime_nsec(const struct stat &st)
+{
+#if defined(HAVE_STRUCT_STAT_ST_MTIM)
+	return st.st_mtim.tv_nsec;
+#elif defined(HAVE_STRUCT_STAT_ST_MTIMESPEC)
+	return st.st_mtimespec.tv_nsec;
+#else
+	return 0;
+#endif
+}
+
+static void free_read_ahead(read_ahead &ra)
+{
+#if SUPPORTS_EXTFS_WATCH
+	if (ra.wd >= 0)
+		extfs_unwatch_file(ra.wd);
+	ra.wd = -1;
+#endif
+	delete[] ra.buffer;
+	ra.buffer = NULL;
+}
+
+// Drop all read-ahead buffers
+static void clear_read_aheads(void)
+{
+	for (read_ahead_map::iterator it = read_aheads.begin(); it != read_aheads.end(); ++it)
+		free_read_ahead(it->second);
+	read_aheads.clear();
+}
+
+// Drop read-ahead buffer of fork that is closed
+static void close_read_ahead(int fd)
+{
+	read_ahead_map::iterator it = read_aheads.find(fd);
+	if (it != read_aheads.end()) {
+		free_read_ahead(it->second);
+		read_aheads.erase(it);
+	}
+}
+
+// Drop buffered data of all open forks of a file
+static void invalidate_read_ahead(uint32 fcb)
+{
+	uint32 id = ReadMacInt32(fcb + fcbFlNm);
+	bool rsrc = (ReadMacInt8(fcb + fcbFlags) & fcbResourceMask) != 0;
+	for (read_ahead_map::iterator it = read_aheads.begin(); it != read_aheads.end(); ++it) {
+		if (it->second.id == id && it->second.rsrc == rsrc)
+			it->second.size = 0;
+	}
+}
+
+// Remember state of host file before the buffer is filled, returns false if it can't be checked later
+static bool get_file_state(int fd, read_ahead &ra)
+{
+#if SUPPORTS_EXTFS_WATCH
+	if (ra.wd < 0)
+		ra.wd = extfs_watch_file(fd);
+	if (ra.wd >= 0) {
+		ra.generation = extfs_file_generation(ra.wd);
+		return true;
+	}
+#endif
+	struct stat st;
+	if (fstat(fd, &st) < 0)
+		return false;
+	ra.file_size = st.st_size;
+	ra.mtime = st.st_mtime;
+	ra.mtime_nsec = get_mtime_nsec(st);
+	return true;
+}
+
+// Was the host file changed since the buffer was filled?
+static bool file_state_changed(int fd, const read_ahead &ra)
+{
+#if SUPPORTS_EXTFS_WATCH
+	if (ra.wd >= 0)
+		return extfs_file_changed(ra.wd, ra.generation);
+#endif
+	struct stat st;
+	return fstat(fd, &st) < 0 || st.st_size != ra.file_size || st.st_mtime != ra.mtime || get_mtime_nsec(st) != ra.mtime_nsec;
+}
+
+// Read from fork at position, returns number of bytes read (or -1 on error)
+static ssize_t read_fork(uint32 fcb, int fd, uint8 *dest, size_t length, off_t pos)
+{
+	uint32 id = ReadMacInt32(fcb + fcbFlNm);
+	bool rsrc = (ReadMacInt8(fcb + fcbFlags) & fcbResourceMask) != 0;
+	read_ahead_map::iterator it = read_aheads.find(fd);
+	bool fresh = it == read_aheads.end();
+	if (fresh) {
+		read_ahead ra;
+		ra.buffer = NULL;
+#if SUPPORTS_EXTFS_WATCH
+		ra.wd = -1;
+#endif
+		it = read_aheads.insert(read_ahead_map::value_type(fd, ra)).first;
+	}
+	read_ahead &ra = it->second;
+	if (fresh || ra.id != id || ra.rsrc != rsrc) {	// fd may have been reused
+		if (!fresh)
+			free_read_ahead(ra);
+		ra.id = id;
+		ra.rsrc = rsrc;
+		ra.next = -1;
+		ra.sequential = 0;
+		ra.start = 0;
+		ra.size = 0;
+	}
+	if (pos == ra.next)
+		ra.sequential++;
+	else
+		ra.sequential = 0;
+
+	// Buffered data, unless the host file was changed since
+	size_t done = 0;
+	if (pos >= ra.start && pos < ra.start + (off_t)ra.size && file_state_changed(fd, ra))
+		ra.size = 0;
+	if (pos >= ra.start && pos < ra.start + (off_t)ra.size) {
+		done = ra.start + ra.size - pos;
+		if (done > length)
+			done = length;
+		memcpy(dest, ra.buffer + (pos - ra.start), done);
+	}
+
+	// Read the rest, through the buffer if the fork is read sequentially in small pieces
+	if (done < length) {
+		size_t rest = length - done;
+		if (ra.sequential >= READ_AHEAD_AFTER && rest < READ_AHEAD_SIZE / 2) {
+			if (ra.buffer == NULL)
+				ra.buffer = new uint8[READ_AHEAD_SIZE];
+			ra.size = 0;
+			bool state_ok = get_file_state(fd, ra);
+			ssize_t actual = extfs_read(fd, ra.buffer, READ_AHEAD_SIZE, pos + done);
+			if (actual < 0)
+				return done ? (ssize_t)done : -1;
+			if (state_ok) {
+				ra.start = pos + done;
+				ra.size = actual;
+			}
+			if (rest > (size_t)actual)
+				rest = actual;
+			memcpy(dest + done, ra.buffer, rest);
+			done += rest;
+		} else {
+			ssize_t actual = extfs_read(fd, dest + done, rest, pos + done);
+			if (actual < 0)
+				return done ? (ssize_t)done : -1;
+			done += actual;
+		}
+	}
+	ra.next = pos + done;
+	return done;
+}
+
+
 /*
  *  Deinitialization
  */
@@ -464,12 +770,149 @@ void ExtFSExit(void)
 		p = next;
 	}
 	first_fs_item = last_fs_item = NULL;
+	num_cached_dirs = 0;
+	clear_read_aheads();
 
 	// System specific deinitialization
 	extfs_exit();
 }
 
 
+/*
+ *  Save/restore state for snapshots: the CNID mapping and the host side
+ *  of the forks that are open (the FCBs themselves are in Mac RAM)
+ */
+
+// Low memory globals describing the FCB table
+const uint32 FCBSPtr = 0x34e;
+const uint32 FSFCBLen = 0x3f6;
+
+static void put_string(snapshot_out &s, const char *str)
+{
+	uint16 len = strlen(str);
+	s.put16(len);
+	s.put_bytes(str, len);
+}
+
+static std::string get_string(snapshot_in &s)
+{
+	std::string str(s.get16(), 0);
+	if (!str.empty())
+		s.get_bytes(&str[0], str.size());
+	return str;
+}
+
+// Collect the FCBs that belong to our volume
+static void get_open_forks(std::vector<uint32> &fcbs)
+{
+	uint32 table = ReadMacInt32(FCBSPtr);
+	uint16 fcb_len = ReadMacInt16(FSFCBLen);
+	if (table == 0 || fcb_len == 0)
+		return;
+	uint16 table_len = ReadMacInt16(table);
+	for (uint32 ofs = 2; ofs + fcb_len <= table_len; ofs += fcb_len) {
+		uint32 fcb = table + ofs;
+		uint32 vcb = ReadMacInt32(fcb + fcbVPtr);
+		if (ReadMacInt32(fcb + fcbFlNm) && vcb && ReadMacInt16(vcb + vcbFSID) == MY_FSID)
+			fcbs.push_back(fcb);
+	}
+}
+
+void ExtFSSaveState(snapshot_out &s)
+{
+	s.put_bool(ready);
+	put_string(s, RootPath);
+	if (!ready)
+		return;
+	s.put32(fs_data);
+	s.put32(drive_number);
+	s.put32(next_cnid);
+
+	// FSItems behind root, in creation order so parents come first
+	uint32 num_items = 0;
+	for (FSItem *p = first_fs_item->next->next; p; p = p->next)
+		num_items++;
+	s.put32(num_items);
+	for (FSItem *p = first_fs_item->next->next; p; p = p->next) {
+		s.put32(p->id);
+		s.put32(p->parent_id);
+		put_string(s, p->name);
+		s.put_bytes(p->guest_name, 32);
+	}
+
+	// Open forks
+	std::vector<uint32> fcbs;
+	get_open_forks(fcbs);
+	s.put32(fcbs.size());
+	for (size_t i = 0; i < fcbs.size(); i++) {
+		int fd = (int32)ReadMacInt32(fcbs[i] + fcbCatPos);
+		s.put32(fcbs[i]);
+		s.put_bool(fd >= 0);
+		s.put64(fd >= 0 ? ReadMacInt32(fcbs[i] + fcbCrPs) : 0);
+	}
+}
+
+bool ExtFSLoadState(snapshot_in &s)
+{
+	bool was_ready = s.get_bool();
+	std::string root = get_string(s);
+	if (was_ready != ready || root != RootPath)
+		return false;
+	if (!ready)
+		return s.ok();
+	fs_data = s.get32();
+	drive_number = s.get32();
+	next_cnid = s.get32();
+
+	uint32 num_items = s.get32();
+	for (uint32 i = 0; i < num_items; i++) {
+		uint32 id = s.get32();
+		uint32 parent_id = s.get32();
+		std::string name = get_string(s);
+		FSItem *parent = find_fsitem_by_id(parent_id);
+		if (parent == NULL)
+			return false;
+		FSItem *p = new FSItem;
+		last_fs_item->next = p;
+		p->next = NULL;
+		last_fs_item = p;
+		p->id = id;
+		p->parent_id = parent_id;
+		p->parent = parent;
+		p->name = new char[name.size() + 1];
+		strcpy(p->name, name.c_str());
+		s.get_bytes(p->guest_name, 32);
+		p->guest_name[31] = 0;
+		p->entries_valid = false;
+	}
+
+	// Reopen forks, the files must still be there
+	clear_read_aheads();
+	uint32 num_forks = s.get32();
+	for (uint32 i = 0; i < num_forks; i++) {
+		uint32 fcb = s.get32();
+		bool has_fd = s.get_bool();
+		s.get64();		// File position, the mark in the FCB is used
+		FSItem *item = find_fsitem_by_id(ReadMacInt32(fcb + fcbFlNm));
+		if (item == NULL)
+			return false;
+		get_path_for_fsitem(item);
+		uint8 flags = ReadMacInt8(fcb + fcbFlags);
+		int flag = (flags & fcbWriteMask) ? O_RDWR : O_RDONLY;
+		int fd = -1;
+		if (has_fd) {
+			fd = (flags & fcbResourceMask) ? open_rfork(full_path, flag) : open(full_path, flag);
+			if (fd < 0) {
+				D(bug(" can't reopen %s\n", full_path));
+				return false;
+			}
+		}
+		WriteMacInt32(fcb + fcbCatPos, fd);
+	}
+	return s.ok();
+}
+
+
 /*
  *  Install file system
  */
@@ -1276,26 +1719,16 @@ static int16 fs_get_file_info(uint32 pb, bool hfs, uint32 dirID)
 		get_path_for_fsitem(p);
 
 		// Look for nth item in directory and add name to path
-		DIR *d = opendir(full_path);
-		if (d == NULL)
+		if (!get_dir_entries(p))
 			return dirNFErr;
-		struct dirent *de = NULL;
-		for (int i=0; i<dir_index; i++) {
-read_next_de:
-			de = readdir(d);
-			if (de == NULL) {
-				closedir(d);
-				return fnfErr;
-			}
-			if (de->d_name[0] == '.')
-				goto read_next_de;	// Suppress names beginning with '.' (MacOS could interpret these as driver names)
-			//!! suppress directories
-		}
-		add_path_comp(de->d_name);
+		if (dir_index > (int)p->entries.size())
+			return fnfErr;
+		const char *name = p->entries[dir_index - 1].c_str();
+		//!! suppress directories
+		add_path_comp(name);
 
 		// Get FSItem for queried item
-		fs_item = find_fsitem(de->d_name, p);
-		closedir(d);
+		fs_item = find_fsitem(name, p);
 	}
 
 	// Get stats
@@ -1400,25 +1833,15 @@ static int16 fs_get_cat_info(uint32 pb)
 		get_path_for_fsitem(p);
 
 		// Look for nth item in directory and add name to path
-		DIR *d = opendir(full_path);
-		if (d == NULL)
+		if (!get_dir_entries(p))
 			return dirNFErr;
-		struct dirent *de = NULL;
-		for (int i=0; i<dir_index; i++) {
-read_next_de:
-			de = readdir(d);
-			if (de == NULL) {
-				closedir(d);
-				return fnfErr;
-			}
-			if (de->d_name[0] == '.')
-				goto read_next_de;	// Suppress names beginning with '.' (MacOS could interpret these as driver names)
-		}
-		add_path_comp(de->d_name);
+		if (dir_index > (int)p->entries.size())
+			return fnfErr;
+		const char *name = p->entries[dir_index - 1].c_str();
+		add_path_comp(name);
 
 		// Get FSItem for queried item
-		fs_item = find_fsitem(de->d_name, p);
-		closedir(d);
+		fs_item = find_fsitem(name, p);
 	}
 	D(bug("  path %s\n", full_path));
 
@@ -1444,13 +1867,7 @@ read_next_de:
 #else
 	WriteMacInt32(pb + ioFlCrDat, 0);
 #endif
-	time_t mtime = st.st_mtime;
-	bool cached = true;
-	if (mtime > fs_item->mtime) {
-		fs_item->mtime = mtime;
-		cached = false;
-	}
-	WriteMacInt32(pb + ioFlMdDat, TimeToMacTime(mtime));
+	WriteMacInt32(pb + ioFlMdDat, TimeToMacTime(st.st_mtime));
 	WriteMacInt32(pb + ioFlBkDat, 0);
 
 	get_finfo(full_path, pb + ioFlFndrInfo, pb + ioFlXFndrInfo, S_ISDIR(st.st_mode));
@@ -1458,26 +1875,7 @@ read_next_de:
 	if (S_ISDIR(st.st_mode)) {
 
 		// Determine number of files in directory (cached)
-		int count;
-		if (cached)
-			count = fs_item->cache_dircount;
-		else {
-			count = 0;
-			DIR *d = opendir(full_path);
-			if (d) {
-				struct dirent *de;
-				for (;;) {
-					de = readdir(d);
-					if (de == NULL)
-						break;
-					if (de->d_name[0] == '.')
-						continue;	// Suppress names beginning with '.'
-					count++;
-				}
-				closedir(d);
-			}
-			fs_item->cache_dircount = count;
-		}
+		int count = get_dir_entries(fs_item, &st) ? fs_item->entries.size() : 0;
 		WriteMacInt16(pb + ioDrNmFls, count);
 	} else {
 		WriteMacInt16(pb + ioFlStBlk, 0);
@@ -1623,6 +2021,7 @@ static int16 fs_close(uint32 pb)
 	int fd = ReadMacInt32(fcb + fcbCatPos);
 
 	// Close file
+	close_read_ahead(fd);
 	if (ReadMacInt8(fcb + fcbFlags) & fcbResourceMask) {
 		FSItem *item = find_fsitem_by_id(ReadMacInt32(fcb + fcbFlNm));
 		if (item) {
@@ -1747,6 +2146,7 @@ static int16 fs_set_eof(uint32 pb)
 
 	// Truncate file
 	uint32 size = ReadMacInt32(pb + ioMisc);
+	invalidate_read_ahead(fcb);
 	if (ftruncate(fd, size) < 0)
 		return errno2oserr();
 
@@ -1785,9 +2185,7 @@ static int16 fs_get_fpos(uint32 pb)
 	}
 
 	// Get file position
-	uint32 pos = (uint32) lseek(fd, 0, SEEK_CUR);
-	WriteMacInt32(fcb + fcbCrPs, pos);
-	WriteMacInt32(pb + ioPosOffset, pos);
+	WriteMacInt32(pb + ioPosOffset, ReadMacInt32(fcb + fcbCrPs));
 	return noErr;
 }
 
@@ -1812,23 +2210,9 @@ static int16 fs_set_fpos(uint32 pb)
 	}
 
 	// Set file position
-	switch (ReadMacInt16(pb + ioPosMode) & 3) {
-		case fsFromStart:
-			if (lseek(fd, ReadMacInt32(pb + ioPosOffset), SEEK_SET) < 0)
-				return posErr;
-			break;
-		case fsFromLEOF:
-			if (lseek(fd, (int32)ReadMacInt32(pb + ioPosOffset), SEEK_END) < 0)
-				return posErr;
-			break;
-		case fsFromMark:
-			if (lseek(fd, (int32)ReadMacInt32(pb + ioPosOffset), SEEK_CUR) < 0)
-				return posErr;
-			break;
-		default:
-			break;
-	}
-	uint32 pos = (uint32) lseek(fd, 0, SEEK_CUR);
+	off_t pos;
+	if (!get_new_mark(pb, fcb, fd, pos))
+		return posErr;
 	WriteMacInt32(fcb + fcbCrPs, pos);
 	WriteMacInt32(pb + ioPosOffset, pos);
 	return noErr;
@@ -1858,31 +2242,51 @@ static int16 fs_read(uint32 pb)
 			return fnOpnErr;
 	}
 
-	// Seek
-	switch (ReadMacInt16(pb + ioPosMode) & 3) {
-		case fsFromStart:
-			if (lseek(fd, ReadMacInt32(pb + ioPosOffset), SEEK_SET) < 0)
-				return posErr;
-			break;
-		case fsFromLEOF:
-			if (lseek(fd, (int32)ReadMacInt32(pb + ioPosOffset), SEEK_END) < 0)
-				return posErr;
-			break;
-		case fsFromMark:
-			if (lseek(fd, (int32)ReadMacInt32(pb + ioPosOffset), SEEK_CUR) < 0)
-				return posErr;
-			break;
-	}
-
-	// Read
-	ssize_t actual = extfs_read(fd, Mac2HostAddr(ReadMacInt32(pb + ioBuffer)), ReadMacInt32(pb + ioReqCount));
+	// Get position
+	off_t pos;
+	if (!get_new_mark(pb, fcb, fd, pos))
+		return posErr;
+
+	// Read, in newline mode in pieces up to the newline character
+	uint8 *buffer = Mac2HostAddr(ReadMacInt32(pb + ioBuffer));
+	size_t length = ReadMacInt32(pb + ioReqCount);
+	uint16 pos_mode = ReadMacInt16(pb + ioPosMode);
+	ssize_t actual;
+	bool newline_found = false;
+	if (pos_mode & NEWLINE_MODE) {
+		const size_t PIECE_SIZE = 0x400;
+		actual = 0;
+		while ((size_t)actual < length) {
+			size_t piece = length - actual;
+			if (piece > PIECE_SIZE)
+				piece = PIECE_SIZE;
+			ssize_t res = read_fork(fcb, fd, buffer + actual, piece, pos + actual);
+			if (res < 0) {
+				if (actual == 0)
+					actual = -1;
+				break;
+			}
+			uint8 *nl = (uint8 *)memchr(buffer + actual, pos_mode >> 8, res);
+			if (nl) {
+				actual = nl + 1 - buffer;
+				newline_found = true;
+				break;
+			}
+			actual += res;
+			if ((size_t)res < piece)
+				break;
+		}
+	} else
+		actual = read_fork(fcb, fd, buffer, length, pos);
 	int16 read_err = errno2oserr();
 	D(bug("  actual %d\n", actual));
+	BenchIO(BENCH_EXTFS_READ, actual);
 	WriteMacInt32(pb + ioActCount, actual >= 0 ? actual : 0);
-	uint32 pos = (uint32) lseek(fd, 0, SEEK_CUR);
+	if (actual > 0)
+		pos += actual;
 	WriteMacInt32(fcb + fcbCrPs, pos);
 	WriteMacInt32(pb + ioPosOffset, pos);
-	if (actual != (ssize_t)ReadMacInt32(pb + ioReqCount))
+	if (actual != (ssize_t)length && !newline_found)
 		return actual < 0 ? read_err : eofErr;
 	else
 		return noErr;
@@ -1912,28 +2316,20 @@ static int16 fs_write(uint32 pb)
 			return fnOpnErr;
 	}
 
-	// Seek
-	switch (ReadMacInt16(pb + ioPosMode) & 3) {
-		case fsFromStart:
-			if (lseek(fd, ReadMacInt32(pb + ioPosOffset), SEEK_SET) < 0)
-				return posErr;
-			break;
-		case fsFromLEOF:
-			if (lseek(fd, (int32)ReadMacInt32(pb + ioPosOffset), SEEK_END) < 0)
-				return posErr;
-			break;
-		case fsFromMark:
-			if (lseek(fd, (int32)ReadMacInt32(pb + ioPosOffset), SEEK_CUR) < 0)
-				return posErr;
-			break;
-	}
+	// Get position
+	off_t pos;
+	if (!get_new_mark(pb, fcb, fd, pos))
+		return posErr;
 
 	// Write
-	ssize_t actual = extfs_write(fd, Mac2HostAddr(ReadMacInt32(pb + ioBuffer)), ReadMacInt32(pb + ioReqCount));
+	invalidate_read_ahead(fcb);
+	ssize_t actual = extfs_write(fd, Mac2HostAddr(ReadMacInt32(pb + ioBuffer)), ReadMacInt32(pb + ioReqCount), pos);
 	int16 write_err = errno2oserr();
 	D(bug("  actual %d\n", actual));
+	BenchIO(BENCH_EXTFS_WRITE, actual);
 	WriteMacInt32(pb + ioActCount, actual >= 0 ? actual : 0);
-	uint32 pos = (uint32) lseek(fd, 0, SEEK_CUR);
+	if (actual > 0)
+		pos += actual;
 	WriteMacInt32(fcb + fcbCrPs, pos);
 	WriteMacInt32(pb + ioPosOffset, pos);
 	if (actual != (ssize_t)ReadMacInt32(pb + ioReqCount))
@@ -1963,6 +2359,7 @@ static int16 fs_create(uint32 pb, uint32 dirID)
 		return errno2oserr();
 	else {
 		close(fd);
+		forget_dir_entries(fs_item->parent);
 		return noErr;
 	}
 }
@@ -1986,6 +2383,7 @@ static int16 fs_dir_create(uint32 pb)
 	if (mkdir(full_path, 0777) < 0)
 		return errno2oserr();
 	else {
+		forget_dir_entries(fs_item->parent);
 		WriteMacInt32(pb + ioDirID, fs_item->id);
 		return noErr;
 	}
@@ -2005,8 +2403,11 @@ static int16 fs_delete(uint32 pb, uint32 dirID)
 	// Delete file
 	if (!extfs_remove(full_path))
 		return errno2oserr();
-	else
+	else {
+		forget_dir_entries(fs_item->parent);
+		forget_dir_entries(fs_item);
 		return noErr;
+	}
 }
 
 // Rename file/directory
@@ -2041,6 +2442,9 @@ static int16 fs_rename(uint32 pb, uint32 dirID)
 	if (!extfs_rename(old_path, full_path))
 		return errno2oserr();
 	else {
+		forget_dir_entries(fs_item->parent);
+		forget_dir_entries(fs_item);
+
 		// The ID of the old file/dir has to stay the same, so we swap the IDs of the FSItems
 		swap_parent_ids(fs_item->id, new_item->id);
 		uint32 t = fs_item->id;
@@ -2085,6 +2489,10 @@ static int16 fs_cat_move(uint32 pb)
 	if (!extfs_rename(old_path, full_path))
 		return errno2oserr();
 	else {
+		forget_dir_entries(fs_item->parent);
+		forget_dir_entries(new_dir_item);
+		forget_dir_entries(fs_item);
+
 		// The ID of the old file/dir has to stay the same, so we swap the IDs of the FSItems
 		FSItem *new_item = find_fsitem(fs_item->name, new_dir_item);
 		if (new_item) {
@@ -2287,3 +2695,259 @@ int16 ExtFSHFS(uint32 vcb, uint16 selectCode, uint32 paramBlock, uint32 globalsP
 			return paramErr;
 	}
 }
+
+
+#ifdef EXTFS_WATCH_TEST
+/*
+ *  Enumerates host directories by index like the Finder does, while
+ *  creating, deleting and renaming entries on the host in between, and
+ *  checks that the cached entries and helper directory contents follow.
+ *  Also reads a fork in small pieces through the read-ahead buffer while
+ *  another program writes to the file. Built with and without the host
+ *  directory and file watcher.
+ *
+ *  extfs_watch_test
+ */
+
+#include <pthread.h>
+#include <sys/time.h>
+#include <algorithm>
+
+static char root_dir[] = "/tmp/extfs_watch_test.XXXXXX";
+static uint8 mac_mem[64];
+
+bool BenchRunning = false;
+uint64 BenchIOCalls[BENCH_NUM_IO], BenchIOBytes[BENCH_NUM_IO];
+uintptr MEMBaseDiff = (uintptr)mac_mem;
+void Execute68k(uint32 addr, M68kRegisters *r) {}
+void Execute68kTrap(uint16 trap, M68kRegisters *r) {}
+int FindFreeDriveNumber(int num) {return num;}
+const char *GetString(int num) {return "Unix";}
+static uint64 ticks_offset = 0;		// Skipped time, see settle_helpers()
+uint64 GetTicks_usec(void) {struct timeval tv; gettimeofday(&tv, NULL); return (uint64)tv.tv_sec * 1000000 + tv.tv_usec + ticks_offset;}
+time_t MacTimeToTime(uint32 t) {return t;}
+uint32 TimeToMacTime(time_t t) {return t;}
+const char *PrefsFindString(const char *name, int index) {return strcmp(name, "extfs") == 0 ? root_dir : NULL;}
+void QuitEmulator(void) {exit(1);}
+void Set_pthread_attr(pthread_attr_t *attr, int priority) {pthread_attr_init(attr);}
+
+static std::string host_path(const char *name)
+{
+	return std::string(root_dir) + "/" + name;
+}
+
+static void create_file(const char *name, const void *data = NULL, size_t length = 0)
+{
+	FILE *f = fopen(host_path(name).c_str(), "wb");
+	if (f) {
+		fwrite(data, 1, length, f);
+		fclose(f);
+	}
+}
+
+static FSItem *dir_item(const char *name)
+{
+	return find_fsitem(name, find_fsitem_by_id(ROOT_ID));
+}
+
+static bool read_entries(FSItem *p)
+{
+	get_path_for_fsitem(p);
+	return get_dir_entries(p);
+}
+
+static bool has_entry(FSItem *p, const char *name)
+{
+	return std::find(p->entries.begin(), p->entries.end(), name) != p->entries.end();
+}
+
+static bool has_type(const char *name, const char *type)
+{
+	std::string path = host_path(name);
+	char full[MAX_PATH_LENGTH];
+	strcpy(full, path.c_str());
+	get_finfo(full, Host2MacAddr(mac_mem), Host2MacAddr(mac_mem + 16), false);
+	return memcmp(mac_mem, type, 4) == 0;
+}
+
+const uint64 SETTLE_TIMEOUT = 5000000;		// usec
+
+// Wait until the watcher has seen a host change in directory "p", without the watcher changes are seen at once
+static void settle(FSItem *p)
+{
+#if SUPPORTS_EXTFS_WATCH
+	get_path_for_fsitem(p);
+	uint64 deadline = GetTicks_usec() + SETTLE_TIMEOUT;
+	while (!extfs_dir_changed(full_path, p->entries_generation) && GetTicks_usec() < deadline)
+		usleep(1000);
+#endif
+}
+
+// Wait until file "name" has the Finder type "type". Without the watcher, helper
+// directories are checked once a second, so the clock is moved on while waiting
+static void settle_helpers(const char *name, const char *type)
+{
+	uint64 deadline = GetTicks_usec() + SETTLE_TIMEOUT;
+	while (!has_type(name, type) && GetTicks_usec() < deadline) {
+		usleep(1000);
+#if !SUPPORTS_EXTFS_WATCH
+		ticks_offset += 100000;
+#endif
+	}
+}
+
+// Wait until the watcher has seen a host write to the buffered file "fd", without the watcher it is seen at once
+static void settle_fork(int fd)
+{
+#if SUPPORTS_EXTFS_WATCH
+	const read_ahead &ra = read_aheads[fd];
+	uint64 deadline = GetTicks_usec() + SETTLE_TIMEOUT;
+	while (ra.wd >= 0 && !extfs_file_changed(ra.wd, ra.generation) && GetTicks_usec() < deadline)
+		usleep(1000);
+#endif
+}
+
+#define CHECK(cond) do { if (!(cond)) { fprintf(stderr, "FAILED: %s (line %d)\n", #cond, __LINE__); return 1; } } while (0)
+
+int main(void)
+{
+	CHECK(mkdtemp(root_dir) != NULL);
+	CHECK(mkdir(host_path("big").c_str(), 0755) == 0 && mkdir(host_path("sub").c_str(), 0755) == 0);
+	char name[64];
+	for (int i = 0; i < 500; i++) {
+		sprintf(name, "big/f%03d", i);
+		create_file(name);
+	}
+	ExtFSInit();
+
+	// Enumerate by index, deleting and creating entries halfway through
+	FSItem *big = dir_item("big");
+	int seen = 0;
+	for (int i = 1; i <= 500; i++) {
+		CHECK(read_entries(big));
+		if (i == 250) {
+			CHECK(unlink(host_path("big/f499").c_str()) == 0);
+			create_file("big/new");
+			settle(big);
+		}
+		if (i <= (int)big->entries.size())
+			seen++;
+	}
+	CHECK(seen == 500);
+	CHECK(read_entries(big) && big->entries.size() == 500 && has_entry(big, "new") && !has_entry(big, "f499"));
+
+	// Renaming an entry
+	CHECK(rename(host_path("big/new").c_str(), host_path("big/new2").c_str()) == 0);
+	settle(big);
+	CHECK(read_entries(big) && has_entry(big, "new2") && !has_entry(big, "new"));
+
+	// Renaming the directory away and back, then removing and recreating it
+	FSItem *sub = dir_item("sub");
+	create_file("sub/a");
+	CHECK(read_entries(sub) && sub->entries.size() == 1);
+	CHECK(rename(host_path("sub").c_str(), host_path("sub2").c_str()) == 0);
+	settle(sub);
+	CHECK(!read_entries(sub));
+	CHECK(rename(host_path("sub2").c_str(), host_path("sub").c_str()) == 0);
+	create_file("sub/b");
+	settle(sub);
+	CHECK(read_entries(sub) && sub->entries.size() == 2);
+	CHECK(system(("rm -rf " + host_path("sub") + " && mkdir " + host_path("sub")).c_str()) == 0);
+	settle(sub);
+	CHECK(read_entries(sub) && sub->entries.empty());
+
+	// Finder info written by another program
+	uint8 finf[SIZEOF_FInfo + SIZEOF_FXInfo] = "TYPECRE8";
+	CHECK(!has_type("big/f000", "TYPE"));
+	CHECK(mkdir(host_path("big/.finf").c_str(), 0755) == 0);
+	create_file("big/.finf/f000", finf, sizeof(finf));
+	settle_helpers("big/f000", "TYPE");
+	CHECK(has_type("big/f000", "TYPE"));
+	create_file("big/.finf/f001", finf, sizeof(finf));
+	settle_helpers("big/f001", "TYPE");
+	CHECK(has_type("big/f001", "TYPE"));
+
+	// With the helper directories cached, files without Finder info cost no system calls
+	BenchRunning = true;
+	for (int i = 0; i < 499; i++) {
+		sprintf(name, "big/f%03d", i);
+		CHECK(has_type(name, "TYPE") == (i < 2));
+	}
+	BenchRunning = false;
+	printf("Finder info of 499 files: %llu system calls\n", (unsigned long long)BenchIOCalls[BENCH_EXTFS_META_SYSCALL]);
+	CHECK(BenchIOCalls[BENCH_EXTFS_META_SYSCALL] <= 10);
+
+	// Fork read in small pieces through the read-ahead buffer
+	std::vector<uint8> data(300000);
+	for (size_t i = 0; i < data.size(); i++)
+		data[i] = i % 251;
+	create_file("data", &data[0], data.size());
+	int fd = open(host_path("data").c_str(), O_RDONLY);
+	CHECK(fd >= 0);
+	uint32 fcb = Host2MacAddr(mac_mem + 32);
+	WriteMacInt32(fcb + fcbFlNm, 1234);
+	WriteMacInt8(fcb + fcbFlags, 0);
+	uint8 buf[3000];
+	off_t pos = 0;
+	for (int i = 1; pos < (off_t)data.size(); i = i * 7 % 2999 + 1) {
+		ssize_t actual = read_fork(fcb, fd, buf, i, pos);
+		CHECK(actual == std::min((off_t)i, (off_t)data.size() - pos));
+		CHECK(memcmp(buf, &data[pos], actual) == 0);
+		pos += actual;
+	}
+
+	// Another program overwrites buffered data within the same second, with
+	// the old modification time, then changes the size
+	pos = 1000;
+	for (int i = 0; i < 4; i++, pos += 100)
+		CHECK(read_fork(fcb, fd, buf, 100, pos) == 100 && buf[0] == data[pos]);
+	int other = open(host_path("data").c_str(), O_WRONLY);
+	CHECK(other >= 0);
+	uint8 changed[200];
+	memset(changed, 0x33, sizeof(changed));
+	usleep(20000);		// Past the file system timestamp granularity
+	CHECK(pwrite(other, changed, sizeof(changed), pos) == sizeof(changed));
+	settle_fork(fd);
+	CHECK(read_fork(fcb, fd, buf, 100, pos) == 100 && buf[0] == 0x33 && buf[99] == 0x33);
+	pos += 100;
+	CHECK(read_fork(fcb, fd, buf, 100, pos) == 100 && buf[0] == 0x33 && buf[99] == 0x33);
+	pos += 100;
+	memset(changed, 0xaa, sizeof(changed));
+	struct timeval old_time[2] = {{1000000000, 0}, {1000000000, 0}};
+	CHECK(pwrite(other, changed, sizeof(changed), pos) == sizeof(changed) && futimes(other, old_time) == 0);
+	settle_fork(fd);
+	CHECK(read_fork(fcb, fd, buf, 100, pos) == 100 && buf[0] == 0xaa && buf[99] == 0xaa);
+	pos += 100;
+	CHECK(read_fork(fcb, fd, buf, 100, pos) == 100 && buf[0] == 0xaa && buf[99] == 0xaa);
+	pos += 100;
+	memset(changed, 0x55, sizeof(changed));
+	CHECK(pwrite(other, changed, sizeof(changed), pos) == sizeof(changed) && pwrite(other, changed, 1, data.size()) == 1);
+	CHECK(futimes(other, old_time) == 0);
+	settle_fork(fd);
+	CHECK(read_fork(fcb, fd, buf, 100, pos) == 100 && buf[0] == 0x55 && buf[99] == 0x55);
+	close(other);
+
+	close_read_ahead(fd);
+	close(fd);
+
+	// Listing more directories than are cached
+	for (int i = 0; i < DIR_CACHE_MAX_DIRS + 50; i++) {
+		sprintf(name, "d%03d", i);
+		CHECK(mkdir(host_path(name).c_str(), 0755) == 0);
+		create_file((std::string(name) + "/x").c_str());
+		FSItem *d = dir_item(name);
+		CHECK(read_entries(d) && d->entries.size() == 1 && has_entry(d, "x"));
+		CHECK(num_cached_dirs <= DIR_CACHE_MAX_DIRS);
+	}
+	CHECK(read_entries(big) && big->entries.size() == 500);
+
+	ExtFSExit();
+	CHECK(system(("rm -rf " + std::string(root_dir)).c_str()) == 0);
+#if SUPPORTS_EXTFS_WATCH
+	printf("extfs_watch_test: OK with directory watcher\n");
+#else
+	printf("extfs_watch_test: OK without directory watcher\n");
+#endif
+	return 0;
+}
+#endif
@@ -0,0 +1,1098 @@
+/*
+ *  gfxaccel.cpp - Native QuickDraw acceleration
+ *
+ *  Basilisk II (C) 1997-2008 Christian Bauer
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/*
+ *  SEE ALSO
+ *    Inside Macintosh: Imaging With QuickDraw, chapter 3 "QuickDraw Drawing"
+ *    Inside Macintosh: Imaging With QuickDraw, chapter 4 "Color QuickDraw"
+ *
+ *  The EraseRect(), PaintRect(), InvertRect() and CopyBits() traps are
+ *  patched with small 68k stubs that first call EMUL_OP_QDACCEL. The
+ *  native code only handles the plain cases on the main screen (color
+ *  port, visible pen, rectangular clipping, solid patterns, no pictures or
+ *  custom bottlenecks being recorded) and lets the original trap run
+ *  otherwise.
+ */
+
+#include "sysdeps.h"
+#include "cpu_emulation.h"
+#include "main.h"
+#include "emul_op.h"
+#include "prefs.h"
+#include "video.h"
+
+#define DEBUG 0
+#include "debug.h"
+
+
+// Accelerated traps, the selector is passed in d0 by the 68k stubs
+enum {
+	QDACCEL_ERASE_RECT,
+	QDACCEL_PAINT_RECT,
+	QDACCEL_INVERT_RECT,
+	QDACCEL_COPY_BITS,
+	QDACCEL_NUM_TRAPS
+};
+
+static const struct {
+	uint16 trap;		// Toolbox trap number
+	uint16 arg_size;	// Size of Pascal arguments on the stack
+} accel_traps[QDACCEL_NUM_TRAPS] = {
+	{ 0xa8a3, 4 },		// EraseRect(r)
+	{ 0xa8a2, 4 },		// PaintRect(r)
+	{ 0xa8a4, 4 },		// InvertRect(r)
+	{ 0xa8ec, 22 }		// CopyBits(srcBits, dstBits, srcRect, dstRect, mode, maskRgn)
+};
+
+const int STUB_SIZE = 0x20;	// Space reserved for each 68k stub
+
+// CGrafPort fields
+enum {
+	portPortPixMap = 2,
+	portPortVersion = 6,
+	portVisRgn = 24,
+	portClipRgn = 28,
+	portBkPixPat = 32,
+	portPnMode = 56,
+	portPnPixPat = 58,
+	portPnVis = 66,
+	portFgColor = 80,
+	portBkColor = 84,
+	portPicSave = 92,
+	portRgnSave = 96,
+	portPolySave = 100,
+	portGrafProcs = 104
+};
+
+// PixMap fields
+enum {
+	pmBaseAddr = 0,
+	pmRowBytes = 4,
+	pmBounds = 6,
+	pmPixelSize = 32
+};
+
+// PixPat fields
+enum {
+	patType = 0,
+	pat1Data = 20
+};
+
+// Low memory globals
+const uint32 CrsrRect = 0x83c;
+const uint32 HiliteMode = 0x938;
+const uint32 CrsrVis = 0x8cc;
+
+const int patCopy = 8;
+const int srcCopy = 0;
+
+
+/*
+ *	Utility functions
+ */
+
+struct qd_rect {
+	int16 top, left, bottom, right;
+};
+
+static inline void read_rect(uint32 addr, qd_rect &r)
+{
+	r.top = ReadMacInt16(addr + 0);
+	r.left = ReadMacInt16(addr + 2);
+	r.bottom = ReadMacInt16(addr + 4);
+	r.right = ReadMacInt16(addr + 6);
+}
+
+static inline bool rect_empty(const qd_rect &r)
+{
+	return r.bottom <= r.top || r.right <= r.left;
+}
+
+static inline void rect_intersect(qd_rect &r, const qd_rect &s)
+{
+	if (s.top > r.top)
+		r.top = s.top;
+	if (s.left > r.left)
+		r.left = s.left;
+	if (s.bottom < r.bottom)
+		r.bottom = s.bottom;
+	if (s.right < r.right)
+		r.right = s.right;
+}
+
+static inline bool rect_overlap(const qd_rect &r, const qd_rect &s)
+{
+	return r.left < s.right && s.left < r.right && r.top < s.bottom && s.top < r.bottom;
+}
+
+static inline bool rect_contains(const qd_rect &r, const qd_rect &s)
+{
+	return s.top >= r.top && s.left >= r.left && s.bottom <= r.bottom && s.right <= r.right;
+}
+
+struct qd_pixmap {
+	uint32 base;
+	int32 row_bytes;
+	int bpp;
+	qd_rect bounds;
+};
+
+// Get pixmap for BitMap pointer, fails on 1-bit bitmaps and non-screen pixmaps
+static bool get_screen_pixmap(uint32 bits, qd_pixmap &pm)
+{
+	uint32 p;
+	uint16 rb = ReadMacInt16(bits + pmRowBytes);
+	if ((rb & 0xc000) == 0xc000)		// portBits of a CGrafPort
+		p = ReadMacInt32(ReadMacInt32(bits));
+	else if (rb & 0x8000)				// PixMap
+		p = bits;
+	else
+		return false;
+	if (p == 0)
+		return false;
+
+	pm.base = ReadMacInt32(p + pmBaseAddr);
+	if (pm.base != VideoMonitors[0]->get_mac_frame_base())
+		return false;
+	pm.row_bytes = ReadMacInt16(p + pmRowBytes) & 0x3fff;
+	read_rect(p + pmBounds, pm.bounds);
+	switch (ReadMacInt16(p + pmPixelSize)) {
+	case 8:
+		pm.bpp = 1;
+		break;
+	case 16:
+		pm.bpp = 2;
+		break;
+	case 32:
+		pm.bpp = 4;
+		break;
+	default:
+		return false;
+	}
+	return true;
+}
+
+// Get rectangular region, fails on complex regions
+static bool get_rect_region(uint32 handle, qd_rect &r)
+{
+	if (handle == 0)
+		return false;
+	uint32 p = ReadMacInt32(handle);
+	if (p == 0 || ReadMacInt16(p) != 10)
+		return false;
+	read_rect(p + 2, r);
+	return true;
+}
+
+// Check that the port draws plainly and return its clipping rectangle
+static bool check_port(uint32 port, qd_rect &clip)
+{
+	if (port == 0)
+		return false;
+	if ((ReadMacInt16(port + portPortVersion) & 0xc000) != 0xc000)
+		return false;
+	if (ReadMacInt32(port + portGrafProcs) || ReadMacInt32(port + portPicSave)
+	 || ReadMacInt32(port + portRgnSave) || ReadMacInt32(port + portPolySave))
+		return false;
+
+	qd_rect r;
+	if (!get_rect_region(ReadMacInt32(port + portVisRgn), clip))
+		return false;
+	if (!get_rect_region(ReadMacInt32(port + portClipRgn), r))
+		return false;
+	rect_intersect(clip, r);
+	return true;
+}
+
+// Get pixel value of a solid pattern, fails on other patterns
+static bool get_solid_pattern(uint32 port, uint32 pixpat, uint32 &pixel)
+{
+	uint32 p = pixpat ? ReadMacInt32(pixpat) : 0;
+	if (p == 0 || ReadMacInt16(p + patType) != 0)
+		return false;
+	uint32 hi = ReadMacInt32(p + pat1Data), lo = ReadMacInt32(p + pat1Data + 4);
+	if (hi == 0 && lo == 0)
+		pixel = ReadMacInt32(port + portBkColor);
+	else if (hi == 0xffffffff && lo == 0xffffffff)
+		pixel = ReadMacInt32(port + portFgColor);
+	else
+		return false;
+	return true;
+}
+
+// Check that the port colors are black and white so that CopyBits() doesn't colorize
+static bool black_and_white_port(uint32 port, int bpp)
+{
+	const uint32 fore = ReadMacInt32(port + portFgColor);
+	const uint32 back = ReadMacInt32(port + portBkColor);
+	if (bpp == 1)
+		return (fore & 0xff) == 0xff && (back & 0xff) == 0;
+	const uint32 white = bpp == 2 ? 0x7fff : 0xffffff;
+	return (fore & white) == 0 && (back & white) == white;
+}
+
+// Hide the cursor if it overlaps the screen rectangle, returns true if ShowCursor() is needed
+static bool hide_cursor(const qd_rect &r, M68kRegisters *regs)
+{
+	qd_rect crsr;
+	read_rect(CrsrRect, crsr);
+	if (ReadMacInt8(CrsrVis) == 0 || !rect_overlap(r, crsr))
+		return false;
+	M68kRegisters r2 = *regs;
+	Execute68kTrap(0xa852, &r2);	// HideCursor()
+	return true;
+}
+
+static void show_cursor(M68kRegisters *regs)
+{
+	M68kRegisters r2 = *regs;
+	Execute68kTrap(0xa853, &r2);	// ShowCursor()
+}
+
+// Pass-through dirty areas to redraw functions
+static inline void set_dirty_area(const qd_rect &r)
+{
+	video_set_dirty_area(r.left, r.top, r.right - r.left, r.bottom - r.top);
+}
+
+
+/*
+ *	Row kernels
+ */
+
+// Wide vector type, the compiler lowers it to SSE2 or NEON registers
+#if defined(__GNUC__)
+#define HAVE_QD_VECTORS 1
+typedef uint32 vec_u32 __attribute__((vector_size(16)));
+#endif
+
+// Fill row with 32-bit pattern given in memory byte order
+static void do_fillrect(uint8 *dest, uint32 pattern, uint32 length)
+{
+	uint32 i = 0;
+#ifdef HAVE_QD_VECTORS
+	const vec_u32 v = { pattern, pattern, pattern, pattern };
+	for (; i + 16 <= length; i += 16)
+		memcpy(dest + i, &v, sizeof(v));
+#endif
+	for (; i + 4 <= length; i += 4)
+		memcpy(dest + i, &pattern, 4);
+	const uint8 *pb = (const uint8 *)&pattern;
+	for (; i < length; i++)
+		dest[i] = pb[i & 3];
+}
+
+// Invert row
+static void do_invrect(uint8 *dest, uint32 length)
+{
+	uint32 i = 0;
+#ifdef HAVE_QD_VECTORS
+	for (; i + 16 <= length; i += 16) {
+		vec_u32 v;
+		memcpy(&v, dest + i, sizeof(v));
+		v = ~v;
+		memcpy(dest + i, &v, sizeof(v));
+	}
+#endif
+	for (; i + 4 <= length; i += 4) {
+		uint32 v;
+		memcpy(&v, dest + i, 4);
+		v = ~v;
+		memcpy(dest + i, &v, 4);
+	}
+	for (; i < length; i++)
+		dest[i] = ~dest[i];
+}
+
+// Replicate a pixel value over 32 bits, in memory byte order
+static inline uint32 replicate_pixel(uint32 pixel, int bpp)
+{
+	switch (bpp) {
+	case 1:
+		pixel = (pixel & 0xff) * 0x01010101;
+		break;
+	case 2:
+		pixel = (pixel & 0xffff) * 0x00010001;
+		break;
+	}
+	return htonl(pixel);
+}
+
+
+/*
+ *	EraseRect(), PaintRect() and InvertRect()
+ */
+
+static bool accel_rect(int selector, M68kRegisters *r)
+{
+	uint32 port = ReadMacInt32(ReadMacInt32(r->a[5]));	// thePort
+	qd_rect clip;
+	if (!check_port(port, clip))
+		return false;
+	if ((int16)ReadMacInt16(port + portPnVis) < 0)	// HidePen()
+		return false;
+	qd_pixmap pm;
+	if (!get_screen_pixmap(port + portPortPixMap, pm))
+		return false;
+
+	// Get operation
+	uint32 pixel = 0;
+	switch (selector) {
+	case QDACCEL_ERASE_RECT:
+		if (!get_solid_pattern(port, ReadMacInt32(port + portBkPixPat), pixel))
+			return false;
+		break;
+	case QDACCEL_PAINT_RECT:
+		if (ReadMacInt16(port + portPnMode) != patCopy)
+			return false;
+		if (!get_solid_pattern(port, ReadMacInt32(port + portPnPixPat), pixel))
+			return false;
+		break;
+	case QDACCEL_INVERT_RECT:
+		if ((ReadMacInt8(HiliteMode) & 0x80) == 0)		// highlighting requested
+			return false;
+		break;
+	}
+
+	// Clip rectangle, in local coordinates
+	qd_rect rect;
+	read_rect(ReadMacInt32(r->a[7] + 4), rect);
+	rect_intersect(rect, clip);
+	rect_intersect(rect, pm.bounds);
+	if (rect_empty(rect))
+		return true;
+
+	// Convert to screen coordinates
+	qd_rect scr;
+	scr.top = rect.top - pm.bounds.top;
+	scr.left = rect.left - pm.bounds.left;
+	scr.bottom = rect.bottom - pm.bounds.top;
+	scr.right = rect.right - pm.bounds.left;
+	D(bug("accel_rect %d, %d,%d-%d,%d pixel %08x\n", selector, scr.left, scr.top, scr.right, scr.bottom, pixel));
+
+	// And perform the operation
+	bool cursor_hidden = hide_cursor(scr, r);
+	set_dirty_area(scr);
+	uint8 *dest = Mac2HostAddr(pm.base + scr.top * pm.row_bytes + scr.left * pm.bpp);
+	const uint32 length = (scr.right - scr.left) * pm.bpp;
+	const uint32 pattern = replicate_pixel(pixel, pm.bpp);
+	for (int y = scr.top; y < scr.bottom; y++) {
+		if (selector == QDACCEL_INVERT_RECT)
+			do_invrect(dest, length);
+		else
+			do_fillrect(dest, pattern, length);
+		dest += pm.row_bytes;
+	}
+	if (cursor_hidden)
+		show_cursor(r);
+	return true;
+}
+
+
+/*
+ *	CopyBits() within the screen (scrolling, window dragging)
+ */
+
+static bool accel_copybits(M68kRegisters *r)
+{
+	uint32 sp = r->a[7];
+	uint32 mask_rgn = ReadMacInt32(sp + 4);
+	uint16 mode = ReadMacInt16(sp + 8);
+	uint32 dst_rect = ReadMacInt32(sp + 10);
+	uint32 src_rect = ReadMacInt32(sp + 14);
+	uint32 dst_bits = ReadMacInt32(sp + 18);
+	uint32 src_bits = ReadMacInt32(sp + 22);
+	if (mask_rgn != 0 || mode != srcCopy)
+		return false;
+
+	// Only copy into the current port
+	uint32 port = ReadMacInt32(ReadMacInt32(r->a[5]));	// thePort
+	if (dst_bits != port + portPortPixMap)
+		return false;
+	qd_rect clip;
+	if (!check_port(port, clip))
+		return false;
+
+	qd_pixmap src_pm, dst_pm;
+	if (!get_screen_pixmap(src_bits, src_pm) || !get_screen_pixmap(dst_bits, dst_pm))
+		return false;
+	if (src_pm.bpp != dst_pm.bpp || src_pm.row_bytes != dst_pm.row_bytes)
+		return false;
+	if (!black_and_white_port(port, dst_pm.bpp))
+		return false;
+
+	// Reject scaling and source rectangles that need clipping
+	qd_rect s, d;
+	read_rect(src_rect, s);
+	read_rect(dst_rect, d);
+	if (s.right - s.left != d.right - d.left || s.bottom - s.top != d.bottom - d.top)
+		return false;
+	if (!rect_contains(src_pm.bounds, s))
+		return false;
+
+	// Clip destination and move source accordingly
+	qd_rect dc = d;
+	rect_intersect(dc, clip);
+	rect_intersect(dc, dst_pm.bounds);
+	if (rect_empty(dc))
+		return true;
+	s.top += dc.top - d.top;
+	s.left += dc.left - d.left;
+
+	// Convert to screen coordinates
+	const int bpp = dst_pm.bpp;
+	const int32 row_bytes = dst_pm.row_bytes;
+	const int width = dc.right - dc.left, height = dc.bottom - dc.top;
+	qd_rect src_scr, dst_scr;
+	src_scr.top = s.top - src_pm.bounds.top;
+	src_scr.left = s.left - src_pm.bounds.left;
+	src_scr.bottom = src_scr.top + height;
+	src_scr.right = src_scr.left + width;
+	dst_scr.top = dc.top - dst_pm.bounds.top;
+	dst_scr.left = dc.left - dst_pm.bounds.left;
+	dst_scr.bottom = dst_scr.top + height;
+	dst_scr.right = dst_scr.left + width;
+	D(bug("accel_copybits %d,%d -> %d,%d, %dx%d\n", src_scr.left, src_scr.top, dst_scr.left, dst_scr.top, width, height));
+
+	// And perform the blit, bottom-up if the destination is below the source
+	qd_rect both = src_scr;
+	if (dst_scr.top < both.top) both.top = dst_scr.top;
+	if (dst_scr.left < both.left) both.left = dst_scr.left;
+	if (dst_scr.bottom > both.bottom) both.bottom = dst_scr.bottom;
+	if (dst_scr.right > both.right) both.right = dst_scr.right;
+	bool cursor_hidden = hide_cursor(both, r);
+	set_dirty_area(dst_scr);
+	uint8 *src = Mac2HostAddr(src_pm.base + src_scr.top * row_bytes + src_scr.left * bpp);
+	uint8 *dst = Mac2HostAddr(dst_pm.base + dst_scr.top * row_bytes + dst_scr.left * bpp);
+	const uint32 length = width * bpp;
+	if (dst_scr.top > src_scr.top) {
+		src += (height - 1) * row_bytes;
+		dst += (height - 1) * row_bytes;
+		for (int i = 0; i < height; i++) {
+			memmove(dst, src, length);
+			src -= row_bytes;
+			dst -= row_bytes;
+		}
+	} else {
+		for (int i = 0; i < height; i++) {
+			memmove(dst, src, length);
+			src += row_bytes;
+			dst += row_bytes;
+		}
+	}
+	if (cursor_hidden)
+		show_cursor(r);
+	return true;
+}
+
+
+/*
+ *  Execute accelerated trap, returns false if the original trap has to run
+ */
+
+bool VideoAccelDispatch(uint32 selector, M68kRegisters *r)
+{
+	// Drawing spanning several monitors is left to QuickDraw
+	if (VideoMonitors.size() != 1)
+		return false;
+
+	switch (selector) {
+	case QDACCEL_ERASE_RECT:
+	case QDACCEL_PAINT_RECT:
+	case QDACCEL_INVERT_RECT:
+		return accel_rect(selector, r);
+	case QDACCEL_COPY_BITS:
+		return accel_copybits(r);
+	}
+	return false;
+}
+
+
+/*
+ *  Install QuickDraw acceleration patches, called by EMUL_OP_INSTALL_DRIVERS
+ */
+
+void VideoInstallAccel(uint32 patch)
+{
+	if (!PrefsFindBool("gfxaccel"))
+		return;
+	D(bug("Video: Installing QuickDraw acceleration patches at %08x\n", patch));
+
+	M68kRegisters r;
+	for (int i = 0; i < QDACCEL_NUM_TRAPS; i++) {
+		const uint16 trap = accel_traps[i].trap;
+
+		// Get original trap address
+		r.d[0] = trap;
+		Execute68kTrap(0xa746, &r);		// GetToolTrapAddress()
+		uint32 orig = r.a[0];
+
+		// Build stub
+		uint32 base = patch + i * STUB_SIZE;
+		uint16 *wp = (uint16 *)Mac2HostAddr(base);
+		*wp++ = htons(0x7000 | i);		// moveq	#selector,d0
+		*wp++ = htons(M68K_EMUL_OP_QDACCEL);
+		*wp++ = htons(0x4a80);			// tst.l	d0
+		*wp++ = htons(0x6708);			// beq.s	1
+		*wp++ = htons(0x205f);			// move.l	(sp)+,a0
+		*wp++ = htons(0x4fef);			// lea		arg_size(sp),sp
+		*wp++ = htons(accel_traps[i].arg_size);
+		*wp++ = htons(M68K_JMP_A0);		// jmp		(a0)
+		*wp++ = htons(M68K_JMP);		//1	jmp		orig
+		*wp++ = htons(orig >> 16);
+		*wp = htons(orig & 0xffff);
+		FlushCodeCache(Mac2HostAddr(base), STUB_SIZE);
+
+		// Install stub
+		r.d[0] = trap;
+		r.a[0] = base;
+		Execute68kTrap(0xa647, &r);		// SetToolTrapAddress()
+	}
+}
+
+
+#ifdef GFXACCEL_TEST
+/*
+ *  Runs the accelerated traps on a CGrafPort and PixMap built in fake Mac
+ *  memory at 8, 16 and 32 bits, and compares the frame buffer with what
+ *  the plain trap draws (EraseRect, PaintRect, InvertRect and overlapping
+ *  CopyBits, clipped and with the pixmap bounds not at 0,0). Every port
+ *  that the native code doesn't handle must fall through to the original
+ *  trap without touching the screen. Finally the native fill and scroll
+ *  rates are printed.
+ *
+ *  gfxaccel_test
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+
+#if DIRECT_ADDRESSING
+uintptr MEMBaseDiff;
+#endif
+
+// Fake Mac memory layout
+const uint32 MEM_SIZE = 0x400000;
+const uint32 A5_WORLD = 0x2000;		// (A5) points to thePort in the QuickDraw globals
+const uint32 QD_THE_PORT = 0x2100;
+const uint32 PORT = 0x3000;
+const uint32 H_PIXMAP = 0x4000, H_VIS = 0x4004, H_CLIP = 0x4008, H_BKPAT = 0x400c, H_PNPAT = 0x4010, H_MASK = 0x4014;
+const uint32 PIXMAP = 0x5000, VIS_RGN = 0x5100, CLIP_RGN = 0x5200, BK_PAT = 0x5300, PN_PAT = 0x5400, MASK_RGN = 0x5500;
+const uint32 SRC_PIXMAP = 0x5800;	// Screen as a separate PixMap
+const uint32 RECT = 0x6000, SRC_RECT = 0x6010;
+const uint32 STACK = 0x7000;
+const uint32 SCREEN = 0x100000;
+
+const int WIDTH = 640, HEIGHT = 480;
+const int BOUNDS_TOP = -20, BOUNDS_LEFT = -40;	// Local coordinates of the top left screen pixel
+
+static uint8 *mem;
+static int bpp;
+static int32 row_bytes;
+static uint8 ref[WIDTH * 4 * HEIGHT + 64 * HEIGHT];	// Expected frame buffer contents
+static int failures;
+
+#define CHECK(cond) do { \
+	if (!(cond)) { \
+		printf("%s:%d: %s failed\n", __FILE__, __LINE__, #cond); \
+		failures++; \
+	} \
+} while (0)
+
+// Test monitor, only the frame base is used
+class test_monitor_desc : public monitor_desc {
+public:
+	test_monitor_desc(const vector<video_mode> &modes) : monitor_desc(modes, VDEPTH_32BIT, 0x80) {}
+	virtual void switch_to_current_mode(void) {}
+	virtual void set_palette(uint8 *pal, int num) {}
+};
+
+monitor_desc::monitor_desc(const vector<video_mode> &available_modes, video_depth default_depth, uint32 default_id) : modes(available_modes) {}
+vector<monitor_desc *> VideoMonitors;
+
+bool PrefsFindBool(const char *name) {return true;}
+void FlushCodeCache(void *start, uint32 size) {}
+
+static int hide_count, show_count;
+void Execute68kTrap(uint16 trap, struct M68kRegisters *r)
+{
+	if (trap == 0xa852)
+		hide_count++;
+	else if (trap == 0xa853)
+		show_count++;
+}
+
+static int dirty_count;
+static qd_rect dirty;
+void video_set_dirty_area(int x, int y, int w, int h)
+{
+	dirty_count++;
+	dirty.top = y;
+	dirty.left = x;
+	dirty.bottom = y + h;
+	dirty.right = x + w;
+}
+
+static void write_rect(uint32 addr, int top, int left, int bottom, int right)
+{
+	WriteMacInt16(addr + 0, top);
+	WriteMacInt16(addr + 2, left);
+	WriteMacInt16(addr + 4, bottom);
+	WriteMacInt16(addr + 6, right);
+}
+
+static void write_pixmap(uint32 p, uint32 base, int pixel_size)
+{
+	WriteMacInt32(p + pmBaseAddr, base);
+	WriteMacInt16(p + pmRowBytes, 0x8000 | row_bytes);
+	write_rect(p + pmBounds, BOUNDS_TOP, BOUNDS_LEFT, BOUNDS_TOP + HEIGHT, BOUNDS_LEFT + WIDTH);
+	WriteMacInt16(p + pmPixelSize, pixel_size);
+}
+
+static void write_pattern(uint32 p, uint32 hi, uint32 lo)
+{
+	WriteMacInt16(p + patType, 0);
+	WriteMacInt32(p + pat1Data, hi);
+	WriteMacInt32(p + pat1Data + 4, lo);
+}
+
+static uint32 white_pixel(void)
+{
+	return bpp == 1 ? 0 : bpp == 2 ? 0x7fff : 0xffffff;
+}
+
+static uint32 black_pixel(void)
+{
+	return bpp == 1 ? 0xff : 0;
+}
+
+// Build a port that the native code accepts: color port on the screen,
+// rectangular clipping, black and white port colors, solid patterns
+static void setup_port(void)
+{
+	memset(mem, 0, SCREEN);
+	WriteMacInt32(A5_WORLD, QD_THE_PORT);
+	WriteMacInt32(QD_THE_PORT, PORT);
+	WriteMacInt8(HiliteMode, 0x80);
+	WriteMacInt8(CrsrVis, 0);
+	write_rect(CrsrRect, 0, 0, 16, 16);
+
+	WriteMacInt32(H_PIXMAP, PIXMAP);
+	WriteMacInt32(H_VIS, VIS_RGN);
+	WriteMacInt32(H_CLIP, CLIP_RGN);
+	WriteMacInt32(H_BKPAT, BK_PAT);
+	WriteMacInt32(H_PNPAT, PN_PAT);
+	WriteMacInt32(H_MASK, MASK_RGN);
+
+	write_pixmap(PIXMAP, SCREEN, bpp * 8);
+	write_pixmap(SRC_PIXMAP, SCREEN, bpp * 8);
+	WriteMacInt16(VIS_RGN, 10);
+	write_rect(VIS_RGN + 2, BOUNDS_TOP, BOUNDS_LEFT, BOUNDS_TOP + HEIGHT, BOUNDS_LEFT + WIDTH);
+	WriteMacInt16(CLIP_RGN, 10);
+	write_rect(CLIP_RGN + 2, -32767, -32767, 32767, 32767);
+	WriteMacInt16(MASK_RGN, 10);
+	write_rect(MASK_RGN + 2, -32767, -32767, 32767, 32767);
+	write_pattern(BK_PAT, 0, 0);
+	write_pattern(PN_PAT, 0xffffffff, 0xffffffff);
+
+	WriteMacInt32(PORT + portPortPixMap, H_PIXMAP);
+	WriteMacInt16(PORT + portPortVersion, 0xc000);
+	WriteMacInt32(PORT + portVisRgn, H_VIS);
+	WriteMacInt32(PORT + portClipRgn, H_CLIP);
+	WriteMacInt32(PORT + portBkPixPat, H_BKPAT);
+	WriteMacInt16(PORT + portPnMode, patCopy);
+	WriteMacInt32(PORT + portPnPixPat, H_PNPAT);
+	WriteMacInt16(PORT + portPnVis, 0);
+	WriteMacInt32(PORT + portFgColor, black_pixel());
+	WriteMacInt32(PORT + portBkColor, white_pixel());
+	hide_count = show_count = dirty_count = 0;
+}
+
+// Fill screen with random pixels and take it as the expected contents
+static void randomize_screen(void)
+{
+	uint8 *p = mem + SCREEN;
+	for (int32 i = 0; i < row_bytes * HEIGHT; i++)
+		p[i] = rand();
+	memcpy(ref, p, row_bytes * HEIGHT);
+}
+
+static bool screen_matches(void)
+{
+	return memcmp(mem + SCREEN, ref, row_bytes * HEIGHT) == 0;
+}
+
+// Reference drawing, on screen coordinates that are already clipped
+static void ref_fill(const qd_rect &r, uint32 pixel)
+{
+	for (int y = r.top; y < r.bottom; y++)
+		for (int x = r.left; x < r.right; x++) {
+			uint8 *p = ref + y * row_bytes + x * bpp;
+			for (int i = 0; i < bpp; i++)
+				p[i] = pixel >> ((bpp - 1 - i) * 8);
+		}
+}
+
+static void ref_invert(const qd_rect &r)
+{
+	for (int y = r.top; y < r.bottom; y++)
+		for (int x = r.left * bpp; x < r.right * bpp; x++)
+			ref[y * row_bytes + x] = ~ref[y * row_bytes + x];
+}
+
+static void ref_copy(const qd_rect &src, const qd_rect &dst)
+{
+	static uint8 old[sizeof(ref)];
+	memcpy(old, ref, row_bytes * HEIGHT);
+	for (int y = 0; y < dst.bottom - dst.top; y++)
+		memcpy(ref + (dst.top + y) * row_bytes + dst.left * bpp, old + (src.top + y) * row_bytes + src.left * bpp, (dst.right - dst.left) * bpp);
+}
+
+// Screen rectangle of local rectangle clipped to screen and clip rectangle
+static qd_rect to_screen(int top, int left, int bottom, int right, const qd_rect &clip)
+{
+	qd_rect r = {(int16)top, (int16)left, (int16)bottom, (int16)right};
+	rect_intersect(r, clip);
+	qd_rect bounds = {(int16)BOUNDS_TOP, (int16)BOUNDS_LEFT, (int16)(BOUNDS_TOP + HEIGHT), (int16)(BOUNDS_LEFT + WIDTH)};
+	rect_intersect(r, bounds);
+	r.top -= BOUNDS_TOP;
+	r.bottom -= BOUNDS_TOP;
+	r.left -= BOUNDS_LEFT;
+	r.right -= BOUNDS_LEFT;
+	return r;
+}
+
+static bool same_rect(const qd_rect &r, const qd_rect &s)
+{
+	return r.top == s.top && r.left == s.left && r.bottom == s.bottom && r.right == s.right;
+}
+
+// Call accelerated trap as the 68k stub does
+static bool call_rect(int selector, int top, int left, int bottom, int right)
+{
+	write_rect(RECT, top, left, bottom, right);
+	M68kRegisters r;
+	memset(&r, 0, sizeof(r));
+	r.a[5] = A5_WORLD;
+	r.a[7] = STACK;
+	WriteMacInt32(STACK + 4, RECT);
+	return VideoAccelDispatch(selector, &r);
+}
+
+static bool call_copybits(uint32 src_bits, int sy, int sx, int dy, int dx, int height, int width, uint16 mode = srcCopy, uint32 mask = 0)
+{
+	write_rect(SRC_RECT, sy, sx, sy + height, sx + width);
+	write_rect(RECT, dy, dx, dy + height, dx + width);
+	M68kRegisters r;
+	memset(&r, 0, sizeof(r));
+	r.a[5] = A5_WORLD;
+	r.a[7] = STACK;
+	WriteMacInt32(STACK + 4, mask);
+	WriteMacInt16(STACK + 8, mode);
+	WriteMacInt32(STACK + 10, RECT);
+	WriteMacInt32(STACK + 14, SRC_RECT);
+	WriteMacInt32(STACK + 18, PORT + portPortPixMap);
+	WriteMacInt32(STACK + 22, src_bits);
+	return VideoAccelDispatch(QDACCEL_COPY_BITS, &r);
+}
+
+static void check_drawing(void)
+{
+	static const qd_rect no_clip = {-32767, -32767, 32767, 32767};
+	const uint32 fg = bpp == 1 ? 0x5a : bpp == 2 ? 0x1234 : 0x00123456;
+	const uint32 bg = bpp == 1 ? 0xc3 : bpp == 2 ? 0x4321 : 0x00654321;
+
+	// Fills in colors, partly off the screen
+	setup_port();
+	WriteMacInt32(PORT + portFgColor, fg);
+	WriteMacInt32(PORT + portBkColor, bg);
+	randomize_screen();
+	CHECK(call_rect(QDACCEL_PAINT_RECT, -50, -60, 100, 33));
+	qd_rect r = to_screen(-50, -60, 100, 33, no_clip);
+	ref_fill(r, fg);
+	CHECK(screen_matches());
+	CHECK(dirty_count == 1 && same_rect(dirty, r));
+	CHECK(call_rect(QDACCEL_ERASE_RECT, 400, 550, 500, 700));
+	ref_fill(to_screen(400, 550, 500, 700, no_clip), bg);
+	CHECK(screen_matches());
+	CHECK(call_rect(QDACCEL_INVERT_RECT, 10, 3, 211, 598));
+	ref_invert(to_screen(10, 3, 211, 598, no_clip));
+	CHECK(screen_matches());
+	CHECK(hide_count == 0 && show_count == 0);
+
+	// White pen pattern paints in the background color, black background pattern erases in the foreground color
+	write_pattern(PN_PAT, 0, 0);
+	write_pattern(BK_PAT, 0xffffffff, 0xffffffff);
+	CHECK(call_rect(QDACCEL_PAINT_RECT, 0, 0, 7, 5));
+	ref_fill(to_screen(0, 0, 7, 5, no_clip), bg);
+	CHECK(call_rect(QDACCEL_ERASE_RECT, 1, 100, 2, 101));
+	ref_fill(to_screen(1, 100, 2, 101, no_clip), fg);
+	CHECK(screen_matches());
+
+	// Intersection of visRgn and clipRgn
+	write_rect(VIS_RGN + 2, 0, 0, 300, 300);
+	write_rect(CLIP_RGN + 2, 50, -100, 1000, 250);
+	const qd_rect clip = {50, 0, 300, 250};
+	dirty_count = 0;
+	CHECK(call_rect(QDACCEL_INVERT_RECT, -10, -10, 400, 400));
+	ref_invert(to_screen(-10, -10, 400, 400, clip));
+	CHECK(screen_matches());
+	CHECK(dirty_count == 1);
+
+	// Nothing to draw
+	dirty_count = 0;
+	CHECK(call_rect(QDACCEL_PAINT_RECT, 310, 0, 320, 10));
+	CHECK(call_rect(QDACCEL_PAINT_RECT, 100, 100, 100, 200));
+	CHECK(screen_matches());
+	CHECK(dirty_count == 0);
+
+	// Cursor is hidden only when it overlaps
+	setup_port();
+	randomize_screen();
+	WriteMacInt8(CrsrVis, 1);
+	write_rect(CrsrRect, 100, 100, 116, 116);
+	CHECK(call_rect(QDACCEL_PAINT_RECT, 0, 0, 10, 10));
+	CHECK(hide_count == 0 && show_count == 0);
+	CHECK(call_rect(QDACCEL_PAINT_RECT, 70, 50, 90, 70));
+	CHECK(hide_count == 1 && show_count == 1);
+	ref_fill(to_screen(0, 0, 10, 10, no_clip), black_pixel());
+	ref_fill(to_screen(70, 50, 90, 70, no_clip), black_pixel());
+	CHECK(screen_matches());
+
+	// Overlapping CopyBits in all directions, within the port and from a separate PixMap of the screen
+	static const struct {
+		int dy, dx;
+	} moves[] = {{1, 0}, {-1, 0}, {0, 1}, {0, -1}, {17, 5}, {-17, -5}, {3, -40}, {-3, 40}, {0, 0}};
+	for (uint32 i = 0; i < sizeof(moves) / sizeof(moves[0]); i++) {
+		setup_port();
+		randomize_screen();
+		const uint32 src_bits = i & 1 ? SRC_PIXMAP : PORT + portPortPixMap;
+		const int sy = 100, sx = 80, h = 200, w = 301;
+		CHECK(call_copybits(src_bits, sy, sx, sy + moves[i].dy, sx + moves[i].dx, h, w));
+		ref_copy(to_screen(sy, sx, sy + h, sx + w, no_clip), to_screen(sy + moves[i].dy, sx + moves[i].dx, sy + moves[i].dy + h, sx + moves[i].dx + w, no_clip));
+		CHECK(screen_matches());
+		CHECK(dirty_count == 1);
+	}
+
+	// Clipped destination takes the matching part of the source
+	setup_port();
+	randomize_screen();
+	write_rect(CLIP_RGN + 2, 120, 90, 250, 200);
+	CHECK(call_copybits(PORT + portPortPixMap, 100, 80, 110, 70, 200, 200));
+	ref_copy(to_screen(120 - 10, 90 + 10, 250 - 10, 200 + 10, no_clip), to_screen(120, 90, 250, 200, no_clip));
+	CHECK(screen_matches());
+
+	// Destination partly and completely off the screen
+	setup_port();
+	randomize_screen();
+	CHECK(call_copybits(PORT + portPortPixMap, 0, 0, -30, 400, 50, 300));
+	ref_copy(to_screen(10, 0, 50, 200, no_clip), to_screen(-20, 400, 20, 600, no_clip));
+	CHECK(screen_matches());
+	dirty_count = 0;
+	CHECK(call_copybits(PORT + portPortPixMap, 0, 0, -100, 400, 50, 300));
+	CHECK(screen_matches());
+	CHECK(dirty_count == 0);
+}
+
+// Ports and arguments that must go to the original trap
+enum {
+	FALL_NO_PORT,
+	FALL_OLD_PORT,
+	FALL_GRAF_PROCS,
+	FALL_PIC_SAVE,
+	FALL_RGN_SAVE,
+	FALL_POLY_SAVE,
+	FALL_NO_VIS_RGN,
+	FALL_COMPLEX_VIS_RGN,
+	FALL_COMPLEX_CLIP_RGN,
+	FALL_OFFSCREEN,
+	FALL_1_BIT,
+	FALL_HIDDEN_PEN,
+	FALL_PEN_MODE,
+	FALL_PEN_PATTERN,
+	FALL_PEN_PIXPAT,
+	FALL_BK_PATTERN,
+	FALL_HILITE,
+	FALL_MONITORS,
+	FALL_MASK_RGN,
+	FALL_COPY_MODE,
+	FALL_OTHER_DEST,
+	FALL_BITMAP_SOURCE,
+	FALL_OFFSCREEN_SOURCE,
+	FALL_SOURCE_DEPTH,
+	FALL_SOURCE_ROW_BYTES,
+	FALL_COLORIZE,
+	FALL_SCALE,
+	FALL_SOURCE_CLIPPED,
+	FALL_SELECTOR,
+	FALL_NUM
+};
+
+static const char *fall_names[FALL_NUM] = {
+	"no port", "old-style port", "grafProcs", "picSave", "rgnSave", "polySave", "no visRgn",
+	"complex visRgn", "complex clipRgn", "off-screen pixmap", "1-bit pixmap", "hidden pen",
+	"pen mode", "pen pattern", "pen pixel pattern", "background pattern", "highlighting",
+	"two monitors", "mask region", "transfer mode", "other destination", "BitMap source",
+	"off-screen source", "source depth", "source row bytes", "colorizing", "scaling",
+	"clipped source", "unknown selector"
+};
+
+static void check_fall_through(int what, int selector)
+{
+	setup_port();
+	memcpy(mem + SCREEN, ref, row_bytes * HEIGHT);
+	uint32 src_bits = SRC_PIXMAP;
+	int sy = 10, sh = 20;
+	uint16 mode = srcCopy;
+	uint32 mask = 0;
+	switch (what) {
+	case FALL_NO_PORT:			WriteMacInt32(QD_THE_PORT, 0); break;
+	case FALL_OLD_PORT:			WriteMacInt16(PORT + portPortVersion, 0); break;
+	case FALL_GRAF_PROCS:		WriteMacInt32(PORT + portGrafProcs, 0x5f00); break;
+	case FALL_PIC_SAVE:			WriteMacInt32(PORT + portPicSave, 0x5f00); break;
+	case FALL_RGN_SAVE:			WriteMacInt32(PORT + portRgnSave, 0x5f00); break;
+	case FALL_POLY_SAVE:		WriteMacInt32(PORT + portPolySave, 0x5f00); break;
+	case FALL_NO_VIS_RGN:		WriteMacInt32(PORT + portVisRgn, 0); break;
+	case FALL_COMPLEX_VIS_RGN:	WriteMacInt16(VIS_RGN, 28); break;
+	case FALL_COMPLEX_CLIP_RGN:	WriteMacInt16(CLIP_RGN, 28); break;
+	case FALL_OFFSCREEN:		WriteMacInt32(PIXMAP + pmBaseAddr, 0x200000); break;
+	case FALL_1_BIT:			WriteMacInt16(PIXMAP + pmPixelSize, 1); break;
+	case FALL_HIDDEN_PEN:		WriteMacInt16(PORT + portPnVis, 0xffff); break;
+	case FALL_PEN_MODE:			WriteMacInt16(PORT + portPnMode, patCopy + 2); break;
+	case FALL_PEN_PATTERN:		write_pattern(PN_PAT, 0xaa55aa55, 0xaa55aa55); break;
+	case FALL_PEN_PIXPAT:		WriteMacInt16(PN_PAT + patType, 1); break;
+	case FALL_BK_PATTERN:		write_pattern(BK_PAT, 0xffffffff, 0); break;
+	case FALL_HILITE:			WriteMacInt8(HiliteMode, 0); break;
+	case FALL_MONITORS:			VideoMonitors.push_back(VideoMonitors[0]); break;
+	case FALL_MASK_RGN:			mask = H_MASK; break;
+	case FALL_COPY_MODE:		mode = srcCopy + 1; break;
+	case FALL_OTHER_DEST:		WriteMacInt32(QD_THE_PORT, PORT + 0x100); Mac2Mac_memcpy(PORT + 0x100, PORT, 0x100); break;
+	case FALL_BITMAP_SOURCE:	WriteMacInt16(SRC_PIXMAP + pmRowBytes, row_bytes); break;
+	case FALL_OFFSCREEN_SOURCE:	WriteMacInt32(SRC_PIXMAP + pmBaseAddr, 0x200000); break;
+	case FALL_SOURCE_DEPTH:		WriteMacInt16(SRC_PIXMAP + pmPixelSize, bpp == 4 ? 16 : 32); break;
+	case FALL_SOURCE_ROW_BYTES:	WriteMacInt16(SRC_PIXMAP + pmRowBytes, 0x8000 | (row_bytes - 4)); break;
+	case FALL_COLORIZE:			WriteMacInt32(PORT + portFgColor, 0x00123456); break;
+	case FALL_SCALE:			sh = 21; break;
+	case FALL_SOURCE_CLIPPED:	sy = BOUNDS_TOP - 1; break;
+	case FALL_SELECTOR:			selector = QDACCEL_NUM_TRAPS; break;
+	}
+
+	bool handled;
+	if (selector == QDACCEL_COPY_BITS) {
+		write_rect(SRC_RECT, sy, 10, sy + sh, 30);
+		write_rect(RECT, 15, 15, 35, 35);
+		M68kRegisters r;
+		memset(&r, 0, sizeof(r));
+		r.a[5] = A5_WORLD;
+		r.a[7] = STACK;
+		WriteMacInt32(STACK + 4, mask);
+		WriteMacInt16(STACK + 8, mode);
+		WriteMacInt32(STACK + 10, RECT);
+		WriteMacInt32(STACK + 14, SRC_RECT);
+		WriteMacInt32(STACK + 18, PORT + portPortPixMap);
+		WriteMacInt32(STACK + 22, src_bits);
+		handled = VideoAccelDispatch(selector, &r);
+	} else
+		handled = call_rect(selector, 10, 10, 30, 30);
+	if (handled || !screen_matches() || dirty_count || hide_count)
+		printf("%d bit: %s not passed to the original trap (selector %d)\n", bpp * 8, fall_names[what], selector);
+	CHECK(!handled);
+	CHECK(screen_matches());
+	CHECK(dirty_count == 0 && hide_count == 0);
+
+	if (what == FALL_MONITORS)
+		VideoMonitors.pop_back();
+}
+
+static void check_fall_throughs(void)
+{
+	randomize_screen();
+
+	// Port conditions apply to all traps
+	for (int what = FALL_NO_PORT; what <= FALL_1_BIT; what++)
+		for (int selector = 0; selector < QDACCEL_NUM_TRAPS; selector++)
+			check_fall_through(what, selector);
+	for (int selector = QDACCEL_ERASE_RECT; selector <= QDACCEL_INVERT_RECT; selector++)
+		check_fall_through(FALL_HIDDEN_PEN, selector);
+	check_fall_through(FALL_PEN_MODE, QDACCEL_PAINT_RECT);
+	check_fall_through(FALL_PEN_PATTERN, QDACCEL_PAINT_RECT);
+	check_fall_through(FALL_PEN_PIXPAT, QDACCEL_PAINT_RECT);
+	check_fall_through(FALL_BK_PATTERN, QDACCEL_ERASE_RECT);
+	check_fall_through(FALL_HILITE, QDACCEL_INVERT_RECT);
+	for (int selector = 0; selector < QDACCEL_NUM_TRAPS; selector++)
+		check_fall_through(FALL_MONITORS, selector);
+	for (int what = FALL_MASK_RGN; what <= FALL_SOURCE_CLIPPED; what++)
+		check_fall_through(what, QDACCEL_COPY_BITS);
+	check_fall_through(FALL_SELECTOR, QDACCEL_ERASE_RECT);
+}
+
+static double now(void)
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec * 1e-6;
+}
+
+// Native fill and scroll rates for the whole screen
+static void measure(void)
+{
+	setup_port();
+	const int n = 200;
+	double t = now();
+	for (int i = 0; i < n; i++)
+		call_rect(QDACCEL_PAINT_RECT, BOUNDS_TOP, BOUNDS_LEFT, BOUNDS_TOP + HEIGHT, BOUNDS_LEFT + WIDTH);
+	const double fill = now() - t;
+	t = now();
+	for (int i = 0; i < n; i++)
+		call_copybits(PORT + portPortPixMap, BOUNDS_TOP + 16, BOUNDS_LEFT, BOUNDS_TOP, BOUNDS_LEFT, HEIGHT - 16, WIDTH);
+	const double scroll = now() - t;
+	printf("%2d bit: PaintRect %.0f Mpixel/s, CopyBits scroll %.0f Mpixel/s\n", bpp * 8,
+	       n * (double)WIDTH * HEIGHT / fill / 1e6, n * (double)WIDTH * (HEIGHT - 16) / scroll / 1e6);
+}
+
+int main(void)
+{
+	mem = (uint8 *)calloc(MEM_SIZE, 1);
+#if DIRECT_ADDRESSING
+	MEMBaseDiff = (uintptr)mem;
+#endif
+	vector<video_mode> modes;
+	test_monitor_desc monitor(modes);
+	monitor.set_mac_frame_base(SCREEN);
+	VideoMonitors.push_back(&monitor);
+
+	srand(1);
+	for (bpp = 1; bpp <= 4; bpp *= 2) {
+		row_bytes = WIDTH * bpp + 32;	// Padded rows
+		check_drawing();
+		check_fall_throughs();
+	}
+	for (bpp = 1; bpp <= 4; bpp *= 2) {
+		row_bytes = WIDTH * bpp + 32;
+		measure();
+	}
+
+	if (failures)
+		return 1;
+	printf("gfxaccel_test: OK\n");
+	return 0;
+}
+#endif
@@ -16,6 +16,7 @@ using std::string;
 #include "version.h"
 #include "main.h"
 #include "vm_alloc.h"
+#include "startup.h"
 #define DEBUG 0
 #include "debug.h"
 #import "B2AppDelegate.h"
@@ -439,6 +440,8 @@ void ClearInterruptFlag(uint32 flag)
 
 void ErrorAlert(const char *text)
 {
+	if (StartupDeferAlert(text, true))
+		return;
 	NSLog(@"Error: %s", text);
     [[B2AppDelegate sharedInstance] showAlertWithTitle:@(GetString(STR_ERROR_ALERT_TITLE)) message:@(text)];
 }
@@ -450,6 +453,8 @@ void ErrorAlert(const char *text)
 
 void WarningAlert(const char *text)
 {
+    if (StartupDeferAlert(text, false))
+        return;
     NSLog(@"Warning: %s", text);
     [[B2AppDelegate sharedInstance] showAlertWithTitle:@(GetString(STR_WARNING_ALERT_TITLE)) message:@(text)];
 }
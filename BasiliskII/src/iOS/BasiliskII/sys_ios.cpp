@@ -882,6 +882,13 @@ void SysCDSetVolume(void *arg, uint8 left, uint8 right)
 	if (!fh)
 		return;
 
+#if defined(BINCUE)
+	if (fh->is_bincue) {
+		CDSetVolume_bincue(fh->bincue_fd, left, right);
+		return;
+	}
+#endif
+
 	if (fh->is_cdrom) {
 #if defined(__linux__)
 		cdrom_volctrl vol;
@@ -908,6 +915,13 @@ void SysCDGetVolume(void *arg, uint8 &left, uint8 &right)
 	if (!fh)
 		return;
 
+#if defined(BINCUE)
+	if (fh->is_bincue) {
+		CDGetVolume_bincue(fh->bincue_fd, left, right);
+		return;
+	}
+#endif
+
 	left = right = 0;
 	if (fh->is_cdrom) {
 #if defined(__linux__)
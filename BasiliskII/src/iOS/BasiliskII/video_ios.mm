@@ -331,3 +331,7 @@ void VideoExit(void)
 void VideoQuitFullScreen(void)
 {
 }
+
+void video_set_dirty_area(int x, int y, int w, int h)
+{
+}
@@ -60,6 +60,9 @@
 /* ExtFS is supported */
 #define SUPPORTS_EXTFS 1
 
+/* Machine state can be saved to snapshot files and the checkpoint log */
+#define SUPPORTS_SNAPSHOT 1
+
 /* BSD socket API supported */
 #define SUPPORTS_UDP_TUNNEL 1
 
@@ -34,6 +34,7 @@ extern void ADBKeyDown(int code);
 extern void ADBKeyUp(int code);
 
 extern void ADBInterrupt(void);
+extern void ADBReplayInput(void);
 
 extern void ADBSetRelMouseMode(bool relative);
 
@@ -0,0 +1,71 @@
+/*
+ *  bench.h - Scripted guest benchmarks
+ *
+ *  Basilisk II (C) 1997-2008 Christian Bauer
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef BENCH_H
+#define BENCH_H
+
+// Kinds of I/O counted while a benchmark runs
+enum {
+	BENCH_DISK_READ,	// Sys_read()
+	BENCH_DISK_WRITE,	// Sys_write()
+	BENCH_EXTFS_READ,	// Data read from host files by ExtFS
+	BENCH_EXTFS_WRITE,	// Data written to host files by ExtFS
+	BENCH_EXTFS_META_SYSCALL,	// System calls for Finder info and resource fork lookups
+	BENCH_NUM_IO
+};
+
+#if SUPPORTS_BENCH
+
+extern bool BenchRunning;			// Running the "benchscript"
+extern bool BenchCounting;			// Interpreter counts instructions in ReplayInstructions
+
+extern bool BenchInit(void);		// Read script, before InitAll()
+extern void BenchStart(void);		// Start script, before Start680x0()
+extern void BenchExit(void);		// Write "benchresult"
+
+extern void BenchInterrupt(void);	// Called by the 1Hz interrupt, quits when the script is done
+extern void BenchIdleBegin(void);	// Around idle_wait(), to find out when the Mac is idle
+extern void BenchIdleEnd(void);
+
+// I/O done by the emulation thread
+extern uint64 BenchIOCalls[BENCH_NUM_IO];
+extern uint64 BenchIOBytes[BENCH_NUM_IO];
+
+static inline void BenchIO(int kind, int64 bytes)
+{
+	if (BenchRunning && bytes >= 0) {
+		BenchIOCalls[kind]++;
+		BenchIOBytes[kind] += bytes;
+	}
+}
+
+#else
+
+const bool BenchRunning = false;
+const bool BenchCounting = false;
+
+static inline void BenchInterrupt(void) {}
+static inline void BenchIdleBegin(void) {}
+static inline void BenchIdleEnd(void) {}
+static inline void BenchIO(int kind, int64 bytes) {}
+
+#endif
+
+#endif
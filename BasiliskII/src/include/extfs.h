@@ -38,13 +38,24 @@ extern void set_finfo(const char *path, uint32 finfo, uint32 fxinfo, bool is_dir
 extern uint32 get_rfork_size(const char *path);
 extern int open_rfork(const char *path, int flag);
 extern void close_rfork(const char *path, int fd);
-extern ssize_t extfs_read(int fd, void *buffer, size_t length);
-extern ssize_t extfs_write(int fd, void *buffer, size_t length);
+extern ssize_t extfs_read(int fd, void *buffer, size_t length, off_t offset);
+extern ssize_t extfs_write(int fd, void *buffer, size_t length, off_t offset);
 extern bool extfs_remove(const char *path);
 extern bool extfs_rename(const char *old_path, const char *new_path);
 extern const char *host_encoding_to_macroman(const char *filename); // What if the guest OS is using MacJapanese or MacArabic? Oh well...
 extern const char *macroman_to_host_encoding(const char *filename); // What if the guest OS is using MacJapanese or MacArabic? Oh well...
 
+// Host directory and file watching (Linux inotify), for keeping directory contents and file data cached
+#if defined(HAVE_SYS_INOTIFY_H) && defined(__linux__) && !defined(EXTFS_NO_WATCH)
+#define SUPPORTS_EXTFS_WATCH 1
+extern bool extfs_watch_dir(const char *path, uint32 &generation);
+extern bool extfs_dir_changed(const char *path, uint32 generation);
+extern int extfs_watch_file(int fd);
+extern void extfs_unwatch_file(int wd);
+extern uint32 extfs_file_generation(int wd);
+extern bool extfs_file_changed(int wd, uint32 generation);
+#endif
+
 // Maximum length of full path name
 const int MAX_PATH_LENGTH = 1024;
 
@@ -0,0 +1,88 @@
+/*
+ *  file_util.h - Helpers for binary files (snapshots, checkpoints, disk overlays)
+ *
+ *  Basilisk II (C) 1997-2008 Christian Bauer
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef FILE_UTIL_H
+#define FILE_UTIL_H
+
+#include <errno.h>
+#include <unistd.h>
+#include <vector>
+
+// Big-endian fields
+static inline uint32 get_be32(const uint8 *p)
+{
+	return (p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+static inline void put_be32(uint8 *p, uint32 v)
+{
+	p[0] = v >> 24;
+	p[1] = v >> 16;
+	p[2] = v >> 8;
+	p[3] = v;
+}
+
+static inline void append_be32(std::vector<uint8> &v, uint32 x)
+{
+	v.push_back(x >> 24);
+	v.push_back(x >> 16);
+	v.push_back(x >> 8);
+	v.push_back(x);
+}
+
+// Check whether the 8-byte aligned part of a buffer is zero
+static inline bool is_zero(const uint8 *p, uint32 len)
+{
+	const uint64 *q = (const uint64 *)p;
+	for (uint32 i = 0; i < len / 8; i++)
+		if (q[i])
+			return false;
+	return true;
+}
+
+// Transfer exactly len bytes at file position pos (or at the current
+// position if pos is negative), retrying short transfers and EINTR;
+// hitting end-of-file while reading is an error
+static inline bool transfer_all(int fd, uint8 *b, size_t len, int64 pos, bool writing)
+{
+	while (len) {
+		ssize_t actual;
+		if (writing)
+			actual = pos < 0 ? write(fd, b, len) : pwrite(fd, b, len, pos);
+		else
+			actual = pos < 0 ? read(fd, b, len) : pread(fd, b, len, pos);
+		if (actual < 0 && errno == EINTR)
+			continue;
+		if (actual <= 0)
+			return false;
+		b += actual;
+		len -= actual;
+		if (pos >= 0)
+			pos += actual;
+	}
+	return true;
+}
+
+static inline bool read_all(int fd, void *p, size_t len) {return transfer_all(fd, (uint8 *)p, len, -1, false);}
+static inline bool write_all(int fd, const void *p, size_t len) {return transfer_all(fd, (uint8 *)p, len, -1, true);}
+static inline bool pread_all(int fd, void *p, size_t len, uint64 pos) {return transfer_all(fd, (uint8 *)p, len, pos, false);}
+static inline bool pwrite_all(int fd, const void *p, size_t len, uint64 pos) {return transfer_all(fd, (uint8 *)p, len, pos, true);}
+
+#endif
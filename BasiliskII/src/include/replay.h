@@ -0,0 +1,71 @@
+/*
+ *  replay.h - Record and replay of nondeterministic input
+ *
+ *  Basilisk II (C) 1997-2008 Christian Bauer
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef REPLAY_H
+#define REPLAY_H
+
+#include <vector>
+
+// Kinds of events in the replay log
+enum {
+	REPLAY_END,			// Recording stopped
+	REPLAY_INTERRUPT,	// 68k interrupt taken
+	REPLAY_IRQ,			// Interrupt flags handled by EMUL_OP_IRQ
+	REPLAY_ADB,			// Mouse and keyboard input
+	REPLAY_TIME,		// Host clock read
+	REPLAY_ETHER,		// Network packet received
+	REPLAY_SERIAL		// Serial port I/O
+};
+
+#if SUPPORTS_REPLAY
+
+extern bool ReplayRecording;		// Logging input to the "record" file
+extern bool ReplayPlaying;			// Taking input from the "replay" file instead of the host
+
+extern bool ReplayInit(void);		// Open log, before InitAll() (turns off the JIT compiler)
+extern void ReplayStart(void);		// Once the machine is set up, before Start680x0()
+extern void ReplayExit(void);
+
+// Input read by the emulation thread, logged when recording and taken from the log when replaying
+extern uint32 ReplayValue(int kind, uint32 value);
+extern void ReplayBytes(int kind, void *data, uint32 size);
+extern int32 ReplayRead(int kind, void *data, int32 length, uint32 capacity);	// Result of read() into a buffer of CAPACITY bytes
+extern void ReplayData(int kind, std::vector<uint8> &data);
+
+// CPU emulation, the log is timed in 68k instructions
+extern uint64 ReplayInstructions;	// Instructions executed so far
+extern uint64 ReplayEventDue;		// Instruction count of the next interrupt or end of replay
+extern bool ReplayEventReached(void);	// Returns true if an interrupt has to be taken now
+extern bool ReplayInterruptDue(void);	// Replaying and an interrupt is taken at this instruction
+extern void ReplayInterrupt(void);		// Interrupt taken
+
+#else
+
+const bool ReplayRecording = false;
+const bool ReplayPlaying = false;
+
+static inline uint32 ReplayValue(int kind, uint32 value) {return value;}
+static inline void ReplayBytes(int kind, void *data, uint32 size) {}
+static inline int32 ReplayRead(int kind, void *data, int32 length, uint32 capacity) {return length;}
+static inline void ReplayData(int kind, std::vector<uint8> &data) {}
+
+#endif
+
+#endif
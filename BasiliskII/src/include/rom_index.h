@@ -0,0 +1,33 @@
+/*
+ *  rom_index.h - Index for byte signature searches in the ROM
+ *
+ *  Basilisk II (C) 1997-2008 Christian Bauer
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef ROM_INDEX_H
+#define ROM_INDEX_H
+
+// Index the unpatched ROM at ROM/SIZE, loaded from/saved to CACHE_DIR if not NULL
+extern void ROMIndexInit(const uint8 *rom, uint32 size, const char *cache_dir);
+extern void ROMIndexExit(void);
+
+// Return offset of first match of DATA in [START, END) of ROM, or 0. Same result as a
+// plain linear search, also after the indexed ROM has been patched (other ROMs are
+// searched linearly).
+extern uint32 ROMIndexFind(const uint8 *rom, uint32 start, uint32 end, const uint8 *data, uint32 data_len);
+
+#endif
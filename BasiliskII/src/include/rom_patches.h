@@ -44,6 +44,9 @@ extern uint32 PutScrapPatch;
 // Mac address of GetScrap() patch
 extern uint32 GetScrapPatch;
 
+// Mac address of space for QuickDraw acceleration patches
+extern uint32 QDAccelPatch;
+
 // Flag: print ROM information in PatchROM()
 extern bool PrintROMInfo;
 
@@ -53,4 +56,11 @@ extern void InstallDrivers(uint32 pb);
 extern void InstallSERD(void);
 extern void PatchAfterStartup(void);
 
+#if SUPPORTS_ROM_CACHE
+// Cache of patched ROMs (system specific): LoadPatchedROM() puts the ROM saved under KEY
+// at ROMBaseHost and returns the STATE saved with it, or false if there is none
+extern bool LoadPatchedROM(const char *key, void *state, uint32 state_size);
+extern void SavePatchedROM(const char *key, const void *state, uint32 state_size);
+#endif
+
 #endif
@@ -0,0 +1,128 @@
+/*
+ *  snapshot.h - Machine state snapshots
+ *
+ *  Basilisk II (C) 1997-2008 Christian Bauer
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <string.h>
+#include <vector>
+
+// Section data written by a module (big-endian, like everything on the Mac)
+class snapshot_out {
+public:
+	void put8(uint8 v) {data.push_back(v);}
+	void put16(uint16 v) {put8(v >> 8); put8(v);}
+	void put32(uint32 v) {put16(v >> 16); put16(v);}
+	void put64(uint64 v) {put32(v >> 32); put32(v);}
+	void put_bool(bool v) {put8(v ? 1 : 0);}
+	void put_bytes(const void *p, uint32 len) {data.insert(data.end(), (const uint8 *)p, (const uint8 *)p + len);}
+
+	std::vector<uint8> data;
+};
+
+// Section data read back by a module, reading past the end returns zeroes and sets the error flag
+class snapshot_in {
+public:
+	snapshot_in(const uint8 *p, uint32 len) : ptr(p), end(p + len), error(false) {}
+
+	uint8 get8(void) {if (ptr < end) return *ptr++; error = true; return 0;}
+	uint16 get16(void) {uint16 v = get8() << 8; return v | get8();}
+	uint32 get32(void) {uint32 v = get16() << 16; return v | get16();}
+	uint64 get64(void) {uint64 v = (uint64)get32() << 32; return v | get32();}
+	bool get_bool(void) {return get8() != 0;}
+	void get_bytes(void *p, uint32 len)
+	{
+		if (len > (uint32)(end - ptr)) {
+			memset(p, 0, len);
+			ptr = end;
+			error = true;
+		} else {
+			memcpy(p, ptr, len);
+			ptr += len;
+		}
+	}
+
+	// Everything was read, and no more than that
+	bool ok(void) const {return !error && ptr == end;}
+
+private:
+	const uint8 *ptr, *end;
+	bool error;
+};
+
+// State of one module, as stored in snapshot files and the checkpoint log
+struct snapshot_section {
+	uint32 tag;
+	std::vector<uint8> data;
+};
+
+typedef std::vector<snapshot_section> snapshot_section_vec;
+
+#if SUPPORTS_SNAPSHOT
+
+// Snapshot file handling
+extern bool SnapshotSave(const char *path);		// Write snapshot, emulation thread at top level only
+extern bool SnapshotLoad(const char *path);		// Restore snapshot, after InitAll() and before Start680x0()
+extern void SnapshotRequest(void);				// Ask emulation thread to save to the "snapshot" file (any thread)
+extern void SnapshotCheckpoint(void);			// Called by the CPU emulation at the next safe point
+
+// Module states, the load functions return an error message or NULL
+extern void SnapshotSaveSections(snapshot_section_vec &sections);
+extern const char *SnapshotCheckSections(const snapshot_section_vec &sections);	// Machine configuration, before memory is changed
+extern const char *SnapshotLoadSections(const snapshot_section_vec &sections);	// ROM and modules, once RAM is in place
+
+// Checkpoint log, RAM pages written since the last checkpoint and the module states
+extern bool CheckpointLoad(const char *path);	// Restore last complete checkpoint, after InitAll() and before Start680x0()
+extern void CheckpointInit(void);				// Start writing the "checkpoint" log, before Start680x0()
+extern void CheckpointExit(void);
+extern void CheckpointTick(void);				// Called once per second (any thread)
+extern void CheckpointSafePoint(void);			// Called from SnapshotCheckpoint()
+
+#else
+
+static inline void SnapshotRequest(void) {}
+static inline void SnapshotCheckpoint(void) {}
+static inline void CheckpointTick(void) {}
+
+#endif
+
+// State of the individual modules, load functions return false if the state doesn't fit this machine
+extern void CPUSaveState(snapshot_out &s);
+extern bool CPULoadState(snapshot_in &s);
+extern void XPRAMSaveState(snapshot_out &s);
+extern bool XPRAMLoadState(snapshot_in &s);
+extern void ADBSaveState(snapshot_out &s);
+extern bool ADBLoadState(snapshot_in &s);
+extern void TimerSaveState(snapshot_out &s);
+extern bool TimerLoadState(snapshot_in &s);
+extern void SonySaveState(snapshot_out &s);
+extern bool SonyLoadState(snapshot_in &s);
+extern void DiskSaveState(snapshot_out &s);
+extern bool DiskLoadState(snapshot_in &s);
+extern void CDROMSaveState(snapshot_out &s);
+extern bool CDROMLoadState(snapshot_in &s);
+extern void ExtFSSaveState(snapshot_out &s);
+extern bool ExtFSLoadState(snapshot_in &s);
+extern void VideoSaveState(snapshot_out &s);
+extern bool VideoLoadState(snapshot_in &s);
+extern void AudioSaveState(snapshot_out &s);
+extern bool AudioLoadState(snapshot_in &s);
+
+#endif
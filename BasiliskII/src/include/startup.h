@@ -0,0 +1,41 @@
+/*
+ *  startup.h - Startup phase trace and concurrent initialization
+ *
+ *  Basilisk II (C) 1997-2008 Christian Bauer
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef STARTUP_H
+#define STARTUP_H
+
+// Startup phase trace
+extern void StartupTraceInit(void);					// Start the clock, first thing in main()
+extern int StartupPhaseBegin(const char *name);		// Start of phase, returns handle for StartupPhaseEnd()
+extern void StartupPhaseEnd(int phase);				// End of phase
+extern void StartupMark(const char *name);			// Single point in time, e.g. the first 68k instruction
+extern bool StartupTraceWrite(const char *path);	// Write trace as Chrome trace-event JSON
+
+// Initialization work that runs on worker threads while the main thread continues
+struct startup_task {
+	const char *name;
+	void (*func)(void);
+};
+
+extern void StartupTasksRun(const startup_task *tasks, int num_tasks);	// Start tasks
+extern void StartupTasksWait(void);										// Wait for tasks, then show their alerts
+extern bool StartupDeferAlert(const char *text, bool error);			// Called by ErrorAlert()/WarningAlert(), true if alert was queued
+
+#endif
@@ -141,6 +141,10 @@ inline bool IsDirectMode(const video_mode &mode)
 // Mac video driver per-display private variables (opaque)
 struct video_locals;
 
+// Snapshot streams
+class snapshot_out;
+class snapshot_in;
+
 
 // Abstract base class representing one (possibly virtual) monitor
 // ("monitor" = rectangular display with a contiguous frame buffer)
@@ -179,6 +183,10 @@ public:
 	int16 driver_control(uint16 code, uint32 param, uint32 dce);
 	int16 driver_status(uint16 code, uint32 param);
 
+	// Save/restore driver state and frame buffer contents (snapshots)
+	void save_state(snapshot_out &s) const;
+	bool load_state(snapshot_in &s);
+
 protected:
 	vector<video_mode> modes;                         // List of supported video modes
 	vector<video_mode>::const_iterator current_mode;  // Currently selected video mode
@@ -271,5 +279,11 @@ extern void VideoQuitFullScreen(void);
 
 extern void VideoInterrupt(void);
 extern void VideoRefresh(void);
+extern uint64 VideoAlignTick(uint64 next);
+
+// QuickDraw acceleration
+extern void VideoInstallAccel(uint32 patch);
+extern bool VideoAccelDispatch(uint32 selector, struct M68kRegisters *r);
+extern void video_set_dirty_area(int x, int y, int w, int h);
 
 #endif
@@ -32,6 +32,9 @@ extern uint8 XPRAM[XPRAM_SIZE];
 extern void XPRAMInit(const char *vmdir);
 extern void XPRAMExit(void);
 
+extern void XPRAMMarkDirty(void);		// Called when the Mac writes to XPRAM
+extern void XPRAMSaveIfDirty(void);		// Called once a second, saves XPRAM when the writes are over
+
 // System specific and internal functions/data
 extern void LoadXPRAM(const char *vmdir);
 extern void SaveXPRAM(void);
@@ -37,6 +37,8 @@
 #include "rom_patches.h"
 #include "user_strings.h"
 #include "prefs.h"
+#include "sys.h"
+#include "startup.h"
 #include "main.h"
 
 #define DEBUG 0
@@ -57,6 +59,39 @@ static void mon_write_byte_b2(uintptr adr, uint32 b)
 #endif
 
 
+/*
+ *  Initialization tasks that only open host devices and backends, they run concurrently
+ */
+
+static void InitDrives(void)
+{
+	int phase = StartupPhaseBegin("SonyInit");
+	SonyInit();
+	StartupPhaseEnd(phase);
+
+	phase = StartupPhaseBegin("DiskInit");
+	DiskInit();
+	StartupPhaseEnd(phase);
+
+	phase = StartupPhaseBegin("CDROMInit");
+	CDROMInit();
+	StartupPhaseEnd(phase);
+
+#ifndef USE_SDL_AUDIO
+	// After CDROMInit(), CD audio of bin/cue images attaches to the audio device when it is opened
+	phase = StartupPhaseBegin("AudioInit");
+	AudioInit();
+	StartupPhaseEnd(phase);
+#endif
+}
+
+static const startup_task host_init_tasks[] = {
+	{"drives and audio", InitDrives},
+	{"SCSIInit", SCSIInit},
+	{"EtherInit", EtherInit}
+};
+
+
 /*
  *  Initialize everything, returns false on error
  */
@@ -64,7 +99,10 @@ static void mon_write_byte_b2(uintptr adr, uint32 b)
 bool InitAll(const char *vmdir)
 {
 	// Check ROM version
-	if (!CheckROM()) {
+	int phase = StartupPhaseBegin("CheckROM");
+	bool rom_ok = CheckROM();
+	StartupPhaseEnd(phase);
+	if (!rom_ok) {
 		ErrorAlert(STR_UNSUPPORTED_ROM_TYPE_ERR);
 		return false;
 	}
@@ -100,7 +138,9 @@ bool InitAll(const char *vmdir)
 #endif
 
 	// Load XPRAM
+	phase = StartupPhaseBegin("XPRAMInit");
 	XPRAMInit(vmdir);
+	StartupPhaseEnd(phase);
 
 	// Load XPRAM default values if signature not found
 	if (XPRAM[0x0c] != 0x4e || XPRAM[0x0d] != 0x75
@@ -140,37 +180,63 @@ bool InitAll(const char *vmdir)
 	XPRAM[0x7a] = i16 >> 8;
 	XPRAM[0x7b] = i16 & 0xff;
 
-	// Init drivers
-	SonyInit();
-	DiskInit();
-	CDROMInit();
-	SCSIInit();
+	// No drives specified in prefs? Then add defaults (before the prefs are read concurrently)
+	phase = StartupPhaseBegin("default drives");
+	if (PrefsFindString("floppy", 0) == NULL)
+		SysAddFloppyPrefs();
+	if (PrefsFindString("disk", 0) == NULL)
+		SysAddDiskPrefs();
+	if (PrefsFindString("cdrom", 0) == NULL)
+		SysAddCDROMPrefs();
+	StartupPhaseEnd(phase);
+
+	// Open drives, SCSI devices, network and audio in the background
+	StartupTasksRun(host_init_tasks, lengthof(host_init_tasks));
 
 #if SUPPORTS_EXTFS
 	// Init external file system
+	phase = StartupPhaseBegin("ExtFSInit");
 	ExtFSInit();
+	StartupPhaseEnd(phase);
 #endif
 
 	// Init serial ports
+	phase = StartupPhaseBegin("SerialInit");
 	SerialInit();
-
-	// Init network
-	EtherInit();
+	StartupPhaseEnd(phase);
 
 	// Init Time Manager
+	phase = StartupPhaseBegin("TimerInit");
 	TimerInit();
+	StartupPhaseEnd(phase);
 
 	// Init clipboard
+	phase = StartupPhaseBegin("ClipInit");
 	ClipInit();
+	StartupPhaseEnd(phase);
 
 	// Init ADB
+	phase = StartupPhaseBegin("ADBInit");
 	ADBInit();
-
-	// Init audio
-	AudioInit();
+	StartupPhaseEnd(phase);
 
 	// Init video
-	if (!VideoInit(ROMVersion == ROM_VERSION_64K || ROMVersion == ROM_VERSION_PLUS || ROMVersion == ROM_VERSION_CLASSIC))
+	phase = StartupPhaseBegin("VideoInit");
+	bool video_ok = VideoInit(ROMVersion == ROM_VERSION_64K || ROMVersion == ROM_VERSION_PLUS || ROMVersion == ROM_VERSION_CLASSIC);
+	StartupPhaseEnd(phase);
+
+	// Background tasks must be done before the Mac can access the devices (and before ExitAll())
+	phase = StartupPhaseBegin("wait for tasks");
+	StartupTasksWait();
+	StartupPhaseEnd(phase);
+
+#ifdef USE_SDL_AUDIO
+	// SDL is not thread-safe, so SDL audio is opened by the main thread after VideoInit()
+	phase = StartupPhaseBegin("AudioInit");
+	AudioInit();
+	StartupPhaseEnd(phase);
+#endif
+	if (!video_ok)
 		return false;
 
 	// Set default video mode in XPRAM
@@ -182,12 +248,18 @@ bool InitAll(const char *vmdir)
 
 #if EMULATED_68K
 	// Init 680x0 emulation (this also activates the memory system which is needed for PatchROM())
-	if (!Init680x0())
+	phase = StartupPhaseBegin("Init680x0");
+	bool cpu_ok = Init680x0();
+	StartupPhaseEnd(phase);
+	if (!cpu_ok)
 		return false;
 #endif
 
 	// Install ROM patches
-	if (!PatchROM()) {
+	phase = StartupPhaseBegin("PatchROM");
+	rom_ok = PatchROM();
+	StartupPhaseEnd(phase);
+	if (!rom_ok) {
 		ErrorAlert(STR_UNSUPPORTED_ROM_TYPE_ERR);
 		return false;
 	}
@@ -53,11 +53,14 @@ prefs_desc common_prefs_items[] = {
 	{"bootdriver", TYPE_INT32, false, "boot driver number"},
 	{"ramsize", TYPE_INT32, false,    "size of Mac RAM in bytes"},
 	{"frameskip", TYPE_INT32, false,  "number of frames to skip in refreshed video modes"},
+	{"blitthreads", TYPE_INT32, false,"number of threads converting the frame buffer (0 = auto)"},
+	{"gfxaccel", TYPE_BOOLEAN, false, "turn on QuickDraw acceleration"},
 	{"modelid", TYPE_INT32, false,    "Mac Model ID (Gestalt Model ID minus 6)"},
 	{"cpu", TYPE_INT32, false,        "CPU type (0 = 68000, 1 = 68010 etc.)"},
 	{"fpu", TYPE_BOOLEAN, false,      "enable FPU emulation"},
 	{"nocdrom", TYPE_BOOLEAN, false,  "don't install CD-ROM driver"},
 	{"nosound", TYPE_BOOLEAN, false,  "don't enable sound output"},
+	{"audiolatency", TYPE_INT32, false, "audio buffering ahead of the host in ms (0 = auto)"},
 	{"noclipconversion", TYPE_BOOLEAN, false, "don't convert clipboard contents"},
 	{"nogui", TYPE_BOOLEAN, false,    "disable GUI"},
 	{"jit", TYPE_BOOLEAN, false,         "enable JIT compiler"},
@@ -75,6 +78,8 @@ prefs_desc common_prefs_items[] = {
 	{"hotkey",TYPE_INT32,false,"hotkey modifier"},
 	{"scale_nearest",TYPE_BOOLEAN,false,"nearest neighbor scaling"},
 	{"scale_integer",TYPE_BOOLEAN,false,"integer scaling"},
+	{"vsync", TYPE_BOOLEAN, false, "present in sync with the display (SDL2)"},
+	{"framestats", TYPE_BOOLEAN, false, "print frame time statistics at exit (SDL2)"},
 	{"yearofs", TYPE_INT32, 0,			"year offset"},
 	{"dayofs", TYPE_INT32, 0,			"day offset"},
 	{NULL, TYPE_END, false, NULL} // End of list
@@ -100,8 +105,10 @@ void AddPrefsDefaults(void)
 	PrefsAddBool("fpu", false);
 	PrefsAddBool("nocdrom", false);
 	PrefsAddBool("nosound", false);
+	PrefsAddInt32("audiolatency", 0);
 	PrefsAddBool("noclipconversion", false);
 	PrefsAddBool("nogui", false);
+	PrefsAddBool("gfxaccel", false);
 	
 #if USE_JIT
 	// JIT compiler specific options
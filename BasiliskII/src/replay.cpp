@@ -0,0 +1,649 @@
+/*
+ *  replay.cpp - Record and replay of nondeterministic input
+ *
+ *  Basilisk II (C) 1997-2008 Christian Bauer
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/*
+ *  Everything that makes two runs of the same workload differ enters the
+ *  Mac in the emulation thread at a few points: the 68k interrupts taken,
+ *  the interrupt flags handled by EMUL_OP_IRQ, host input applied by the
+ *  ADB code, host clock reads, and data received from the network and
+ *  serial ports. When recording, each of these is logged with the number
+ *  of 68k instructions executed so far. When replaying, host input is
+ *  ignored and the logged events are fed back at the same instruction,
+ *  so the Mac goes through exactly the same states, as fast as the host
+ *  allows. An event that doesn't match the log ends the replay and the
+ *  Mac continues with live input.
+ *
+ *  The CPU runs in the interpreter while recording or replaying, compiled
+ *  code doesn't count instructions.
+ *
+ *  File layout (host byte order, logs are only replayed on the same host):
+ *    header        magic, version, RAM size, ROM checksum, RAM checksum,
+ *                  XPRAM contents
+ *    events        instruction count (64 bit), kind, payload size, payload
+ */
+
+#include "sysdeps.h"
+
+#if SUPPORTS_REPLAY
+
+#include <stdio.h>
+#include <string.h>
+
+#include "cpu_emulation.h"
+#include "main.h"
+#include "prefs.h"
+#include "xpram.h"
+#include "replay.h"
+
+#define DEBUG 0
+#include "debug.h"
+
+
+// File format
+static const char REPLAY_MAGIC[8] = {'B', '2', 'R', 'P', 'L', 'A', 'Y', 0x0a};
+const uint32 REPLAY_VERSION = 1;
+
+struct replay_header {
+	char magic[8];
+	uint32 version;
+	uint32 ram_size;
+	uint32 rom_checksum;
+	uint32 ram_checksum;
+	uint8 xpram[XPRAM_SIZE];
+};
+
+struct replay_event {
+	uint64 count;		// ReplayInstructions when the event happened
+	uint32 kind;
+	uint32 size;		// Size of payload that follows
+};
+
+const uint64 NO_EVENT = ~(uint64)0;
+const uint32 MAX_EVENT_SIZE = 0x100000;		// Larger payloads only come from damaged logs
+
+static const char *const kind_names[] = {"end", "interrupt", "IRQ flags", "ADB input", "clock", "Ethernet", "serial"};
+
+
+// Global variables
+bool ReplayRecording = false;
+bool ReplayPlaying = false;
+uint64 ReplayInstructions = 0;
+uint64 ReplayEventDue = NO_EVENT;
+
+static FILE *log_file = NULL;
+static const char *log_path;
+static B2_mutex *log_lock = NULL;			// Recording, QuitEmulator() may be called from any thread
+static replay_header header;
+static replay_event next_event;				// Replaying, next event and its payload
+static std::vector<uint8> next_data;
+static uint64 num_events = 0;
+static uint64 start_ticks;
+
+static void read_next(void);
+
+
+// Checksum of RAM contents, to detect replays that don't start from the recorded state
+static uint32 ram_checksum(void)
+{
+	uint32 h = 2166136261u;
+	const uint32 *p = (const uint32 *)RAMBaseHost;
+	for (uint32 i = 0; i < RAMSize / 4; i++)
+		h = (h ^ p[i]) * 16777619u;
+	return h;
+}
+
+
+/*
+ *  Open log, called before InitAll() so the JIT compiler can be turned off
+ */
+
+bool ReplayInit(void)
+{
+	const char *record_path = PrefsFindString("record");
+	const char *replay_path = PrefsFindString("replay");
+
+	uint32 rom_checksum;
+	memcpy(&rom_checksum, ROMBaseHost, sizeof(rom_checksum));
+
+	if (replay_path && *replay_path) {
+		log_path = replay_path;
+		log_file = fopen(replay_path, "rb");
+		if (log_file == NULL)
+			return false;
+		if (fread(&header, sizeof(header), 1, log_file) != 1
+		 || memcmp(header.magic, REPLAY_MAGIC, sizeof(REPLAY_MAGIC)) || header.version != REPLAY_VERSION
+		 || header.ram_size != RAMSize || header.rom_checksum != rom_checksum) {
+			fclose(log_file);
+			log_file = NULL;
+			return false;
+		}
+		ReplayPlaying = true;
+	} else if (record_path && *record_path) {
+		log_path = record_path;
+		log_file = fopen(record_path, "wb");
+		if (log_file == NULL)
+			return false;
+		memcpy(header.magic, REPLAY_MAGIC, sizeof(REPLAY_MAGIC));
+		header.version = REPLAY_VERSION;
+		header.ram_size = RAMSize;
+		header.rom_checksum = rom_checksum;
+		log_lock = B2_create_mutex();
+		ReplayRecording = true;
+	} else
+		return true;
+
+	// Compiled code doesn't count instructions
+	PrefsReplaceBool("jit", false);
+	return true;
+}
+
+
+/*
+ *  Start recording or replaying, the machine state must be the same as
+ *  when the recording was started (boot from the same disks, or resume
+ *  from the same snapshot)
+ */
+
+void ReplayStart(void)
+{
+	if (ReplayRecording) {
+		header.ram_checksum = ram_checksum();
+		memcpy(header.xpram, XPRAM, XPRAM_SIZE);
+		fwrite(&header, sizeof(header), 1, log_file);
+		printf("Recording input to %s\n", log_path);
+	} else if (ReplayPlaying) {
+		memcpy(XPRAM, header.xpram, XPRAM_SIZE);
+		if (header.ram_checksum != ram_checksum())
+			printf("WARNING: RAM contents differ from the recording, replay will diverge\n");
+		printf("Replaying input from %s\n", log_path);
+		read_next();
+	}
+	fflush(stdout);
+	start_ticks = GetTicks_usec();
+}
+
+
+/*
+ *  Deinitialization
+ */
+
+void ReplayExit(void)
+{
+	if (log_file == NULL)
+		return;
+
+	if (ReplayRecording) {
+		B2_lock_mutex(log_lock);
+		ReplayRecording = false;
+		replay_event e = {ReplayInstructions, REPLAY_END, 0};
+		fwrite(&e, sizeof(e), 1, log_file);
+		if (ferror(log_file) | fclose(log_file))
+			printf("WARNING: Error writing replay log %s\n", log_path);
+		else
+			printf("Recorded %llu instructions, %llu events\n", (unsigned long long)ReplayInstructions, (unsigned long long)num_events + 1);
+		log_file = NULL;
+		B2_unlock_mutex(log_lock);
+	} else {
+		ReplayPlaying = false;
+		ReplayEventDue = NO_EVENT;
+		fclose(log_file);
+		log_file = NULL;
+	}
+}
+
+
+/*
+ *  Recording, append event to log
+ */
+
+static void write_event(int kind, const void *data, uint32 size)
+{
+	replay_event e = {ReplayInstructions, (uint32)kind, size};
+	B2_lock_mutex(log_lock);
+	if (log_file) {
+		fwrite(&e, sizeof(e), 1, log_file);
+		if (size)
+			fwrite(data, size, 1, log_file);
+		num_events++;
+	}
+	B2_unlock_mutex(log_lock);
+}
+
+
+/*
+ *  Replaying, stop with live input or quit at the end of the log
+ */
+
+static void stop_playback(void)
+{
+	ReplayPlaying = false;
+	ReplayEventDue = NO_EVENT;
+}
+
+static void diverged(int kind, uint32 size)
+{
+	if (next_event.kind != (uint32)kind)
+		printf("WARNING: Replay diverged at instruction %llu, %s instead of %s at instruction %llu, continuing with live input\n",
+			(unsigned long long)ReplayInstructions, kind_names[kind],
+			next_event.kind <= REPLAY_SERIAL ? kind_names[next_event.kind] : "garbage", (unsigned long long)next_event.count);
+	else if (next_event.count != ReplayInstructions)
+		printf("WARNING: Replay diverged, %s at instruction %llu instead of %llu, continuing with live input\n",
+			kind_names[kind], (unsigned long long)ReplayInstructions, (unsigned long long)next_event.count);
+	else
+		printf("WARNING: Replay diverged at instruction %llu, %s of %u bytes instead of %u, continuing with live input\n",
+			(unsigned long long)ReplayInstructions, kind_names[kind], size, next_event.size);
+	stop_playback();
+}
+
+static void bad_event(int kind)
+{
+	printf("WARNING: Replay log has a bad %s event at instruction %llu, continuing with live input\n",
+		kind_names[kind], (unsigned long long)next_event.count);
+	stop_playback();
+}
+
+static void finish(void)
+{
+	double secs = (GetTicks_usec() - start_ticks) / 1000000.0;
+	printf("Replay finished: %llu instructions, %llu events in %.3f s (%.2f MIPS)\n",
+		(unsigned long long)ReplayInstructions, (unsigned long long)num_events, secs, secs > 0 ? ReplayInstructions / secs / 1000000.0 : 0.0);
+	fflush(stdout);
+	stop_playback();
+	QuitEmulator();
+}
+
+
+/*
+ *  Replaying, read next event from log
+ */
+
+static void read_next(void)
+{
+	if (fread(&next_event, sizeof(next_event), 1, log_file) != 1) {
+
+		// Recording emulator didn't quit properly, end here
+		next_event.count = ReplayInstructions;
+		next_event.kind = REPLAY_END;
+		next_event.size = 0;
+	}
+	if (next_event.kind > REPLAY_SERIAL || next_event.size > MAX_EVENT_SIZE) {
+		printf("WARNING: Replay log is damaged at instruction %llu, continuing with live input\n", (unsigned long long)next_event.count);
+		next_event.kind = REPLAY_END;
+		next_event.size = 0;
+		next_data.clear();
+		stop_playback();
+		return;
+	}
+	next_data.resize(next_event.size);
+	if (next_event.size && fread(&next_data[0], next_event.size, 1, log_file) != 1) {
+		next_event.kind = REPLAY_END;
+		next_event.size = 0;
+		next_data.clear();
+	}
+	num_events++;
+
+	if (next_event.kind == REPLAY_END && next_event.count <= ReplayInstructions)
+		finish();
+	ReplayEventDue = (next_event.kind == REPLAY_INTERRUPT || next_event.kind == REPLAY_END) ? next_event.count : NO_EVENT;
+}
+
+// The next event must be KIND at this instruction, returns false if the replay diverged
+static bool expect(int kind, uint32 size)
+{
+	if (next_event.kind == (uint32)kind && next_event.count == ReplayInstructions && next_event.size == size)
+		return true;
+	diverged(kind, size);
+	return false;
+}
+
+
+/*
+ *  Input read from the host by the emulation thread
+ */
+
+uint32 ReplayValue(int kind, uint32 value)
+{
+	ReplayBytes(kind, &value, sizeof(value));
+	return value;
+}
+
+void ReplayBytes(int kind, void *data, uint32 size)
+{
+	if (ReplayRecording)
+		write_event(kind, data, size);
+	else if (ReplayPlaying && expect(kind, size)) {
+		if (size)
+			memcpy(data, &next_data[0], size);
+		read_next();
+	}
+}
+
+int32 ReplayRead(int kind, void *data, int32 length, uint32 capacity)
+{
+	if (ReplayRecording) {
+		std::vector<uint8> buf(4 + (length > 0 ? length : 0));
+		memcpy(&buf[0], &length, 4);
+		if (length > 0)
+			memcpy(&buf[4], data, length);
+		write_event(kind, &buf[0], buf.size());
+	} else if (ReplayPlaying && expect(kind, next_event.size)) {
+
+		// The logged result must match its data, which must fit the caller's buffer
+		int32 logged = 0;
+		if (next_event.size >= 4)
+			memcpy(&logged, &next_data[0], 4);
+		uint32 actual = next_event.size >= 4 ? next_event.size - 4 : 0;
+		if (next_event.size < 4 || actual != (logged > 0 ? (uint32)logged : 0) || actual > capacity) {
+			bad_event(kind);
+			return length;
+		}
+		length = logged;
+		if (actual)
+			memcpy(data, &next_data[4], actual);
+		read_next();
+	}
+	return length;
+}
+
+void ReplayData(int kind, std::vector<uint8> &data)
+{
+	if (ReplayRecording)
+		write_event(kind, data.empty() ? NULL : &data[0], data.size());
+	else if (ReplayPlaying && expect(kind, next_event.size)) {
+		data = next_data;
+		read_next();
+	}
+}
+
+
+/*
+ *  Interrupts, taken by the CPU emulation exactly where the log says
+ */
+
+bool ReplayEventReached(void)
+{
+	if (next_event.kind == REPLAY_END) {
+		finish();
+		return false;
+	}
+	return true;
+}
+
+bool ReplayInterruptDue(void)
+{
+	return ReplayPlaying && next_event.kind == REPLAY_INTERRUPT && next_event.count == ReplayInstructions;
+}
+
+void ReplayInterrupt(void)
+{
+	if (ReplayRecording)
+		write_event(REPLAY_INTERRUPT, NULL, 0);
+	else if (ReplayPlaying && expect(REPLAY_INTERRUPT, 0))
+		read_next();
+}
+
+#ifdef REPLAY_TEST
+/*
+ *  Records one event of each kind into a log and replays it with
+ *  different live input, which must be replaced by the logged input.
+ *  A replay that diverges, a logged read that doesn't fit the caller's
+ *  buffer and a log with a damaged size field must all end the replay
+ *  without touching memory outside the buffers.
+ */
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string>
+
+uint32 RAMSize;
+uint8 *RAMBaseHost, *ROMBaseHost;
+uint8 XPRAM[XPRAM_SIZE];
+static const char *record_pref, *replay_pref;
+static bool quit_called;
+
+const char *PrefsFindString(const char *name, int index) {return strcmp(name, "record") == 0 ? record_pref : replay_pref;}
+void PrefsReplaceBool(const char *name, bool b) {}
+uint64 GetTicks_usec(void) {return 0;}
+void QuitEmulator(void) {quit_called = true;}
+
+struct B2_mutex {};
+B2_mutex *B2_create_mutex(void) {return new B2_mutex;}
+void B2_lock_mutex(B2_mutex *mutex) {}
+void B2_unlock_mutex(B2_mutex *mutex) {}
+void B2_delete_mutex(B2_mutex *mutex) {delete mutex;}
+
+static int failures;
+
+#define CHECK(cond) do { \
+	if (!(cond)) { \
+		printf("%s:%d: %s failed\n", __FILE__, __LINE__, #cond); \
+		failures++; \
+	} \
+} while (0)
+
+static const int32 PACKET_SIZE = 100;
+static const uint32 END_COUNT = 60;
+
+// Record an interrupt, IRQ flags, clock bytes, two Ethernet reads, ADB data and a serial read
+static void record(const std::string &path)
+{
+	record_pref = path.c_str();
+	replay_pref = NULL;
+	ReplayInstructions = 0;
+	CHECK(ReplayInit() && ReplayRecording);
+	ReplayStart();
+
+	ReplayInstructions = 10;
+	ReplayInterrupt();
+	ReplayInstructions = 11;
+	CHECK(ReplayValue(REPLAY_IRQ, 5) == 5);
+	ReplayInstructions = 20;
+	uint8 time[8] = {1, 2, 3, 4, 5, 6, 7, 8};
+	ReplayBytes(REPLAY_TIME, time, sizeof(time));
+	ReplayInstructions = 30;
+	uint8 packet[PACKET_SIZE];
+	for (int32 i = 0; i < PACKET_SIZE; i++)
+		packet[i] = i;
+	CHECK(ReplayRead(REPLAY_ETHER, packet, PACKET_SIZE, 1514) == PACKET_SIZE);
+	ReplayInstructions = 31;
+	CHECK(ReplayRead(REPLAY_ETHER, packet, -1, 1514) == -1);
+	ReplayInstructions = 40;
+	std::vector<uint8> adb(3, 0x42);
+	ReplayData(REPLAY_ADB, adb);
+	ReplayInstructions = 50;
+	CHECK(ReplayRead(REPLAY_SERIAL, (void *)"abc", 3, 16) == 3);
+	ReplayInstructions = END_COUNT;
+	ReplayExit();
+	CHECK(!ReplayRecording);
+}
+
+// Start replaying the log, returns false if the header was refused
+static bool start_replay(const std::string &path)
+{
+	record_pref = NULL;
+	replay_pref = path.c_str();
+	ReplayInstructions = 0;
+	quit_called = false;
+	if (!ReplayInit())
+		return false;
+	ReplayStart();
+	return true;
+}
+
+static void test_round_trip(const std::string &path)
+{
+	memset(XPRAM, 0, XPRAM_SIZE);
+	CHECK(start_replay(path) && ReplayPlaying);
+	CHECK(XPRAM[0] == 0x11);
+	CHECK(ReplayEventDue == 10);
+
+	ReplayInstructions = 10;
+	CHECK(ReplayEventReached() && ReplayInterruptDue());
+	ReplayInterrupt();
+	ReplayInstructions = 11;
+	CHECK(ReplayValue(REPLAY_IRQ, 9) == 5);
+	ReplayInstructions = 20;
+	uint8 time[8] = {0};
+	ReplayBytes(REPLAY_TIME, time, sizeof(time));
+	CHECK(time[0] == 1 && time[7] == 8);
+	ReplayInstructions = 30;
+	uint8 packet[1514];
+	memset(packet, 0xff, sizeof(packet));
+	CHECK(ReplayRead(REPLAY_ETHER, packet, -1, sizeof(packet)) == PACKET_SIZE);
+	CHECK(packet[0] == 0 && packet[PACKET_SIZE - 1] == PACKET_SIZE - 1 && packet[PACKET_SIZE] == 0xff);
+	ReplayInstructions = 31;
+	CHECK(ReplayRead(REPLAY_ETHER, packet, 20, sizeof(packet)) == -1);
+	ReplayInstructions = 40;
+	std::vector<uint8> adb;
+	ReplayData(REPLAY_ADB, adb);
+	CHECK(adb.size() == 3 && adb[2] == 0x42);
+	ReplayInstructions = 50;
+	char serial[16] = "xyz";
+	CHECK(ReplayRead(REPLAY_SERIAL, serial, 0, sizeof(serial)) == 3);
+	CHECK(memcmp(serial, "abc", 3) == 0);
+
+	CHECK(ReplayPlaying && ReplayEventDue == END_COUNT);
+	ReplayInstructions = END_COUNT;
+	CHECK(!ReplayEventReached());
+	CHECK(quit_called && !ReplayPlaying);
+	ReplayExit();
+}
+
+static void test_divergence(const std::string &path)
+{
+	CHECK(start_replay(path));
+	ReplayInstructions = 10;
+	ReplayInterrupt();
+
+	// IRQ flags one instruction late, the live value is kept from here on
+	ReplayInstructions = 12;
+	fflush(stdout);
+	FILE *out = tmpfile();
+	int saved_stdout = dup(1);
+	dup2(fileno(out), 1);
+	CHECK(ReplayValue(REPLAY_IRQ, 9) == 9);
+	fflush(stdout);
+	dup2(saved_stdout, 1);
+	close(saved_stdout);
+	char warning[256] = "";
+	rewind(out);
+	CHECK(fgets(warning, sizeof(warning), out) && strstr(warning, "IRQ flags at instruction 12 instead of 11,") != NULL);
+	fclose(out);
+	CHECK(!ReplayPlaying && ReplayEventDue == NO_EVENT);
+	ReplayInstructions = 20;
+	uint8 time[8] = {0};
+	ReplayBytes(REPLAY_TIME, time, sizeof(time));
+	CHECK(time[0] == 0);
+	CHECK(!quit_called);
+	ReplayExit();
+}
+
+static void test_capacity(const std::string &path)
+{
+	CHECK(start_replay(path));
+	ReplayInstructions = 10;
+	ReplayInterrupt();
+	ReplayInstructions = 11;
+	ReplayValue(REPLAY_IRQ, 0);
+	ReplayInstructions = 20;
+	uint8 time[8];
+	ReplayBytes(REPLAY_TIME, time, sizeof(time));
+
+	// The logged packet is larger than the buffer, which must stay untouched along with what follows it
+	ReplayInstructions = 30;
+	uint8 packet[PACKET_SIZE + 16];
+	memset(packet, 0xee, sizeof(packet));
+	CHECK(ReplayRead(REPLAY_ETHER, packet, -1, PACKET_SIZE / 2) == -1);
+	CHECK(!ReplayPlaying);
+	for (uint32 i = 0; i < sizeof(packet); i++) {
+		if (packet[i] != 0xee) {
+			CHECK(packet[i] == 0xee);
+			break;
+		}
+	}
+	ReplayExit();
+}
+
+// Overwrite the size field of the first event
+static void damage_first_size(const std::string &path, uint32 size)
+{
+	FILE *f = fopen(path.c_str(), "r+b");
+	CHECK(f != NULL);
+	if (f == NULL)
+		return;
+	fseek(f, sizeof(replay_header) + offsetof(replay_event, size), SEEK_SET);
+	fwrite(&size, sizeof(size), 1, f);
+	fclose(f);
+}
+
+static void test_damaged(const std::string &path)
+{
+	damage_first_size(path, 0x7fffffff);
+	CHECK(start_replay(path));
+	CHECK(!ReplayPlaying && ReplayEventDue == NO_EVENT);
+	CHECK(next_data.empty());
+	ReplayInstructions = 10;
+	ReplayInterrupt();
+	CHECK(ReplayValue(REPLAY_IRQ, 9) == 9);
+	CHECK(!quit_called);
+	ReplayExit();
+
+	// A different ROM is refused
+	ROMBaseHost[0] ^= 1;
+	CHECK(!start_replay(path));
+	ROMBaseHost[0] ^= 1;
+}
+
+int main(void)
+{
+	char dir[] = "/tmp/replay_test.XXXXXX";
+	if (mkdtemp(dir) == NULL) {
+		perror("mkdtemp");
+		return 1;
+	}
+	const std::string path = std::string(dir) + "/log";
+
+	RAMSize = 0x10000;
+	RAMBaseHost = (uint8 *)calloc(RAMSize, 1);
+	ROMBaseHost = (uint8 *)calloc(0x1000, 1);
+	ROMBaseHost[0] = 0x42;
+	memset(XPRAM, 0x11, XPRAM_SIZE);
+
+	record(path);
+	test_round_trip(path);
+	test_divergence(path);
+	test_capacity(path);
+	test_damaged(path);
+
+	unlink(path.c_str());
+	rmdir(dir);
+	free(RAMBaseHost);
+	free(ROMBaseHost);
+	if (failures) {
+		printf("replay_test: %d failures\n", failures);
+		return 1;
+	}
+	printf("replay_test: OK\n");
+	return 0;
+}
+#endif
+
+#endif
@@ -0,0 +1,531 @@
+/*
+ *  rom_index.cpp - Index for byte signature searches in the ROM
+ *
+ *  Basilisk II (C) 1997-2008 Christian Bauer
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/*
+ *  The index maps a hash of every 4-byte sequence of the unpatched ROM to
+ *  the offsets where it occurs, in ascending order. PatchROM() searches
+ *  the ROM while it is patching it, so a copy of the unpatched ROM is
+ *  kept as well: windows that were not modified since are found through
+ *  the index, windows overlapping modified bytes are searched directly.
+ *
+ *  Index file layout (all values in host byte order, the file is only a
+ *  cache for this machine):
+ *    header        magic, version, ROM size, ROM checksum, ROM hash
+ *    buckets       NUM_BUCKETS + 1 start indices into the offset table
+ *    offsets       ROM size - 3 offsets, grouped by bucket
+ */
+
+#include "sysdeps.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+
+#include "rom_index.h"
+
+#define DEBUG 0
+#include "debug.h"
+
+
+const uint32 KEY_LEN = 4;					// Bytes hashed for the index
+const int KEY_BITS = 16;
+const uint32 NUM_BUCKETS = 1 << KEY_BITS;
+const uint32 BLOCK_SIZE = 64;				// Granularity of modified ROM detection
+
+static const char INDEX_MAGIC[8] = {'B', '2', 'R', 'O', 'M', 'I', 'D', 'X'};
+const uint32 INDEX_VERSION = 1;
+
+struct index_header {
+	char magic[8];
+	uint32 version;
+	uint32 size;
+	uint32 checksum;			// Checksum stored in the ROM header
+	uint32 pad;
+	uint64 hash;				// Hash of the whole ROM
+};
+
+static const uint8 *rom_data = NULL;		// Current ROM
+static uint32 rom_size = 0;
+static std::vector<uint8> rom_orig;			// ROM at ROMIndexInit() time
+static std::vector<uint32> buckets;			// Start of bucket in offsets[]
+static std::vector<uint32> offsets;			// Offsets of all 4-byte sequences, grouped by hash
+
+
+static inline uint32 key_hash(const uint8 *p)
+{
+	uint32 w = (p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+	return (w * 0x9e3779b1) >> (32 - KEY_BITS);
+}
+
+// Hash of the ROM contents, to tell ROMs with the same checksum apart
+static uint64 rom_hash(const uint8 *p, uint32 size)
+{
+	uint64 h = 0xcbf29ce484222325ULL ^ size;
+	uint32 i = 0;
+	for (; i + 8 <= size; i += 8) {
+		uint64 w;
+		memcpy(&w, p + i, 8);
+		h = (h ^ w) * 0x100000001b3ULL;
+		h ^= h >> 29;
+	}
+	for (; i < size; i++)
+		h = (h ^ p[i]) * 0x100000001b3ULL;
+	return h;
+}
+
+
+/*
+ *  Build index from scratch
+ */
+
+static void build_index(void)
+{
+	uint32 num = rom_size - KEY_LEN + 1;
+	buckets.assign(NUM_BUCKETS + 1, 0);
+	offsets.resize(num);
+
+	const uint8 *p = &rom_orig[0];
+	for (uint32 i = 0; i < num; i++)
+		buckets[key_hash(p + i) + 1]++;
+	for (uint32 k = 0; k < NUM_BUCKETS; k++)
+		buckets[k + 1] += buckets[k];
+
+	std::vector<uint32> fill(buckets.begin(), buckets.end() - 1);
+	for (uint32 i = 0; i < num; i++)
+		offsets[fill[key_hash(p + i)]++] = i;
+}
+
+
+/*
+ *  Index cache file
+ */
+
+static void cache_path(char *path, size_t len, const char *dir)
+{
+	uint32 checksum = (rom_orig[0] << 24) | (rom_orig[1] << 16) | (rom_orig[2] << 8) | rom_orig[3];
+	snprintf(path, len, "%s/rom-%08x-%x.index", dir, checksum, rom_size);
+}
+
+// The file may have been damaged, and searches trust the index
+static bool index_valid(void)
+{
+	if (buckets[0] != 0 || buckets[NUM_BUCKETS] != offsets.size())
+		return false;
+	const uint32 num = rom_size - KEY_LEN + 1;
+	for (uint32 k = 0; k < NUM_BUCKETS; k++) {
+		if (buckets[k] > buckets[k + 1])
+			return false;
+		for (uint32 i = buckets[k]; i < buckets[k + 1]; i++)
+			if (offsets[i] >= num || (i > buckets[k] && offsets[i] <= offsets[i - 1]))
+				return false;
+	}
+	return true;
+}
+
+static bool load_index(const char *dir, uint64 hash)
+{
+	char path[1024];
+	cache_path(path, sizeof(path), dir);
+	FILE *f = fopen(path, "rb");
+	if (f == NULL)
+		return false;
+
+	index_header h;
+	bool ok = fread(&h, sizeof(h), 1, f) == 1
+	       && memcmp(h.magic, INDEX_MAGIC, 8) == 0 && h.version == INDEX_VERSION
+	       && h.size == rom_size && h.hash == hash;
+	if (ok) {
+		buckets.resize(NUM_BUCKETS + 1);
+		offsets.resize(rom_size - KEY_LEN + 1);
+		ok = fread(&buckets[0], sizeof(uint32), buckets.size(), f) == buckets.size()
+		  && fread(&offsets[0], sizeof(uint32), offsets.size(), f) == offsets.size()
+		  && index_valid();
+	}
+	fclose(f);
+	D(bug("ROM index %s %s\n", path, ok ? "loaded" : "invalid"));
+	return ok;
+}
+
+static void save_index(const char *dir, uint64 hash)
+{
+	char path[1024], tmp_path[1040];
+	cache_path(path, sizeof(path), dir);
+	snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+	FILE *f = fopen(tmp_path, "wb");
+	if (f == NULL)
+		return;
+
+	index_header h;
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, INDEX_MAGIC, 8);
+	h.version = INDEX_VERSION;
+	h.size = rom_size;
+	h.checksum = (rom_orig[0] << 24) | (rom_orig[1] << 16) | (rom_orig[2] << 8) | rom_orig[3];
+	h.hash = hash;
+	bool ok = fwrite(&h, sizeof(h), 1, f) == 1
+	       && fwrite(&buckets[0], sizeof(uint32), buckets.size(), f) == buckets.size()
+	       && fwrite(&offsets[0], sizeof(uint32), offsets.size(), f) == offsets.size();
+	ok = (fclose(f) == 0) && ok;
+
+	// Written under a temporary name, so other instances never see a partial file
+	if (!ok || rename(tmp_path, path) < 0)
+		remove(tmp_path);
+	D(bug("ROM index %s %s\n", path, ok ? "saved" : "not saved"));
+}
+
+
+/*
+ *  Initialization
+ */
+
+void ROMIndexInit(const uint8 *rom, uint32 size, const char *cache_dir)
+{
+	ROMIndexExit();
+	if (size < KEY_LEN)
+		return;
+
+	rom_data = rom;
+	rom_size = size;
+	rom_orig.assign(rom, rom + size);
+
+	if (cache_dir && *cache_dir) {
+		uint64 hash = rom_hash(rom, size);
+		if (!load_index(cache_dir, hash)) {
+			build_index();
+			save_index(cache_dir, hash);
+		}
+	} else
+		build_index();
+}
+
+
+/*
+ *  Deinitialization
+ */
+
+void ROMIndexExit(void)
+{
+	rom_data = NULL;
+	rom_size = 0;
+	std::vector<uint8>().swap(rom_orig);
+	std::vector<uint32>().swap(buckets);
+	std::vector<uint32>().swap(offsets);
+}
+
+
+/*
+ *  Search ROM for byte string
+ */
+
+static uint32 find_linear(const uint8 *rom, uint32 start, uint32 end, const uint8 *data, uint32 data_len)
+{
+	for (uint32 ofs = start; ofs < end; ofs++) {
+		if (!memcmp(rom + ofs, data, data_len))
+			return ofs;
+	}
+	return 0;
+}
+
+uint32 ROMIndexFind(const uint8 *rom, uint32 start, uint32 end, const uint8 *data, uint32 data_len)
+{
+	// Searches the index can't answer
+	if (rom != rom_data || data_len < KEY_LEN || data_len > rom_size || end > rom_size - data_len + 1)
+		return find_linear(rom, start, end, data, data_len);
+	if (start >= end)
+		return 0;
+	uint32 best = end;
+
+	// Unmodified windows: first offset from the index that still matches,
+	// candidates are taken from the least frequent 4 bytes of DATA
+	uint32 key_ofs = 0, key = key_hash(data);
+	for (uint32 i = 1; i + KEY_LEN <= data_len; i++) {
+		uint32 k = key_hash(data + i);
+		if (buckets[k + 1] - buckets[k] < buckets[key + 1] - buckets[key]) {
+			key = k;
+			key_ofs = i;
+		}
+	}
+	const uint32 *first = &offsets[0] + buckets[key], *last = &offsets[0] + buckets[key + 1];
+	for (const uint32 *p = std::lower_bound(first, last, start + key_ofs); p < last && *p - key_ofs < best; p++) {
+		if (!memcmp(rom_data + *p - key_ofs, data, data_len)) {
+			best = *p - key_ofs;
+			break;
+		}
+	}
+
+	// Windows that overlap modified blocks are searched directly, in ascending order
+	uint32 scanned = start;
+	for (uint32 b = start - start % BLOCK_SIZE; b < best + data_len - 1 && b < rom_size; b += BLOCK_SIZE) {
+		uint32 len = std::min(BLOCK_SIZE, rom_size - b);
+		if (memcmp(rom_data + b, &rom_orig[b], len) == 0)
+			continue;
+		uint32 from = std::max(scanned, b + 1 > data_len ? b + 1 - data_len : 0);
+		uint32 to = std::min(best, b + len);
+		for (uint32 ofs = from; ofs < to; ofs++) {
+			if (!memcmp(rom_data + ofs, data, data_len)) {
+				best = ofs;
+				break;
+			}
+		}
+		scanned = std::max(scanned, to);
+	}
+
+	return best < end ? best : 0;
+}
+
+
+#ifdef ROM_INDEX_BENCHMARK
+/*
+ *  Compare indexed and linear searches on ROM files given on the command line:
+ *  signatures are taken from the ROM itself, and the ROM is modified while
+ *  searching, like PatchROM() does.
+ */
+
+#include <stdlib.h>
+#include <sys/time.h>
+
+static double now_ms(void)
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec * 1000.0 + tv.tv_usec / 1000.0;
+}
+
+int main(int argc, char **argv)
+{
+	const char *cache_dir = getenv("ROM_INDEX_CACHE");
+	const int num_searches = 200;
+
+	printf("%-24s %8s %10s %10s %10s %10s\n", "ROM", "size", "index(ms)", "cached(ms)", "linear(ms)", "indexed(ms)");
+	for (int i = 1; i < argc; i++) {
+		FILE *f = fopen(argv[i], "rb");
+		if (f == NULL) {
+			perror(argv[i]);
+			continue;
+		}
+		std::vector<uint8> rom;
+		uint8 buf[65536];
+		size_t actual;
+		while ((actual = fread(buf, 1, sizeof(buf), f)) > 0)
+			rom.insert(rom.end(), buf, buf + actual);
+		fclose(f);
+		if (rom.size() < 0x10000) {
+			fprintf(stderr, "%s: too small\n", argv[i]);
+			continue;
+		}
+		uint32 size = rom.size();
+
+		// Build, and load from cache if given
+		double t = now_ms();
+		ROMIndexInit(&rom[0], size, NULL);
+		double build_time = now_ms() - t;
+		double cached_time = 0;
+		if (cache_dir) {
+			ROMIndexInit(&rom[0], size, cache_dir);
+			t = now_ms();
+			ROMIndexInit(&rom[0], size, cache_dir);
+			cached_time = now_ms() - t;
+		}
+
+		// Signatures of 8..32 bytes from random places, searched in ranges of up to 64K
+		// before them, with a 4-byte patch applied after every search
+		srand(i);
+		std::vector<uint8> patched = rom;
+		std::vector<uint32> starts, ends, sig_offsets, lens;
+		for (int n = 0; n < num_searches; n++) {
+			uint32 len = 8 + rand() % 25;
+			uint32 ofs = rand() % (size - len);
+			uint32 range = 1 + rand() % 0x10000;
+			sig_offsets.push_back(ofs);
+			lens.push_back(len);
+			starts.push_back(ofs > range ? ofs - range : 0);
+			ends.push_back(std::min(size - len + 1, ofs + 1 + rand() % 0x1000));
+		}
+
+		double linear_time = 0, indexed_time = 0;
+		int mismatches = 0;
+		for (int n = 0; n < num_searches; n++) {
+			uint8 sig[32];
+			memcpy(sig, &rom[sig_offsets[n]], lens[n]);
+
+			// Plain search
+			t = now_ms();
+			uint32 expected = find_linear(&rom[0], starts[n], ends[n], sig, lens[n]);
+			linear_time += now_ms() - t;
+
+			t = now_ms();
+			uint32 found = ROMIndexFind(&rom[0], starts[n], ends[n], sig, lens[n]);
+			indexed_time += now_ms() - t;
+			if (found != expected)
+				mismatches++;
+
+			// Patch the ROM somewhere
+			uint32 p = rand() % (size - 4);
+			rom[p] ^= 0x4e; rom[p + 1] ^= 0x71;
+		}
+		ROMIndexExit();
+
+		const char *name = strrchr(argv[i], '/');
+		printf("%-24s %8u %10.2f %10.2f %10.2f %10.2f%s\n", name ? name + 1 : argv[i], size,
+		       build_time, cached_time, linear_time, indexed_time, mismatches ? "  MISMATCH" : "");
+	}
+	return 0;
+}
+#endif
+
+
+#ifdef ROM_INDEX_TEST
+/*
+ *  Searches a synthetic ROM through the index and linearly while patching
+ *  it, with an index that was built, loaded from the cache, and rebuilt
+ *  after the cache file was damaged.
+ */
+
+#include <stdlib.h>
+#include <unistd.h>
+
+static int failures;
+
+#define CHECK(cond) do { \
+	if (!(cond)) { \
+		printf("%s:%d: %s failed\n", __FILE__, __LINE__, #cond); \
+		failures++; \
+	} \
+} while (0)
+
+// 512K of code-like data: a few hundred short words, repeated with variations
+static void make_rom(std::vector<uint8> &rom)
+{
+	rom.resize(0x80000);
+	srand(1);
+	uint16 words[300];
+	for (int i = 0; i < 300; i++)
+		words[i] = rand();
+	for (uint32 i = 0; i < rom.size(); i += 2) {
+		uint16 w = rand() % 8 ? words[rand() % 300] : rand();
+		rom[i] = w >> 8;
+		rom[i + 1] = w;
+	}
+}
+
+// Index the ROM, optionally with cache, and compare searches like PatchROM() does them,
+// with the ROM patched after every search
+static int index_and_search(std::vector<uint8> &rom, const char *cache_dir, int seed)
+{
+	ROMIndexInit(&rom[0], rom.size(), cache_dir);
+	std::vector<uint8> copy = rom;
+	int mismatches = 0;
+	srand(seed);
+	for (int n = 0; n < 300; n++) {
+		uint32 len = 4 + rand() % 29;
+		uint32 ofs = rand() % (rom.size() - len);
+		uint8 sig[32];
+		memcpy(sig, &rom[ofs], len);
+		uint32 start = rand() % (ofs + 1);
+		uint32 end = std::min((uint32)rom.size() - len + 1, ofs + 1 + rand() % 0x1000);
+		if (ROMIndexFind(&rom[0], start, end, sig, len) != find_linear(&rom[0], start, end, sig, len))
+			mismatches++;
+		uint32 p = rand() % (rom.size() - 4);
+		rom[p] ^= 0x4e; rom[p + 1] ^= 0x71;
+	}
+	ROMIndexExit();
+	rom = copy;
+	return mismatches;
+}
+
+// Overwrite a 32-bit word of the index file
+static void damage_file(const char *path, long pos, uint32 v)
+{
+	FILE *f = fopen(path, "r+b");
+	if (f == NULL)
+		return;
+	fseek(f, pos, SEEK_SET);
+	fwrite(&v, 4, 1, f);
+	fclose(f);
+}
+
+int main(void)
+{
+	std::vector<uint8> rom;
+	make_rom(rom);
+
+	char dir[] = "/tmp/rom_index_test.XXXXXX";
+	if (mkdtemp(dir) == NULL) {
+		perror("mkdtemp");
+		return 1;
+	}
+	ROMIndexInit(&rom[0], rom.size(), dir);
+	char path[1024];
+	cache_path(path, sizeof(path), dir);
+	ROMIndexExit();
+
+	// Built, then loaded from the cache
+	CHECK(index_and_search(rom, NULL, 1) == 0);
+	CHECK(access(path, R_OK) == 0);
+	CHECK(index_and_search(rom, dir, 2) == 0);
+
+	// Damaged cache files are rebuilt
+	const long buckets_pos = sizeof(index_header), offsets_pos = buckets_pos + (NUM_BUCKETS + 1) * 4;
+	static const struct {
+		const char *what;
+		long pos;
+		uint32 value;
+	} damage[] = {
+		{"offset past the ROM", offsets_pos + 1000 * 4, 0x7ffffffc},
+		{"last offset at the end of the ROM", offsets_pos + (0x80000 - KEY_LEN) * 4, 0x80000 - KEY_LEN + 1},
+		{"bucket going back", buckets_pos + 1000 * 4, 0},
+		{"bucket past the offsets", buckets_pos + 30000 * 4, 0x7fffffff},
+		{"first bucket", buckets_pos, 1},
+	};
+	for (uint32 d = 0; d < sizeof(damage) / sizeof(damage[0]); d++) {
+		damage_file(path, damage[d].pos, damage[d].value);
+		ROMIndexInit(&rom[0], rom.size(), dir);
+		CHECK(index_valid());
+		ROMIndexExit();
+		FILE *f = fopen(path, "rb");
+		uint32 v = 0;
+		if (f) {
+			fseek(f, damage[d].pos, SEEK_SET);
+			if (fread(&v, 4, 1, f) != 1)
+				v = 0;
+			fclose(f);
+		}
+		if (v == damage[d].value) {
+			printf("damaged index (%s) was not rebuilt\n", damage[d].what);
+			failures++;
+		}
+		CHECK(index_and_search(rom, dir, 3 + d) == 0);
+	}
+
+	// Truncated file
+	truncate(path, offsets_pos + 100);
+	CHECK(index_and_search(rom, dir, 10) == 0);
+
+	unlink(path);
+	rmdir(dir);
+	if (failures) {
+		printf("rom_index_test: %d failures\n", failures);
+		return 1;
+	}
+	printf("rom_index_test: OK\n");
+	return 0;
+}
+#endif
@@ -19,6 +19,7 @@
  */
 
 #include <string.h>
+#include <vector>
 
 #include "sysdeps.h"
 #include "cpu_emulation.h"
@@ -38,6 +39,7 @@
 #endif
 
 #include "rom_patches.h"
+#include "rom_index.h"
 
 #define DEBUG 0
 #include "debug.h"
@@ -47,6 +49,7 @@
 uint32 UniversalInfo;		// ROM offset of UniversalInfo
 uint32 PutScrapPatch = 0;	// Mac address of PutScrap() patch
 uint32 GetScrapPatch = 0;	// Mac address of GetScrap() patch
+uint32 QDAccelPatch = 0;	// Mac address of QuickDraw acceleration patches
 uint32 ROMBreakpoint = 0;	// ROM offset of breakpoint (0 = disabled, 0x2310 = CritError)
 bool PrintROMInfo = false;	// Flag: print ROM information in PatchROM()
 bool PatchHWBases = true;	// Flag: patch hardware base addresses
@@ -73,13 +76,7 @@ uint16 ROMVersion;
 
 static uint32 find_rom_data(uint32 start, uint32 end, const uint8 *data, uint32 data_len)
 {
-	uint32 ofs = start;
-	while (ofs < end) {
-		if (!memcmp((void *)(ROMBaseHost + ofs), data, data_len))
-			return ofs;
-		ofs++;
-	}
-	return 0;
+	return ROMIndexFind(ROMBaseHost, start, end, data, data_len);
 }
 
 
@@ -87,9 +84,37 @@ static uint32 find_rom_data(uint32 start, uint32 end, const uint8 *data, uint32
  *  Search ROM resource by type/ID, return ROM offset of resource data
  */
 
+// Resource chain, read once by PatchROM()
+struct rom_rsrc {
+	uint32 entry;		// ROM offset of chain entry
+	uint32 data;		// ROM offset of resource data
+	uint32 type;
+	int16 id;
+};
+static std::vector<rom_rsrc> rom_rsrcs;
+static size_t rsrc_index = 0;		// Index of last found resource + 1
+
+static void read_rom_resources(void)
+{
+	rom_rsrcs.clear();
+	uint32 lp = ROMBaseMac + ReadMacInt32(ROMBaseMac + 0x1a);
+	uint32 ptr = ReadMacInt32(lp);
+	while (ptr && ptr < ROMSize && rom_rsrcs.size() < 0x10000) {
+		lp = ROMBaseMac + ptr;
+		rom_rsrc r;
+		r.entry = ptr;
+		r.data = ReadMacInt32(lp + 12);
+		r.type = ReadMacInt32(lp + 16);
+		r.id = ReadMacInt16(lp + 20);
+		rom_rsrcs.push_back(r);
+		ptr = ReadMacInt32(lp + 8);
+	}
+	D(bug("%d ROM resources\n", (int)rom_rsrcs.size()));
+}
+
 static uint32 rsrc_ptr = 0;
 
-static uint32 find_rom_resource(uint32 s_type, int16 s_id, bool cont = false)
+static uint32 find_rom_resource_chain(uint32 s_type, int16 s_id, bool cont)
 {
 	uint32 lp = ROMBaseMac + ReadMacInt32(ROMBaseMac + 0x1a);
 	uint32 x = ReadMacInt32(lp);
@@ -115,12 +140,72 @@ static uint32 find_rom_resource(uint32 s_type, int16 s_id, bool cont = false)
 	return 0;
 }
 
+static uint32 find_rom_resource(uint32 s_type, int16 s_id, bool cont = false)
+{
+	if (rom_rsrcs.empty())
+		return find_rom_resource_chain(s_type, s_id, cont);
+
+	if (!cont)
+		rsrc_index = 0;
+	for (size_t i = rsrc_index; i < rom_rsrcs.size(); i++) {
+		const rom_rsrc &r = rom_rsrcs[i];
+		if (r.type == s_type && r.id == s_id) {
+			rsrc_index = i + 1;
+
+			// Walk the chain if a patch has changed the entry
+			uint32 lp = ROMBaseMac + r.entry;
+			if (ReadMacInt32(lp + 12) != r.data || ReadMacInt32(lp + 16) != r.type || ReadMacInt16(lp + 20) != (uint16)r.id) {
+				rom_rsrcs.clear();
+				return find_rom_resource_chain(s_type, s_id, cont);
+			}
+			rsrc_ptr = r.entry;
+			return r.data;
+		}
+	}
+	rsrc_index = rom_rsrcs.size();
+	rsrc_ptr = 0;
+	return 0;
+}
+
 
 /*
  *  Search offset of A-Trap routine in ROM
  */
 
-static uint32 find_rom_trap(uint16 trap)
+// Trap table, decoded once by PatchROM(): $A800..$ABFF followed by $A000..$A3FF
+const int NUM_ROM_TRAPS = 0x800;
+static std::vector<uint32> rom_traps;
+
+static void decode_rom_traps(void)
+{
+	rom_traps.assign(NUM_ROM_TRAPS, 0);
+	uint32 p = ReadMacInt32(ROMBaseMac + 0x22);
+	uint32 ofs = 0;
+	for (int i=0; i<NUM_ROM_TRAPS; i++) {
+		if (p + 5 > ROMSize)
+			break;
+		const uint8 *bp = ROMBaseHost + p;
+		uint8 b = *bp++;
+		int32 add = 0;
+		if (b == 0x80)			// Unimplemented trap
+			;
+		else if (b == 0xff) {	// Absolute address
+			ofs = (bp[0] << 24) | (bp[1] << 16) | (bp[2] << 8) | bp[3];
+			bp += 4;
+		} else if (b & 0x80) {	// 1 byte offset
+			if ((add = (b & 0x7f) << 1) == 0)
+				break;
+		} else {				// 2 byte offset
+			if ((add = int16(((b << 8) | *bp++) << 1)) == 0)
+				break;
+		}
+		ofs += add;
+		p = bp - ROMBaseHost;
+		rom_traps[i] = b == 0x80 ? 0 : ofs;
+	}
+}
+
+static uint32 find_rom_trap_table(uint16 trap)
 {
 	uint8 *bp = (uint8 *)(ROMBaseHost + ReadMacInt32(ROMBaseMac + 0x22));
 	uint16 rom_trap = 0xa800;
@@ -154,6 +239,13 @@ again:
 	goto again;
 }
 
+static uint32 find_rom_trap(uint16 trap)
+{
+	if (rom_traps.empty() || (trap & 0xf400) != 0xa000)
+		return find_rom_trap_table(trap);
+	return rom_traps[(trap & 0x0800) ? (trap & 0x3ff) : 0x400 + (trap & 0x3ff)];
+}
+
 
 /*
  *  Print ROM information to stream,
@@ -1637,6 +1729,9 @@ static bool patch_rom_32(void)
 	*wp++ = htons(base >> 16);
 	*wp = htons(base & 0xffff);
 
+	// Reserve space for QuickDraw acceleration patches (they are built by EMUL_OP_INSTALL_DRIVERS)
+	QDAccelPatch = ROMBaseMac + sony_offset + 0xe00;
+
 	// Look for double PACK 4 resources
 	if ((base = find_rom_resource(FOURCC('P','A','C','K'), 4)) == 0) return false;
 	if ((base = find_rom_resource(FOURCC('P','A','C','K'), 4, true)) == 0 && FPUType == 0)
@@ -1659,26 +1754,155 @@ static bool patch_rom_32(void)
 	return true;
 }
 
+#if SUPPORTS_ROM_CACHE
+/*
+ *  Cache of patched ROMs: patch_rom_32() takes most of the ROM setup time, so its
+ *  result is saved together with the state it leaves outside of the ROM
+ */
+
+const uint32 ROM_TAIL_SIZE = 4096;	// ROM end overwritten by InstallSlotROM()
+
+struct patched_rom_state {
+	uint32 universal_info;
+	uint32 put_scrap_patch;
+	uint32 get_scrap_patch;
+	uint32 qd_accel_patch;
+	uint32 sony_offset;
+	uint32 serd_offset;
+	uint32 microseconds_offset;
+	uint32 debugutil_offset;
+	uint32 sony_disk_icon_addr;
+	uint32 sony_drive_icon_addr;
+	uint32 disk_icon_addr;
+	uint32 cdrom_icon_addr;
+	uint8 rom_tail[ROM_TAIL_SIZE];	// Unpatched ROM end, the slot ROM depends on the video modes
+};
+
+// Hash everything patch_rom_32() depends on into KEY (the build is added by the system specific code)
+static void patched_rom_key(char *key)
+{
+	uint64 h = UVAL64(0xcbf29ce484222325);
+	for (uint32 i = 0; i < ROMSize; i++)
+		h = (h ^ ROMBaseHost[i]) * UVAL64(0x100000001b3);
+
+#if defined(USE_SCRATCHMEM_SUBTERFUGE)
+	extern uint8 *ScratchMem;
+#endif
+	uint32 params[] = {
+		ROMVersion, ROMSize, ROMBaseMac, RAMBaseMac,
+#if defined(USE_SCRATCHMEM_SUBTERFUGE)
+		Host2MacAddr(ScratchMem),
+#endif
+		(uint32)CPUType, CPUIs68060, (uint32)FPUType, TwentyFourBitAddressing, PatchHWBases,
+		(uint32)PrefsFindInt32("modelid")
+	};
+	for (uint32 i = 0; i < sizeof(params) / sizeof(params[0]); i++)
+		h = (h ^ params[i]) * UVAL64(0x100000001b3);
+
+	sprintf(key, "%08x%08x", uint32(h >> 32), uint32(h));
+}
+
+static void save_patched_rom_state(patched_rom_state &state)
+{
+	state.universal_info = UniversalInfo;
+	state.put_scrap_patch = PutScrapPatch;
+	state.get_scrap_patch = GetScrapPatch;
+	state.qd_accel_patch = QDAccelPatch;
+	state.sony_offset = sony_offset;
+	state.serd_offset = serd_offset;
+	state.microseconds_offset = microseconds_offset;
+	state.debugutil_offset = debugutil_offset;
+	state.sony_disk_icon_addr = SonyDiskIconAddr;
+	state.sony_drive_icon_addr = SonyDriveIconAddr;
+	state.disk_icon_addr = DiskIconAddr;
+	state.cdrom_icon_addr = CDROMIconAddr;
+}
+
+static void restore_patched_rom_state(const patched_rom_state &state)
+{
+	UniversalInfo = state.universal_info;
+	PutScrapPatch = state.put_scrap_patch;
+	GetScrapPatch = state.get_scrap_patch;
+	QDAccelPatch = state.qd_accel_patch;
+	sony_offset = state.sony_offset;
+	serd_offset = state.serd_offset;
+	microseconds_offset = state.microseconds_offset;
+	debugutil_offset = state.debugutil_offset;
+	SonyDiskIconAddr = state.sony_disk_icon_addr;
+	SonyDriveIconAddr = state.sony_drive_icon_addr;
+	DiskIconAddr = state.disk_icon_addr;
+	CDROMIconAddr = state.cdrom_icon_addr;
+}
+#endif
+
 bool PatchROM(void)
 {
 	// Print some information about the ROM
 	if (PrintROMInfo)
 		print_rom_info();
 
+#if SUPPORTS_ROM_CACHE
+	// Use the ROM patched by an earlier run if nothing it depends on has changed
+	patched_rom_state state;
+	char cache_key[20];
+	uint8 *rom_tail = ROMBaseHost + ROMSize - ROM_TAIL_SIZE;
+	bool use_cache = ROMVersion == ROM_VERSION_32 && ROMBreakpoint == 0;
+	if (use_cache) {
+		patched_rom_key(cache_key);
+		if (LoadPatchedROM(cache_key, &state, sizeof(state))) {
+			D(bug("patched ROM %s loaded from cache\n", cache_key));
+			restore_patched_rom_state(state);
+			memcpy(rom_tail, state.rom_tail, ROM_TAIL_SIZE);
+			if (!InstallSlotROM())
+				return false;
+			FlushCodeCache(ROMBaseHost, ROMSize);
+			return true;
+		}
+		memcpy(state.rom_tail, rom_tail, ROM_TAIL_SIZE);
+	}
+#endif
+
+	// Index ROM for the searches of the patch functions
+	ROMIndexInit(ROMBaseHost, ROMSize, PrefsFindString("romcachedir"));
+	if (ROMVersion == ROM_VERSION_32) {
+		read_rom_resources();
+		decode_rom_traps();
+	}
+
 	// Patch ROM depending on version
+	bool patched;
 	switch (ROMVersion) {
 		case ROM_VERSION_CLASSIC:
-			if (!patch_rom_classic())
-				return false;
+			patched = patch_rom_classic();
 			break;
 		case ROM_VERSION_32:
-			if (!patch_rom_32())
-				return false;
+			patched = patch_rom_32();
 			break;
 		default:
-			return false;
+			patched = false;
+			break;
 	}
 
+	ROMIndexExit();
+	std::vector<rom_rsrc>().swap(rom_rsrcs);
+	std::vector<uint32>().swap(rom_traps);
+	if (!patched)
+		return false;
+
+#if SUPPORTS_ROM_CACHE
+	// Save patched ROM, but only if rebuilding the slot ROM on the saved ROM end reproduces it
+	if (use_cache) {
+		uint8 patched_tail[ROM_TAIL_SIZE];
+		memcpy(patched_tail, rom_tail, ROM_TAIL_SIZE);
+		memcpy(rom_tail, state.rom_tail, ROM_TAIL_SIZE);
+		if (InstallSlotROM() && memcmp(rom_tail, patched_tail, ROM_TAIL_SIZE) == 0) {
+			save_patched_rom_state(state);
+			SavePatchedROM(cache_key, &state, sizeof(state));
+		} else
+			memcpy(rom_tail, patched_tail, ROM_TAIL_SIZE);
+	}
+#endif
+
 	// Install breakpoint
 	if (ROMBreakpoint) {
 #if ENABLE_MON
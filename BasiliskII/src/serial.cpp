@@ -35,6 +35,7 @@
 #include "serial_defs.h"
 
 #include "emul_op.h"
+#include "replay.h"
 
 #define DEBUG 0
 #include "debug.h"
@@ -43,6 +44,60 @@
 // Global variables
 SERDPort *the_serd_port[2];
 
+// Parameter blocks of pending Prime() calls, to record and replay their completion
+static uint32 input_pb[2], output_pb[2];
+
+
+/*
+ *  Start Prime() while replaying, the host port is not used and the data
+ *  and completion come from the replay log
+ */
+
+static int16 replay_prime(bool &pending, bool &done, uint32 dt, uint32 dce)
+{
+	int16 res = ReplayValue(REPLAY_SERIAL, 0);
+	if (res == 1) {		// Command in progress
+		done = false;
+		pending = true;
+		WriteMacInt32(dt + serdtDCE, dce);
+	}
+	return res;
+}
+
+
+/*
+ *  Abort pending Prime() calls while replaying, like KillIO does for the host port
+ */
+
+static void replay_kill_io(SERDPort *p, int i)
+{
+	if (p->read_pending) {
+		WriteMacInt16(input_pb[i] + ioResult, uint16(abortErr));
+		WriteMacInt32(input_pb[i] + ioActCount, 0);
+		p->read_pending = p->read_done = false;
+	}
+	if (p->write_pending) {
+		WriteMacInt16(output_pb[i] + ioResult, uint16(abortErr));
+		WriteMacInt32(output_pb[i] + ioActCount, 0);
+		p->write_pending = p->write_done = false;
+	}
+}
+
+
+/*
+ *  Record or replay what the host port wrote to the Mac for a completed Prime()
+ */
+
+static void replay_completion(uint32 pb, uint32 dt, bool input)
+{
+	if (!ReplayRecording && !ReplayPlaying)
+		return;
+	ReplayBytes(REPLAY_SERIAL, Mac2HostAddr(pb + ioActCount), 4);
+	ReplayBytes(REPLAY_SERIAL, Mac2HostAddr(dt + serdtResult), 4);
+	if (input)
+		ReplayRead(REPLAY_SERIAL, Mac2HostAddr(ReadMacInt32(pb + ioBuffer)), ReadMacInt32(pb + ioActCount), ReadMacInt32(pb + ioReqCount));
+}
+
 
 /*
  *  Driver Open() routine
@@ -70,7 +125,7 @@ int16 SerialOpen(uint32 pb, uint32 dce, int port)
 		the_port->cum_errors = 0;
 
 		// Open port
-		int16 res = the_port->open(ReadMacInt16(0x1fc + (port & 2)));
+		int16 res = ReplayValue(REPLAY_SERIAL, the_port->open(ReadMacInt16(0x1fc + (port & 2))));
 		if (res)
 			return res;
 
@@ -127,14 +182,20 @@ int16 SerialPrime(uint32 pb, uint32 dce, int port)
 		if (the_port->read_pending) {
 			printf("FATAL: SerialPrimeIn() called while request is pending\n");
 			return readErr;
-		} else
-			return the_port->prime_in(pb, dce);
+		}
+		input_pb[port >> 1] = pb;
+		if (ReplayPlaying)
+			return replay_prime(the_port->read_pending, the_port->read_done, the_port->input_dt, dce);
+		return ReplayValue(REPLAY_SERIAL, the_port->prime_in(pb, dce));
 	} else {
 		if (the_port->write_pending) {
 			printf("FATAL: SerialPrimeOut() called while request is pending\n");
 			return readErr;
-		} else
-			return the_port->prime_out(pb, dce);
+		}
+		output_pb[port >> 1] = pb;
+		if (ReplayPlaying)
+			return replay_prime(the_port->write_pending, the_port->write_done, the_port->output_dt, dce);
+		return ReplayValue(REPLAY_SERIAL, the_port->prime_out(pb, dce));
 	}
 }
 
@@ -157,8 +218,15 @@ int16 SerialControl(uint32 pb, uint32 dce, int port)
 		case kSERDSetPollWrite:
 			return noErr;
 
-		default:
-			return the_port->control(pb, dce, code);
+		default: {
+			// The host port is not used while replaying
+			int16 res = noErr;
+			if (!ReplayPlaying)
+				res = the_port->control(pb, dce, code);
+			else if (code == 1)	// KillIO
+				replay_kill_io(the_port, port >> 1);
+			return ReplayValue(REPLAY_SERIAL, res);
+		}
 	}
 }
 
@@ -188,8 +256,11 @@ int16 SerialStatus(uint32 pb, uint32 dce, int port)
 			WriteMacInt16(pb + csParam + 6, 0x0616);
 			return noErr;
 
-		default:
-			return the_port->status(pb, dce, code);
+		default: {
+			int16 res = ReplayPlaying ? (int16)noErr : the_port->status(pb, dce, code);
+			ReplayBytes(REPLAY_SERIAL, Mac2HostAddr(pb + csParam), 22);
+			return ReplayValue(REPLAY_SERIAL, res);
+		}
 	}
 }
 
@@ -228,14 +299,16 @@ int16 SerialClose(uint32 pb, uint32 dce, int port)
  *  Serial interrupt - Prime command completed, activate deferred tasks to call IODone
  */
 
-static void serial_irq(SERDPort *p)
+static void serial_irq(SERDPort *p, int i)
 {
 	if (p->is_open) {
-		if (p->read_pending && p->read_done) {
+		if (p->read_pending && ReplayValue(REPLAY_SERIAL, p->read_done)) {
+			replay_completion(input_pb[i], p->input_dt, true);
 			EnqueueMac(p->input_dt, 0xd92);
 			p->read_pending = p->read_done = false;
 		}
-		if (p->write_pending && p->write_done) {
+		if (p->write_pending && ReplayValue(REPLAY_SERIAL, p->write_done)) {
+			replay_completion(output_pb[i], p->output_dt, false);
 			EnqueueMac(p->output_dt, 0xd92);
 			p->write_pending = p->write_done = false;
 		}
@@ -246,6 +319,6 @@ void SerialInterrupt(void)
 {
 	D(bug("SerialIRQ\n"));
 
-	serial_irq(the_serd_port[0]);
-	serial_irq(the_serd_port[1]);
+	serial_irq(the_serd_port[0], 0);
+	serial_irq(the_serd_port[1], 1);
 }
@@ -0,0 +1,727 @@
+/*
+ *  snapshot.cpp - Machine state snapshots
+ *
+ *  Basilisk II (C) 1997-2008 Christian Bauer
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/*
+ *  A snapshot holds the complete state of a running Mac: RAM, the patched
+ *  ROM, CPU and FPU registers, XPRAM and the state of the drivers that
+ *  keep host-side data (ADB, Time Manager, disk drivers, external file
+ *  system, video, audio).
+ *  It is taken between two instructions of the outermost CPU loop, so no
+ *  EMUL_OP handler is in progress, and restored after InitAll() instead
+ *  of booting the ROM.
+ *
+ *  File layout (all values big-endian):
+ *    header        magic, version, RAM/ROM size, chunk size, number of
+ *                  sections, offset of RAM chunk table
+ *    sections      tag, flags, size, stored size, data (maybe deflated)
+ *    chunk table   type, stored size and file offset of each RAM chunk
+ *    chunk data    raw chunks start on a chunk boundary
+ *
+ *  RAM is stored in chunks of CHUNK_SIZE bytes. Chunks that contain only
+ *  zeroes are not stored at all, chunks that compress well are deflated,
+ *  and the others are stored raw. Raw and zero chunks are restored with
+ *  mmap(), so their pages are only read in when the Mac touches them.
+ *  Deflated chunks are unpacked during the restore.
+ *
+ *  The snapshot doesn't contain the disk images. They must be the same,
+ *  with unchanged contents, when resuming. Forks open on the external
+ *  file system are reopened by name. Host state of serial ports, SCSI
+ *  and Ethernet is not saved.
+ */
+
+#include "sysdeps.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <string>
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+#include "cpu_emulation.h"
+#include "main.h"
+#include "prefs.h"
+#include "rom_patches.h"
+#include "snapshot.h"
+#include "file_util.h"
+
+#define DEBUG 0
+#include "debug.h"
+
+#ifndef MAP_ANONYMOUS
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+
+
+// File format
+static const char SNAPSHOT_MAGIC[8] = {'B', '2', 'S', 'N', 'A', 'P', 0x0d, 0x0a};
+const uint32 SNAPSHOT_VERSION = 1;
+const uint32 HEADER_SIZE = 40;
+const uint32 CHUNK_SIZE = 0x10000;			// RAM chunk size, multiple of any host page size
+
+// Section flags
+const uint32 SECTION_DEFLATED = 1;
+
+// RAM chunk types
+enum {
+	CHUNK_ZERO,			// All zeroes, not stored
+	CHUNK_RAW,			// Stored as is, at a CHUNK_SIZE aligned file offset
+	CHUNK_DEFLATED		// Stored compressed
+};
+
+// Section tags
+#define FOURCC(a, b, c, d) (((uint32)(a) << 24) | ((b) << 16) | ((c) << 8) | (d))
+const uint32 TAG_MACHINE = FOURCC('M', 'A', 'C', 'H');
+const uint32 TAG_ROM = FOURCC('R', 'O', 'M', ' ');
+const uint32 TAG_CPU = FOURCC('C', 'P', 'U', ' ');
+const uint32 TAG_XPRAM = FOURCC('X', 'P', 'R', 'M');
+const uint32 TAG_ADB = FOURCC('A', 'D', 'B', ' ');
+const uint32 TAG_TIMER = FOURCC('T', 'I', 'M', 'E');
+const uint32 TAG_SONY = FOURCC('S', 'O', 'N', 'Y');
+const uint32 TAG_DISK = FOURCC('D', 'I', 'S', 'K');
+const uint32 TAG_CDROM = FOURCC('C', 'D', 'R', 'M');
+const uint32 TAG_EXTFS = FOURCC('E', 'X', 'T', 'F');
+const uint32 TAG_VIDEO = FOURCC('V', 'I', 'D', 'E');
+const uint32 TAG_AUDIO = FOURCC('A', 'U', 'D', 'I');
+
+
+/*
+ *  Helper functions
+ */
+
+// Compress data, returns false if it doesn't shrink below the given size
+static bool deflate_data(const uint8 *src, uint32 len, std::vector<uint8> &out, uint32 max_len)
+{
+#ifdef HAVE_ZLIB
+	uLongf out_len = compressBound(len);
+	out.resize(out_len);
+	if (compress2(&out[0], &out_len, src, len, Z_BEST_SPEED) != Z_OK || out_len >= max_len)
+		return false;
+	out.resize(out_len);
+	return true;
+#else
+	return false;
+#endif
+}
+
+static bool inflate_data(const uint8 *src, uint32 len, uint8 *dest, uint32 dest_len)
+{
+#ifdef HAVE_ZLIB
+	uLongf out_len = dest_len;
+	return uncompress(dest, &out_len, src, len) == Z_OK && out_len == dest_len;
+#else
+	return false;
+#endif
+}
+
+
+/*
+ *  Machine configuration, must match when resuming
+ */
+
+static void machine_save_state(snapshot_out &s)
+{
+	s.put32(ReadMacInt32(ROMBaseMac));	// ROM checksum
+	s.put16(ROMVersion);
+	s.put32(PrefsFindInt32("modelid"));
+	s.put_bool(TwentyFourBitAddressing);
+}
+
+static bool machine_load_state(snapshot_in &s)
+{
+	uint32 rom_checksum = s.get32();
+	uint16 rom_version = s.get16();
+	uint32 model_id = s.get32();
+	bool twenty_four_bit = s.get_bool();
+	return s.ok() && rom_checksum == ReadMacInt32(ROMBaseMac) && rom_version == ROMVersion
+	    && model_id == (uint32)PrefsFindInt32("modelid") && twenty_four_bit == TwentyFourBitAddressing;
+}
+
+
+/*
+ *  Save snapshot
+ */
+
+static void add_section(snapshot_section_vec &sections, uint32 tag, void (*save)(snapshot_out &))
+{
+	snapshot_out s;
+	save(s);
+	snapshot_section sec;
+	sec.tag = tag;
+	sec.data.swap(s.data);
+	sections.push_back(sec);
+}
+
+static void rom_save_state(snapshot_out &s)
+{
+	s.put_bytes(ROMBaseHost, ROMSize);
+}
+
+void SnapshotSaveSections(snapshot_section_vec &sections)
+{
+	add_section(sections, TAG_MACHINE, machine_save_state);
+	add_section(sections, TAG_ROM, rom_save_state);
+	add_section(sections, TAG_CPU, CPUSaveState);
+	add_section(sections, TAG_XPRAM, XPRAMSaveState);
+	add_section(sections, TAG_ADB, ADBSaveState);
+	add_section(sections, TAG_TIMER, TimerSaveState);
+	add_section(sections, TAG_SONY, SonySaveState);
+	add_section(sections, TAG_DISK, DiskSaveState);
+	add_section(sections, TAG_CDROM, CDROMSaveState);
+	add_section(sections, TAG_EXTFS, ExtFSSaveState);
+	add_section(sections, TAG_VIDEO, VideoSaveState);
+	add_section(sections, TAG_AUDIO, AudioSaveState);
+}
+
+static bool write_snapshot(int fd, bool compress)
+{
+	// Collect module states
+	snapshot_section_vec sections;
+	SnapshotSaveSections(sections);
+
+	// Write sections after the header
+	uint64 pos = HEADER_SIZE;
+	if (lseek(fd, pos, SEEK_SET) < 0)
+		return false;
+	std::vector<uint8> packed;
+	for (snapshot_section_vec::const_iterator i = sections.begin(); i != sections.end(); ++i) {
+		uint32 size = i->data.size();
+		bool deflated = compress && size > 0 && deflate_data(&i->data[0], size, packed, size);
+		uint32 stored = deflated ? packed.size() : size;
+		uint8 head[16];
+		put_be32(head, i->tag);
+		put_be32(head + 4, deflated ? SECTION_DEFLATED : 0);
+		put_be32(head + 8, size);
+		put_be32(head + 12, stored);
+		if (!write_all(fd, head, 16) || !write_all(fd, deflated ? &packed[0] : &i->data[0], stored))
+			return false;
+		pos += 16 + stored;
+	}
+
+	// Leave room for the chunk table, chunk data starts at the next chunk boundary
+	const uint32 num_chunks = (RAMSize + CHUNK_SIZE - 1) / CHUNK_SIZE;
+	std::vector<uint8> table(num_chunks * 16);
+	const uint64 table_pos = pos;
+	pos = (pos + table.size() + CHUNK_SIZE - 1) & ~(uint64)(CHUNK_SIZE - 1);
+	if (lseek(fd, pos, SEEK_SET) < 0)
+		return false;
+
+	// Write RAM chunks
+	static const uint8 zero[CHUNK_SIZE] = {0};
+	uint32 num_zero = 0, num_raw = 0, num_deflated = 0;
+	for (uint32 c = 0; c < num_chunks; c++) {
+		uint32 ofs = c * CHUNK_SIZE;
+		uint32 len = RAMSize - ofs < CHUNK_SIZE ? RAMSize - ofs : CHUNK_SIZE;
+		const uint8 *p = RAMBaseHost + ofs;
+		uint32 type, stored = 0;
+		uint64 where = 0;
+		if (is_zero(p, len & ~7) && memcmp(p + (len & ~7), zero, len & 7) == 0) {
+			type = CHUNK_ZERO;
+			num_zero++;
+		} else if (compress && deflate_data(p, len, packed, len / 2)) {
+			type = CHUNK_DEFLATED;
+			stored = packed.size();
+			where = pos;
+			if (!write_all(fd, &packed[0], stored))
+				return false;
+			pos += stored;
+			num_deflated++;
+		} else {
+			type = CHUNK_RAW;
+			stored = len;
+			uint64 aligned = (pos + CHUNK_SIZE - 1) & ~(uint64)(CHUNK_SIZE - 1);
+			if (!write_all(fd, zero, aligned - pos) || !write_all(fd, p, len))
+				return false;
+			where = aligned;
+			pos = aligned + len;
+			num_raw++;
+		}
+		put_be32(&table[c * 16], type);
+		put_be32(&table[c * 16 + 4], stored);
+		put_be32(&table[c * 16 + 8], where >> 32);
+		put_be32(&table[c * 16 + 12], where);
+	}
+	D(bug("Snapshot RAM: %u zero, %u raw, %u deflated chunks\n", num_zero, num_raw, num_deflated));
+
+	// Write chunk table and header
+	uint8 header[HEADER_SIZE];
+	memcpy(header, SNAPSHOT_MAGIC, 8);
+	put_be32(header + 8, SNAPSHOT_VERSION);
+	put_be32(header + 12, RAMSize);
+	put_be32(header + 16, ROMSize);
+	put_be32(header + 20, CHUNK_SIZE);
+	put_be32(header + 24, sections.size());
+	put_be32(header + 28, table_pos >> 32);
+	put_be32(header + 32, table_pos);
+	put_be32(header + 36, num_chunks);
+	return lseek(fd, table_pos, SEEK_SET) >= 0 && write_all(fd, &table[0], table.size())
+	    && lseek(fd, 0, SEEK_SET) >= 0 && write_all(fd, header, HEADER_SIZE);
+}
+
+bool SnapshotSave(const char *path)
+{
+	// Write to a new file, so a snapshot that is currently mapped stays intact
+	std::string tmp_path = std::string(path) + ".tmp";
+	int fd = open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	if (fd < 0) {
+		fprintf(stderr, "Snapshot %s: %s\n", tmp_path.c_str(), strerror(errno));
+		return false;
+	}
+	bool ok = write_snapshot(fd, PrefsFindBool("snapshotcompress"));
+	if (close(fd) < 0)
+		ok = false;
+	if (ok && rename(tmp_path.c_str(), path) < 0)
+		ok = false;
+	if (!ok) {
+		fprintf(stderr, "Snapshot %s: %s\n", path, strerror(errno));
+		unlink(tmp_path.c_str());
+	}
+	return ok;
+}
+
+
+/*
+ *  Load snapshot
+ */
+
+static const std::vector<uint8> *find_section(const snapshot_section_vec &sections, uint32 tag)
+{
+	for (snapshot_section_vec::const_iterator i = sections.begin(); i != sections.end(); ++i)
+		if (i->tag == tag)
+			return &i->data;
+	return NULL;
+}
+
+// Restore one module, returns error message or NULL
+static const char *load_section(const snapshot_section_vec &sections, uint32 tag, bool (*load)(snapshot_in &), const char *what)
+{
+	const std::vector<uint8> *data = find_section(sections, tag);
+	if (data == NULL)
+		return what;
+	snapshot_in s(data->empty() ? NULL : &(*data)[0], data->size());
+	return load(s) ? NULL : what;
+}
+
+// Check that a RAM chunk table entry lies within the file
+static bool chunk_in_file(uint64 file_size, const uint8 *entry)
+{
+	uint32 type = get_be32(entry);
+	uint32 stored = get_be32(entry + 4);
+	uint64 where = ((uint64)get_be32(entry + 8) << 32) | get_be32(entry + 12);
+	return type == CHUNK_ZERO || (where <= file_size && stored <= file_size - where);
+}
+
+// Restore one RAM chunk
+static bool load_chunk(int fd, uint32 c, const uint8 *entry)
+{
+	uint32 ofs = c * CHUNK_SIZE;
+	uint32 len = RAMSize - ofs < CHUNK_SIZE ? RAMSize - ofs : CHUNK_SIZE;
+	uint8 *p = RAMBaseHost + ofs;
+	uint32 type = get_be32(entry);
+	uint32 stored = get_be32(entry + 4);
+	uint64 where = ((uint64)get_be32(entry + 8) << 32) | get_be32(entry + 12);
+
+	switch (type) {
+		case CHUNK_ZERO:
+			if (len == CHUNK_SIZE && mmap(p, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0) != MAP_FAILED)
+				return true;
+			memset(p, 0, len);
+			return true;
+
+		case CHUNK_RAW:
+			if (stored != len)
+				return false;
+			if (len == CHUNK_SIZE && (where & (CHUNK_SIZE - 1)) == 0
+			 && mmap(p, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, where) != MAP_FAILED)
+				return true;
+			return lseek(fd, where, SEEK_SET) >= 0 && read_all(fd, p, len);
+
+		case CHUNK_DEFLATED: {
+			std::vector<uint8> packed(stored);
+			return stored && lseek(fd, where, SEEK_SET) >= 0 && read_all(fd, &packed[0], stored)
+			    && inflate_data(&packed[0], stored, p, len);
+		}
+
+		default:
+			return false;
+	}
+}
+
+static const char *read_snapshot(int fd)
+{
+	// Check header
+	struct stat st;
+	uint8 header[HEADER_SIZE];
+	if (fstat(fd, &st) < 0 || !read_all(fd, header, HEADER_SIZE) || memcmp(header, SNAPSHOT_MAGIC, 8))
+		return "not a snapshot file";
+	if (get_be32(header + 8) != SNAPSHOT_VERSION)
+		return "unsupported snapshot version";
+	if (get_be32(header + 12) != RAMSize || get_be32(header + 16) != ROMSize || get_be32(header + 20) != CHUNK_SIZE)
+		return "RAM or ROM size differs";
+	uint32 num_sections = get_be32(header + 24);
+	uint64 table_pos = ((uint64)get_be32(header + 28) << 32) | get_be32(header + 32);
+	uint32 num_chunks = get_be32(header + 36);
+	if (num_chunks != (RAMSize + CHUNK_SIZE - 1) / CHUNK_SIZE)
+		return "corrupt chunk table";
+
+	// Sizes come from the file, so check them against its length before
+	// allocating anything (deflate can't expand data by more than 1032:1)
+	uint64 file_size = st.st_size;
+	if (table_pos < HEADER_SIZE || table_pos > file_size || (uint64)num_chunks * 16 > file_size - table_pos
+	 || (uint64)num_sections * 16 > table_pos - HEADER_SIZE)
+		return "truncated file";
+
+	// Read sections
+	snapshot_section_vec sections(num_sections);
+	std::vector<uint8> packed;
+	uint64 pos = HEADER_SIZE;
+	for (uint32 i = 0; i < num_sections; i++) {
+		uint8 head[16];
+		if (!read_all(fd, head, 16))
+			return "truncated file";
+		snapshot_section &sec = sections[i];
+		sec.tag = get_be32(head);
+		uint32 flags = get_be32(head + 4);
+		uint32 size = get_be32(head + 8);
+		uint32 stored = get_be32(head + 12);
+		pos += 16;
+		if (pos > table_pos || stored > table_pos - pos || size > (uint64)stored * 1032)
+			return "corrupt section table";
+		pos += stored;
+		sec.data.resize(size);
+		if (flags & SECTION_DEFLATED) {
+			packed.resize(stored);
+			if (!read_all(fd, &packed[0], stored) || !inflate_data(&packed[0], stored, &sec.data[0], size))
+				return "cannot decompress section";
+		} else if (stored != size || (size && !read_all(fd, &sec.data[0], size)))
+			return "truncated file";
+	}
+
+	// Check machine configuration before anything is changed
+	const char *err;
+	if ((err = SnapshotCheckSections(sections)) != NULL)
+		return err;
+
+	// Restore memory, after checking that all chunks are in the file
+	std::vector<uint8> table(num_chunks * 16);
+	if (lseek(fd, table_pos, SEEK_SET) < 0 || !read_all(fd, &table[0], table.size()))
+		return "truncated file";
+	for (uint32 c = 0; c < num_chunks; c++)
+		if (!chunk_in_file(file_size, &table[c * 16]))
+			return "truncated file";
+	for (uint32 c = 0; c < num_chunks; c++)
+		if (!load_chunk(fd, c, &table[c * 16]))
+			return "cannot restore RAM";
+	return SnapshotLoadSections(sections);
+}
+
+const char *SnapshotCheckSections(const snapshot_section_vec &sections)
+{
+	if (load_section(sections, TAG_MACHINE, machine_load_state, "machine"))
+		return "snapshot was taken with a different ROM or Mac model";
+	const std::vector<uint8> *rom = find_section(sections, TAG_ROM);
+	if (rom == NULL || rom->size() != ROMSize)
+		return "missing ROM";
+	return NULL;
+}
+
+const char *SnapshotLoadSections(const snapshot_section_vec &sections)
+{
+	const std::vector<uint8> *rom = find_section(sections, TAG_ROM);
+	if (rom == NULL || rom->size() != ROMSize)
+		return "missing ROM";
+	memcpy(ROMBaseHost, &(*rom)[0], ROMSize);
+	FlushCodeCache(RAMBaseHost, RAMSize + ROMSize);
+
+	// Restore modules, the CPU comes last as it relies on the memory being in place
+	const char *err;
+	if ((err = load_section(sections, TAG_XPRAM, XPRAMLoadState, "XPRAM"))
+	 || (err = load_section(sections, TAG_ADB, ADBLoadState, "ADB"))
+	 || (err = load_section(sections, TAG_TIMER, TimerLoadState, "Time Manager"))
+	 || (err = load_section(sections, TAG_SONY, SonyLoadState, "floppy drives differ"))
+	 || (err = load_section(sections, TAG_DISK, DiskLoadState, "disk drives differ"))
+	 || (err = load_section(sections, TAG_CDROM, CDROMLoadState, "CD-ROM drives differ"))
+	 || (err = load_section(sections, TAG_EXTFS, ExtFSLoadState, "external file system differs"))
+	 || (err = load_section(sections, TAG_VIDEO, VideoLoadState, "video mode or monitors differ"))
+	 || (err = load_section(sections, TAG_AUDIO, AudioLoadState, "audio"))
+	 || (err = load_section(sections, TAG_CPU, CPULoadState, "CPU or FPU type differs")))
+		return err;
+	return NULL;
+}
+
+bool SnapshotLoad(const char *path)
+{
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		fprintf(stderr, "Snapshot %s: %s\n", path, strerror(errno));
+		return false;
+	}
+	const char *err = read_snapshot(fd);
+	close(fd);	// mapped chunks stay valid
+	if (err) {
+		fprintf(stderr, "Snapshot %s: %s\n", path, err);
+		return false;
+	}
+	D(bug("Resumed from snapshot %s\n", path));
+	return true;
+}
+
+
+/*
+ *  Request snapshot to the "snapshot" file from any thread, the CPU
+ *  emulation calls SnapshotCheckpoint() when it is safe to take it
+ */
+
+static volatile bool snapshot_pending = false;
+
+void SnapshotRequest(void)
+{
+	const char *path = PrefsFindString("snapshot");
+	if (path && *path) {
+		snapshot_pending = true;
+		TriggerSnapshot();
+	}
+}
+
+void SnapshotCheckpoint(void)
+{
+	// The checkpoint log uses the same safe point
+	CheckpointSafePoint();
+
+	if (!snapshot_pending)
+		return;
+	snapshot_pending = false;
+	const char *path = PrefsFindString("snapshot");
+	if (path == NULL || *path == 0)
+		return;
+	if (SnapshotSave(path))
+		printf("Snapshot saved to %s\n", path);
+}
+
+
+#ifdef SNAPSHOT_TEST
+/*
+ *  Round trip of a synthetic machine: RAM with zero, incompressible and
+ *  compressible chunks, a ROM and module sections, saved with and without
+ *  compression and resumed into scrambled memory. Damaged files and a
+ *  different ROM must be refused.
+ */
+
+uint32 RAMBaseMac, ROMBaseMac, RAMSize, ROMSize;
+uint8 *RAMBaseHost, *ROMBaseHost;
+#if DIRECT_ADDRESSING
+uintptr MEMBaseDiff;
+#endif
+uint16 ROMVersion = ROM_VERSION_32;
+bool TwentyFourBitAddressing = false;
+static bool compress_pref;
+
+const char *PrefsFindString(const char *name, int index) {return NULL;}
+bool PrefsFindBool(const char *name) {return compress_pref;}
+int32 PrefsFindInt32(const char *name) {return 14;}
+void FlushCodeCache(void *start, uint32 size) {}
+void TriggerSnapshot(void) {}
+void CheckpointSafePoint(void) {}
+
+// Modules: each section holds its tag and a per-module state byte
+static uint8 xpram_state[256];
+void XPRAMSaveState(snapshot_out &s) {s.put_bytes(xpram_state, sizeof(xpram_state));}
+bool XPRAMLoadState(snapshot_in &s) {s.get_bytes(xpram_state, sizeof(xpram_state)); return s.ok();}
+
+static uint8 module_state[10];
+#define TEST_MODULE(name, n) \
+	void name##SaveState(snapshot_out &s) {s.put32(n); s.put8(module_state[n]);} \
+	bool name##LoadState(snapshot_in &s) {uint32 tag = s.get32(); module_state[n] = s.get8(); return s.ok() && tag == n;}
+TEST_MODULE(CPU, 0)
+TEST_MODULE(ADB, 1)
+TEST_MODULE(Timer, 2)
+TEST_MODULE(Sony, 3)
+TEST_MODULE(Disk, 4)
+TEST_MODULE(CDROM, 5)
+TEST_MODULE(ExtFS, 6)
+TEST_MODULE(Video, 7)
+TEST_MODULE(Audio, 8)
+
+static int failures;
+
+#define CHECK(cond) do { \
+	if (!(cond)) { \
+		printf("%s:%d: %s failed\n", __FILE__, __LINE__, #cond); \
+		failures++; \
+	} \
+} while (0)
+
+// Fill RAM: every fourth chunk zero, then random, text-like and zero-page-with-one-byte chunks
+static void fill_machine(void)
+{
+	srand(1);
+	for (uint32 c = 0; c < RAMSize / CHUNK_SIZE; c++) {
+		uint8 *p = RAMBaseHost + c * CHUNK_SIZE;
+		switch (c % 4) {
+			case 0: memset(p, 0, CHUNK_SIZE); break;
+			case 1: for (uint32 i = 0; i < CHUNK_SIZE; i++) p[i] = rand(); break;
+			case 2: for (uint32 i = 0; i < CHUNK_SIZE; i++) p[i] = "Basilisk II "[i % 12]; break;
+			case 3: memset(p, 0, CHUNK_SIZE); p[CHUNK_SIZE - 1] = c; break;
+		}
+	}
+	for (uint32 i = 0; i < ROMSize; i++)
+		ROMBaseHost[i] = rand();
+	for (uint32 i = 0; i < sizeof(xpram_state); i++)
+		xpram_state[i] = i;
+	for (uint32 i = 0; i < sizeof(module_state); i++)
+		module_state[i] = 0x40 + i;
+}
+
+// Scramble everything except the ROM checksum, which identifies the machine
+static void scramble_machine(void)
+{
+	memset(RAMBaseHost, 0xaa, RAMSize);
+	memset(ROMBaseHost + 4, 0x55, ROMSize - 4);
+	memset(xpram_state, 0, sizeof(xpram_state));
+	memset(module_state, 0, sizeof(module_state));
+}
+
+static bool machine_matches(const std::vector<uint8> &ram, const std::vector<uint8> &rom)
+{
+	for (uint32 i = 0; i < sizeof(xpram_state); i++)
+		if (xpram_state[i] != (uint8)i)
+			return false;
+	for (uint32 i = 0; i < sizeof(module_state); i++)
+		if (i < 9 && module_state[i] != 0x40 + i)
+			return false;
+	return memcmp(RAMBaseHost, &ram[0], RAMSize) == 0 && memcmp(ROMBaseHost, &rom[0], ROMSize) == 0;
+}
+
+// Overwrite 4 bytes of a file
+static void patch_file(const char *path, off_t pos, uint32 v)
+{
+	uint8 b[4];
+	put_be32(b, v);
+	int fd = open(path, O_WRONLY);
+	pwrite_all(fd, b, 4, pos);
+	close(fd);
+}
+
+int main(void)
+{
+	RAMSize = 4 * 1024 * 1024;
+	ROMSize = 1024 * 1024;
+	RAMBaseHost = (uint8 *)mmap(NULL, RAMSize + ROMSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (RAMBaseHost == MAP_FAILED) {
+		perror("mmap");
+		return 1;
+	}
+	ROMBaseHost = RAMBaseHost + RAMSize;
+	ROMBaseMac = RAMSize;
+#if DIRECT_ADDRESSING
+	MEMBaseDiff = (uintptr)RAMBaseHost;
+#endif
+
+	char dir[] = "/tmp/snapshot_test.XXXXXX";
+	if (mkdtemp(dir) == NULL) {
+		perror("mkdtemp");
+		return 1;
+	}
+	const std::string path = std::string(dir) + "/snap";
+
+	fill_machine();
+	const std::vector<uint8> ram(RAMBaseHost, RAMBaseHost + RAMSize), rom(ROMBaseHost, ROMBaseHost + ROMSize);
+	for (int compress = 0; compress < 2; compress++) {
+		compress_pref = compress;
+		CHECK(SnapshotSave(path.c_str()));
+		CHECK(access((path + ".tmp").c_str(), F_OK) < 0);
+		struct stat st;
+		CHECK(stat(path.c_str(), &st) == 0);
+		printf("%s: %llu bytes for %u KB RAM and %u KB ROM\n", compress ? "compressed" : "uncompressed",
+		       (unsigned long long)st.st_size, RAMSize / 1024, ROMSize / 1024);
+
+		scramble_machine();
+		CHECK(SnapshotLoad(path.c_str()));
+		CHECK(machine_matches(ram, rom));
+
+		// Restored RAM is a private mapping, writes must not reach the file
+		memset(RAMBaseHost, 0x11, RAMSize);
+		CHECK(SnapshotLoad(path.c_str()));
+		CHECK(machine_matches(ram, rom));
+	}
+
+	// Damaged files are refused before memory is changed
+	const std::string bad = path + ".bad";
+	std::vector<uint8> file;
+	{
+		struct stat st;
+		stat(path.c_str(), &st);
+		file.resize(st.st_size);
+		int fd = open(path.c_str(), O_RDONLY);
+		read_all(fd, &file[0], file.size());
+		close(fd);
+	}
+	const uint32 num_sections = get_be32(&file[24]);
+	CHECK(num_sections == 12);
+	static const struct {
+		const char *what;
+		off_t pos;			// where to patch, or -1 to truncate
+		uint32 value;
+	} damage[] = {
+		{"magic", 0, 0},
+		{"version", 8, SNAPSHOT_VERSION + 1},
+		{"RAM size", 12, 8 * 1024 * 1024},
+		{"section count", 24, 0x10000000},
+		{"chunk table position", 32, 0xfffffff0},
+		{"first section size", HEADER_SIZE + 8, 0x7fffffff},
+		{"first section stored size", HEADER_SIZE + 12, 0x7fffffff},
+		{"truncated", -1, 0},
+	};
+	for (uint32 d = 0; d < sizeof(damage) / sizeof(damage[0]); d++) {
+		int fd = open(bad.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+		write_all(fd, &file[0], damage[d].pos < 0 ? file.size() / 2 : file.size());
+		close(fd);
+		if (damage[d].pos >= 0)
+			patch_file(bad.c_str(), damage[d].pos, damage[d].value);
+		memset(RAMBaseHost, 0x22, RAMSize);
+		if (SnapshotLoad(bad.c_str())) {
+			printf("damaged %s accepted\n", damage[d].what);
+			failures++;
+		}
+		CHECK(RAMBaseHost[0] == 0x22 && RAMBaseHost[RAMSize - 1] == 0x22);
+	}
+	unlink(bad.c_str());
+
+	// A different ROM is refused
+	put_be32(ROMBaseHost, get_be32(ROMBaseHost) ^ 1);
+	CHECK(!SnapshotLoad(path.c_str()));
+
+	unlink(path.c_str());
+	rmdir(dir);
+	if (failures) {
+		printf("snapshot_test: %d failures\n", failures);
+		return 1;
+	}
+	printf("snapshot_test: OK\n");
+	return 0;
+}
+#endif
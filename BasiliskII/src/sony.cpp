@@ -44,6 +44,7 @@ using std::vector;
 #include "sys.h"
 #include "prefs.h"
 #include "sony.h"
+#include "snapshot.h"
 
 #define DEBUG 0
 #include "debug.h"
@@ -151,11 +152,7 @@ static drive_vec::iterator get_drive_info(int num)
 
 void SonyInit(void)
 {
-	// No drives specified in prefs? Then add defaults
-	if (PrefsFindString("floppy", 0) == NULL)
-		SysAddFloppyPrefs();
-
-	// Add drives specified in preferences
+	// Add drives specified in preferences (InitAll() adds defaults if there are none)
 	int index = 0;
 	const char *str;
 	while ((str = PrefsFindString("floppy", index++)) != NULL) {
@@ -558,3 +555,36 @@ void SonyInterrupt(void)
 
 	mount_mountable_volumes();
 }
+
+
+/*
+ *  Save/restore drive table for snapshots (the same floppy images must be configured)
+ */
+
+void SonySaveState(snapshot_out &s)
+{
+	s.put_bool(acc_run_called);
+	s.put32(drives.size());
+	drive_vec::const_iterator info, end = drives.end();
+	for (info = drives.begin(); info != end; ++info) {
+		s.put32(info->num);
+		s.put_bool(info->to_be_mounted);
+		s.put_bool(info->read_only);
+		s.put32(info->status);
+	}
+}
+
+bool SonyLoadState(snapshot_in &s)
+{
+	acc_run_called = s.get_bool();
+	if (s.get32() != drives.size())
+		return false;
+	drive_vec::iterator info, end = drives.end();
+	for (info = drives.begin(); info != end; ++info) {
+		info->num = s.get32();
+		info->to_be_mounted = s.get_bool();
+		info->read_only = s.get_bool();
+		info->status = s.get32();
+	}
+	return s.ok();
+}
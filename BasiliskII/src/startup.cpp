@@ -0,0 +1,438 @@
+/*
+ *  startup.cpp - Startup phase trace and concurrent initialization
+ *
+ *  Basilisk II (C) 1997-2008 Christian Bauer
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/*
+ *  The trace can be loaded into chrome://tracing or Perfetto. Every phase
+ *  is a "complete" event on the thread it ran on, single points in time
+ *  (like the start of the 68k emulation) are "instant" events.
+ *
+ *  Startup tasks run on one worker thread each while the main thread goes
+ *  on with the initialization that must happen there (GUI, video). Alerts
+ *  raised by a task are shown by the main thread in StartupTasksWait().
+ */
+
+#include "sysdeps.h"
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+#ifdef HAVE_PTHREADS
+#include <pthread.h>
+#endif
+
+#include "main.h"
+#include "startup.h"
+
+#define DEBUG 0
+#include "debug.h"
+
+
+// Trace event
+struct startup_event {
+	const char *name;
+	int thread;			// 0 = main thread, n = worker thread n
+	uint64 start;		// Microseconds since StartupTraceInit()
+	int64 duration;		// Microseconds, PHASE_RUNNING or POINT_IN_TIME
+};
+
+const int64 PHASE_RUNNING = -1;
+const int64 POINT_IN_TIME = -2;
+
+static uint64 trace_start = 0;					// GetTicks_usec() at StartupTraceInit()
+static std::vector<startup_event> trace_events;
+
+#ifdef HAVE_PTHREADS
+static pthread_mutex_t startup_lock = PTHREAD_MUTEX_INITIALIZER;	// Protects everything here
+static pthread_key_t worker_key;				// Number of worker thread, NULL on other threads
+static bool worker_key_valid = false;
+static std::vector<pthread_t> workers;			// Running worker threads
+static const startup_task *tasks;				// Tasks given to StartupTasksRun()
+static int num_tasks = 0, next_task = 0;
+
+// Alerts raised on worker threads
+struct deferred_alert {
+	std::string text;
+	bool error;
+};
+static std::vector<deferred_alert> deferred_alerts;
+
+static inline void startup_lock_acquire(void) {pthread_mutex_lock(&startup_lock);}
+static inline void startup_lock_release(void) {pthread_mutex_unlock(&startup_lock);}
+#else
+static inline void startup_lock_acquire(void) {}
+static inline void startup_lock_release(void) {}
+#endif
+
+
+/*
+ *  Start the clock
+ */
+
+void StartupTraceInit(void)
+{
+	trace_start = GetTicks_usec();
+}
+
+
+/*
+ *  Record phases
+ */
+
+static int current_thread(void)
+{
+#ifdef HAVE_PTHREADS
+	if (worker_key_valid)
+		return (int)(intptr)pthread_getspecific(worker_key);
+#endif
+	return 0;
+}
+
+static int add_event(const char *name, int64 duration)
+{
+	startup_event e;
+	e.name = name;
+	e.thread = current_thread();
+	e.start = GetTicks_usec() - trace_start;
+	e.duration = duration;
+
+	startup_lock_acquire();
+	int index = trace_events.size();
+	trace_events.push_back(e);
+	startup_lock_release();
+	return index;
+}
+
+int StartupPhaseBegin(const char *name)
+{
+	return add_event(name, PHASE_RUNNING);
+}
+
+void StartupPhaseEnd(int phase)
+{
+	uint64 now = GetTicks_usec() - trace_start;
+	startup_lock_acquire();
+	startup_event &e = trace_events[phase];
+	e.duration = now - e.start;
+	D(bug("Startup phase %s took %d us\n", e.name, (int)e.duration));
+	startup_lock_release();
+}
+
+void StartupMark(const char *name)
+{
+	add_event(name, POINT_IN_TIME);
+	D(bug("Startup mark %s after %d ms\n", name, (int)((GetTicks_usec() - trace_start) / 1000)));
+}
+
+
+/*
+ *  Write trace file
+ */
+
+bool StartupTraceWrite(const char *path)
+{
+	FILE *f = fopen(path, "w");
+	if (f == NULL)
+		return false;
+
+	startup_lock_acquire();
+	fprintf(f, "{\"traceEvents\":[\n");
+
+	// Thread names
+	int max_thread = 0;
+	for (size_t i = 0; i < trace_events.size(); i++)
+		if (trace_events[i].thread > max_thread)
+			max_thread = trace_events[i].thread;
+	fprintf(f, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,\"args\":{\"name\":\"main\"}}");
+	for (int t = 1; t <= max_thread; t++)
+		fprintf(f, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"startup worker %d\"}}", t, t);
+
+	// Phases that have ended, and points in time
+	for (size_t i = 0; i < trace_events.size(); i++) {
+		const startup_event &e = trace_events[i];
+		if (e.duration == POINT_IN_TIME)
+			fprintf(f, ",\n{\"name\":\"%s\",\"cat\":\"startup\",\"ph\":\"i\",\"s\":\"g\",\"ts\":%llu,\"pid\":1,\"tid\":%d}",
+			        e.name, (unsigned long long)e.start, e.thread);
+		else if (e.duration != PHASE_RUNNING)
+			fprintf(f, ",\n{\"name\":\"%s\",\"cat\":\"startup\",\"ph\":\"X\",\"ts\":%llu,\"dur\":%lld,\"pid\":1,\"tid\":%d}",
+			        e.name, (unsigned long long)e.start, (long long)e.duration, e.thread);
+	}
+
+	fprintf(f, "\n],\"displayTimeUnit\":\"ms\"}\n");
+	startup_lock_release();
+
+	bool ok = !ferror(f);
+	return fclose(f) == 0 && ok;
+}
+
+
+/*
+ *  Run initialization tasks concurrently (tasks must remain valid until StartupTasksWait())
+ */
+
+static void run_task(const startup_task &task)
+{
+	int phase = StartupPhaseBegin(task.name);
+	task.func();
+	StartupPhaseEnd(phase);
+}
+
+#ifdef HAVE_PTHREADS
+// Run tasks until there are none left
+static void run_pending_tasks(void)
+{
+	for (;;) {
+		startup_lock_acquire();
+		int i = next_task < num_tasks ? next_task++ : -1;
+		startup_lock_release();
+		if (i < 0)
+			break;
+		run_task(tasks[i]);
+	}
+}
+
+static void *startup_worker(void *arg)
+{
+	pthread_setspecific(worker_key, arg);
+	run_pending_tasks();
+	return NULL;
+}
+#endif
+
+void StartupTasksRun(const startup_task *t, int n)
+{
+#ifdef HAVE_PTHREADS
+	if (!worker_key_valid)
+		worker_key_valid = (pthread_key_create(&worker_key, NULL) == 0);
+
+	tasks = t;
+	num_tasks = n;
+	next_task = 0;
+
+	// One worker per task, tasks are mostly waiting for devices and the network
+	if (worker_key_valid) {
+		for (int i = 0; i < n; i++) {
+			pthread_t thread;
+			if (pthread_create(&thread, NULL, startup_worker, (void *)(intptr)(i + 1)) != 0)
+				break;
+			workers.push_back(thread);
+		}
+	}
+	D(bug("%d startup workers for %d tasks\n", (int)workers.size(), n));
+#else
+	for (int i = 0; i < n; i++)
+		run_task(t[i]);
+#endif
+}
+
+void StartupTasksWait(void)
+{
+#ifdef HAVE_PTHREADS
+	// Tasks that no worker could be started for run here
+	run_pending_tasks();
+	for (size_t i = 0; i < workers.size(); i++)
+		pthread_join(workers[i], NULL);
+	workers.clear();
+	tasks = NULL;
+	num_tasks = next_task = 0;
+
+	// Show alerts of tasks
+	std::vector<deferred_alert> alerts;
+	startup_lock_acquire();
+	alerts.swap(deferred_alerts);
+	startup_lock_release();
+	for (size_t i = 0; i < alerts.size(); i++) {
+		if (alerts[i].error)
+			ErrorAlert(alerts[i].text.c_str());
+		else
+			WarningAlert(alerts[i].text.c_str());
+	}
+#endif
+}
+
+
+/*
+ *  Queue alert if called from a worker thread, the GUI can only be used by the main thread
+ */
+
+bool StartupDeferAlert(const char *text, bool error)
+{
+#ifdef HAVE_PTHREADS
+	if (current_thread() == 0)
+		return false;
+	deferred_alert a;
+	a.text = text;
+	a.error = error;
+	startup_lock_acquire();
+	deferred_alerts.push_back(a);
+	startup_lock_release();
+	return true;
+#else
+	return false;
+#endif
+}
+
+
+#ifdef STARTUP_TEST
+/*
+ *  Runs tasks that sleep next to a main thread that sleeps too, and
+ *  checks that they overlap, that each ran on its own worker, that alerts
+ *  raised by tasks reach the main thread only in StartupTasksWait(), and
+ *  that the trace contains every phase.
+ */
+
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+uint64 GetTicks_usec(void)
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return (uint64)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+// Alerts as ErrorAlert()/WarningAlert() of the Unix version handle them
+static pthread_t main_thread;
+static std::vector<std::string> shown_alerts;
+static bool alert_off_main_thread;
+
+static void show_alert(const char *text, bool error)
+{
+	if (StartupDeferAlert(text, error))
+		return;
+	if (!pthread_equal(pthread_self(), main_thread))
+		alert_off_main_thread = true;
+	shown_alerts.push_back(std::string(error ? "error: " : "warning: ") + text);
+}
+
+void ErrorAlert(const char *text) {show_alert(text, true);}
+void WarningAlert(const char *text) {show_alert(text, false);}
+
+static int failures;
+
+#define CHECK(cond) do { \
+	if (!(cond)) { \
+		printf("%s:%d: %s failed\n", __FILE__, __LINE__, #cond); \
+		failures++; \
+	} \
+} while (0)
+
+const int TASK_USEC = 100000;
+static pthread_t task_thread[3];
+
+static void task(int n)
+{
+	task_thread[n] = pthread_self();
+	usleep(TASK_USEC);
+}
+
+static void task_a(void) {task(0); ErrorAlert("task a failed");}
+static void task_b(void) {task(1);}
+static void task_c(void) {task(2); WarningAlert("task c warned");}
+
+static const startup_task test_tasks[] = {
+	{"task a", task_a},
+	{"task b", task_b},
+	{"task c", task_c}
+};
+
+int main(void)
+{
+	main_thread = pthread_self();
+	StartupTraceInit();
+
+	for (int round = 0; round < 2; round++) {
+		shown_alerts.clear();
+		memset(task_thread, 0, sizeof(task_thread));
+		uint64 start = GetTicks_usec();
+		StartupTasksRun(test_tasks, 3);
+
+		// Alerts of the main thread are shown at once
+		int phase = StartupPhaseBegin("main work");
+		WarningAlert("main warned");
+		CHECK(shown_alerts.size() == 1);
+		usleep(TASK_USEC);
+		StartupPhaseEnd(phase);
+		StartupTasksWait();
+		uint64 elapsed = GetTicks_usec() - start;
+		printf("round %d: 4 x %d ms of work took %d ms\n", round, TASK_USEC / 1000, (int)(elapsed / 1000));
+
+		// Everything ran side by side, each task on a thread of its own
+		CHECK(elapsed < 2 * TASK_USEC);
+		for (int i = 0; i < 3; i++) {
+			CHECK(!pthread_equal(task_thread[i], main_thread));
+			for (int j = 0; j < i; j++)
+				CHECK(!pthread_equal(task_thread[i], task_thread[j]));
+		}
+
+		// Alerts of tasks were shown by the main thread in StartupTasksWait()
+		CHECK(!alert_off_main_thread);
+		CHECK(shown_alerts.size() == 3);
+		if (shown_alerts.size() == 3) {
+			CHECK(shown_alerts[0] == "warning: main warned");
+			CHECK(shown_alerts[1] == "error: task a failed" || shown_alerts[2] == "error: task a failed");
+			CHECK(shown_alerts[1] == "warning: task c warned" || shown_alerts[2] == "warning: task c warned");
+		}
+		CHECK(!StartupDeferAlert("not deferred on the main thread", true));
+	}
+	StartupMark("done");
+
+	// Every phase of both rounds is in the trace, tasks on worker threads
+	CHECK(trace_events.size() == 2 * 4 + 1);
+	int worker_phases = 0;
+	for (size_t i = 0; i < trace_events.size(); i++) {
+		CHECK(trace_events[i].duration != PHASE_RUNNING);
+		if (strncmp(trace_events[i].name, "task ", 5) == 0) {
+			CHECK(trace_events[i].thread >= 1 && trace_events[i].thread <= 3);
+			CHECK(trace_events[i].duration >= TASK_USEC);
+			worker_phases++;
+		} else
+			CHECK(trace_events[i].thread == 0);
+	}
+	CHECK(worker_phases == 6);
+
+	char path[] = "/tmp/startup_test.XXXXXX";
+	int fd = mkstemp(path);
+	CHECK(fd >= 0);
+	close(fd);
+	CHECK(StartupTraceWrite(path));
+	FILE *f = fopen(path, "r");
+	std::string json;
+	char buf[256];
+	size_t n;
+	while (f && (n = fread(buf, 1, sizeof(buf), f)) > 0)
+		json.append(buf, n);
+	if (f)
+		fclose(f);
+	unlink(path);
+	CHECK(json.compare(0, 15, "{\"traceEvents\":") == 0);
+	CHECK(json.find("\"name\":\"task b\"") != std::string::npos);
+	CHECK(json.find("\"name\":\"done\",\"cat\":\"startup\",\"ph\":\"i\"") != std::string::npos);
+	CHECK(json.find("startup worker 3") != std::string::npos);
+
+	if (failures) {
+		printf("startup_test: %d failures\n", failures);
+		return 1;
+	}
+	printf("startup_test: OK\n");
+	return 0;
+}
+#endif
@@ -31,6 +31,8 @@
 #include "main.h"
 #include "macos_util.h"
 #include "timer.h"
+#include "snapshot.h"
+#include "replay.h"
 
 #define DEBUG 0
 #include "debug.h"
@@ -60,6 +62,17 @@ const int NUM_DESCS = 64;		// Maximum number of descriptors
 static TMDesc desc[NUM_DESCS];
 
 
+/*
+ *  Get current time (from the replay log when replaying)
+ */
+
+static void current_time(tm_time_t &t)
+{
+	timer_current_time(t);
+	ReplayBytes(REPLAY_TIME, &t, sizeof(t));
+}
+
+
 /*
  *  Allocate descriptor for given TMTask in list
  */
@@ -209,7 +222,7 @@ int16 RmvTime(uint32 tm)
 
 		// Compute remaining time
 		tm_time_t remaining, current;
-		timer_current_time(current);
+		current_time(current);
 		timer_sub_time(remaining, desc[i].wakeup, current);
 		WriteMacInt32(tm + tmCount, timer_host2mac_time(remaining));
 	} else
@@ -261,7 +274,7 @@ int16 PrimeTime(uint32 tm, int32 time)
 
 			// No, calculate wakeup time relative to current time
 			tm_time_t now;
-			timer_current_time(now);
+			current_time(now);
 			timer_add_time(desc[i].wakeup, now, delay);
 		}
 
@@ -273,7 +286,7 @@ int16 PrimeTime(uint32 tm, int32 time)
 		// Not extended task, calculate wakeup time relative to current time
 		tm_time_t delay;
 		timer_mac2host_time(delay, time);
-		timer_current_time(desc[i].wakeup);
+		current_time(desc[i].wakeup);
 		timer_add_time(desc[i].wakeup, desc[i].wakeup, delay);
 	}
 
@@ -292,7 +305,7 @@ void TimerInterrupt(void)
 {
 	// Look for active TMTasks that have expired
 	tm_time_t now;
-	timer_current_time(now);
+	current_time(now);
 	for (int i=0; i<NUM_DESCS; i++)
 		if (desc[i].in_use) {
 			uint32 tm = desc[i].task;
@@ -314,3 +327,43 @@ void TimerInterrupt(void)
 			}
 		}
 }
+
+
+/*
+ *  Save/restore Time Manager descriptors for snapshots (wakeup times are
+ *  stored relative to the time of the snapshot)
+ */
+
+void TimerSaveState(snapshot_out &s)
+{
+	tm_time_t now;
+	timer_current_time(now);
+	s.put32(NUM_DESCS);
+	for (int i=0; i<NUM_DESCS; i++) {
+		s.put_bool(desc[i].in_use);
+		if (desc[i].in_use) {
+			tm_time_t left;
+			timer_sub_time(left, desc[i].wakeup, now);
+			s.put32(desc[i].task);
+			s.put32(timer_host2mac_time(left));
+		}
+	}
+}
+
+bool TimerLoadState(snapshot_in &s)
+{
+	if (s.get32() != NUM_DESCS)
+		return false;
+	tm_time_t now;
+	timer_current_time(now);
+	for (int i=0; i<NUM_DESCS; i++) {
+		desc[i].in_use = s.get_bool();
+		if (desc[i].in_use) {
+			desc[i].task = s.get32();
+			tm_time_t left;
+			timer_mac2host_time(left, (int32)s.get32());
+			timer_add_time(desc[i].wakeup, now, left);
+		}
+	}
+	return s.ok();
+}
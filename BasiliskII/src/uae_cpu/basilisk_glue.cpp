@@ -31,6 +31,8 @@
 #include "readcpu.h"
 #include "newcpu.h"
 #include "compiler/compemu.h"
+#include "snapshot.h"
+#include "replay.h"
 
 
 // RAM and ROM pointers
@@ -59,6 +61,9 @@ bool UseJIT = false;
 // From newcpu.cpp
 extern bool quit_program;
 
+// Nesting level of Execute68k()/Execute68kTrap() calls
+static int execute_nesting = 0;
+
 
 /*
  *  Initialize 680x0 emulation, CheckROM() must have been called first
@@ -137,7 +142,9 @@ void InitFrameBufferMapping(void)
 
 void Start680x0(void)
 {
-	m68k_reset();
+	// A restored snapshot has already set up the registers
+	if (!m68k_state_loaded)
+		m68k_reset();
 #if USE_JIT
     if (UseJIT)
 	m68k_compile_execute();
@@ -163,12 +170,36 @@ void TriggerNMI(void)
 }
 
 
+/*
+ *  Request snapshot, it is taken once the CPU is back at the outermost
+ *  execution loop (i.e. not inside an EMUL_OP handler)
+ */
+
+void TriggerSnapshot(void)
+{
+	SPCFLAGS_SET( SPCFLAG_SNAPSHOT );
+}
+
+void m68k_snapshot(void)
+{
+	if (execute_nesting)
+		return;
+	SPCFLAGS_CLEAR( SPCFLAG_SNAPSHOT );
+	SnapshotCheckpoint();
+}
+
+
 /*
  *  Get 68k interrupt level
  */
 
 int intlev(void)
 {
+#if SUPPORTS_REPLAY
+	// Host interrupts are ignored, they are taken where the replay log says
+	if (ReplayPlaying)
+		return ReplayInterruptDue() ? 1 : 0;
+#endif
 	return InterruptFlags ? 1 : 0;
 }
 
@@ -201,7 +232,9 @@ void Execute68kTrap(uint16 trap, struct M68kRegisters *r)
 	m68k_setpc(m68k_areg(regs, 7));
 	fill_prefetch_0();
 	quit_program = false;
+	execute_nesting++;
 	m68k_execute();
+	execute_nesting--;
 
 	// Clean up stack
 	m68k_areg(regs, 7) += 4;
@@ -248,7 +281,9 @@ void Execute68k(uint32 addr, struct M68kRegisters *r)
 	m68k_setpc(addr);
 	fill_prefetch_0();
 	quit_program = false;
+	execute_nesting++;
 	m68k_execute();
+	execute_nesting--;
 
 	// Clean up stack
 	m68k_areg(regs, 7) += 2;
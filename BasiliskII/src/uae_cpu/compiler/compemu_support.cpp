@@ -217,6 +217,7 @@ int segvcount=0;
 int soft_flush_count=0;
 int hard_flush_count=0;
 int checksum_count=0;
+int compiled_block_count=0;
 static uae_u8* current_compile_p=NULL;
 static uae_u8* max_compile_start;
 static uae_u8* compiled_code=NULL;
@@ -5716,7 +5717,12 @@ static uint8 *do_alloc_code(uint32 size, int depth)
 
 	return do_alloc_code(size, depth + 1);
 #else
-	uint8 *code = (uint8 *)vm_acquire(size);
+	// Transparent huge pages save TLB misses when jumping between translated blocks,
+	// hugetlbfs pages are not used as the cache is reallocated and protected as needed
+	int options = VM_MAP_DEFAULT;
+	if (vm_huge_page_options(PrefsFindString("hugepages")))
+		options |= VM_MAP_HUGEPAGES;
+	uint8 *code = (uint8 *)vm_acquire(size, options);
 	return code == VM_MAP_FAILED ? NULL : code;
 #endif
 }
@@ -6589,6 +6595,7 @@ void compiler_dumpstate(void)
 static void compile_block(cpu_history* pc_hist, int blocklen)
 {
     if (letit && compiled_code) {
+	compiled_block_count++;
 #if PROFILE_COMPILE_TIME
 	compile_count++;
 	clock_t start_time = clock();
@@ -242,6 +242,11 @@ static inline void set_fpiar(uae_u32 new_fpiar);
 extern void fpu_init(bool integral_68040);
 extern void fpu_exit(void);
 extern void fpu_reset(void);
+
+/* Snapshot support, FP0-FP7 in extended format followed by FPCR, FPSR and FPIAR */
+#define FPU_STATE_WORDS (8 * 3 + 3)
+extern void fpu_save_state(uae_u32 *state);
+extern void fpu_restore_state(const uae_u32 *state);
 	
 /* Floating-point arithmetic instructions */
 void fpuop_arithmetic(uae_u32 opcode, uae_u32 extra) REGPARAM;
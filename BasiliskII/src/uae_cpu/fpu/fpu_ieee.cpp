@@ -2150,3 +2150,21 @@ PUBLIC void FFPU fpu_reset (void)
 	fpu_exit();
 	fpu_init(FPU is_integral);
 }
+
+PUBLIC void FFPU fpu_save_state (uae_u32 *state)
+{
+	for (int i = 0; i < 8; i++)
+		extract_extended(FPU registers[i], &state[i * 3], &state[i * 3 + 1], &state[i * 3 + 2]);
+	state[24] = get_fpcr();
+	state[25] = get_fpsr();
+	state[26] = FPU instruction_address;
+}
+
+PUBLIC void FFPU fpu_restore_state (const uae_u32 *state)
+{
+	for (int i = 0; i < 8; i++)
+		make_extended_no_normalize(state[i * 3], state[i * 3 + 1], state[i * 3 + 2], FPU registers[i]);
+	set_fpcr(state[24]);
+	set_fpsr(state[25]);
+	FPU instruction_address = state[26];
+}
@@ -38,6 +38,9 @@ extern int intlev(void);	// From baisilisk_glue.cpp
 #include "newcpu.h"
 #include "compiler/compemu.h"
 #include "fpu/fpu.h"
+#include "snapshot.h"
+#include "replay.h"
+#include "bench.h"
 
 #if defined(ENABLE_EXCLUSIVE_SPCFLAGS) && !defined(HAVE_HARDWARE_LOCKS)
 B2_mutex *spcflags_lock = NULL;
@@ -810,6 +813,9 @@ kludge_me_do:
 static void Interrupt(int nr)
 {
 	assert(nr < 8 && nr >= 0);
+#if SUPPORTS_REPLAY
+	ReplayInterrupt();
+#endif
 	lastint_regs = regs;
 	lastint_no = nr;
 	Exception(nr+24, 0);
@@ -1217,6 +1223,97 @@ void m68k_reset (void)
 #endif
 }
 
+/*
+ *  Save/restore CPU and FPU registers for snapshots, must be called
+ *  between two instructions of the outermost m68k_execute() loop
+ */
+
+bool m68k_state_loaded = false;
+
+void CPUSaveState(snapshot_out &s)
+{
+	MakeSR();
+	s.put32(CPUType);
+	s.put32(FPUType);
+	for (int i = 0; i < 16; i++)
+		s.put32(regs.regs[i]);
+	s.put32(m68k_getpc());
+	s.put16(regs.sr);
+	s.put32(regs.usp);
+	s.put32(regs.isp);
+	s.put32(regs.msp);
+	s.put32(regs.vbr);
+	s.put32(regs.sfc);
+	s.put32(regs.dfc);
+	s.put_bool(regs.stopped);
+	s.put32(cacr);
+	s.put32(caar);
+	s.put32(tc);
+	s.put32(itt0);
+	s.put32(itt1);
+	s.put32(dtt0);
+	s.put32(dtt1);
+	s.put32(mmusr);
+	s.put32(urp);
+	s.put32(srp);
+
+	uae_u32 fpu_state[FPU_STATE_WORDS];
+	fpu_save_state(fpu_state);
+	for (int i = 0; i < FPU_STATE_WORDS; i++)
+		s.put32(fpu_state[i]);
+}
+
+bool CPULoadState(snapshot_in &s)
+{
+	if (s.get32() != (uae_u32)CPUType || s.get32() != (uae_u32)FPUType)
+		return false;
+
+	m68k_reset();
+	for (int i = 0; i < 16; i++)
+		regs.regs[i] = s.get32();
+	uaecptr pc = s.get32();
+	regs.sr = s.get16();
+	regs.usp = s.get32();
+	regs.isp = s.get32();
+	regs.msp = s.get32();
+	regs.vbr = s.get32();
+	regs.sfc = s.get32();
+	regs.dfc = s.get32();
+	bool stopped = s.get_bool();
+	uae_u32 new_cacr = s.get32();
+	caar = s.get32();
+	tc = s.get32();
+	itt0 = s.get32();
+	itt1 = s.get32();
+	dtt0 = s.get32();
+	dtt1 = s.get32();
+	mmusr = s.get32();
+	urp = s.get32();
+	srp = s.get32();
+
+	uae_u32 fpu_state[FPU_STATE_WORDS];
+	for (int i = 0; i < FPU_STATE_WORDS; i++)
+		fpu_state[i] = s.get32();
+	if (!s.ok())
+		return false;
+	fpu_restore_state(fpu_state);
+
+	// A7 already belongs to the saved mode, so don't let MakeFromSR() switch stacks
+	regs.s = (regs.sr >> 13) & 1;
+	regs.m = (regs.sr >> 12) & 1;
+	MakeFromSR();
+	if (CPUType >= 2)
+		m68k_move2c(2, &new_cacr);	// also updates the JIT cache state
+	regs.stopped = stopped;
+	if (stopped)
+		SPCFLAGS_SET( SPCFLAG_STOP );
+
+	m68k_setpc(pc);
+	fill_prefetch_0();
+	m68k_state_loaded = true;
+	return true;
+}
+
 void m68k_emulop_return(void)
 {
 	SPCFLAGS_SET( SPCFLAG_BRK );
@@ -1225,6 +1322,10 @@ void m68k_emulop_return(void)
 
 void m68k_emulop(uae_u32 opcode)
 {
+#ifdef SHEEPSHAVER
+	// SheepShaver's EMUL_OPs are F-line opcodes
+	op_illg(opcode);
+#else
 	struct M68kRegisters r;
 	int i;
 
@@ -1241,12 +1342,18 @@ void m68k_emulop(uae_u32 opcode)
 	}
 	regs.sr = r.sr;
 	MakeFromSR();
+#endif
 }
 
 void REGPARAM2 op_illg (uae_u32 opcode)
 {
 	uaecptr pc = m68k_getpc ();
 
+#ifdef SHEEPSHAVER
+	m68k_sheep_op(opcode);
+	return;
+#endif
+
 	if ((opcode & 0xF000) == 0xA000) {
 		Exception(0xA,0);
 		return;
@@ -1330,6 +1437,9 @@ int m68k_do_specialties (void)
 		SPCFLAGS_CLEAR( SPCFLAG_JIT_EXEC_RETURN );
 #endif
 
+	if (SPCFLAGS_TEST( SPCFLAG_SNAPSHOT ))
+		m68k_snapshot();
+
 	if (SPCFLAGS_TEST( SPCFLAG_DOTRACE )) {
 		Exception (9,last_trace_ad);
 	}
@@ -1382,6 +1492,27 @@ void m68k_do_execute (void)
 	}
 }
 
+#if SUPPORTS_REPLAY
+// Same as m68k_do_execute(), counting instructions for the replay log and benchmarks
+static void m68k_do_execute_counted (void)
+{
+	for (;;) {
+		uae_u32 opcode = GET_OPCODE;
+#if FLIGHT_RECORDER
+		m68k_record_step(m68k_getpc());
+#endif
+		(*cpufunctbl[opcode])(opcode);
+		cpu_check_ticks();
+		if (++ReplayInstructions == ReplayEventDue && ReplayEventReached())
+			SPCFLAGS_SET( SPCFLAG_DOINT );
+		if (SPCFLAGS_TEST(SPCFLAG_ALL_BUT_EXEC_RETURN)) {
+			if (m68k_do_specialties())
+				return;
+		}
+	}
+}
+#endif
+
 void m68k_execute (void)
 {
 #if USE_JIT
@@ -1390,6 +1521,11 @@ void m68k_execute (void)
 	for (;;) {
 		if (quit_program)
 			break;
+#if SUPPORTS_REPLAY
+		if (ReplayRecording || ReplayPlaying || BenchCounting)
+			m68k_do_execute_counted();
+		else
+#endif
 		m68k_do_execute();
 	}
 #if USE_JIT
@@ -300,6 +300,11 @@ extern void m68k_divl (uae_u32, uae_u32, uae_u16, uaecptr);
 extern void m68k_mull (uae_u32, uae_u32, uae_u16);
 extern void m68k_emulop (uae_u32);
 extern void m68k_emulop_return (void);
+#ifdef SHEEPSHAVER
+extern void m68k_sheep_op (uae_u32);	// Traps and unimplemented opcodes, passed to the ROM's 68k emulator
+#endif
+extern void m68k_snapshot (void);
+extern bool m68k_state_loaded;
 extern void init_m68k (void);
 extern void exit_m68k (void);
 extern void m68k_dumpstate (uaecptr *);
@@ -39,6 +39,7 @@ enum {
 	SPCFLAG_JIT_END_COMPILE		= 0,
 	SPCFLAG_JIT_EXEC_RETURN		= 0,
 #endif
+	SPCFLAG_SNAPSHOT			= 0x100,
 	
 	SPCFLAG_ALL					= SPCFLAG_STOP
 								| SPCFLAG_INT
@@ -48,6 +49,7 @@ enum {
 								| SPCFLAG_DOINT
 								| SPCFLAG_JIT_END_COMPILE
 								| SPCFLAG_JIT_EXEC_RETURN
+								| SPCFLAG_SNAPSHOT
 								,
 	
 	SPCFLAG_ALL_BUT_EXEC_RETURN	= SPCFLAG_ALL & ~SPCFLAG_JIT_EXEC_RETURN
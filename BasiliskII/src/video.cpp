@@ -36,6 +36,7 @@
 #include "slot_rom.h"
 #include "video.h"
 #include "video_defs.h"
+#include "snapshot.h"
 
 #define DEBUG 0
 #include "debug.h"
@@ -969,3 +970,82 @@ int16 VideoDriverStatus(uint32 pb, uint32 dce)
 	else
 		return nsDrvErr;
 }
+
+
+/*
+ *  Save/restore driver state and frame buffer contents for snapshots
+ */
+
+void monitor_desc::save_state(snapshot_out &s) const
+{
+	s.put16(current_apple_mode);
+	s.put32(current_id);
+	s.put16(preferred_apple_mode);
+	s.put32(preferred_id);
+	s.put_bool(luminance_mapping);
+	s.put_bool(interrupts_enabled);
+	s.put_bool(dm_present);
+	s.put32(gamma_table);
+	s.put32(alloc_gamma_table_size);
+	s.put32(slot_param);
+	s.put_bytes(palette, sizeof(palette));
+	s.put32(mac_frame_base);
+
+	uint32 size = current_mode->bytes_per_row * current_mode->y;
+	s.put32(size);
+	s.put_bytes(Mac2HostAddr(mac_frame_base), size);
+}
+
+bool monitor_desc::load_state(snapshot_in &s)
+{
+	uint16 apple_mode = s.get16();
+	uint32 id = s.get32();
+	vector<video_mode>::const_iterator it = find_mode(apple_mode, id);
+	if (it == invalid_mode())
+		return false;
+
+	preferred_apple_mode = s.get16();
+	preferred_id = s.get32();
+	luminance_mapping = s.get_bool();
+	interrupts_enabled = s.get_bool();
+	dm_present = s.get_bool();
+	gamma_table = s.get32();
+	alloc_gamma_table_size = s.get32();
+	slot_param = s.get32();
+	s.get_bytes(palette, sizeof(palette));
+	uint32 frame_base = s.get32();
+
+	// Switch mode, the frame buffer must end up where the Mac expects it
+	current_mode = it;
+	current_apple_mode = apple_mode;
+	current_id = id;
+	switch_to_current_mode();
+	if (mac_frame_base != frame_base)
+		return false;
+	set_palette(palette, palette_size(current_mode->depth));
+
+	uint32 size = s.get32();
+	if (size != current_mode->bytes_per_row * current_mode->y)
+		return false;
+	s.get_bytes(Mac2HostAddr(mac_frame_base), size);
+	return true;
+}
+
+void VideoSaveState(snapshot_out &s)
+{
+	s.put32(VideoMonitors.size());
+	vector<monitor_desc *>::const_iterator i, end = VideoMonitors.end();
+	for (i = VideoMonitors.begin(); i != end; ++i)
+		(*i)->save_state(s);
+}
+
+bool VideoLoadState(snapshot_in &s)
+{
+	if (s.get32() != VideoMonitors.size())
+		return false;
+	vector<monitor_desc *>::const_iterator i, end = VideoMonitors.end();
+	for (i = VideoMonitors.begin(); i != end; ++i)
+		if (!(*i)->load_state(s))
+			return false;
+	return s.ok();
+}
@@ -27,11 +27,20 @@
 
 #include "sysdeps.h"
 #include "xpram.h"
+#include "snapshot.h"
 
 
 // Extended parameter RAM
 uint8 XPRAM[XPRAM_SIZE];
 
+// Delayed saving of XPRAM changes
+const int XPRAM_SAVE_DELAY = 1;			// Seconds without writes before XPRAM is saved
+const int XPRAM_MAX_SAVE_DELAY = 30;	// Seconds after which XPRAM is saved even if it is still being written to
+
+static volatile bool xpram_dirty = false;	// Flag: XPRAM changed since it was last saved
+static volatile int quiet_seconds = 0;		// Seconds since last write
+static int dirty_seconds = 0;				// Seconds since first unsaved write
+
 
 /*
  *  Initialize XPRAM
@@ -56,3 +65,176 @@ void XPRAMExit(void)
 	// Save XPRAM to settings file
 	SaveXPRAM();
 }
+
+
+/*
+ *  Track XPRAM changes, saving XPRAM once the Mac has stopped changing it
+ *  (XPRAMMarkDirty() is called on the emulator thread, XPRAMSaveIfDirty()
+ *  on the timer thread; a write that races with saving marks XPRAM dirty
+ *  again, so it is saved the next time)
+ */
+
+void XPRAMMarkDirty(void)
+{
+	quiet_seconds = 0;
+	xpram_dirty = true;
+}
+
+void XPRAMSaveIfDirty(void)
+{
+	if (!xpram_dirty)
+		return;
+	dirty_seconds++;
+
+	// The first tick after a write can come right after it and doesn't
+	// count, so XPRAM is saved 1-2 seconds after the last write
+	if (quiet_seconds++ < XPRAM_SAVE_DELAY && dirty_seconds < XPRAM_MAX_SAVE_DELAY)
+		return;
+
+	xpram_dirty = false;
+	dirty_seconds = 0;
+	SaveXPRAM();
+}
+
+
+/*
+ *  Save/restore XPRAM for snapshots
+ */
+
+void XPRAMSaveState(snapshot_out &s)
+{
+	s.put32(XPRAM_SIZE);
+	s.put_bytes(XPRAM, XPRAM_SIZE);
+}
+
+bool XPRAMLoadState(snapshot_in &s)
+{
+	if (s.get32() != XPRAM_SIZE)
+		return false;
+	s.get_bytes(XPRAM, XPRAM_SIZE);
+	if (!s.ok())
+		return false;
+
+	// The restored XPRAM replaces the one in the settings file
+	XPRAMMarkDirty();
+	return true;
+}
+
+
+#ifdef XPRAM_TEST
+/*
+ *  Ticks the saver the way the 1Hz timer does and checks when the XPRAM
+ *  file is written: two ticks after the last write, after at most
+ *  XPRAM_MAX_SAVE_DELAY ticks of continuous writes, and after XPRAM was
+ *  restored from a snapshot.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string>
+
+static int failures;
+
+#define CHECK(cond) do { \
+	if (!(cond)) { \
+		printf("%s:%d: %s failed\n", __FILE__, __LINE__, #cond); \
+		failures++; \
+	} \
+} while (0)
+
+static std::string xpram_file;
+
+// Byte of the XPRAM file, -1 if there is none
+static int saved_byte(int i)
+{
+	uint8 buf[XPRAM_SIZE];
+	int fd = open(xpram_file.c_str(), O_RDONLY);
+	if (fd < 0)
+		return -1;
+	int actual = read(fd, buf, XPRAM_SIZE);
+	close(fd);
+	return actual == XPRAM_SIZE ? buf[i] : -1;
+}
+
+// Mac writes a byte, like the EMUL_OPs do
+static void mac_write(int i, uint8 v)
+{
+	XPRAM[i] = v;
+	XPRAMMarkDirty();
+}
+
+// Ticks until byte I of the file is V, or -1
+static int ticks_until_saved(int i, uint8 v, int max_ticks)
+{
+	for (int t = 1; t <= max_ticks; t++) {
+		XPRAMSaveIfDirty();
+		if (saved_byte(i) == v)
+			return t;
+	}
+	return -1;
+}
+
+int main(void)
+{
+	char dir[] = "/tmp/xpram_test.XXXXXX";
+	if (mkdtemp(dir) == NULL) {
+		perror("mkdtemp");
+		return 1;
+	}
+	xpram_file = std::string(dir) + "/xpram";
+	XPRAMInit(dir);
+	CHECK(saved_byte(0) == -1);
+
+	// Nothing written, nothing saved
+	CHECK(ticks_until_saved(0, 0, 5) == -1);
+
+	// One write is saved on the second tick
+	mac_write(0x10, 0xa8);
+	CHECK(ticks_until_saved(0x10, 0xa8, 5) == 2);
+
+	// Writes every second are saved after XPRAM_MAX_SAVE_DELAY seconds
+	int t;
+	for (t = 1; t <= 2 * XPRAM_MAX_SAVE_DELAY; t++) {
+		mac_write(0x20, t);
+		XPRAMSaveIfDirty();
+		if (saved_byte(0x20) != 0)
+			break;
+	}
+	CHECK(t == XPRAM_MAX_SAVE_DELAY);
+
+	// Restored XPRAM is saved like a write
+	snapshot_out out;
+	out.put32(XPRAM_SIZE);
+	for (uint32 i = 0; i < XPRAM_SIZE; i++)
+		out.put8(i ^ 0x5a);
+	snapshot_in in(&out.data[0], out.data.size());
+	CHECK(XPRAMLoadState(in));
+	CHECK(XPRAM[0x30] == (0x30 ^ 0x5a));
+	CHECK(ticks_until_saved(0x30, 0x30 ^ 0x5a, 5) == 2);
+
+	// A state of the wrong size is refused and doesn't cause a save
+	snapshot_out bad;
+	bad.put32(XPRAM_SIZE / 2);
+	bad.put_bytes(XPRAM, XPRAM_SIZE / 2);
+	snapshot_in bad_in(&bad.data[0], bad.data.size());
+	CHECK(!XPRAMLoadState(bad_in));
+	XPRAM[0x40] = 0xee;
+	CHECK(ticks_until_saved(0x40, 0xee, 5) == -1);
+
+	// XPRAMExit() saves, no temporary file is left
+	XPRAMExit();
+	CHECK(saved_byte(0x40) == 0xee);
+	CHECK(access((xpram_file + ".tmp").c_str(), F_OK) < 0);
+
+	unlink(xpram_file.c_str());
+	rmdir(dir);
+	if (failures) {
+		printf("xpram_test: %d failures\n", failures);
+		return 1;
+	}
+	printf("xpram_test: OK\n");
+	return 0;
+}
+#endif
@@ -0,0 +1 @@
+../../../BasiliskII/src/CrossPlatform/atomic_ops.h
\ No newline at end of file
@@ -0,0 +1 @@
+../../../BasiliskII/src/CrossPlatform/audio_convert.h
\ No newline at end of file
@@ -0,0 +1 @@
+../../../BasiliskII/src/CrossPlatform/audio_ring.h
\ No newline at end of file
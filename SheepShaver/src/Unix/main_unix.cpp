@@ -215,11 +215,6 @@ static bool dr_emulator_area_mapped = false;// Flag: Mac DR Emulator mmap()ped
 static KernelData *kernel_data;				// Pointer to Kernel Data
 static EmulatorData *emulator_data;
 
-static uint8 last_xpram[XPRAM_SIZE];		// Buffer for monitoring XPRAM changes
-
-static bool nvram_thread_active = false;	// Flag: NVRAM watchdog installed
-static volatile bool nvram_thread_cancel;	// Flag: Cancel NVRAM thread
-static pthread_t nvram_thread;				// NVRAM watchdog
 static bool tick_thread_active = false;		// Flag: MacOS thread installed
 static volatile bool tick_thread_cancel;	// Flag: Cancel 60Hz thread
 static pthread_t tick_thread;				// 60Hz thread
@@ -255,7 +250,6 @@ static bool kernel_data_init(void);
 static bool shm_map_address(int kernel_area, uint32 addr);
 static void Quit(void);
 static void *emul_func(void *arg);
-static void *nvram_func(void *arg);
 static void *tick_func(void *arg);
 #if EMULATED_PPC
 extern void emul_ppc(uint32 start);
@@ -344,14 +338,14 @@ int atomic_or(int *var, int v)
  *  Memory management helpers
  */
 
-static inline uint8 *vm_mac_acquire(uint32 size)
+static inline uint8 *vm_mac_acquire(uint32 size, int options = VM_MAP_DEFAULT)
 {
-	return (uint8 *)vm_acquire(size);
+	return (uint8 *)vm_acquire(size, options);
 }
 
-static inline int vm_mac_acquire_fixed(uint32 addr, uint32 size)
+static inline int vm_mac_acquire_fixed(uint32 addr, uint32 size, int options = VM_MAP_DEFAULT)
 {
-	return vm_acquire_fixed(Mac2HostAddr(addr), size);
+	return vm_acquire_fixed(Mac2HostAddr(addr), size, options);
 }
 
 static inline int vm_mac_release(uint32 addr, uint32 size)
@@ -730,6 +724,8 @@ int main(int argc, char **argv)
 {
 	char str[256];
 	bool memory_mapped_from_zero, ram_rom_areas_contiguous;
+	int32 numa_node;
+	int ram_options;
 	const char *vmdir = NULL;
 
 	// Initialize variables
@@ -882,6 +878,11 @@ int main(int argc, char **argv)
 	// Initialize VM system
 	vm_init();
 
+	// Bind memory and threads to a NUMA node, before anything big is allocated
+	numa_node = PrefsFindInt32("numanode");
+	if (numa_node >= 0 && vm_bind_numa_node(numa_node) < 0)
+		printf("WARNING: Cannot bind to NUMA node %d (%s)\n", numa_node, strerror(errno));
+
 	// Get system info
 	get_system_info();
 
@@ -952,8 +953,10 @@ int main(int argc, char **argv)
 	}
 	memory_mapped_from_zero = false;
 	ram_rom_areas_contiguous = false;
+	// Huge pages for RAM, they save TLB misses on random guest accesses
+	ram_options = vm_huge_page_options(PrefsFindString("hugepages"));
 #if REAL_ADDRESSING && HAVE_LINKER_SCRIPT
-	if (vm_mac_acquire_fixed(0, RAMSize) == 0) {
+	if (vm_mac_acquire_fixed(0, RAMSize, VM_MAP_DEFAULT | ram_options) == 0) {
 		D(bug("Could allocate RAM from 0x0000\n"));
 		RAMBase = 0;
 		RAMBaseHost = Mac2HostAddr(RAMBase);
@@ -973,7 +976,9 @@ int main(int argc, char **argv)
 #if REAL_ADDRESSING
 		// Allocate RAM at any address. Since ROM must be higher than RAM, allocate the RAM
 		// and ROM areas contiguously, plus a little extra to allow for ROM address alignment.
-		RAMBaseHost = vm_mac_acquire(RAMSize + ROM_AREA_SIZE + ROM_ALIGNMENT + SIG_STACK_SIZE);
+		// ROM is write protected later, so the area can't have hugetlbfs pages that span RAM and ROM
+		RAMBaseHost = vm_mac_acquire(RAMSize + ROM_AREA_SIZE + ROM_ALIGNMENT + SIG_STACK_SIZE,
+		                             VM_MAP_DEFAULT | (ram_options ? VM_MAP_HUGEPAGES : 0));
 		if (RAMBaseHost == VM_MAP_FAILED) {
 			sprintf(str, GetString(STR_RAM_ROM_MMAP_ERR), strerror(errno));
 			ErrorAlert(str);
@@ -986,7 +991,7 @@ int main(int argc, char **argv)
 
 		ram_rom_areas_contiguous = true;
 #else
-		if (vm_mac_acquire_fixed(RAM_BASE, RAMSize) < 0) {
+		if (vm_mac_acquire_fixed(RAM_BASE, RAMSize, VM_MAP_DEFAULT | ram_options) < 0) {
 			sprintf(str, GetString(STR_RAM_MMAP_ERR), strerror(errno));
 			ErrorAlert(str);
 			goto quit;
@@ -1063,12 +1068,6 @@ int main(int argc, char **argv)
 	tick_thread_active = (pthread_create(&tick_thread, NULL, tick_func, NULL) == 0);
 	D(bug("Tick thread installed (%ld)\n", tick_thread));
 
-	// Start NVRAM watchdog thread
-	memcpy(last_xpram, XPRAM, XPRAM_SIZE);
-	nvram_thread_cancel = false;
-	nvram_thread_active = (pthread_create(&nvram_thread, NULL, nvram_func, NULL) == 0);
-	D(bug("NVRAM thread installed (%ld)\n", nvram_thread));
-
 #if !EMULATED_PPC
 	// Install SIGILL handler
 	sigemptyset(&sigill_action.sa_mask);	// Block interrupts during ILL handling
@@ -1129,13 +1128,6 @@ static void Quit(void)
 		pthread_join(tick_thread, NULL);
 	}
 
-	// Stop NVRAM watchdog thread
-	if (nvram_thread_active) {
-		nvram_thread_cancel = true;
-		pthread_cancel(nvram_thread);
-		pthread_join(nvram_thread, NULL);
-	}
-
 #if !EMULATED_PPC
 	// Uninstall SIGSEGV and SIGBUS handlers
 	sigemptyset(&sigsegv_action.sa_mask);
@@ -1380,29 +1372,6 @@ void MakeExecutable(int dummy, uint32 start, uint32 length)
 }
 
 
-/*
- *  NVRAM watchdog thread (saves NVRAM every minute)
- */
-
-static void nvram_watchdog(void)
-{
-	if (memcmp(last_xpram, XPRAM, XPRAM_SIZE)) {
-		memcpy(last_xpram, XPRAM, XPRAM_SIZE);
-		SaveXPRAM();
-	}
-}
-
-static void *nvram_func(void *arg)
-{
-	while (!nvram_thread_cancel) {
-		for (int i=0; i<60 && !nvram_thread_cancel; i++)
-			Delay_usec(999999);		// Only wait 1 second so we quit promptly when nvram_thread_cancel becomes true
-		nvram_watchdog();
-	}
-	return NULL;
-}
-
-
 /*
  *  60Hz thread (really 60.15Hz)
  */
@@ -1417,7 +1386,7 @@ static void *tick_func(void *arg)
 	while (!tick_thread_cancel) {
 
 		// Wait
-		next += 16625;
+		next = VideoAlignTick(next + 16625);
 		int64 delay = next - GetTicks_usec();
 		if (delay > 0)
 			Delay_usec(delay);
@@ -1469,10 +1438,11 @@ static void *tick_func(void *arg)
 		}
 #endif
 
-		// Pseudo Mac 1Hz interrupt, update local time
+		// Pseudo Mac 1Hz interrupt, update local time, save NVRAM if the Mac has changed it
 		if (++tick_counter > 60) {
 			tick_counter = 0;
 			WriteMacInt32(0x20c, TimerDateTime());
+			XPRAMSaveIfDirty();
 		}
 
 		// Trigger 60Hz interrupt
@@ -41,6 +41,11 @@ prefs_desc platform_prefs_items[] = {
 	{"ignoresegv", TYPE_BOOLEAN, false,    "ignore illegal memory accesses"},
 #endif
 	{"idlewait", TYPE_BOOLEAN, false,      "sleep when idle"},
+	{"diskoverlay", TYPE_STRING, false,    "directory for copy-on-write overlays of disk image files"},
+	{"hugepages", TYPE_STRING, false,      "huge pages for RAM and JIT cache (\"thp\" or \"hugetlb\")"},
+	{"numanode", TYPE_INT32, false,        "NUMA node to bind memory and threads to"},
+	{"romcachedir", TYPE_STRING, false,    "directory to cache ROM search indexes in"},
+	{"extfsmeta", TYPE_STRING, false,      "where ExtFS keeps Finder info (\"files\", \"cache\" or \"xattr\")"},
 #ifdef USE_SDL_VIDEO
 	{"sdlrender", TYPE_STRING, false,      "SDL_Renderer driver (\"auto\", \"software\" (may be faster), etc.)"},
 #endif
@@ -121,6 +126,7 @@ void AddPlatformPrefsDefaults(void)
 	PrefsReplaceString("extfs", "/");
 	PrefsReplaceInt32("mousewheelmode", 1);
 	PrefsReplaceInt32("mousewheellines", 3);
+	PrefsAddInt32("numanode", -1);
 #ifdef __linux__
 	if (access("/dev/sound/dsp", F_OK) == 0) {
 		PrefsReplaceString("dsp", "/dev/sound/dsp");
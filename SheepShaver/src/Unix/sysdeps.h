@@ -418,6 +418,55 @@ typedef struct timeval tm_time_t;
 #define IBM_FLOAT_FORMAT 3
 #define C4X_FLOAT_FORMAT 4
 
+#if ENABLE_UAE_68K
+/* UAE CPU data types */
+#define uae_s8 int8
+#define uae_u8 uint8
+#define uae_s16 int16
+#define uae_u16 uint16
+#define uae_s32 int32
+#define uae_u32 uint32
+#define uae_s64 int64
+#define uae_u64 uint64
+typedef uae_u32 uaecptr;
+
+/* UAE CPU defines */
+#if defined(__i386__) || defined(__powerpc__) || defined(__ppc__) || defined(__m68k__) || defined(__x86_64__)
+#ifdef WORDS_BIGENDIAN
+static inline uae_u32 do_get_mem_long(uae_u32 *a) {return *a;}
+static inline uae_u32 do_get_mem_word(uae_u16 *a) {return *a;}
+static inline void do_put_mem_long(uae_u32 *a, uae_u32 v) {*a = v;}
+static inline void do_put_mem_word(uae_u16 *a, uae_u32 v) {*a = v;}
+#else
+static inline uae_u32 do_get_mem_long(uae_u32 *a) {return bswap_32(*a);}
+static inline uae_u32 do_get_mem_word(uae_u16 *a) {return bswap_16(*a);}
+static inline void do_put_mem_long(uae_u32 *a, uae_u32 v) {*a = bswap_32(v);}
+static inline void do_put_mem_word(uae_u16 *a, uae_u32 v) {*a = bswap_16(v);}
+#endif
+#else
+/* CPUs which can not do unaligned accesses */
+static inline uae_u32 do_get_mem_long(uae_u32 *a) {uint8 *b = (uint8 *)a; return (b[0] << 24) | (b[1] << 16) | (b[2] << 8) | b[3];}
+static inline uae_u32 do_get_mem_word(uae_u16 *a) {uint8 *b = (uint8 *)a; return (b[0] << 8) | b[1];}
+static inline void do_put_mem_long(uae_u32 *a, uae_u32 v) {uint8 *b = (uint8 *)a; b[0] = v >> 24; b[1] = v >> 16; b[2] = v >> 8; b[3] = v;}
+static inline void do_put_mem_word(uae_u16 *a, uae_u32 v) {uint8 *b = (uint8 *)a; b[0] = v >> 8; b[1] = v;}
+#endif
+
+#define do_get_mem_byte(a) ((uae_u32)*((uae_u8 *)(a)))
+#define do_put_mem_byte(a, v) (*(uae_u8 *)(a) = (v))
+
+#define __inline__ inline
+#define CPU_EMU_SIZE 0
+#define ENUMDECL typedef enum
+#define ENUMNAME(name) name
+#define write_log printf
+#define ASM_SYM(a)
+
+#ifndef REGPARAM
+# define REGPARAM
+#endif
+#define REGPARAM2
+#endif
+
 // High-precision timing
 #if defined(HAVE_PTHREADS) && defined(HAVE_CLOCK_NANOSLEEP)
 #define PRECISE_TIMING 1
@@ -220,6 +220,22 @@ extern void ClipboardSelectionRequest(XSelectionRequestEvent *);
 #endif
 
 
+/*
+ *  Framebuffer allocation routines
+ */
+
+#ifdef ENABLE_VOSF
+static void *vm_acquire_framebuffer(uint32 size)
+{
+	// prefer host write-tracking over SIGSEGV for VOSF, if available
+	void *fb = vm_acquire(size, VM_MAP_DEFAULT | VM_MAP_WRITE_WATCH);
+	if (fb == VM_MAP_FAILED)
+		fb = vm_acquire(size);
+	return fb;
+}
+#endif
+
+
 /*
  *  Utility functions
  */
@@ -584,7 +600,7 @@ static bool open_window(int width, int height)
 	// Allocate memory for frame buffer (SIZE is extended to page-boundary)
 	the_host_buffer = the_buffer_copy;
 	the_buffer_size = page_extend((aligned_height + 2) * img->bytes_per_line);
-	the_buffer = (uint8 *)vm_acquire(the_buffer_size);
+	the_buffer = (uint8 *)vm_acquire_framebuffer(the_buffer_size);
 	the_buffer_copy = (uint8 *)malloc(the_buffer_size);
 	D(bug("the_buffer = %p, the_buffer_copy = %p, the_host_buffer = %p\n", the_buffer, the_buffer_copy, the_host_buffer));
 #else
@@ -771,7 +787,7 @@ static bool open_fbdev_dga(int width, int height)
 	the_host_buffer = the_buffer;
 	the_buffer_size = page_extend((height + 2) * bytes_per_row);
 	the_buffer_copy = (uint8 *)malloc(the_buffer_size);
-	the_buffer = (uint8 *)vm_acquire(the_buffer_size);
+	the_buffer = (uint8 *)vm_acquire_framebuffer(the_buffer_size);
 	D(bug("the_buffer = %p, the_buffer_copy = %p, the_host_buffer = %p\n", the_buffer, the_buffer_copy, the_host_buffer));
 #endif
 
@@ -862,7 +878,7 @@ static bool open_xf86_dga(int width, int height)
 	  the_host_buffer = the_buffer;
 	  the_buffer_size = page_extend((height + 2) * bytes_per_row);
 	  the_buffer_copy = (uint8 *)malloc(the_buffer_size);
-	  the_buffer = (uint8 *)vm_acquire(the_buffer_size);
+	  the_buffer = (uint8 *)vm_acquire_framebuffer(the_buffer_size);
 	  D(bug("the_buffer = %p, the_buffer_copy = %p, the_host_buffer = %p\n", the_buffer, the_buffer_copy, the_host_buffer));
 	}
 #else
@@ -1367,6 +1383,7 @@ bool VideoInit(void)
 #ifdef ENABLE_VOSF
 	// Zero the mainBuffer structure
 	mainBuffer.dirtyPages = NULL;
+	mainBuffer.refreshPages = NULL;
 	mainBuffer.pageInfo = NULL;
 #endif
 	
@@ -1692,6 +1709,9 @@ void VideoExit(void)
 		redraw_thread_active = false;
 	}
 
+	// Stop the blitter threads
+	Screen_blitter_exit();
+
 	// Unlock frame buffer
 	UNLOCK_FRAME_BUFFER;
 	XSync(x_display, false);
@@ -2497,7 +2517,7 @@ static void *redraw_func(void *arg)
 #ifdef ENABLE_VOSF
 					if (use_vosf) {
 						XDisplayLock();
-						if (mainBuffer.dirty) {
+						if (video_vosf_dirty()) {
 							LOCK_VOSF;
 							update_display_window_vosf();
 							UNLOCK_VOSF;
@@ -2533,7 +2553,7 @@ static void *redraw_func(void *arg)
 				// Update display (VOSF variant)
 				if (++tick_counter >= frame_skip) {
 					tick_counter = 0;
-					if (mainBuffer.dirty) {
+					if (video_vosf_dirty()) {
 						LOCK_VOSF;
 						update_display_dga_vosf();
 						UNLOCK_VOSF;
@@ -2582,3 +2602,13 @@ void video_set_dirty_area(int x, int y, int w, int h)
 
 	// XXX handle dirty bounding boxes for non-VOSF modes
 }
+
+
+/*
+ *  Align 60Hz tick to the host's vertical blank (not supported, the tick runs freely)
+ */
+
+uint64 VideoAlignTick(uint64 next)
+{
+	return next;
+}
@@ -65,6 +65,33 @@ static inline void NQD_set_dirty_area(uint32 p)
 }
 
 
+// Wide vector types, the compiler lowers them to SSE2 or NEON registers
+#if defined(__GNUC__)
+#define HAVE_NQD_VECTORS 1
+typedef uint8  vec_u8  __attribute__((vector_size(16)));
+typedef uint16 vec_u16 __attribute__((vector_size(16)));
+typedef uint32 vec_u32 __attribute__((vector_size(16)));
+
+static inline vec_u32 vec_load(const uint8 *p)
+{
+	vec_u32 v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static inline void vec_store(uint8 *p, vec_u32 v)
+{
+	memcpy(p, &v, sizeof(v));
+}
+
+static inline vec_u32 vec_splat(uint32 x)
+{
+	vec_u32 v = { x, x, x, x };
+	return v;
+}
+#endif
+
+
 /*
  *	Rectangle inversion
  */
@@ -91,6 +118,14 @@ static inline void do_invrect(uint8 *dest, uint32 length)
 	}
 #endif
 
+#ifdef HAVE_NQD_VECTORS
+	// Invert 32-byte blocks
+	for (; length >= 32; dest += 32, length -= 32) {
+		vec_store(dest, ~vec_load(dest));
+		vec_store(dest + 16, ~vec_load(dest + 16));
+	}
+#endif
+
 	// Invert 8-byte words
 	if (length >= 8) {
 		const int r = (length / 8) % 8;
@@ -204,6 +239,15 @@ static inline void do_fillrect(uint8 *dest, uint32 color, uint32 length)
 	}
 #endif
 
+#ifdef HAVE_NQD_VECTORS
+	// Fill 32-byte blocks
+	const vec_u32 cv = vec_splat(color);
+	for (; length >= 32; dest += 32, length -= 32) {
+		vec_store(dest, cv);
+		vec_store(dest + 16, cv);
+	}
+#endif
+
 	// Fill 8-byte words
 	if (length >= 8) {
 		const uint64 c = (((uint64)color) << 32) | color;
@@ -318,6 +362,194 @@ bool NQD_fillrect_hook(uint32 p)
  *	Isomorphic rectangle blitting
  */
 
+// Boolean raster operations applied by do_bitblt_rop(), dest = dest OP (src ^ c)
+enum {
+	ROP_COPY,
+	ROP_OR,
+	ROP_AND,
+	ROP_XOR
+};
+
+template< int op >
+static inline uint32 rop_4(uint32 d, uint32 s, uint32 c)
+{
+	switch (op) {
+	case ROP_COPY:	return s ^ c;
+	case ROP_OR:	return d | (s ^ c);
+	case ROP_AND:	return d & (s ^ c);
+	case ROP_XOR:	return d ^ (s ^ c);
+	}
+	return d;
+}
+
+#ifdef HAVE_NQD_VECTORS
+template< int op >
+static inline vec_u32 rop_16(vec_u32 d, vec_u32 s, vec_u32 c)
+{
+	switch (op) {
+	case ROP_COPY:	return s ^ c;
+	case ROP_OR:	return d | (s ^ c);
+	case ROP_AND:	return d & (s ^ c);
+	case ROP_XOR:	return d ^ (s ^ c);
+	}
+	return d;
+}
+#endif
+
+// Apply raster operation to one row, c holds the pixel mask in memory byte order
+template< int op >
+static void do_bitblt_rop(uint8 *dest, const uint8 *src, uint32 length, uint32 c)
+{
+	uint8 cb[4];
+	memcpy(cb, &c, 4);
+
+	// Overlapping rows with dest after src have to be processed backwards
+	if (dest > src && dest < src + length) {
+		for (int32 i = length - 1; i >= 0; i--)
+			dest[i] = rop_4<op>(dest[i], src[i], cb[i & 3]);
+		return;
+	}
+
+	uint32 i = 0;
+#ifdef HAVE_NQD_VECTORS
+	const vec_u32 cv = vec_splat(c);
+	for (; i + 32 <= length; i += 32) {
+		vec_u32 s0 = vec_load(src + i), s1 = vec_load(src + i + 16);
+		vec_u32 d0 = vec_load(dest + i), d1 = vec_load(dest + i + 16);
+		vec_store(dest + i, rop_16<op>(d0, s0, cv));
+		vec_store(dest + i + 16, rop_16<op>(d1, s1, cv));
+	}
+	for (; i + 16 <= length; i += 16)
+		vec_store(dest + i, rop_16<op>(vec_load(dest + i), vec_load(src + i), cv));
+#endif
+	for (; i + 4 <= length; i += 4) {
+		uint32 s, d;
+		memcpy(&s, src + i, 4);
+		memcpy(&d, dest + i, 4);
+		d = rop_4<op>(d, s, c);
+		memcpy(dest + i, &d, 4);
+	}
+	for (; i < length; i++)
+		dest[i] = rop_4<op>(dest[i], src[i], cb[i & 3]);
+}
+
+// Copy one row, leaving destination pixels alone where the source matches key
+template< int bpp >
+static void do_bitblt_transparent(uint8 *dest, const uint8 *src, uint32 length, uint32 key)
+{
+	// Overlapping rows with dest after src have to be processed backwards
+	const bool backwards = dest > src && dest < src + length;
+
+	uint32 i = 0;
+#ifdef HAVE_NQD_VECTORS
+	if (!backwards) {
+		const vec_u32 kv = vec_splat(key);
+		for (; i + 16 <= length; i += 16) {
+			vec_u32 s = vec_load(src + i);
+			vec_u32 d = vec_load(dest + i);
+			vec_u32 m;
+			switch (bpp) {
+			case 1: m = (vec_u32)((vec_u8)s == (vec_u8)kv); break;
+			case 2: m = (vec_u32)((vec_u16)s == (vec_u16)kv); break;
+			default: m = (vec_u32)(s == kv); break;
+			}
+			vec_store(dest + i, (d & m) | (s & ~m));
+		}
+	}
+#endif
+	if (backwards) {
+		for (int32 j = length - bpp; j >= (int32)i; j -= bpp) {
+			if (memcmp(src + j, &key, bpp) != 0)
+				memmove(dest + j, src + j, bpp);
+		}
+	}
+	else {
+		for (; i < length; i += bpp) {
+			if (memcmp(src + i, &key, bpp) != 0)
+				memcpy(dest + i, src + i, bpp);
+		}
+	}
+}
+
+// Replicate a pen value over 32 bits, in memory byte order
+static inline uint32 replicate_pixel(uint32 pixel, int bpp)
+{
+	switch (bpp) {
+	case 1:
+		pixel = (pixel & 0xff) * 0x01010101;
+		break;
+	case 2:
+		pixel = (pixel & 0xffff) * 0x00010001;
+		break;
+	}
+	return htonl(pixel);
+}
+
+// Return the pixel value of white for the depth, black being its complement
+static inline uint32 white_pixel(int depth)
+{
+	switch (depth) {
+	case 8:
+		return 0;
+	case 15: case 16:
+		return 0x7fff;
+	default:
+		return 0xffffff;
+	}
+}
+
+// Check that the pens are black and white so that boolean modes need no colorizing
+static inline bool NQD_black_and_white_pens(uint32 p)
+{
+	const int depth = ReadMacInt32(p + acclDestPixelSize);
+	const uint32 fore = ReadMacInt32(p + acclForePen);
+	const uint32 back = ReadMacInt32(p + acclBackPen);
+	if (depth == 8)
+		return (fore & 0xff) == 0xff && (back & 0xff) == 0;
+	const uint32 white = white_pixel(depth);
+	return (fore & white) == 0 && (back & white) == white;
+}
+
+// Perform one row of the blit in the requested transfer mode
+static inline void do_bitblt(int mode, int bpp, uint8 *dest, const uint8 *src, uint32 length, uint32 white, uint32 key)
+{
+	// Indexed pixels keep black as all ones so the Mac operations map
+	// directly onto booleans. Direct pixels have black as zero instead,
+	// which turns srcOr into an AND and srcBic into an OR with the
+	// complemented source.
+	const bool indexed = bpp == 1;
+	switch (mode) {
+	case 0:		// srcCopy
+		memmove(dest, src, length);
+		break;
+	case 1:		// srcOr
+		if (indexed)
+			do_bitblt_rop<ROP_OR>(dest, src, length, 0);
+		else
+			do_bitblt_rop<ROP_AND>(dest, src, length, 0);
+		break;
+	case 2:		// srcXor
+		do_bitblt_rop<ROP_XOR>(dest, src, length, indexed ? 0 : white);
+		break;
+	case 3:		// srcBic
+		if (indexed)
+			do_bitblt_rop<ROP_AND>(dest, src, length, 0xffffffff);
+		else
+			do_bitblt_rop<ROP_OR>(dest, src, length, white);
+		break;
+	case 4:		// notSrcCopy
+		do_bitblt_rop<ROP_COPY>(dest, src, length, indexed ? 0xffffffff : white);
+		break;
+	case 36:	// transparent
+		switch (bpp) {
+		case 1: do_bitblt_transparent<1>(dest, src, length, key); break;
+		case 2: do_bitblt_transparent<2>(dest, src, length, key); break;
+		case 4: do_bitblt_transparent<4>(dest, src, length, key); break;
+		}
+		break;
+	}
+}
+
 void NQD_bitblt(uint32 p)
 {
 	D(bug("accl_bitblt %08x\n", p));
@@ -329,12 +561,16 @@ void NQD_bitblt(uint32 p)
 	int16 dest_Y = (int16)ReadMacInt16(p + acclDestRect + 0) - (int16)ReadMacInt16(p + acclDestBoundsRect + 0);
 	int16 width  = (int16)ReadMacInt16(p + acclDestRect + 6) - (int16)ReadMacInt16(p + acclDestRect + 2);
 	int16 height = (int16)ReadMacInt16(p + acclDestRect + 4) - (int16)ReadMacInt16(p + acclDestRect + 0);
+	const int mode = ReadMacInt32(p + acclTransferMode);
 	D(bug(" src addr %08x, dest addr %08x\n", ReadMacInt32(p + acclSrcBaseAddr), ReadMacInt32(p + acclDestBaseAddr)));
 	D(bug(" src X %d, src Y %d, dest X %d, dest Y %d\n", src_X, src_Y, dest_X, dest_Y));
-	D(bug(" width %d, height %d\n", width, height));
+	D(bug(" width %d, height %d, mode %d\n", width, height, mode));
 
 	// And perform the blit
-	const int bpp = bytes_per_pixel(ReadMacInt32(p + acclSrcPixelSize));
+	const int depth = ReadMacInt32(p + acclSrcPixelSize);
+	const int bpp = bytes_per_pixel(depth);
+	const uint32 white = replicate_pixel(white_pixel(depth), bpp);
+	const uint32 key = replicate_pixel(ReadMacInt32(p + acclBackPen), bpp);
 	width *= bpp;
 	if ((int32)ReadMacInt32(p + acclSrcRowBytes) > 0) {
 		const int src_row_bytes = (int32)ReadMacInt32(p + acclSrcRowBytes);
@@ -342,7 +578,7 @@ void NQD_bitblt(uint32 p)
 		uint8 *src = Mac2HostAddr(ReadMacInt32(p + acclSrcBaseAddr) + (src_Y * src_row_bytes) + (src_X * bpp));
 		uint8 *dst = Mac2HostAddr(ReadMacInt32(p + acclDestBaseAddr) + (dest_Y * dst_row_bytes) + (dest_X * bpp));
 		for (int i = 0; i < height; i++) {
-			memmove(dst, src, width);
+			do_bitblt(mode, bpp, dst, src, width, white, key);
 			src += src_row_bytes;
 			dst += dst_row_bytes;
 		}
@@ -353,7 +589,7 @@ void NQD_bitblt(uint32 p)
 		uint8 *src = Mac2HostAddr(ReadMacInt32(p + acclSrcBaseAddr) + ((src_Y + height - 1) * src_row_bytes) + (src_X * bpp));
 		uint8 *dst = Mac2HostAddr(ReadMacInt32(p + acclDestBaseAddr) + ((dest_Y + height - 1) * dst_row_bytes) + (dest_X * bpp));
 		for (int i = height - 1; i >= 0; i--) {
-			memmove(dst, src, width);
+			do_bitblt(mode, bpp, dst, src, width, white, key);
 			src -= src_row_bytes;
 			dst -= dst_row_bytes;
 		}
@@ -392,9 +628,24 @@ bool NQD_bitblt_hook(uint32 p)
 		ReadMacInt32(p + acclSrcPixelSize) >= 8 &&
 		ReadMacInt32(p + acclSrcPixelSize) == ReadMacInt32(p + acclDestPixelSize) &&
 		(int32)(ReadMacInt32(p + acclSrcRowBytes) ^ ReadMacInt32(p + acclDestRowBytes)) >= 0 &&	// same sign?
-		ReadMacInt32(p + acclTransferMode) == 0 &&												// srcCopy?
 		(int32)ReadMacInt32(p + 0x15c) > 0) {
 
+		// Boolean modes other than srcCopy are only handled without colorizing
+		switch (ReadMacInt32(p + acclTransferMode)) {
+		case 0:		// srcCopy
+		case 36:	// transparent
+			break;
+		case 1:		// srcOr
+		case 2:		// srcXor
+		case 3:		// srcBic
+		case 4:		// notSrcCopy
+			if (NQD_black_and_white_pens(p))
+				break;
+			return false;
+		default:
+			return false;
+		}
+
 		// Yes, set function pointer
 		WriteMacInt32(p + acclDrawProc, NativeTVECT(NATIVE_NQD_BITBLT));
 		return true;
@@ -459,3 +710,175 @@ void VideoInstallAccel(void)
 		}
 	}
 }
+
+
+#ifdef NQD_TEST
+/*
+ *  Checks the row kernels of the accelerated transfer modes, fills and
+ *  inversions at 8, 16 and 32 bits against what QuickDraw draws for the
+ *  same pixels, with black and white pens. Rows start at all byte
+ *  offsets and also overlap the source either way, like scrolling does.
+ *
+ *  gfxaccel_test
+ */
+
+#include <stdio.h>
+
+uint32 SheepMem::page_size;
+uintptr SheepMem::zero_page;
+uintptr SheepMem::base;
+uintptr SheepMem::data;
+uintptr SheepMem::proc;
+uint32 screen_base;
+void video_set_dirty_area(int x, int y, int w, int h) {}
+uint32 NativeTVECT(int selector) {return 0;}
+void NQDMisc(uint32 arg1, uintptr arg2) {}
+bool PrefsFindBool(const char *name) {return false;}
+
+static uint32 get_pixel(const uint8 *p, int bpp)
+{
+	uint32 v = 0;
+	for (int i = 0; i < bpp; i++)
+		v = (v << 8) | p[i];
+	return v;
+}
+
+static void put_pixel(uint8 *p, int bpp, uint32 v)
+{
+	for (int i = bpp - 1; i >= 0; i--, v >>= 8)
+		p[i] = v;
+}
+
+// Pixel drawn by QuickDraw for source S over destination D
+static uint32 reference_pixel(int mode, int depth, uint32 s, uint32 d, uint32 key)
+{
+	const uint32 white = white_pixel(depth);
+	const uint32 black = depth == 8 ? 0xff : 0;
+	switch (mode) {
+	case 0:		return s;
+	case 1:		return s == black ? black : d;
+	case 2:		return s == black ? (depth == 8 ? ~d & 0xff : d ^ white) : d;
+	case 3:		return s == black ? white : d;
+	case 4:		return s == black ? white : black;
+	case 36:	return s != key ? s : d;
+	}
+	return d;
+}
+
+static int check_bitblt(int mode, int depth)
+{
+	const int bpp = bytes_per_pixel(depth);
+	const uint32 white = white_pixel(depth);
+	const uint32 black = depth == 8 ? 0xff : 0;
+	const bool boolean = mode >= 1 && mode <= 4;
+	uint8 buf[2048], ref[2048];
+	int errors = 0;
+
+	for (int n = 0; n < 400; n++) {
+		const uint32 key = rand() & (depth == 8 ? 0xff : white);
+		const int align = rand() % 16;
+		memset(buf, 0, sizeof(buf));
+		for (int i = align; i + bpp <= (int)sizeof(buf); i += bpp) {
+			uint32 v = rand() & (depth == 8 ? 0xff : white);
+			if (boolean)
+				v = (rand() & 1) ? black : white;
+			else if (mode == 36 && rand() % 3 == 0)
+				v = key;
+			put_pixel(buf + i, bpp, v);
+		}
+		memcpy(ref, buf, sizeof(buf));
+
+		// Source and destination rows are apart, or overlap with the
+		// destination before or after the source
+		const int width = 1 + rand() % 200;
+		int src_ofs = align + bpp * (rand() % 32), dst_ofs;
+		switch (n % 3) {
+		case 0: dst_ofs = align + 1024; break;
+		case 1: dst_ofs = src_ofs + bpp * (1 + rand() % 16); break;
+		default: dst_ofs = src_ofs; src_ofs += bpp * (1 + rand() % 16); break;
+		}
+
+		for (int x = 0; x < width; x++) {
+			const uint32 s = get_pixel(buf + src_ofs + x * bpp, bpp);
+			const uint32 d = get_pixel(buf + dst_ofs + x * bpp, bpp);
+			put_pixel(ref + dst_ofs + x * bpp, bpp, reference_pixel(mode, depth, s, d, key));
+		}
+		do_bitblt(mode, bpp, buf + dst_ofs, buf + src_ofs, width * bpp,
+		          replicate_pixel(white, bpp), replicate_pixel(key, bpp));
+		if (memcmp(buf, ref, sizeof(buf)) != 0) {
+			if (errors++ == 0)
+				printf("mode %d, depth %d: wrong pixels, width %d, source at %d, destination at %d\n",
+				       mode, depth, width, src_ofs, dst_ofs);
+		}
+	}
+	return errors;
+}
+
+static int check_fill_invert(int depth)
+{
+	const int bpp = bytes_per_pixel(depth);
+	uint8 buf[2048], ref[2048];
+	int errors = 0;
+
+	for (int n = 0; n < 400; n++) {
+		for (int i = 0; i < (int)sizeof(buf); i++)
+			buf[i] = ref[i] = rand();
+		const int ofs = bpp * (rand() % 64) + (bpp == 1 ? rand() % 4 : 0);
+		const int width = 1 + rand() % 200;
+		const uint32 pixel = rand() & (depth == 8 ? 0xff : white_pixel(depth));
+		const uint32 color = replicate_pixel(pixel, bpp);
+		const bool invert = n & 1;
+		for (int x = 0; x < width; x++) {
+			if (invert)
+				put_pixel(ref + ofs + x * bpp, bpp, ~get_pixel(ref + ofs + x * bpp, bpp));
+			else
+				put_pixel(ref + ofs + x * bpp, bpp, pixel);
+		}
+		switch (bpp) {
+		case 1:
+			if (invert)
+				do_invrect<8>(buf + ofs, width);
+			else
+				memset(buf + ofs, color, width);
+			break;
+		case 2:
+			if (invert)
+				do_invrect<16>(buf + ofs, width * 2);
+			else
+				do_fillrect<16>(buf + ofs, color, width * 2);
+			break;
+		case 4:
+			if (invert)
+				do_invrect<32>(buf + ofs, width * 4);
+			else
+				do_fillrect<32>(buf + ofs, color, width * 4);
+			break;
+		}
+		if (memcmp(buf, ref, sizeof(buf)) != 0) {
+			if (errors++ == 0)
+				printf("%s, depth %d: wrong pixels, width %d, offset %d\n",
+				       invert ? "invert" : "fill", depth, width, ofs);
+		}
+	}
+	return errors;
+}
+
+int main(void)
+{
+	static const int modes[] = { 0, 1, 2, 3, 4, 36 };
+	static const int depths[] = { 8, 16, 32 };
+	int errors = 0;
+	srand(1);
+	for (int d = 0; d < 3; d++) {
+		for (int m = 0; m < 6; m++)
+			errors += check_bitblt(modes[m], depths[d]);
+		errors += check_fill_invert(depths[d]);
+	}
+	if (errors) {
+		printf("gfxaccel_test: %d rows wrong\n", errors);
+		return 1;
+	}
+	printf("gfxaccel_test: OK\n");
+	return 0;
+}
+#endif
@@ -120,4 +120,13 @@ extern void FlushCodeCache(uintptr start, uintptr end);		// Invalidate emulator
 #endif
 extern void ExecuteNative(int selector);					// Execute native code from EMUL_OP routine (real mode switch)
 
+#if ENABLE_UAE_68K
+// UAE 68k core for Execute68k() subroutines ("uae68k" pref)
+extern bool UseUAE68k;
+extern bool InitUAE68k(void);
+extern void ExitUAE68k(void);
+extern void ExecuteUAE68k(uint32 pc, M68kRegisters *r);			// Execute subroutine, r->a[7] points to the return address
+extern void Execute68kEmulator(uint32 pc, M68kRegisters *r);	// Run 68k code in the ROM emulator until EXEC_RETURN, on the stack at r->a[7]
+#endif
+
 #endif
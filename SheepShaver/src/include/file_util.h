@@ -0,0 +1 @@
+../../../BasiliskII/src/include/file_util.h
\ No newline at end of file
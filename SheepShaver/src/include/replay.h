@@ -0,0 +1 @@
+../../../BasiliskII/src/include/replay.h
\ No newline at end of file
@@ -0,0 +1 @@
+../../../BasiliskII/src/include/rom_index.h
\ No newline at end of file
@@ -144,6 +144,7 @@ extern void video_set_cursor(void);
 extern bool video_can_change_cursor(void);
 extern int16 video_mode_change(VidLocals *csSave, uint32 ParamPtr);
 extern void video_set_dirty_area(int x, int y, int w, int h);
+extern uint64 VideoAlignTick(uint64 next);
 
 extern int16 VSLDoInterruptService(uint32 arg1);
 extern void NQDMisc(uint32 arg1, uintptr arg2);
@@ -28,6 +28,7 @@
 #include "macos_util.h"
 #include "block-alloc.hpp"
 #include "sigsegv.h"
+#include "vm_alloc.h"
 #include "cpu/ppc/ppc-cpu.hpp"
 #include "cpu/ppc/ppc-operations.hpp"
 #include "cpu/ppc/ppc-instructions.hpp"
@@ -42,6 +43,9 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include <algorithm>
 #ifdef HAVE_MALLOC_H
 #include <malloc.h>
 #endif
@@ -79,6 +83,166 @@ static uint32 macos_exec_count = 0;
 static clock_t macos_exec_time = 0;
 #endif
 
+// Transition profiler ("transprof" pref), counts calls and host ticks of
+// each kind of transition per entry point and per EMUL_OP or NATIVE_OP
+// that made it (the call site), times include nested transitions. There
+// are no shortcuts in the transitions yet, execute_68k() always saves the
+// full register set; this is for finding out which ones would pay off
+enum {
+	TRANS_EXEC_68K,			// Execute68k(), key = 68k entry point
+	TRANS_EXEC_68K_TRAP,	// Execute68kTrap(), key = trap number
+	TRANS_MACOS,			// call_macos*(), key = TVECT
+	TRANS_EMUL_OP,			// EMUL_OP, key = selector
+	TRANS_NATIVE_OP,		// NATIVE_OP, key = selector
+	TRANS_INTERRUPT,		// Interrupt, key = nanokernel entry point, 0 = 68k interrupt routine
+	TRANS_NUM_KINDS
+};
+
+static const char *trans_kind_names[TRANS_NUM_KINDS] = {
+	"Execute68k", "Execute68kTrap", "call_macos", "EMUL_OP", "NATIVE_OP", "interrupt"
+};
+
+// Call sites
+const uint32 TRANS_SITE_NONE = 0;
+const uint32 TRANS_SITE_EMUL_OP = 0x10000;		// | selector
+const uint32 TRANS_SITE_NATIVE_OP = 0x20000;	// | selector
+
+struct trans_prof_entry {
+	uint32 kind;		// TRANS_NUM_KINDS = unused
+	uint32 key;
+	uint32 site;
+	uint32 count;
+	uint64 ticks;
+};
+
+const int TRANS_PROF_ENTRIES = 4096;			// Power of two, last entry collects what doesn't fit
+static trans_prof_entry *trans_prof_table = NULL;
+static bool trans_prof_enabled = false;
+static uint32 trans_prof_site = TRANS_SITE_NONE;
+
+// Host time stamp, CPU cycles where it's cheap to read
+#if defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+#define TRANS_TICKS_UNIT "cycles"
+static inline uint64 trans_ticks(void)
+{
+	uint32 lo, hi;
+	__asm__ __volatile__("rdtsc" : "=a" (lo), "=d" (hi));
+	return ((uint64)hi << 32) | lo;
+}
+#else
+#define TRANS_TICKS_UNIT "usec"
+static inline uint64 trans_ticks(void)
+{
+	return GetTicks_usec();
+}
+#endif
+
+static trans_prof_entry *trans_prof_lookup(uint32 kind, uint32 key, uint32 site)
+{
+	uint32 h = (key * 0x9e3779b1) ^ (site * 0x85ebca6b) ^ kind;
+	h ^= h >> 16;
+	for (int i = 0; i < 16; i++) {
+		trans_prof_entry *e = &trans_prof_table[(h + i) % (TRANS_PROF_ENTRIES - 1)];
+		if (e->kind == kind && e->key == key && e->site == site)
+			return e;
+		if (e->kind == TRANS_NUM_KINDS) {
+			e->kind = kind;
+			e->key = key;
+			e->site = site;
+			return e;
+		}
+	}
+	return &trans_prof_table[TRANS_PROF_ENTRIES - 1];
+}
+
+// Profiles the transition from construction to destruction
+class trans_profile {
+	trans_prof_entry *entry;
+	uint32 saved_site;
+	uint64 start;
+public:
+	trans_profile(uint32 kind, uint32 key) : entry(NULL)
+	{
+		if (!trans_prof_enabled)
+			return;
+		entry = trans_prof_lookup(kind, key, trans_prof_site);
+		entry->count++;
+		saved_site = trans_prof_site;
+		if (kind == TRANS_EMUL_OP)
+			trans_prof_site = TRANS_SITE_EMUL_OP | key;
+		else if (kind == TRANS_NATIVE_OP)
+			trans_prof_site = TRANS_SITE_NATIVE_OP | key;
+		start = trans_ticks();
+	}
+	~trans_profile()
+	{
+		if (entry) {
+			entry->ticks += trans_ticks() - start;
+			trans_prof_site = saved_site;
+		}
+	}
+};
+
+static void trans_prof_init(void)
+{
+	trans_prof_enabled = PrefsFindBool("transprof");
+	if (!trans_prof_enabled)
+		return;
+	trans_prof_table = new trans_prof_entry[TRANS_PROF_ENTRIES];
+	for (int i = 0; i < TRANS_PROF_ENTRIES; i++) {
+		trans_prof_table[i].kind = TRANS_NUM_KINDS;
+		trans_prof_table[i].key = trans_prof_table[i].site = trans_prof_table[i].count = 0;
+		trans_prof_table[i].ticks = 0;
+	}
+	trans_prof_table[TRANS_PROF_ENTRIES - 1].key = 0xffffffff;
+}
+
+static bool trans_prof_compare(const trans_prof_entry *a, const trans_prof_entry *b)
+{
+	return a->ticks > b->ticks;
+}
+
+static void trans_prof_exit(void)
+{
+	if (!trans_prof_enabled)
+		return;
+	trans_prof_enabled = false;
+
+	uint32 kind_count[TRANS_NUM_KINDS] = {0};
+	std::vector<const trans_prof_entry *> entries;
+	for (int i = 0; i < TRANS_PROF_ENTRIES; i++) {
+		const trans_prof_entry *e = &trans_prof_table[i];
+		if (e->count) {
+			if (e->kind < TRANS_NUM_KINDS)
+				kind_count[e->kind] += e->count;
+			entries.push_back(e);
+		}
+	}
+	std::sort(entries.begin(), entries.end(), trans_prof_compare);
+
+	printf("### Mixed-mode transitions (ticks in " TRANS_TICKS_UNIT ", including nested transitions)\n");
+	for (int i = 0; i < TRANS_NUM_KINDS; i++)
+		printf("%-15s %10u calls\n", trans_kind_names[i], kind_count[i]);
+	printf("%-15s %-10s %-14s %10s %14s %10s\n", "kind", "key", "site", "calls", "ticks", "ticks/call");
+	for (size_t i = 0; i < entries.size() && i < 50; i++) {
+		const trans_prof_entry *e = entries[i];
+		char site[16];
+		if (e->site & TRANS_SITE_EMUL_OP)
+			sprintf(site, "EMUL_OP %u", e->site & 0xffff);
+		else if (e->site & TRANS_SITE_NATIVE_OP)
+			sprintf(site, "NATIVE_OP %u", e->site & 0xffff);
+		else
+			strcpy(site, "-");
+		printf("%-15s %08x   %-14s %10u %14llu %10llu\n",
+			   e->kind < TRANS_NUM_KINDS ? trans_kind_names[e->kind] : "(table full)", e->key, site,
+			   e->count, (unsigned long long)e->ticks, (unsigned long long)(e->ticks / e->count));
+	}
+	printf("\n");
+
+	delete[] trans_prof_table;
+	trans_prof_table = NULL;
+}
+
 static void enter_mon(void)
 {
 	// Start up mon in real-mode
@@ -158,6 +322,9 @@ public:
 	// Execute 68k routine
 	void execute_68k(uint32 entry, M68kRegisters *r);
 
+	// Run 68k code in the ROM's 68k emulator
+	void execute_68k_emulator(uint32 pc, M68kRegisters *r);
+
 	// Execute ppc routine
 	void execute_ppc(uint32 entry);
 
@@ -183,8 +350,9 @@ sheepshaver_cpu::sheepshaver_cpu()
 	init_decoder();
 
 #if PPC_ENABLE_JIT
+	// Transparent huge pages for the translation cache, it is protected as a whole only
 	if (PrefsFindBool("jit"))
-		enable_jit();
+		enable_jit(0, vm_huge_page_options(PrefsFindString("hugepages")) ? VM_MAP_HUGEPAGES : 0);
 #endif
 }
 
@@ -221,6 +389,7 @@ typedef bit_field< 26, 31 > EMUL_OP_field;
 // Execute EMUL_OP routine
 void sheepshaver_cpu::execute_emul_op(uint32 emul_op)
 {
+	trans_profile prof(TRANS_EMUL_OP, emul_op);
 	M68kRegisters r68;
 	WriteMacInt32(XLM_68K_R25, gpr(25));
 	WriteMacInt32(XLM_RUN_MODE, MODE_EMUL_OP);
@@ -460,6 +629,7 @@ int sheepshaver_cpu::compile1(codegen_context_t & cg_context)
 // Handle MacOS interrupt
 void sheepshaver_cpu::interrupt(uint32 entry)
 {
+	trans_profile prof(TRANS_INTERRUPT, entry);
 #if EMUL_TIME_STATS
 	ppc_interrupt_count++;
 	const clock_t interrupt_start = clock();
@@ -545,7 +715,11 @@ void sheepshaver_cpu::execute_68k(uint32 entry, M68kRegisters *r)
 	gpr(1) -= 56;
 	WriteMacInt32(gpr(1), sp);
 
-	// Save PowerPC registers
+	// Save PowerPC registers. This is done on every call, there is no fast
+	// path: the VBL, ADB and Time Manager tasks that HandleInterrupt() runs
+	// through here pay for the full save as well. Skipping the FPRs for
+	// them has not been implemented, it needs "transprof" numbers from a
+	// Mac OS session to show that it pays off.
 	uint32 saved_GPRs[19];
 	memcpy(&saved_GPRs[0], &gpr(13), sizeof(uint32)*(32-13));
 #if SAVE_FP_EXEC_68K
@@ -553,14 +727,59 @@ void sheepshaver_cpu::execute_68k(uint32 entry, M68kRegisters *r)
 	memcpy(&saved_FPRs[0], &fpr(14), sizeof(double)*(32-14));
 #endif
 
+	// Push return address (points to EXEC_RETURN opcode) on stack
+	gpr(1) -= 4;
+	WriteMacInt32(gpr(1), XLM_EXEC_RETURN_OPCODE);
+
+	// Execute routine, the 68k stack is the PowerPC stack
+	M68kRegisters r68 = *r;
+	r68.a[7] = gpr(1);
+#if ENABLE_UAE_68K
+	if (UseUAE68k)
+		ExecuteUAE68k(entry, &r68);
+	else
+#endif
+	execute_68k_emulator(entry, &r68);
+	gpr(1) = r68.a[7];
+
+	// Save 68k registers
+	for (int i = 0; i < 8; i++)					// d[0]..d[7]
+	  r->d[i] = r68.d[i];
+	for (int i = 0; i < 7; i++)					// a[0]..a[6]
+	  r->a[i] = r68.a[i];
+
+	// Restore PowerPC registers
+	memcpy(&gpr(13), &saved_GPRs[0], sizeof(uint32)*(32-13));
+#if SAVE_FP_EXEC_68K
+	memcpy(&fpr(14), &saved_FPRs[0], sizeof(double)*(32-14));
+#endif
+
+	// Cleanup stack
+	gpr(1) += 56;
+
+	// Restore program counters and branch registers
+	pc() = saved_pc;
+	lr() = saved_lr;
+	ctr()= saved_ctr;
+	set_cr(saved_cr);
+
+#if EMUL_TIME_STATS
+	exec68k_time += (clock() - exec68k_start);
+#endif
+}
+
+// Run 68k code in the ROM's 68k emulator until it executes EXEC_RETURN
+void sheepshaver_cpu::execute_68k_emulator(uint32 pc, M68kRegisters *r)
+{
 	// Setup registers for 68k emulator
 	cr().set(CR_SO_field<2>::mask());			// Supervisor mode
 	for (int i = 0; i < 8; i++)					// d[0]..d[7]
 	  gpr(8 + i) = r->d[i];
 	for (int i = 0; i < 7; i++)					// a[0]..a[6]
 	  gpr(16 + i) = r->a[i];
+	gpr(1) = r->a[7];
 	gpr(23) = 0;
-	gpr(24) = entry;
+	gpr(24) = pc;
 	gpr(25) = ReadMacInt32(XLM_68K_R25);		// MSB of SR
 	gpr(26) = 0;
 	gpr(28) = 0;								// VBR
@@ -568,10 +787,6 @@ void sheepshaver_cpu::execute_68k(uint32 entry, M68kRegisters *r)
 	gpr(30) = ReadMacInt32(KERNEL_DATA_BASE + 0x1078);		// Address of emulator
 	gpr(31) = KernelDataAddr + 0x1000;
 
-	// Push return address (points to EXEC_RETURN opcode) on stack
-	gpr(1) -= 4;
-	WriteMacInt32(gpr(1), XLM_EXEC_RETURN_OPCODE);
-	
 	// Rentering 68k emulator
 	WriteMacInt32(XLM_RUN_MODE, MODE_68K);
 
@@ -595,30 +810,13 @@ void sheepshaver_cpu::execute_68k(uint32 entry, M68kRegisters *r)
 	  r->d[i] = gpr(8 + i);
 	for (int i = 0; i < 7; i++)					// a[0]..a[6]
 	  r->a[i] = gpr(16 + i);
-
-	// Restore PowerPC registers
-	memcpy(&gpr(13), &saved_GPRs[0], sizeof(uint32)*(32-13));
-#if SAVE_FP_EXEC_68K
-	memcpy(&fpr(14), &saved_FPRs[0], sizeof(double)*(32-14));
-#endif
-
-	// Cleanup stack
-	gpr(1) += 56;
-
-	// Restore program counters and branch registers
-	pc() = saved_pc;
-	lr() = saved_lr;
-	ctr()= saved_ctr;
-	set_cr(saved_cr);
-
-#if EMUL_TIME_STATS
-	exec68k_time += (clock() - exec68k_start);
-#endif
+	r->a[7] = gpr(1);
 }
 
 // Call MacOS PPC code
 uint32 sheepshaver_cpu::execute_macos_code(uint32 tvect, int nargs, uint32 const *args)
 {
+	trans_profile prof(TRANS_MACOS, tvect);
 #if EMUL_TIME_STATS
 	macos_exec_count++;
 	const clock_t macos_exec_start = clock();
@@ -841,6 +1039,15 @@ void init_emul_ppc(void)
 	ppc_cpu->set_register(powerpc_registers::GPR(4), any_register(KernelDataAddr + 0x1000));
 	WriteMacInt32(XLM_RUN_MODE, MODE_68K);
 
+#if ENABLE_UAE_68K
+	// Run Execute68k() subroutines on the UAE 68k core, if requested
+	if (PrefsFindBool("uae68k"))
+		UseUAE68k = InitUAE68k();
+#endif
+
+	// Profile mixed-mode transitions, if requested
+	trans_prof_init();
+
 #if ENABLE_MON
 	// Install "regs" command in cxmon
 	mon_add_command("regs", dump_registers, "regs                     Dump PowerPC registers\n");
@@ -858,6 +1065,13 @@ void init_emul_ppc(void)
 
 void exit_emul_ppc(void)
 {
+	trans_prof_exit();
+
+#if ENABLE_UAE_68K
+	if (UseUAE68k)
+		ExitUAE68k();
+#endif
+
 #if EMUL_TIME_STATS
 	clock_t emul_end_time = clock();
 
@@ -996,7 +1210,9 @@ void HandleInterrupt(powerpc_registers *r)
 			const clock_t interrupt_start = clock();
 #endif
 #if 1
-			// Execute full 68k interrupt routine
+			// Execute full 68k interrupt routine (VBL, ADB, Time Manager),
+			// through the complete Execute68k() transition
+			trans_profile prof(TRANS_INTERRUPT, 0);
 			M68kRegisters r;
 			uint32 old_r25 = ReadMacInt32(XLM_68K_R25);	// Save interrupt level
 			WriteMacInt32(XLM_68K_R25, 0x21);			// Execute with interrupt level 1
@@ -1033,6 +1249,7 @@ void HandleInterrupt(powerpc_registers *r)
 // Execute NATIVE_OP routine
 void sheepshaver_cpu::execute_native_op(uint32 selector)
 {
+	trans_profile prof(TRANS_NATIVE_OP, selector);
 #if EMUL_TIME_STATS
 	native_exec_count++;
 	const clock_t native_exec_start = clock();
@@ -1168,9 +1385,23 @@ void sheepshaver_cpu::execute_native_op(uint32 selector)
 
 void Execute68k(uint32 pc, M68kRegisters *r)
 {
+	trans_profile prof(TRANS_EXEC_68K, pc);
 	ppc_cpu->execute_68k(pc, r);
 }
 
+#if ENABLE_UAE_68K
+/*
+ *  Run 68k code in the ROM's 68k emulator for the UAE 68k core, until it
+ *  executes EXEC_RETURN
+ *  r->a[7] is the stack, and is updated
+ */
+
+void Execute68kEmulator(uint32 pc, M68kRegisters *r)
+{
+	ppc_cpu->execute_68k_emulator(pc, r);
+}
+#endif
+
 /*
  *  Execute 68k A-Trap from EMUL_OP routine
  *  r->a[7] is unused, the routine runs on the caller's stack
@@ -1178,11 +1409,12 @@ void Execute68k(uint32 pc, M68kRegisters *r)
 
 void Execute68kTrap(uint16 trap, M68kRegisters *r)
 {
+	trans_profile prof(TRANS_EXEC_68K_TRAP, trap);
 	SheepVar proc_var(4);
 	uint32 proc = proc_var.addr();
 	WriteMacInt16(proc, trap);
 	WriteMacInt16(proc + 2, M68K_RTS);
-	Execute68k(proc, r);
+	ppc_cpu->execute_68k(proc, r);
 }
 
 /*
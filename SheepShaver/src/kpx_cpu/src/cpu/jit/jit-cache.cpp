@@ -36,7 +36,7 @@ const int JIT_CACHE_SIZE = 8 * 1024;
 const int JIT_CACHE_SIZE_GUARD = 4096;
 
 basic_jit_cache::basic_jit_cache()
-	: cache_size(0), tcode_start(NULL), code_start(NULL), code_p(NULL), code_end(NULL), data(NULL)
+	: cache_size(0), map_options(0), tcode_start(NULL), code_start(NULL), code_p(NULL), code_end(NULL), data(NULL)
 {
 }
 
@@ -64,7 +64,7 @@ basic_jit_cache::init_translation_cache(uint32 size)
 	cache_size = (size + JIT_CACHE_SIZE_GUARD + roundup - 1) & -roundup;
 	assert(cache_size > 0);
 
-	tcode_start = (uint8 *)vm_acquire(cache_size, VM_MAP_PRIVATE | VM_MAP_32BIT);
+	tcode_start = (uint8 *)vm_acquire(cache_size, VM_MAP_PRIVATE | VM_MAP_32BIT | map_options);
 	if (tcode_start == VM_MAP_FAILED) {
 		tcode_start = NULL;
 		return false;
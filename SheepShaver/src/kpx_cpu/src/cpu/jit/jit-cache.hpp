@@ -32,6 +32,7 @@ class basic_jit_cache
 {
 	// Translation cache (allocated base, current pointer, end pointer)
 	uint32 cache_size;
+	int map_options;
 	uint8 *tcode_start;
 	uint8 *code_start;
 	uint8 *code_p;
@@ -68,6 +69,7 @@ public:
 
 	bool initialize(void);
 	void set_cache_size(uint32 size);
+	void set_map_options(int options)	{ map_options = options; }
 
 	// Invalidate translation cache
 	void invalidate_cache();
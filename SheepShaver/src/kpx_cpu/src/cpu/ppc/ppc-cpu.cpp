@@ -303,9 +303,10 @@ void powerpc_cpu::initialize()
 }
 
 #if PPC_ENABLE_JIT
-void powerpc_cpu::enable_jit(uint32 cache_size)
+void powerpc_cpu::enable_jit(uint32 cache_size, int map_options)
 {
 	use_jit = true;
+	codegen.set_map_options(map_options);
 	if (cache_size)
 		codegen.set_cache_size(cache_size);
 	codegen.initialize();
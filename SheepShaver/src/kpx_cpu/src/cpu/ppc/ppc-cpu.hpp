@@ -334,7 +334,7 @@ protected:
 
 	bool use_jit;
 public:
-	void enable_jit(uint32 cache_size = 0);
+	void enable_jit(uint32 cache_size = 0, int map_options = 0);
 #endif
 
 private:
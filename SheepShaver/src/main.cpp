@@ -126,6 +126,14 @@ bool InitAll(const char *vmdir)
 	if (!ThunksInit())
 		return false;
 
+	// No drives specified in prefs? Then add defaults
+	if (PrefsFindString("floppy", 0) == NULL)
+		SysAddFloppyPrefs();
+	if (PrefsFindString("disk", 0) == NULL)
+		SysAddDiskPrefs();
+	if (PrefsFindString("cdrom", 0) == NULL)
+		SysAddCDROMPrefs();
+
 	// Init drivers
 	SonyInit();
 	DiskInit();
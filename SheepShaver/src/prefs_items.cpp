@@ -47,21 +47,30 @@ prefs_desc common_prefs_items[] = {
 	{"bootdriver", TYPE_INT32, false,   "boot driver number"},
 	{"ramsize", TYPE_INT32, false,      "size of Mac RAM in bytes"},
 	{"frameskip", TYPE_INT32, false,    "number of frames to skip in refreshed video modes"},
+	{"blitthreads", TYPE_INT32, false,  "number of threads converting the frame buffer (0 = auto)"},
 	{"gfxaccel", TYPE_BOOLEAN, false,   "turn on QuickDraw acceleration"},
 	{"nocdrom", TYPE_BOOLEAN, false,    "don't install CD-ROM driver"},
 	{"nonet", TYPE_BOOLEAN, false,      "don't use Ethernet"},
 	{"nosound", TYPE_BOOLEAN, false,    "don't enable sound output"},
+	{"audiolatency", TYPE_INT32, false, "audio buffering ahead of the host in ms (0 = auto)"},
 	{"nogui", TYPE_BOOLEAN, false,      "disable GUI"},
 	{"noclipconversion", TYPE_BOOLEAN, false, "don't convert clipboard contents"},
 	{"ignoresegv", TYPE_BOOLEAN, false, "ignore illegal memory accesses"},
 	{"ignoreillegal", TYPE_BOOLEAN, false, "ignore illegal instructions"},
 	{"jit", TYPE_BOOLEAN, false,        "enable JIT compiler"},
 	{"jit68k", TYPE_BOOLEAN, false,     "enable 68k DR emulator"},
+	{"transprof", TYPE_BOOLEAN, false,  "print profile of PowerPC/68k/native transitions at exit"},
+#if ENABLE_UAE_68K
+	{"uae68k", TYPE_BOOLEAN, false,     "run 68k subroutines of SheepShaver on the UAE 68k core"},
+	{"uae68kstats", TYPE_BOOLEAN, false, "print statistics of the UAE 68k core at exit"},
+#endif
 	{"keyboardtype", TYPE_INT32, false, "hardware keyboard type"},
 	{"hardcursor", TYPE_BOOLEAN, false, "hardware mouse cursor"},
 	{"hotkey", TYPE_INT32, false,       "hotkey modifier"},
 	{"scale_nearest",TYPE_BOOLEAN,false,"nearest neighbor scaling"},
 	{"scale_integer",TYPE_BOOLEAN,false,"integer scaling"},
+	{"vsync", TYPE_BOOLEAN, false, "present in sync with the display (SDL2)"},
+	{"framestats", TYPE_BOOLEAN, false, "print frame time statistics at exit (SDL2)"},
 	{"cpuclock", TYPE_INT32, 0,			"CPU clock [MHz] of system info"},
 	{"yearofs", TYPE_INT32, 0,			"year offset"},
 	{"dayofs", TYPE_INT32, 0,			"day offset"},
@@ -85,6 +94,7 @@ void AddPrefsDefaults(void)
 	PrefsAddBool("nocdrom", false);
 	PrefsAddBool("nonet", false);
 	PrefsAddBool("nosound", false);
+	PrefsAddInt32("audiolatency", 0);
 	PrefsAddBool("nogui", false);
 	PrefsAddBool("noclipconversion", false);
 	PrefsAddBool("ignoresegv", false);
@@ -97,6 +107,11 @@ void AddPrefsDefaults(void)
 	PrefsAddBool("jit", false);
 #endif
 	PrefsAddBool("jit68k", false);
+	PrefsAddBool("transprof", false);
+#if ENABLE_UAE_68K
+	PrefsAddBool("uae68k", false);
+	PrefsAddBool("uae68kstats", false);
+#endif
 
 	PrefsAddInt32("keyboardtype", 5);
 }
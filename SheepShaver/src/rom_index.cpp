@@ -0,0 +1 @@
+../../BasiliskII/src/rom_index.cpp
\ No newline at end of file
@@ -25,9 +25,11 @@
  */
 
 #include <string.h>
+#include <vector>
 
 #include "sysdeps.h"
 #include "rom_patches.h"
+#include "rom_index.h"
 #include "main.h"
 #include "prefs.h"
 #include "cpu_emulation.h"
@@ -206,13 +208,7 @@ bool DecodeROM(uint8 *data, uint32 size)
 
 static uint32 find_rom_data(uint32 start, uint32 end, const uint8 *data, uint32 data_len)
 {
-	uint32 ofs = start;
-	while (ofs < end) {
-		if (!memcmp(ROMBaseHost + ofs, data, data_len))
-			return ofs;
-		ofs++;
-	}
-	return 0;
+	return ROMIndexFind(ROMBaseHost, start, end, data, data_len);
 }
 
 
@@ -222,8 +218,46 @@ static uint32 find_rom_data(uint32 start, uint32 end, const uint8 *data, uint32
 
 static uint32 rsrc_ptr = 0;
 
+// Resource chain, read once by PatchROM()
+struct rom_rsrc {
+	uint32 ptr;			// Value of rsrc_ptr for this resource
+	uint32 data;		// ROM offset of resource data
+	uint32 type;
+	int16 id;
+};
+static std::vector<rom_rsrc> rom_rsrcs;
+static int last_rsrc = -1;			// Index of last found resource
+
+static void read_rom_resource(rom_rsrc &r)
+{
+	uint32 lp = ROMBase + r.ptr + 4;
+	r.data = ReadMacInt32(lp);
+	r.type = ReadMacInt32(lp + 4);
+	r.id = ReadMacInt16(lp + 8);
+}
+
+static void read_rom_resources(void)
+{
+	rom_rsrcs.clear();
+	last_rsrc = -1;
+	uint32 x = ReadMacInt32(ROMBase + 0x1a);
+	uint32 header_size = ReadMacInt8(ROMBase + x + 5);
+	uint32 ptr = x;
+	while (rom_rsrcs.size() < 0x10000) {
+		ptr = ReadMacInt32(ROMBase + ptr);
+		if (ptr == 0 || ptr >= ROM_SIZE)
+			break;
+		ptr += header_size;
+		rom_rsrc r;
+		r.ptr = ptr;
+		read_rom_resource(r);
+		rom_rsrcs.push_back(r);
+	}
+	D(bug("%d ROM resources\n", (int)rom_rsrcs.size()));
+}
+
 // id = 4711 means "find any ID"
-static uint32 find_rom_resource(uint32 s_type, int16 s_id = 4711, bool cont = false)
+static uint32 find_rom_resource_chain(uint32 s_type, int16 s_id, bool cont)
 {
 	uint32 lp = ROMBase + 0x1a;
 	uint32 x = ReadMacInt32(lp);
@@ -252,6 +286,34 @@ static uint32 find_rom_resource(uint32 s_type, int16 s_id = 4711, bool cont = fa
 	return 0;
 }
 
+static uint32 find_rom_resource(uint32 s_type, int16 s_id = 4711, bool cont = false)
+{
+	if (rom_rsrcs.empty())
+		return find_rom_resource_chain(s_type, s_id, cont);
+
+	// Patches rename the last found resource through rsrc_ptr
+	if (last_rsrc >= 0)
+		read_rom_resource(rom_rsrcs[last_rsrc]);
+
+	int first = 0;
+	if (cont) {
+		if (rsrc_ptr == 0)
+			return 0;
+		first = last_rsrc + 1;
+	}
+	for (int i = first; i < (int)rom_rsrcs.size(); i++) {
+		const rom_rsrc &r = rom_rsrcs[i];
+		if (r.type == s_type && (r.id == s_id || s_id == 4711)) {
+			last_rsrc = i;
+			rsrc_ptr = r.ptr;
+			return r.data;
+		}
+	}
+	last_rsrc = -1;
+	rsrc_ptr = 0;
+	return 0;
+}
+
 
 /*
  *  Search offset of A-Trap routine in ROM
@@ -706,11 +768,17 @@ bool PatchROM(void)
 	if (!check_rom_patch_space(ADDR_MAP_PATCH_SPACE - 10 * 4, 0x100))
 		return false;
 
+	// Index ROM for the searches of the patch functions
+	ROMIndexInit(ROMBaseHost, ROM_SIZE, PrefsFindString("romcachedir"));
+	read_rom_resources();
+
 	// Apply patches
-	if (!patch_nanokernel_boot()) return false;
-	if (!patch_68k_emul()) return false;
-	if (!patch_nanokernel()) return false;
-	if (!patch_68k()) return false;
+	bool patched = patch_nanokernel_boot() && patch_68k_emul() && patch_nanokernel() && patch_68k();
+	ROMIndexExit();
+	std::vector<rom_rsrc>().swap(rom_rsrcs);
+	last_rsrc = -1;
+	if (!patched)
+		return false;
 
 #ifdef M68K_BREAK_POINT
 	// Install 68k breakpoint
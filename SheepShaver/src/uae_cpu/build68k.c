@@ -0,0 +1 @@
+../../../BasiliskII/src/uae_cpu/build68k.c
\ No newline at end of file
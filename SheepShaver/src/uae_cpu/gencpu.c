@@ -0,0 +1 @@
+../../../BasiliskII/src/uae_cpu/gencpu.c
\ No newline at end of file
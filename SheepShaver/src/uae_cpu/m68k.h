@@ -0,0 +1 @@
+../../../BasiliskII/src/uae_cpu/m68k.h
\ No newline at end of file
@@ -0,0 +1,72 @@
+/*
+ *  memory.h - Memory access of the UAE 68k core in SheepShaver
+ *
+ *  SheepShaver (C) 1997-2008 Christian Bauer and Marc Hellwig
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef UAE_MEMORY_H
+#define UAE_MEMORY_H
+
+// The 68k core sees the same Mac address space as the PowerPC emulator
+#include "cpu/vm.hpp"
+
+// CPU type of the 68k core (declared in main.h in Basilisk II)
+extern int CPUType;		// 2 = 68020
+extern int FPUType;		// 0 = no FPU
+
+static __inline__ uae_u8 *do_get_real_address(uaecptr addr)
+{
+	return vm_do_get_real_address(addr);
+}
+static __inline__ uae_u32 do_get_virtual_address(uae_u8 *addr)
+{
+	return vm_do_get_virtual_address(addr);
+}
+static __inline__ uae_u32 get_long(uaecptr addr)
+{
+	return vm_read_memory_4(addr);
+}
+static __inline__ uae_u32 get_word(uaecptr addr)
+{
+	return vm_read_memory_2(addr);
+}
+static __inline__ uae_u32 get_byte(uaecptr addr)
+{
+	return vm_read_memory_1(addr);
+}
+static __inline__ void put_long(uaecptr addr, uae_u32 l)
+{
+	vm_write_memory_4(addr, l);
+}
+static __inline__ void put_word(uaecptr addr, uae_u32 w)
+{
+	vm_write_memory_2(addr, w);
+}
+static __inline__ void put_byte(uaecptr addr, uae_u32 b)
+{
+	vm_write_memory_1(addr, b);
+}
+static __inline__ uae_u8 *get_real_address(uaecptr addr)
+{
+	return do_get_real_address(addr);
+}
+static __inline__ uae_u32 get_virtual_address(uae_u8 *addr)
+{
+	return do_get_virtual_address(addr);
+}
+
+#endif /* UAE_MEMORY_H */
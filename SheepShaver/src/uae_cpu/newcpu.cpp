@@ -0,0 +1 @@
+../../../BasiliskII/src/uae_cpu/newcpu.cpp
\ No newline at end of file
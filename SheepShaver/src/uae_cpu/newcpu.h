@@ -0,0 +1 @@
+../../../BasiliskII/src/uae_cpu/newcpu.h
\ No newline at end of file
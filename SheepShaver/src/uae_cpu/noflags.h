@@ -0,0 +1 @@
+../../../BasiliskII/src/uae_cpu/noflags.h
\ No newline at end of file
@@ -0,0 +1 @@
+../../../BasiliskII/src/uae_cpu/readcpu.cpp
\ No newline at end of file
@@ -0,0 +1 @@
+../../../BasiliskII/src/uae_cpu/readcpu.h
\ No newline at end of file
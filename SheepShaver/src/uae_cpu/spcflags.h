@@ -0,0 +1 @@
+../../../BasiliskII/src/uae_cpu/spcflags.h
\ No newline at end of file
@@ -0,0 +1,561 @@
+/*
+ *  uae_glue.cpp - Glue UAE 68k core to SheepShaver CPU engine interface
+ *
+ *  SheepShaver (C) 1997-2008 Christian Bauer and Marc Hellwig
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/*
+ *  The Mac ROM runs 68k code in its own emulator, which is PowerPC code
+ *  and so gets interpreted or compiled once more by the PowerPC emulator.
+ *  With the "uae68k" pref, 68k subroutines called with Execute68k() run on
+ *  the 68k interpreter of Basilisk II instead, in the same address space
+ *  and on the same stack. Whatever needs the ROM emulator is handed back
+ *  to it with the current registers:
+ *
+ *    A-line traps        The trap runs in the ROM emulator from a [trap,
+ *                        EXEC_RETURN] stub, then the 68k core continues
+ *                        after it. Auto-pop traps and _MixedModeMagic
+ *                        (calls through routine descriptors, i.e. mixed
+ *                        mode switches to PowerPC code) return to the
+ *                        caller of their glue instead, so they run at
+ *                        their own address with the return address on the
+ *                        stack pointing to EXEC_RETURN.
+ *    EMUL_OPs            Called directly.
+ *    everything else     _LoadSeg, EXEC_NATIVE and instructions the
+ *                        68020 core doesn't have (FPU, 68040 cache
+ *                        control): the rest of the subroutine runs in the
+ *                        ROM emulator.
+ *
+ *  The 68k core doesn't take interrupts, they are handled when the ROM
+ *  emulator or PowerPC code runs again. 68k code entered by the Mac OS
+ *  itself (including calls from PowerPC code through the Mixed Mode
+ *  Manager) still runs in the ROM emulator.
+ */
+
+#include "sysdeps.h"
+
+#include "cpu_emulation.h"
+#include "main.h"
+#include "prefs.h"
+#include "emul_op.h"
+#include "xlowmem.h"
+#include "thunks.h"
+#include "m68k.h"
+#include "memory.h"
+#include "readcpu.h"
+#include "newcpu.h"
+
+#define DEBUG 0
+#include "debug.h"
+
+
+// The 68k core is a 68020 without FPU, like the ROM emulator
+int CPUType = 2;
+int FPUType = 0;
+
+// 68k core in use
+bool UseUAE68k = false;
+
+// From newcpu.cpp
+extern bool quit_program;
+
+// Trap words handled specially
+const uint16 M68K_LOAD_SEG = 0xa9f0;			// _LoadSeg
+const uint16 M68K_MIXED_MODE_MAGIC = 0xaafe;	// _MixedModeMagic, first word of a routine descriptor
+
+// Statistics
+static uint32 subroutine_count = 0;		// Execute68k() calls
+static uint32 trap_count = 0;			// Traps run in the ROM emulator
+static uint32 fallback_count = 0;		// Subroutines finished in the ROM emulator
+
+
+/*
+ *  Initialize 68k core
+ */
+
+bool InitUAE68k(void)
+{
+	init_m68k();
+	return true;
+}
+
+
+/*
+ *  Deinitialize 68k core
+ */
+
+void ExitUAE68k(void)
+{
+	exit_m68k();
+	if (PrefsFindBool("uae68kstats"))
+		printf("UAE 68k core: %u subroutines, %u traps in ROM emulator, %u subroutines finished in ROM emulator\n",
+			subroutine_count, trap_count, fallback_count);
+}
+
+
+/*
+ *  The ROM emulator keeps the upper byte of the SR in XLM_68K_R25
+ *  (supervisor mode and interrupt mask), the 68k core always runs in
+ *  supervisor mode
+ */
+
+static void load_sr(void)
+{
+	regs.s = 1;
+	regs.m = 0;
+	regs.sr = 0x2000 | ((ReadMacInt32(XLM_68K_R25) & 7) << 8);
+	MakeFromSR();
+}
+
+static void save_sr(void)
+{
+	WriteMacInt32(XLM_68K_R25, (ReadMacInt32(XLM_68K_R25) & ~7) | regs.intmask);
+}
+
+
+/*
+ *  Copy registers between the 68k core and M68kRegisters
+ */
+
+static void get_regs(M68kRegisters *r)
+{
+	for (int i = 0; i < 8; i++) {
+		r->d[i] = m68k_dreg(regs, i);
+		r->a[i] = m68k_areg(regs, i);
+	}
+}
+
+static void set_regs(const M68kRegisters *r)
+{
+	for (int i = 0; i < 8; i++) {
+		m68k_dreg(regs, i) = r->d[i];
+		m68k_areg(regs, i) = r->a[i];
+	}
+}
+
+
+/*
+ *  Execute 68k subroutine, must be ended with RTS to an EXEC_RETURN
+ *  opcode that is already on the stack at r->a[7]
+ */
+
+void ExecuteUAE68k(uint32 pc, M68kRegisters *r)
+{
+	subroutine_count++;
+
+	// Save state of the outer subroutine (nested call from an EMUL_OP)
+	uaecptr oldpc = m68k_getpc();
+	MakeSR();
+	uae_u16 oldsr = regs.sr;
+
+	// Execute routine
+	set_regs(r);
+	load_sr();
+	m68k_setpc(pc);
+	fill_prefetch_0();
+	quit_program = false;
+	m68k_execute();
+	quit_program = false;
+	get_regs(r);
+	save_sr();
+
+	// Restore outer state
+	regs.sr = oldsr;
+	regs.s = (oldsr >> 13) & 1;
+	MakeFromSR();
+	m68k_setpc(oldpc);
+	fill_prefetch_0();
+}
+
+
+/*
+ *  Run 68k code in the ROM emulator with the registers of the 68k core,
+ *  until it executes EXEC_RETURN
+ */
+
+static void execute_rom_emulator(uint32 pc)
+{
+	M68kRegisters r;
+	get_regs(&r);
+	save_sr();
+	Execute68kEmulator(pc, &r);
+	set_regs(&r);
+	load_sr();
+}
+
+
+/*
+ *  A-line and F-line traps, and opcodes the 68k core doesn't implement
+ */
+
+void m68k_sheep_op(uae_u32 opcode)
+{
+	uaecptr pc = m68k_getpc();
+
+	// Subroutine returned to Execute68k()
+	if (opcode == M68K_EXEC_RETURN) {
+		m68k_emulop_return();
+		return;
+	}
+
+	// EMUL_OP
+	if (opcode >= M68K_EMUL_BREAK && opcode < M68K_EMUL_BREAK + OP_MAX) {
+		M68kRegisters r;
+		get_regs(&r);
+		EmulOp(&r, pc, opcode - M68K_EMUL_BREAK);
+		set_regs(&r);
+		m68k_setpc(pc + 2);
+		fill_prefetch_0();
+		return;
+	}
+
+	// A-line trap
+	if ((opcode & 0xf000) == 0xa000 && opcode != M68K_LOAD_SEG) {
+		trap_count++;
+		D(bug("Trap %04x at %08x\n", opcode, pc));
+		if ((opcode & 0x0c00) == 0x0c00 || opcode == M68K_MIXED_MODE_MAGIC) {
+
+			// Auto-pop or routine descriptor, catch the return to the caller of the glue
+			uaecptr sp = m68k_areg(regs, 7);
+			uae_u32 ret = get_long(sp);
+			put_long(sp, XLM_EXEC_RETURN_OPCODE);
+			execute_rom_emulator(pc);
+			m68k_setpc(ret);
+		} else {
+			SheepVar proc_var(4);
+			uint32 proc = proc_var.addr();
+			WriteMacInt16(proc, opcode);
+			WriteMacInt16(proc + 2, M68K_EXEC_RETURN);
+			execute_rom_emulator(proc);
+
+			// The trap dispatcher sets the condition codes of OS traps from D0.W
+			if ((opcode & 0x0800) == 0) {
+				uae_s16 d0 = m68k_dreg(regs, 0);
+				SET_ZFLG(d0 == 0);
+				SET_NFLG(d0 < 0);
+			}
+			m68k_setpc(pc + 2);
+		}
+		fill_prefetch_0();
+		return;
+	}
+
+	// Anything else, finish the subroutine in the ROM emulator
+	fallback_count++;
+	D(bug("Opcode %04x at %08x, continuing in ROM emulator\n", opcode, pc));
+	execute_rom_emulator(pc);
+	m68k_emulop_return();
+}
+
+
+/*
+ *  Get 68k interrupt level, interrupts are taken by the ROM emulator
+ */
+
+int intlev(void)
+{
+	return 0;
+}
+
+
+/*
+ *  Snapshots are not supported
+ */
+
+void m68k_snapshot(void)
+{
+	SPCFLAGS_CLEAR( SPCFLAG_SNAPSHOT );
+}
+
+
+#ifdef UAE68K_TEST
+/*
+ *  Runs hand-assembled 68k subroutines on the 68k core in the first MB of
+ *  the Mac address space, with a ROM emulator that fakes the traps used:
+ *  OS and toolbox traps, auto-pop glue, a routine descriptor, an EMUL_OP
+ *  that calls 68k code again, and the two fallbacks. Then times a checksum
+ *  loop and a bubble sort, i.e. plain 68k code that never leaves the core.
+ *
+ *  uae68k_test
+ */
+
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+#include <algorithm>
+#include <vector>
+
+// Layout of the test memory
+const uint32 TEST_MEM_SIZE = 0x100000;
+const uint32 TEST_PROC = 0x8000;		// SheepMem procs, growing up
+const uint32 TEST_DATA = 0x10000;		// SheepMem data, growing down
+const uint32 CODE_CHECKSUM = 0x20000;
+const uint32 CODE_SORT = 0x20100;
+const uint32 CODE_TRAPS = 0x20200;
+const uint32 CODE_LOAD_SEG = 0x20300;
+const uint32 CODE_CACHE = 0x20380;
+const uint32 GLUE_AUTO_POP = 0x20400;
+const uint32 GLUE_DESCRIPTOR = 0x20480;
+const uint32 BUFFER = 0x40000;			// 64K
+const uint32 STACK = 0xf0000;
+
+const int EMUL_OP_TEST = 5;				// Selector of the EMUL_OP in CODE_TRAPS
+
+uint32 ROMBase;
+uint32 SheepMem::page_size;
+uintptr SheepMem::zero_page;
+uintptr SheepMem::base;
+uintptr SheepMem::data = TEST_DATA;
+uintptr SheepMem::proc = TEST_PROC;
+bool PrefsFindBool(const char *name) {return strcmp(name, "uae68kstats") == 0;}
+
+static int failures;
+
+#define CHECK(cond) do { \
+	if (!(cond)) { \
+		printf("%s:%d: %s failed\n", __FILE__, __LINE__, #cond); \
+		failures++; \
+	} \
+} while (0)
+
+static uint32 emul_op_selector;
+static uint32 rom_emulator_calls;
+
+// Sum of D1 + 1 longs at A0 -> D0
+static const uint16 checksum_code[] = {
+	0x7000,					//		moveq	#0,d0
+	0xd098,					// 1$	add.l	(a0)+,d0
+	0x51c9, 0xfffc,			//		dbra	d1,1$
+	0x4e75					//		rts
+};
+
+// Bubble sort of D1 + 2 signed words at A0
+static const uint16 sort_code[] = {
+	0x2248,					// 1$	movea.l	a0,a1
+	0x3401,					//		move.w	d1,d2
+	0x3619,					// 2$	move.w	(a1)+,d3
+	0xb651,					//		cmp.w	(a1),d3
+	0x6f08,					//		ble.s	3$
+	0x3811,					//		move.w	(a1),d4
+	0x3283,					//		move.w	d3,(a1)
+	0x3344, 0xfffe,			//		move.w	d4,-2(a1)
+	0x51ca, 0xfff0,			// 3$	dbra	d2,2$
+	0x51c9, 0xffe8,			//		dbra	d1,1$
+	0x4e75					//		rts
+};
+
+// Traps handed to the ROM emulator, D0 = 1 if the condition codes were right
+static const uint16 trap_code[] = {
+	0x323c, 0x0005,			//		move.w	#5,d1
+	0xa002,					//		_Read (OS trap, D0 = D1 - 5)
+	0x662c,					//		bne.s	1$
+	0x323c, 0xfffd,			//		move.w	#-3,d1
+	0xa002,					//		_Read
+	0x6a24,					//		bpl.s	1$
+	0x42a7,					//		clr.l	-(sp)
+	0x3f3c, 0x0014,			//		move.w	#20,-(sp)
+	0x3f3c, 0x0016,			//		move.w	#22,-(sp)
+	0xa9c0,					//		toolbox trap, adds two words
+	0x2a1f,					//		move.l	(sp)+,d5
+	0x4eb9, GLUE_AUTO_POP >> 16, GLUE_AUTO_POP & 0xffff,	// jsr	auto-pop glue
+	0x2c00,					//		move.l	d0,d6
+	0x4eb9, GLUE_DESCRIPTOR >> 16, GLUE_DESCRIPTOR & 0xffff,	// jsr	routine descriptor
+	0x2e00,					//		move.l	d0,d7
+	M68K_EMUL_BREAK + EMUL_OP_TEST,
+	0x7001,					//		moveq	#1,d0
+	0x4e75,					//		rts
+	0x70ff,					// 1$	moveq	#-1,d0
+	0x4e75					//		rts
+};
+
+// _LoadSeg and CINVA, the ROM emulator adds 4 to D0 and returns
+static const uint16 load_seg_code[] = { 0x7003, M68K_LOAD_SEG, 0x4e75 };
+static const uint16 cache_code[] = { 0x7005, 0xf4d8, 0x4e75 };
+
+static void put_code(uint32 addr, const uint16 *code, int n)
+{
+	for (int i = 0; i < n; i++)
+		WriteMacInt16(addr + i * 2, code[i]);
+}
+
+// Call 68k subroutine with return address to EXEC_RETURN on the stack at sp
+static void call_68k(uint32 pc, M68kRegisters *r, uint32 sp)
+{
+	r->a[7] = sp - 4;
+	WriteMacInt32(r->a[7], XLM_EXEC_RETURN_OPCODE);
+	ExecuteUAE68k(pc, r);
+	CHECK(r->a[7] == sp);
+}
+
+// Checksum of n longs at BUFFER with the 68k core
+static uint32 checksum_68k(uint32 n, uint32 sp)
+{
+	M68kRegisters r;
+	memset(&r, 0, sizeof(r));
+	r.a[0] = BUFFER;
+	r.d[1] = n - 1;
+	call_68k(CODE_CHECKSUM, &r, sp);
+	CHECK(r.a[0] == BUFFER + n * 4);
+	return r.d[0];
+}
+
+static uint32 checksum_host(uint32 n)
+{
+	uint32 sum = 0;
+	for (uint32 i = 0; i < n; i++)
+		sum += ReadMacInt32(BUFFER + i * 4);
+	return sum;
+}
+
+// Fake ROM emulator
+void Execute68kEmulator(uint32 pc, M68kRegisters *r)
+{
+	rom_emulator_calls++;
+	uint32 sp = r->a[7];
+	switch (ReadMacInt16(pc)) {
+		case 0xa002:	// From a [trap, EXEC_RETURN] stub
+			CHECK(ReadMacInt16(pc + 2) == M68K_EXEC_RETURN);
+			r->d[0] = (int16)(r->d[1] - 5);
+			break;
+		case 0xa9c0:
+			CHECK(ReadMacInt16(pc + 2) == M68K_EXEC_RETURN);
+			WriteMacInt32(sp + 4, ReadMacInt16(sp) + ReadMacInt16(sp + 2));
+			r->a[7] = sp + 4;
+			break;
+		case 0xad00:
+		case M68K_MIXED_MODE_MAGIC:
+			CHECK(pc == GLUE_AUTO_POP || pc == GLUE_DESCRIPTOR);
+			CHECK(ReadMacInt32(sp) == XLM_EXEC_RETURN_OPCODE);
+			r->d[0] = ReadMacInt16(pc);
+			r->a[7] = sp + 4;
+			break;
+		case M68K_LOAD_SEG:
+		case 0xf4d8:	// Rest of the subroutine is an RTS
+			CHECK(ReadMacInt16(pc + 2) == 0x4e75);
+			CHECK(ReadMacInt32(sp) == XLM_EXEC_RETURN_OPCODE);
+			r->d[0] += 4;
+			r->a[7] = sp + 4;
+			break;
+		default:
+			printf("unexpected opcode %04x at %08x in ROM emulator\n", ReadMacInt16(pc), pc);
+			failures++;
+			break;
+	}
+}
+
+// EMUL_OP, calls the checksum subroutine below the stack of its caller
+extern "C" void EmulOp(M68kRegisters *r, uint32 pc, int selector)
+{
+	emul_op_selector = selector;
+	CHECK(pc == CODE_TRAPS + 0x2e);
+	r->d[1] = checksum_68k(16, r->a[7] - 0x100);
+}
+
+static double now(void)
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec * 1e-6;
+}
+
+int main(void)
+{
+	void *mem = mmap(Mac2HostAddr(0), TEST_MEM_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0);
+	if (mem == MAP_FAILED) {
+		printf("uae68k_test: can't map low memory, skipped\n");
+		return 0;
+	}
+	WriteMacInt16(XLM_EXEC_RETURN_OPCODE, M68K_EXEC_RETURN);
+	put_code(CODE_CHECKSUM, checksum_code, sizeof(checksum_code) / 2);
+	put_code(CODE_SORT, sort_code, sizeof(sort_code) / 2);
+	put_code(CODE_TRAPS, trap_code, sizeof(trap_code) / 2);
+	put_code(CODE_LOAD_SEG, load_seg_code, sizeof(load_seg_code) / 2);
+	put_code(CODE_CACHE, cache_code, sizeof(cache_code) / 2);
+	WriteMacInt16(GLUE_AUTO_POP, 0xad00);
+	WriteMacInt16(GLUE_DESCRIPTOR, M68K_MIXED_MODE_MAGIC);
+	srand(1);
+	for (uint32 i = 0; i < 0x10000; i += 2)
+		WriteMacInt16(BUFFER + i, rand());
+	InitUAE68k();
+
+	// Plain 68k code
+	CHECK(checksum_68k(0x4000, STACK) == checksum_host(0x4000));
+	CHECK(subroutine_count == 1 && rom_emulator_calls == 0);
+
+	// Traps, EMUL_OP with nested subroutine
+	M68kRegisters r;
+	memset(&r, 0, sizeof(r));
+	r.d[3] = 0x12345678;
+	call_68k(CODE_TRAPS, &r, STACK);
+	CHECK(r.d[0] == 1);
+	CHECK(r.d[3] == 0x12345678);
+	CHECK(r.d[5] == 42);
+	CHECK(r.d[6] == 0xad00);
+	CHECK(r.d[7] == M68K_MIXED_MODE_MAGIC);
+	CHECK(emul_op_selector == EMUL_OP_TEST);
+	CHECK(r.d[1] == checksum_host(16));
+	CHECK(trap_count == 5 && rom_emulator_calls == 5);
+	CHECK(SheepMem::Reserve(0) == TEST_DATA);
+
+	// Fallbacks
+	memset(&r, 0, sizeof(r));
+	call_68k(CODE_LOAD_SEG, &r, STACK);
+	CHECK(r.d[0] == 7);
+	call_68k(CODE_CACHE, &r, STACK);
+	CHECK(r.d[0] == 9);
+	CHECK(fallback_count == 2 && trap_count == 5);
+
+	// Sort the buffer as 512 signed words, 200 times
+	const uint32 sort_words = 512;
+	int16 sorted[sort_words];
+	for (uint32 i = 0; i < sort_words; i++)
+		sorted[i] = ReadMacInt16(BUFFER + i * 2);
+	std::sort(sorted, sorted + sort_words);
+	std::vector<uint8> unsorted(Mac2HostAddr(BUFFER), Mac2HostAddr(BUFFER) + sort_words * 2);
+	double sort_time = 0;
+	for (int n = 0; n < 200; n++) {
+		memcpy(Mac2HostAddr(BUFFER), &unsorted[0], sort_words * 2);
+		memset(&r, 0, sizeof(r));
+		r.a[0] = BUFFER;
+		r.d[1] = sort_words - 2;
+		double start = now();
+		call_68k(CODE_SORT, &r, STACK);
+		sort_time += now() - start;
+	}
+	bool ok = true;
+	for (uint32 i = 0; i < sort_words; i++)
+		ok &= (int16)ReadMacInt16(BUFFER + i * 2) == sorted[i];
+	CHECK(ok);
+
+	// Checksum of 64K, 200 times (2 instructions per long)
+	double start = now();
+	for (int n = 0; n < 200; n++)
+		checksum_68k(0x4000, STACK);
+	double checksum_time = now() - start;
+	printf("uae68k_test: bubble sort of %u words %.0f us, checksum of 64K %.0f us (%.1f million 68k instructions/s)\n",
+		sort_words, sort_time / 200 * 1e6, checksum_time / 200 * 1e6, 200 * (2.0 * 0x4000 + 2) / checksum_time * 1e-6);
+
+	ExitUAE68k();
+	munmap(mem, TEST_MEM_SIZE);
+	if (failures) {
+		printf("uae68k_test: %d checks failed\n", failures);
+		return 1;
+	}
+	printf("uae68k_test: OK\n");
+	return 0;
+}
+#endif